@@ -0,0 +1,745 @@
+/* ehci.c - EHCI Support.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/usb.h>
+#include <grub/usbtrans.h>
+#include <grub/misc.h>
+#include <grub/pci.h>
+#include <grub/time.h>
+
+/* Capability registers.  */
+#define GRUB_EHCI_CAP_CAPLENGTH	0x00
+#define GRUB_EHCI_CAP_HCSPARAMS	0x04
+#define GRUB_EHCI_CAP_HCCPARAMS	0x08
+
+#define GRUB_EHCI_HCSPARAMS_NPORTS	0x0f
+#define GRUB_EHCI_HCSPARAMS_PPC		(1 << 4)
+
+/* Operational registers, relative to CAPLENGTH.  */
+typedef enum
+  {
+    GRUB_EHCI_REG_USBCMD = 0x00,
+    GRUB_EHCI_REG_USBSTS = 0x04,
+    GRUB_EHCI_REG_USBINTR = 0x08,
+    GRUB_EHCI_REG_CTRLDSSEGMENT = 0x10,
+    GRUB_EHCI_REG_ASYNCLISTADDR = 0x18,
+    GRUB_EHCI_REG_CONFIGFLAG = 0x40,
+    GRUB_EHCI_REG_PORTSC = 0x44
+  } grub_ehci_reg_t;
+
+#define GRUB_EHCI_CMD_RS	(1 << 0)
+#define GRUB_EHCI_CMD_HCRESET	(1 << 1)
+#define GRUB_EHCI_CMD_ASE	(1 << 5)
+
+#define GRUB_EHCI_STS_HCHALTED	(1 << 12)
+#define GRUB_EHCI_STS_ASS	(1 << 15)
+
+#define GRUB_EHCI_PORT_CCS	(1 << 0)
+#define GRUB_EHCI_PORT_CSC	(1 << 1)
+#define GRUB_EHCI_PORT_PE	(1 << 2)
+#define GRUB_EHCI_PORT_PEC	(1 << 3)
+#define GRUB_EHCI_PORT_OCC	(1 << 5)
+#define GRUB_EHCI_PORT_PR	(1 << 8)
+#define GRUB_EHCI_PORT_LS_MASK	(3 << 10)
+#define GRUB_EHCI_PORT_LS_K	(1 << 10)
+#define GRUB_EHCI_PORT_PP	(1 << 12)
+#define GRUB_EHCI_PORT_OWNER	(1 << 13)
+/* Bits cleared by writing one, which must be written as zero when
+   changing other bits.  */
+#define GRUB_EHCI_PORT_WC	(GRUB_EHCI_PORT_CSC | GRUB_EHCI_PORT_PEC \
+				 | GRUB_EHCI_PORT_OCC)
+
+/* USB legacy support extended capability, in PCI config space.  */
+#define GRUB_EHCI_LEGSUP_ID	0x01
+#define GRUB_EHCI_LEGSUP_BIOS	(1 << 16)
+#define GRUB_EHCI_LEGSUP_OS	(1 << 24)
+
+#define GRUB_EHCI_LINK_TERMINATE	1
+#define GRUB_EHCI_LINK_QH		(1 << 1)
+
+/* qTD token.  */
+#define GRUB_EHCI_TOKEN_ACTIVE	(1 << 7)
+#define GRUB_EHCI_TOKEN_HALTED	(1 << 6)
+#define GRUB_EHCI_TOKEN_DBERR	(1 << 5)
+#define GRUB_EHCI_TOKEN_BABBLE	(1 << 4)
+#define GRUB_EHCI_TOKEN_XACTERR	(1 << 3)
+#define GRUB_EHCI_TOKEN_PID_SHIFT	8
+#define GRUB_EHCI_TOKEN_CERR_SHIFT	10
+#define GRUB_EHCI_TOKEN_BYTES_SHIFT	16
+#define GRUB_EHCI_TOKEN_BYTES_MASK	0x7fff
+#define GRUB_EHCI_TOKEN_TOGGLE	(1U << 31)
+
+/* QH endpoint characteristics and capabilities.  */
+#define GRUB_EHCI_EP_ENDPT_SHIFT	8
+#define GRUB_EHCI_EP_EPS_HIGH		(2 << 12)
+#define GRUB_EHCI_EP_DTC		(1 << 14)
+#define GRUB_EHCI_EP_HEAD		(1 << 15)
+#define GRUB_EHCI_EP_MAXPKT_SHIFT	16
+#define GRUB_EHCI_EP_MULT_ONE		(1U << 30)
+
+/* A qTD addresses five 4KiB pages.  */
+#define GRUB_EHCI_QTD_PAGES	5
+#define GRUB_EHCI_PAGE_SIZE	4096
+
+/* Give up on a transfer that made no progress for this long.  */
+#define GRUB_EHCI_TIMEOUT	5000
+
+/* EHCI Queue Element Transfer Descriptor, with the 64-bit extension
+   and padding to keep the array 32 byte aligned.  */
+struct grub_ehci_qtd
+{
+  grub_uint32_t next;
+  grub_uint32_t alt_next;
+  grub_uint32_t token;
+  grub_uint32_t buffer[GRUB_EHCI_QTD_PAGES];
+  grub_uint32_t buffer_high[GRUB_EHCI_QTD_PAGES];
+  grub_uint32_t pad[3];
+} __attribute__ ((packed));
+
+/* EHCI Queue Head.  */
+struct grub_ehci_qh
+{
+  grub_uint32_t link;
+  grub_uint32_t ep_char;
+  grub_uint32_t ep_cap;
+  grub_uint32_t current;
+  /* The transfer overlay.  */
+  struct grub_ehci_qtd overlay;
+} __attribute__ ((packed));
+
+typedef volatile struct grub_ehci_qtd *grub_ehci_qtd_t;
+typedef volatile struct grub_ehci_qh *grub_ehci_qh_t;
+
+struct grub_ehci
+{
+  volatile grub_uint32_t *iobase;
+
+  /* Number of root hub ports.  */
+  int nports;
+
+  /* The only queue head of the asynchronous schedule, set up for each
+     transfer.  */
+  grub_ehci_qh_t qh;
+
+  struct grub_ehci *next;
+};
+
+static struct grub_ehci *ehci;
+
+static grub_uint32_t
+grub_ehci_readreg32 (struct grub_ehci *e, grub_ehci_reg_t reg)
+{
+  return grub_le_to_cpu32 (e->iobase[reg / 4]);
+}
+
+static void
+grub_ehci_writereg32 (struct grub_ehci *e,
+		      grub_ehci_reg_t reg, grub_uint32_t val)
+{
+  e->iobase[reg / 4] = grub_cpu_to_le32 (val);
+}
+
+static grub_uint32_t
+grub_ehci_port_read (struct grub_ehci *e, int port)
+{
+  return grub_ehci_readreg32 (e, GRUB_EHCI_REG_PORTSC + 4 * port);
+}
+
+/* Set the bits in SET and clear those in CLEAR in the status of PORT,
+   without acknowledging any change.  */
+static void
+grub_ehci_port_update (struct grub_ehci *e, int port,
+		       grub_uint32_t set, grub_uint32_t clear)
+{
+  grub_uint32_t status = grub_ehci_port_read (e, port);
+
+  status &= ~(GRUB_EHCI_PORT_WC | clear);
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_PORTSC + 4 * port, status | set);
+}
+
+/* Wait until the bits in MASK of the status register are VALUE.  */
+static int
+grub_ehci_wait_status (struct grub_ehci *e, grub_uint32_t mask,
+		       grub_uint32_t value, int milliseconds)
+{
+  grub_uint64_t limit = grub_get_time_ms () + milliseconds;
+
+  while ((grub_ehci_readreg32 (e, GRUB_EHCI_REG_USBSTS) & mask) != value)
+    if (grub_get_time_ms () > limit)
+      return 0;
+
+  return 1;
+}
+
+/* Take the controller over from the BIOS, which may still be using it
+   for legacy keyboard and disk emulation.  */
+static void
+grub_ehci_bios_handoff (grub_pci_device_t dev, grub_uint32_t hccparams)
+{
+  int eecp = (hccparams >> 8) & 0xff;
+
+  while (eecp >= 0x40)
+    {
+      grub_pci_address_t addr = grub_pci_make_address (dev, eecp);
+      grub_uint32_t cap = grub_pci_read (addr);
+
+      if ((cap & 0xff) == GRUB_EHCI_LEGSUP_ID)
+	{
+	  grub_uint64_t limit;
+
+	  grub_pci_write (addr, cap | GRUB_EHCI_LEGSUP_OS);
+
+	  limit = grub_get_time_ms () + 1000;
+	  while (grub_pci_read (addr) & GRUB_EHCI_LEGSUP_BIOS)
+	    if (grub_get_time_ms () > limit)
+	      {
+		grub_dprintf ("ehci", "BIOS did not release the controller\n");
+		break;
+	      }
+
+	  /* Disable the SMIs the BIOS may have enabled.  */
+	  addr = grub_pci_make_address (dev, eecp + 4);
+	  grub_pci_write (addr, 0);
+	  return;
+	}
+
+      eecp = (cap >> 8) & 0xff;
+    }
+}
+
+/* Iterate over all PCI devices.  Determine if a device is an EHCI
+   controller.  If this is the case, initialize it.  */
+static int
+grub_ehci_pci_iter (grub_pci_device_t dev,
+		    grub_pci_id_t pciid __attribute__((unused)),
+		    void *closure __attribute__((unused)))
+{
+  grub_uint32_t class_code;
+  grub_uint32_t base;
+  grub_pci_address_t addr;
+  struct grub_ehci *e;
+  volatile grub_uint8_t *caps;
+  grub_uint32_t hcsparams;
+  grub_uint32_t hccparams;
+  int i;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class_code = grub_pci_read (addr) >> 8;
+
+  /* If this is not an EHCI controller, just return.  */
+  if (class_code != 0x0c0320)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  base = grub_pci_read (addr);
+  if ((base & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+
+  /* Enable memory space and bus mastering.  */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr) | 0x6);
+
+  e = grub_zalloc (sizeof (*e));
+  if (! e)
+    return 1;
+
+  caps = grub_pci_device_map_range (dev, base & GRUB_PCI_ADDR_MEM_MASK, 0x100);
+  hcsparams = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+				(caps + GRUB_EHCI_CAP_HCSPARAMS));
+  hccparams = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+				(caps + GRUB_EHCI_CAP_HCCPARAMS));
+  e->iobase = (volatile grub_uint32_t *) (caps + caps[GRUB_EHCI_CAP_CAPLENGTH]);
+
+  grub_dprintf ("ehci", "base=%p hcsparams=0x%x hccparams=0x%x\n",
+		e->iobase, hcsparams, hccparams);
+
+  /* Queue heads are aligned on 32 bytes.  */
+  e->qh = grub_memalign (32, sizeof (struct grub_ehci_qh));
+  if (! e->qh)
+    goto fail;
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if ((grub_uint64_t) e->qh >> 32)
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, "allocated QH memory not <4GB");
+      goto fail;
+    }
+#endif
+
+  grub_ehci_bios_handoff (dev, hccparams);
+
+  /* Stop and reset the controller.  */
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD, 0);
+  if (! grub_ehci_wait_status (e, GRUB_EHCI_STS_HCHALTED,
+			       GRUB_EHCI_STS_HCHALTED, 100))
+    {
+      grub_error (GRUB_ERR_IO, "EHCI does not halt");
+      goto fail;
+    }
+
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD, GRUB_EHCI_CMD_HCRESET);
+  {
+    grub_uint64_t limit = grub_get_time_ms () + 250;
+
+    while (grub_ehci_readreg32 (e, GRUB_EHCI_REG_USBCMD)
+	   & GRUB_EHCI_CMD_HCRESET)
+      if (grub_get_time_ms () > limit)
+	{
+	  grub_error (GRUB_ERR_IO, "EHCI reset timeout");
+	  goto fail;
+	}
+  }
+
+  /* All structures live below 4GB, and interrupts are not used.  */
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_CTRLDSSEGMENT, 0);
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBINTR, 0);
+
+  /* Start the controller and route all ports to it.  */
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD, GRUB_EHCI_CMD_RS);
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_CONFIGFLAG, 1);
+
+  e->nports = hcsparams & GRUB_EHCI_HCSPARAMS_NPORTS;
+  if (hcsparams & GRUB_EHCI_HCSPARAMS_PPC)
+    {
+      for (i = 0; i < e->nports; i++)
+	grub_ehci_port_update (e, i, GRUB_EHCI_PORT_PP, 0);
+      grub_millisleep (20);
+    }
+
+  grub_dprintf ("ehci", "EHCI initialized\n");
+
+  /* Link to ehci now that initialisation is successful.  */
+  e->next = ehci;
+  ehci = e;
+
+  return 0;
+
+ fail:
+  grub_free ((void *) e->qh);
+  grub_free (e);
+
+  return 1;
+}
+
+static void
+grub_ehci_inithw (void)
+{
+  grub_pci_iterate (grub_ehci_pci_iter, 0);
+}
+
+
+
+static int
+grub_ehci_iterate (int (*hook) (grub_usb_controller_t dev, void *closure),
+		   void *closure)
+{
+  struct grub_ehci *e;
+  struct grub_usb_controller dev;
+
+  for (e = ehci; e; e = e->next)
+    {
+      dev.data = e;
+      if (hook (&dev, closure))
+	return 1;
+    }
+
+  return 0;
+}
+
+/* Return how many of the SIZE bytes at ADDR a single qTD can take.
+   Only the last qTD of a transaction may end in a short packet.  */
+static grub_size_t
+grub_ehci_qtd_size (grub_uint32_t addr, grub_size_t size, unsigned int max)
+{
+  grub_size_t avail;
+
+  avail = GRUB_EHCI_QTD_PAGES * GRUB_EHCI_PAGE_SIZE
+    - (addr & (GRUB_EHCI_PAGE_SIZE - 1));
+  if (size <= avail)
+    return size;
+
+  return avail - avail % max;
+}
+
+static void
+grub_ehci_fill_qtd (grub_ehci_qtd_t td, grub_transfer_type_t type,
+		    unsigned int toggle, grub_uint32_t addr, grub_size_t size)
+{
+  static const unsigned int pid[] = { 1, 0, 2 };
+  grub_uint32_t token;
+  int i;
+
+  token = (GRUB_EHCI_TOKEN_ACTIVE
+	   | (pid[type] << GRUB_EHCI_TOKEN_PID_SHIFT)
+	   | (3 << GRUB_EHCI_TOKEN_CERR_SHIFT)
+	   | (size << GRUB_EHCI_TOKEN_BYTES_SHIFT));
+  if (toggle)
+    token |= GRUB_EHCI_TOKEN_TOGGLE;
+
+  td->next = grub_cpu_to_le32 (GRUB_EHCI_LINK_TERMINATE);
+  td->alt_next = grub_cpu_to_le32 (GRUB_EHCI_LINK_TERMINATE);
+  td->token = grub_cpu_to_le32 (token);
+
+  /* The first page pointer keeps the offset, the others are page
+     aligned.  */
+  td->buffer[0] = grub_cpu_to_le32 (addr);
+  for (i = 1; i < GRUB_EHCI_QTD_PAGES; i++)
+    td->buffer[i] = grub_cpu_to_le32 ((addr & ~(GRUB_EHCI_PAGE_SIZE - 1))
+				      + i * GRUB_EHCI_PAGE_SIZE);
+  for (i = 0; i < GRUB_EHCI_QTD_PAGES; i++)
+    td->buffer_high[i] = 0;
+}
+
+/* Return the qTD the controller goes on with after a short packet in the
+   IN qTD I of TD_LIST, the first one of the next stage, or NTDS for the
+   inactive qTD that ends the chain.  */
+static int
+grub_ehci_alt_qtd (grub_ehci_qtd_t td_list, int ntds, int i)
+{
+  for (i++; i < ntds; i++)
+    if (((grub_le_to_cpu32 (td_list[i].token) >> GRUB_EHCI_TOKEN_PID_SHIFT)
+	 & 3) != 1)
+      break;
+
+  return i;
+}
+
+static grub_usb_err_t
+grub_ehci_error (grub_uint32_t token)
+{
+  if (token & GRUB_EHCI_TOKEN_BABBLE)
+    return GRUB_USB_ERR_BABBLE;
+  if (token & GRUB_EHCI_TOKEN_DBERR)
+    return GRUB_USB_ERR_DATA;
+  if (token & GRUB_EHCI_TOKEN_XACTERR)
+    return GRUB_USB_ERR_TIMEOUT;
+  return GRUB_USB_ERR_STALL;
+}
+
+static grub_usb_err_t
+grub_ehci_transfer (grub_usb_controller_t dev,
+		    grub_usb_transfer_t transfer)
+{
+  struct grub_ehci *e = (struct grub_ehci *) dev->data;
+  grub_ehci_qh_t qh = e->qh;
+  grub_ehci_qtd_t td_list;
+  grub_usb_err_t err = GRUB_USB_ERR_NONE;
+  unsigned int max = transfer->max;
+  grub_uint64_t limit;
+  int ntds = 0;
+  int done = 0;
+  int i, j;
+
+  /* Split transfers through a hub are not supported, low and full
+     speed devices are handed to the companion controllers.  */
+  if (transfer->dev->speed != GRUB_USB_SPEED_HIGH)
+    return GRUB_USB_ERR_INTERNAL;
+
+  /* Count the qTDs, a transaction may need several.  */
+  for (i = 0; i < transfer->transcnt; i++)
+    {
+      grub_usb_transaction_t tr = &transfer->transactions[i];
+      grub_uint32_t addr = (grub_uint32_t) (grub_addr_t) tr->data;
+      grub_size_t size = tr->size;
+
+      do
+	{
+	  grub_size_t len = grub_ehci_qtd_size (addr, size, max);
+
+	  addr += len;
+	  size -= len;
+	  ntds++;
+	}
+      while (size);
+    }
+
+  /* One more, inactive, qTD stops the queue head after a short
+     packet.  */
+  td_list = grub_memalign (32, (ntds + 1) * sizeof (struct grub_ehci_qtd));
+  if (! td_list)
+    return GRUB_USB_ERR_INTERNAL;
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if ((grub_uint64_t) td_list >> 32)
+    {
+      grub_free ((void *) td_list);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+#endif
+
+  /* Setup all qTDs.  Every packet flips the data toggle.  */
+  for (i = 0, j = 0; i < transfer->transcnt; i++)
+    {
+      grub_usb_transaction_t tr = &transfer->transactions[i];
+      grub_uint32_t addr = (grub_uint32_t) (grub_addr_t) tr->data;
+      grub_size_t size = tr->size;
+      unsigned int toggle = tr->toggle;
+
+      do
+	{
+	  grub_size_t len = grub_ehci_qtd_size (addr, size, max);
+
+	  grub_ehci_fill_qtd (&td_list[j], tr->pid, toggle, addr, len);
+	  if (j > 0)
+	    td_list[j - 1].next
+	      = grub_cpu_to_le32 ((grub_uint32_t) (grub_addr_t) &td_list[j]);
+
+	  toggle ^= (len ? (len + max - 1) / max : 1) & 1;
+	  addr += len;
+	  size -= len;
+	  j++;
+	}
+      while (size);
+    }
+
+  grub_memset ((void *) &td_list[ntds], 0, sizeof (struct grub_ehci_qtd));
+  td_list[ntds].next = grub_cpu_to_le32 (GRUB_EHCI_LINK_TERMINATE);
+  td_list[ntds].alt_next = grub_cpu_to_le32 (GRUB_EHCI_LINK_TERMINATE);
+
+  /* A short IN packet skips the rest of its stage.  Without an
+     alternate qTD the controller would go on with the next one, and
+     keep reading.  */
+  for (j = 0; j < ntds; j++)
+    if (((grub_le_to_cpu32 (td_list[j].token)
+	  >> GRUB_EHCI_TOKEN_PID_SHIFT) & 3) == 1)
+      td_list[j].alt_next
+	= grub_cpu_to_le32 ((grub_uint32_t) (grub_addr_t)
+			    &td_list[grub_ehci_alt_qtd (td_list, ntds, j)]);
+
+  grub_dprintf ("ehci", "transfer: addr=%d endp=%d transactions=%d qtds=%d\n",
+		transfer->devaddr, transfer->endpoint, transfer->transcnt,
+		ntds);
+
+  /* Point the queue head at the chain.  The toggle comes from the
+     qTDs.  */
+  qh->link = grub_cpu_to_le32 ((grub_uint32_t) (grub_addr_t) qh
+			       | GRUB_EHCI_LINK_QH);
+  qh->ep_char = grub_cpu_to_le32 (transfer->devaddr
+				  | (transfer->endpoint
+				     << GRUB_EHCI_EP_ENDPT_SHIFT)
+				  | GRUB_EHCI_EP_EPS_HIGH
+				  | GRUB_EHCI_EP_DTC
+				  | GRUB_EHCI_EP_HEAD
+				  | (max << GRUB_EHCI_EP_MAXPKT_SHIFT));
+  qh->ep_cap = grub_cpu_to_le32 (GRUB_EHCI_EP_MULT_ONE);
+  qh->current = 0;
+  grub_memset ((void *) &qh->overlay, 0, sizeof (qh->overlay));
+  qh->overlay.next = grub_cpu_to_le32 ((grub_uint32_t) (grub_addr_t) td_list);
+  qh->overlay.alt_next = grub_cpu_to_le32 (GRUB_EHCI_LINK_TERMINATE);
+
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_ASYNCLISTADDR,
+			(grub_uint32_t) (grub_addr_t) qh);
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD,
+			grub_ehci_readreg32 (e, GRUB_EHCI_REG_USBCMD)
+			| GRUB_EHCI_CMD_ASE);
+
+  /* Wait until the chain is completed or halts, following the
+     controller to the alternate qTD after a short packet.  */
+  limit = grub_get_time_ms () + GRUB_EHCI_TIMEOUT;
+  while (1)
+    {
+      grub_uint32_t token = 0;
+      int finished = done;
+
+      while (finished < ntds)
+	{
+	  token = grub_le_to_cpu32 (td_list[finished].token);
+	  if (token & GRUB_EHCI_TOKEN_ACTIVE)
+	    break;
+
+	  if (token & GRUB_EHCI_TOKEN_HALTED)
+	    {
+	      finished++;
+	      break;
+	    }
+
+	  /* Short packet.  */
+	  if (((token >> GRUB_EHCI_TOKEN_BYTES_SHIFT)
+	       & GRUB_EHCI_TOKEN_BYTES_MASK)
+	      && ((token >> GRUB_EHCI_TOKEN_PID_SHIFT) & 3) == 1)
+	    finished = grub_ehci_alt_qtd (td_list, ntds, finished);
+	  else
+	    finished++;
+	}
+
+      if (token & GRUB_EHCI_TOKEN_HALTED)
+	{
+	  err = grub_ehci_error (token);
+	  grub_dprintf ("ehci", "halted, token=0x%x\n", token);
+	  break;
+	}
+
+      if (finished == ntds)
+	break;
+
+      /* Only give up on a transfer that stopped making progress.  */
+      if (finished != done)
+	{
+	  done = finished;
+	  limit = grub_get_time_ms () + GRUB_EHCI_TIMEOUT;
+	}
+      else if (grub_get_time_ms () > limit)
+	{
+	  grub_dprintf ("ehci", "timeout, token=0x%x\n", token);
+	  err = GRUB_USB_ERR_TIMEOUT;
+	  break;
+	}
+    }
+
+  /* Stop the asynchronous schedule before the qTDs are freed.  */
+  grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD,
+			grub_ehci_readreg32 (e, GRUB_EHCI_REG_USBCMD)
+			& ~GRUB_EHCI_CMD_ASE);
+  if (! grub_ehci_wait_status (e, GRUB_EHCI_STS_ASS, 0, 100))
+    grub_dprintf ("ehci", "asynchronous schedule does not stop\n");
+
+  /* The overlay has the toggle after the last packet sent, which is not
+     what usbtrans expects if a short packet ended the transfer.  */
+  if ((transfer->type == GRUB_USB_TRANSACTION_TYPE_BULK) && (qh->current))
+    transfer->dev->toggle[transfer->endpoint]
+      = !! (grub_le_to_cpu32 (qh->overlay.token) & GRUB_EHCI_TOKEN_TOGGLE);
+
+  grub_free ((void *) td_list);
+
+  return err;
+}
+
+static grub_err_t
+grub_ehci_portstatus (grub_usb_controller_t dev,
+		      unsigned int port, unsigned int enable)
+{
+  struct grub_ehci *e = (struct grub_ehci *) dev->data;
+  grub_uint64_t limit;
+
+  if (! enable)
+    {
+      grub_ehci_port_update (e, port, 0, GRUB_EHCI_PORT_PE);
+      return GRUB_ERR_NONE;
+    }
+
+  /* Already reset and enabled by detect_dev.  */
+  if (grub_ehci_port_read (e, port) & GRUB_EHCI_PORT_PE)
+    return GRUB_ERR_NONE;
+
+  /* Reset the port, the controller enables it afterwards if the
+     device is high speed.  */
+  grub_ehci_port_update (e, port, GRUB_EHCI_PORT_PR, GRUB_EHCI_PORT_PE);
+  grub_millisleep (50);
+  grub_ehci_port_update (e, port, 0, GRUB_EHCI_PORT_PR);
+
+  limit = grub_get_time_ms () + 10;
+  while (grub_ehci_port_read (e, port) & GRUB_EHCI_PORT_PR)
+    if (grub_get_time_ms () > limit)
+      return grub_error (GRUB_ERR_IO, "EHCI port reset timeout");
+
+  grub_dprintf ("ehci", "portstatus=0x%x\n", grub_ehci_port_read (e, port));
+
+  if (! (grub_ehci_port_read (e, port) & GRUB_EHCI_PORT_PE))
+    return grub_error (GRUB_ERR_IO, "EHCI port not enabled");
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_usb_speed_t
+grub_ehci_detect_dev (grub_usb_controller_t dev, int port)
+{
+  struct grub_ehci *e = (struct grub_ehci *) dev->data;
+  grub_uint32_t status;
+
+  status = grub_ehci_port_read (e, port);
+
+  grub_dprintf ("ehci", "detect_dev status=0x%x\n", status);
+
+  if (! (status & GRUB_EHCI_PORT_CCS))
+    return GRUB_USB_SPEED_NONE;
+
+  /* A low speed device, leave it to the companion controller.  */
+  if ((status & GRUB_EHCI_PORT_LS_MASK) == GRUB_EHCI_PORT_LS_K)
+    {
+      grub_ehci_port_update (e, port, GRUB_EHCI_PORT_OWNER, 0);
+      return GRUB_USB_SPEED_NONE;
+    }
+
+  /* Only high speed devices are enabled by a reset, full speed ones
+     are handed to the companion controller as well.  */
+  if (grub_ehci_portstatus (dev, port, 1))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      grub_ehci_port_update (e, port, GRUB_EHCI_PORT_OWNER, 0);
+      return GRUB_USB_SPEED_NONE;
+    }
+
+  return GRUB_USB_SPEED_HIGH;
+}
+
+static int
+grub_ehci_hubports (grub_usb_controller_t dev)
+{
+  struct grub_ehci *e = (struct grub_ehci *) dev->data;
+
+  grub_dprintf ("ehci", "root hub ports=%d\n", e->nports);
+
+  return e->nports;
+}
+
+
+
+static struct grub_usb_controller_dev usb_controller =
+{
+  .name = "ehci",
+  .iterate = grub_ehci_iterate,
+  .transfer = grub_ehci_transfer,
+  .hubports = grub_ehci_hubports,
+  .portstatus = grub_ehci_portstatus,
+  .detect_dev = grub_ehci_detect_dev,
+  .max_transaction = 0x100000
+};
+
+GRUB_MOD_INIT(ehci)
+{
+  grub_ehci_inithw ();
+  grub_usb_controller_dev_register (&usb_controller);
+
+  /* The companion controllers lost every port, and got back those with
+     low and full speed devices.  */
+  if (ehci)
+    grub_usb_controller_dev_rescan (&usb_controller);
+}
+
+GRUB_MOD_FINI(ehci)
+{
+  struct grub_ehci *e;
+
+  grub_usb_controller_dev_unregister (&usb_controller);
+
+  /* Give the ports back to the companion controllers.  */
+  for (e = ehci; e; e = e->next)
+    {
+      grub_ehci_writereg32 (e, GRUB_EHCI_REG_USBCMD, 0);
+      grub_ehci_writereg32 (e, GRUB_EHCI_REG_CONFIGFLAG, 0);
+    }
+
+  if (ehci)
+    {
+      grub_usb_forget_devs (&usb_controller);
+      grub_usb_controller_dev_rescan (&usb_controller);
+    }
+}
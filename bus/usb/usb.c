@@ -24,6 +24,8 @@
 
 GRUB_EXPORT(grub_usb_controller_dev_register);
 GRUB_EXPORT(grub_usb_controller_dev_unregister);
+GRUB_EXPORT(grub_usb_controller_dev_rescan);
+GRUB_EXPORT(grub_usb_forget_devs);
 GRUB_EXPORT(grub_usb_iterate);
 GRUB_EXPORT(grub_usb_set_configuration);
 
@@ -67,6 +69,22 @@ grub_usb_controller_dev_unregister (grub_usb_controller_dev_t usb)
       }
 }
 
+/* Scan the root hubs of the controller drivers other than USB again,
+   after USB took over their ports or gave them back.  The devices they
+   found before are gone from their ports.  */
+void
+grub_usb_controller_dev_rescan (grub_usb_controller_dev_t usb)
+{
+  grub_usb_controller_dev_t p;
+
+  for (p = grub_usb_list; p; p = p->next)
+    if ((p != usb) && (p->iterate))
+      {
+	grub_usb_forget_devs (p);
+	p->iterate (grub_usb_controller_dev_register_hook, p);
+      }
+}
+
 #if 0
 int
 grub_usb_controller_iterate (int (*hook) (grub_usb_controller_t dev))
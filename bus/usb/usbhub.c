@@ -174,6 +174,18 @@ grub_usb_root_hub (grub_usb_controller_t controller)
   return GRUB_USB_ERR_NONE;
 }
 
+/* Remove the devices found on the controllers of USB from the device
+   list.  Drivers may still hold them, so they are not freed.  */
+void
+grub_usb_forget_devs (grub_usb_controller_dev_t usb)
+{
+  int i;
+
+  for (i = 0; i < 128; i++)
+    if (grub_usb_devs[i] && grub_usb_devs[i]->controller.dev == usb)
+      grub_usb_devs[i] = 0;
+}
+
 int
 grub_usb_iterate (int (*hook) (grub_usb_device_t dev, void *closure),
 		  void *closure)
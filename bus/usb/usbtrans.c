@@ -135,6 +135,7 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   grub_usb_transfer_t transfer;
   int datablocks;
   unsigned int max;
+  grub_size_t trsize;
   grub_usb_err_t err;
   int toggle = dev->toggle[endpoint];
 
@@ -142,7 +143,9 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   if (dev->initialized)
     {
       struct grub_usb_desc_endp *endpdesc;
-      endpdesc = grub_usb_get_endpdescriptor (dev, 0);
+      endpdesc = grub_usb_get_endpdescriptor (dev, endpoint
+					      | (type == GRUB_USB_TRANSFER_TYPE_IN
+						 ? 0x80 : 0));
 
       if (endpdesc)
 	max = endpdesc->maxpacket;
@@ -157,7 +160,16 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
   if (! transfer)
     return grub_errno;
 
-  datablocks = ((size + max - 1) / max);
+  /* Controllers that split transactions into packets themselves get
+     the data in as few transactions as possible, instead of one per
+     packet.  */
+  trsize = dev->controller.dev->max_transaction;
+  if (trsize >= max)
+    trsize -= trsize % max;
+  else
+    trsize = max;
+
+  datablocks = ((size + trsize - 1) / trsize);
   transfer->transcnt = datablocks;
   transfer->size = size - 1;
   transfer->endpoint = endpoint;
@@ -180,19 +192,21 @@ grub_usb_bulk_readwrite (grub_usb_device_t dev,
     {
       grub_usb_transaction_t tr = &transfer->transactions[i];
 
-      tr->size = (size > max) ? max : size;
+      tr->size = (size > trsize) ? trsize : size;
       /* XXX: Use the right most bit as the data toggle.  Simple and
-	 effective.  */
+	 effective.  Every packet of the transaction flips it.  */
       tr->toggle = toggle;
-      toggle = toggle ? 0 : 1;
+      if (((tr->size + max - 1) / max) & 1)
+	toggle = toggle ? 0 : 1;
       tr->pid = type;
-      tr->data = &data[i * max];
+      tr->data = &data[i * trsize];
       size -= tr->size;
     }
 
-  err = dev->controller.dev->transfer (&dev->controller, transfer);
-  grub_dprintf ("usb", "toggle=%d\n", toggle);
+  /* The controller corrects the toggle if the transfer ended early.  */
   dev->toggle[endpoint] = toggle;
+  err = dev->controller.dev->transfer (&dev->controller, transfer);
+  grub_dprintf ("usb", "toggle=%d\n", dev->toggle[endpoint]);
 
   grub_free (transfer->transactions);
   grub_free (transfer);
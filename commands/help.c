@@ -92,20 +92,15 @@ print_command_help (grub_command_t cmd, void *closure)
 {
   struct grub_cmd_help_closure *c = closure;
 
-  if (cmd->prio & GRUB_PRIO_LIST_FLAG_ACTIVE)
-    {
-      if (! grub_strncmp (cmd->name, c->currarg, grub_strlen (c->currarg)))
-	{
-	  if (c->cnt++ > 0)
-	    grub_printf ("\n\n");
-
-	  if (cmd->flags & GRUB_COMMAND_FLAG_EXTCMD)
-	    grub_arg_show_help ((grub_extcmd_t) cmd->data);
-	  else
-	    grub_printf ("%s %s %s\n%s\n", _("Usage:"), cmd->name, _(cmd->summary),
-			 _(cmd->description));
-	}
-    }
+  if (c->cnt++ > 0)
+    grub_printf ("\n\n");
+
+  if (cmd->flags & GRUB_COMMAND_FLAG_EXTCMD)
+    grub_arg_show_help ((grub_extcmd_t) cmd->data);
+  else
+    grub_printf ("%s %s %s\n%s\n", _("Usage:"), cmd->name, _(cmd->summary),
+		 _(cmd->description));
+
   return 0;
 }
 
@@ -130,7 +125,7 @@ grub_cmd_help (grub_extcmd_t ext __attribute__ ((unused)), int argc,
       for (i = 0; i < argc; i++)
 	{
 	  c.currarg = args[i];
-	  grub_command_iterate (print_command_help, &c);
+	  grub_command_iterate_prefix (c.currarg, print_command_help, &c);
 	}
     }
 
@@ -36,18 +36,19 @@ grub_cmd_geometry (grub_command_t cmd __attribute__ ((unused)),
   p = grub_biosdisk_geom;
   for (; n > 0; n--, p++)
     {
-      char fg[4];
+      char fg[5];
       long long total_sectors;
 
       fg[0] = (p->flags & GRUB_BIOSDISK_FLAG_LBA) ? 'L' : '-';
       fg[1] = (p->flags & GRUB_BIOSDISK_FLAG_CDROM) ? 'C' : '-';
       fg[2] = (p->flags & GRUB_BIOSDISK_FLAG_FB) ? 'F' : '-';
-      fg[3] = 0;
+      fg[3] = (p->flags & GRUB_BIOSDISK_FLAG_FLAT) ? 'X' : '-';
+      fg[4] = 0;
 
       total_sectors = (p->flags & GRUB_BIOSDISK_FLAG_CDROM) ?
 	0 : p->total_sectors;
 
-      grub_printf ("%02x    %s    %-2ld    %-3ld    %-3d    %lld\n",
+      grub_printf ("%02x    %s   %-2ld    %-3ld    %-3d    %lld\n",
 		   p->drive, fg, p->sectors, p->heads, p->max_sectors,
 		   total_sectors);
     }
@@ -295,12 +295,11 @@ grub_mini_cmd_rmmod (struct grub_command *cmd __attribute__ ((unused)),
   return 0;
 }
 
-static int
-print_module (grub_dl_t mod)
+static void
+print_module_deps (grub_dl_t mod)
 {
   grub_dl_dep_t dep;
 
-  grub_printf ("%s\t%d\t\t", mod->name, mod->ref_count);
   for (dep = mod->dep; dep; dep = dep->next)
     {
       if (dep != mod->dep)
@@ -309,18 +308,42 @@ print_module (grub_dl_t mod)
       grub_printf ("%s", dep->mod->name);
     }
   grub_putchar ('\n');
+}
+
+static int
+print_module (grub_dl_t mod)
+{
+  grub_printf ("%s\t%d\t\t", mod->name, mod->ref_count);
+  print_module_deps (mod);
+
+  return 0;
+}
+
+static int
+print_module_time (grub_dl_t mod)
+{
+  grub_printf ("%s\t%d\t\t%llu ms\t", mod->name, mod->ref_count,
+	       (unsigned long long) mod->load_time);
+  print_module_deps (mod);
 
   return 0;
 }
 
-/* lsmod */
+/* lsmod [-t] */
 static grub_err_t
 grub_mini_cmd_lsmod (struct grub_command *cmd __attribute__ ((unused)),
-		     int argc __attribute__ ((unused)),
-		     char *argv[] __attribute__ ((unused)))
+		     int argc, char *argv[])
 {
-  grub_printf ("Name\tRef Count\tDependencies\n");
-  grub_dl_iterate (print_module);
+  if ((argc > 0) && (! grub_strcmp (argv[0], "-t")))
+    {
+      grub_printf ("Name\tRef Count\tLoad Time\tDependencies\n");
+      grub_dl_iterate (print_module_time);
+    }
+  else
+    {
+      grub_printf ("Name\tRef Count\tDependencies\n");
+      grub_dl_iterate (print_module);
+    }
 
   return 0;
 }
@@ -368,7 +391,8 @@ GRUB_MOD_INIT(minicmd)
 			   N_("MODULE"), N_("Remove a module."));
   cmd_lsmod =
     grub_register_command ("lsmod", grub_mini_cmd_lsmod,
-			   0, N_("Show loaded modules."));
+			   N_("[-t]"), N_("Show loaded modules, "
+					  "with their load time if -t."));
   cmd_exit =
     grub_register_command ("exit", grub_mini_cmd_exit,
 			   0, N_("Exit from GRUB."));
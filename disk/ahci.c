@@ -0,0 +1,664 @@
+/* ahci.c - AHCI SATA disk access.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/ata.h>
+
+/* HBA registers.  */
+#define GRUB_AHCI_HBA_CAP	0x00
+#define GRUB_AHCI_HBA_GHC	0x04
+#define GRUB_AHCI_HBA_IS	0x08
+#define GRUB_AHCI_HBA_PI	0x0c
+
+#define GRUB_AHCI_HBA_GHC_AE	(1U << 31)
+
+/* Port registers, relative to the port's base.  */
+#define GRUB_AHCI_PORT_BASE(n)	(0x100 + 0x80 * (n))
+#define GRUB_AHCI_PORT_CLB	0x00
+#define GRUB_AHCI_PORT_CLBU	0x04
+#define GRUB_AHCI_PORT_FB	0x08
+#define GRUB_AHCI_PORT_FBU	0x0c
+#define GRUB_AHCI_PORT_IS	0x10
+#define GRUB_AHCI_PORT_IE	0x14
+#define GRUB_AHCI_PORT_CMD	0x18
+#define GRUB_AHCI_PORT_TFD	0x20
+#define GRUB_AHCI_PORT_SIG	0x24
+#define GRUB_AHCI_PORT_SSTS	0x28
+#define GRUB_AHCI_PORT_SERR	0x30
+#define GRUB_AHCI_PORT_CI	0x38
+
+#define GRUB_AHCI_PORT_CMD_ST	(1 << 0)
+#define GRUB_AHCI_PORT_CMD_FRE	(1 << 4)
+#define GRUB_AHCI_PORT_CMD_FR	(1 << 14)
+#define GRUB_AHCI_PORT_CMD_CR	(1 << 15)
+
+#define GRUB_AHCI_PORT_IS_TFES	(1 << 30)
+
+#define GRUB_AHCI_SSTS_DET_MASK	0x0f
+#define GRUB_AHCI_SSTS_DET_PRESENT	0x03
+
+#define GRUB_AHCI_SIG_ATA	0x00000101
+
+/* Register - Host to Device FIS.  */
+#define GRUB_AHCI_FIS_H2D	0x27
+#define GRUB_AHCI_FIS_H2D_CMD	0x80
+
+/* Entries in the command table's PRD list, each describing at most
+   4MiB.  Together they cover the largest transfer of 65535 sectors.  */
+#define GRUB_AHCI_PRDT_COUNT	8
+#define GRUB_AHCI_PRD_MAX	0x400000
+
+struct grub_ahci_cmd_head
+{
+  grub_uint32_t config;
+  grub_uint32_t transferred;
+  grub_uint32_t command_table_base;
+  grub_uint32_t command_table_base_high;
+  grub_uint32_t reserved[4];
+} __attribute__ ((packed));
+
+struct grub_ahci_prd
+{
+  grub_uint32_t data_base;
+  grub_uint32_t data_base_high;
+  grub_uint32_t reserved;
+  /* Byte count minus one.  */
+  grub_uint32_t size;
+} __attribute__ ((packed));
+
+struct grub_ahci_cmd_table
+{
+  grub_uint8_t cfis[0x40];
+  grub_uint8_t command[0x10];
+  grub_uint8_t reserved[0x30];
+  struct grub_ahci_prd prdt[GRUB_AHCI_PRDT_COUNT];
+} __attribute__ ((packed));
+
+struct grub_ahci_device
+{
+  /* Number of the disk, as in "ahci0".  */
+  int num;
+
+  /* The port's registers.  */
+  volatile grub_uint32_t *regs;
+
+  /* The command list, of which only slot 0 is used, the received FIS
+     area and the command table for that slot.  */
+  struct grub_ahci_cmd_head *command_list;
+  void *rfis;
+  struct grub_ahci_cmd_table *command_table;
+
+  /* Sector count.  */
+  grub_uint64_t size;
+
+  /* Set to 1 if the device supports 48-bit addressing.  */
+  int lba48;
+
+  struct grub_ahci_device *next;
+};
+
+static struct grub_ahci_device *grub_ahci_devices;
+static int grub_ahci_numdevs;
+
+static inline grub_uint32_t
+grub_ahci_port_read (struct grub_ahci_device *dev, int reg)
+{
+  return grub_le_to_cpu32 (dev->regs[reg / 4]);
+}
+
+static inline void
+grub_ahci_port_write (struct grub_ahci_device *dev, int reg,
+		      grub_uint32_t val)
+{
+  dev->regs[reg / 4] = grub_cpu_to_le32 (val);
+}
+
+/* Wait until the bits in MASK of register REG are all clear.  */
+static grub_err_t
+grub_ahci_wait_clear (struct grub_ahci_device *dev, int reg,
+		      grub_uint32_t mask, int milliseconds)
+{
+  grub_uint64_t limit = grub_get_time_ms () + milliseconds;
+
+  while (grub_ahci_port_read (dev, reg) & mask)
+    if (grub_get_time_ms () > limit)
+      return grub_error (GRUB_ERR_TIMEOUT, "AHCI timeout");
+
+  return GRUB_ERR_NONE;
+}
+
+/* Stop processing the command list and receiving FISes.  */
+static grub_err_t
+grub_ahci_port_stop (struct grub_ahci_device *dev)
+{
+  grub_uint32_t cmd = grub_ahci_port_read (dev, GRUB_AHCI_PORT_CMD);
+
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CMD, cmd & ~GRUB_AHCI_PORT_CMD_ST);
+  if (grub_ahci_wait_clear (dev, GRUB_AHCI_PORT_CMD, GRUB_AHCI_PORT_CMD_CR,
+			    500))
+    return grub_errno;
+
+  cmd = grub_ahci_port_read (dev, GRUB_AHCI_PORT_CMD);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CMD,
+			cmd & ~GRUB_AHCI_PORT_CMD_FRE);
+  return grub_ahci_wait_clear (dev, GRUB_AHCI_PORT_CMD, GRUB_AHCI_PORT_CMD_FR,
+			       500);
+}
+
+static grub_err_t
+grub_ahci_port_start (struct grub_ahci_device *dev)
+{
+  grub_uint32_t cmd;
+
+  /* Clear any error left over, then wait for the device to settle.  */
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_SERR, 0xffffffff);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_IS, 0xffffffff);
+
+  cmd = grub_ahci_port_read (dev, GRUB_AHCI_PORT_CMD);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CMD, cmd | GRUB_AHCI_PORT_CMD_FRE);
+
+  if (grub_ahci_wait_clear (dev, GRUB_AHCI_PORT_TFD,
+			    GRUB_ATA_STATUS_BUSY | GRUB_ATA_STATUS_DRQ,
+			    GRUB_ATA_TOUT_STD))
+    return grub_errno;
+
+  cmd = grub_ahci_port_read (dev, GRUB_AHCI_PORT_CMD);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CMD, cmd | GRUB_AHCI_PORT_CMD_ST);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Check that the HBA can transfer SIZE bytes at BUF.  */
+static int
+grub_ahci_dma_usable (const char *buf, grub_size_t size)
+{
+  grub_addr_t addr = (grub_addr_t) buf;
+
+  /* Data blocks must be word aligned.  */
+  if (addr & 1)
+    return 0;
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if ((grub_uint64_t) (addr + size) >> 32)
+    return 0;
+#else
+  (void) size;
+#endif
+
+  return 1;
+}
+
+/* Issue the ATA command CMD through slot 0 and transfer SIZE bytes
+   between the device and BUF.  */
+static grub_err_t
+grub_ahci_command (struct grub_ahci_device *dev, int cmd,
+		   grub_disk_addr_t sector, grub_size_t count,
+		   char *buf, grub_size_t size, int rw)
+{
+  struct grub_ahci_cmd_table *tbl = dev->command_table;
+  grub_uint8_t *fis = tbl->cfis;
+  grub_uint32_t addr = (grub_uint32_t) (grub_addr_t) buf;
+  grub_uint32_t tfd;
+  grub_uint64_t limit;
+  int nprd = 0;
+
+  grub_memset (tbl, 0, 0x80);
+
+  fis[0] = GRUB_AHCI_FIS_H2D;
+  fis[1] = GRUB_AHCI_FIS_H2D_CMD;
+  fis[2] = cmd;
+  fis[4] = sector & 0xff;
+  fis[5] = (sector >> 8) & 0xff;
+  fis[6] = (sector >> 16) & 0xff;
+  /* LBA mode, 28-bit commands keep the top bits in the device
+     register.  */
+  fis[7] = 0x40;
+  if (! dev->lba48)
+    fis[7] |= (sector >> 24) & 0x0f;
+  fis[8] = (sector >> 24) & 0xff;
+  fis[9] = (sector >> 32) & 0xff;
+  fis[10] = (sector >> 40) & 0xff;
+  fis[12] = count & 0xff;
+  fis[13] = (count >> 8) & 0xff;
+
+  /* Scatter the buffer over the PRD list.  */
+  while (size)
+    {
+      grub_uint32_t len = size;
+
+      if (len > GRUB_AHCI_PRD_MAX)
+	len = GRUB_AHCI_PRD_MAX;
+
+      tbl->prdt[nprd].data_base = grub_cpu_to_le32 (addr);
+      tbl->prdt[nprd].data_base_high = 0;
+      tbl->prdt[nprd].reserved = 0;
+      tbl->prdt[nprd].size = grub_cpu_to_le32 (len - 1);
+      nprd++;
+
+      addr += len;
+      size -= len;
+    }
+
+  /* Five dwords of command FIS.  */
+  dev->command_list[0].config = grub_cpu_to_le32 (5 | (rw ? (1 << 6) : 0)
+						  | (nprd << 16));
+  dev->command_list[0].transferred = 0;
+
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_IS, 0xffffffff);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CI, 1);
+
+  /* Interrupts are not used, poll for completion.  */
+  limit = grub_get_time_ms () + GRUB_ATA_TOUT_DATA;
+  while (grub_ahci_port_read (dev, GRUB_AHCI_PORT_CI) & 1)
+    {
+      if (grub_ahci_port_read (dev, GRUB_AHCI_PORT_IS) & GRUB_AHCI_PORT_IS_TFES)
+	break;
+
+      if (grub_get_time_ms () > limit)
+	{
+	  grub_dprintf ("ahci", "ahci%d: command 0x%x timed out\n",
+			dev->num, cmd);
+	  grub_ahci_port_stop (dev);
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_ahci_port_start (dev);
+	  grub_errno = GRUB_ERR_NONE;
+	  return grub_error (GRUB_ERR_TIMEOUT, "AHCI timeout");
+	}
+    }
+
+  tfd = grub_ahci_port_read (dev, GRUB_AHCI_PORT_TFD);
+  if ((grub_ahci_port_read (dev, GRUB_AHCI_PORT_IS) & GRUB_AHCI_PORT_IS_TFES)
+      || (tfd & GRUB_ATA_STATUS_ERR))
+    {
+      grub_dprintf ("ahci", "ahci%d: command 0x%x failed, status=0x%x, "
+		    "error=0x%x\n", dev->num, cmd, tfd & 0xff,
+		    (tfd >> 8) & 0xff);
+
+      /* The port stops on a task file error, restart it.  */
+      grub_ahci_port_stop (dev);
+      grub_errno = GRUB_ERR_NONE;
+      grub_ahci_port_start (dev);
+      grub_errno = GRUB_ERR_NONE;
+
+      if (! rw)
+	return grub_error (GRUB_ERR_READ_ERROR, "AHCI read error");
+      else
+	return grub_error (GRUB_ERR_WRITE_ERROR, "AHCI write error");
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_ahci_identify (struct grub_ahci_device *dev)
+{
+  grub_uint16_t *info16;
+
+  info16 = grub_memalign (2, GRUB_DISK_SECTOR_SIZE);
+  if (! info16)
+    return grub_errno;
+
+  if (grub_ahci_command (dev, GRUB_ATA_CMD_IDENTIFY_DEVICE, 0, 0,
+			 (char *) info16, GRUB_DISK_SECTOR_SIZE, 0))
+    {
+      grub_free (info16);
+      return grub_errno;
+    }
+
+  /* AHCI devices all support LBA, check for LBA48.  */
+  dev->lba48 = (grub_le_to_cpu16 (info16[83]) & (1 << 10)) ? 1 : 0;
+
+  if (dev->lba48)
+    dev->size = grub_le_to_cpu64 (*((grub_uint64_t *) &info16[100]));
+  else
+    dev->size = grub_le_to_cpu32 (*((grub_uint32_t *) &info16[60]));
+
+  grub_dprintf ("ahci", "ahci%d: LBA48: %d, sectors: %llu\n", dev->num,
+		dev->lba48, (unsigned long long) dev->size);
+
+  grub_free (info16);
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_ahci_free_device (struct grub_ahci_device *dev)
+{
+  grub_free (dev->command_list);
+  grub_free (dev->rfis);
+  grub_free (dev->command_table);
+  grub_free (dev);
+}
+
+static void
+grub_ahci_device_initialize (volatile grub_uint32_t *hba, int port)
+{
+  struct grub_ahci_device *dev;
+  struct grub_ahci_device **devp;
+  grub_uint32_t ssts;
+  grub_uint32_t sig;
+
+  dev = grub_zalloc (sizeof (*dev));
+  if (! dev)
+    return;
+
+  dev->regs = hba + GRUB_AHCI_PORT_BASE (port) / 4;
+
+  ssts = grub_ahci_port_read (dev, GRUB_AHCI_PORT_SSTS);
+  sig = grub_ahci_port_read (dev, GRUB_AHCI_PORT_SIG);
+  grub_dprintf ("ahci", "port %d: ssts=0x%x, sig=0x%x\n", port, ssts, sig);
+
+  /* Only ATA disks are handled, ATAPI devices are left to firmware.  */
+  if ((ssts & GRUB_AHCI_SSTS_DET_MASK) != GRUB_AHCI_SSTS_DET_PRESENT
+      || sig != GRUB_AHCI_SIG_ATA)
+    {
+      grub_free (dev);
+      return;
+    }
+
+  /* The structures must be reachable with 32-bit addresses, the upper
+     halves are always written as zero.  */
+  dev->command_list = grub_memalign (1024, 1024);
+  dev->rfis = grub_memalign (256, 256);
+  dev->command_table = grub_memalign (128, sizeof (*dev->command_table));
+  if (! dev->command_list || ! dev->rfis || ! dev->command_table)
+    goto fail;
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if (((grub_uint64_t) dev->command_list >> 32)
+      || ((grub_uint64_t) dev->rfis >> 32)
+      || ((grub_uint64_t) dev->command_table >> 32))
+    {
+      grub_error (GRUB_ERR_OUT_OF_MEMORY, "AHCI memory not <4GB");
+      goto fail;
+    }
+#endif
+
+  grub_memset (dev->command_list, 0, 1024);
+  grub_memset (dev->rfis, 0, 256);
+  dev->command_list[0].command_table_base
+    = grub_cpu_to_le32 ((grub_uint32_t) (grub_addr_t) dev->command_table);
+
+  if (grub_ahci_port_stop (dev))
+    goto fail;
+
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CLB,
+			(grub_uint32_t) (grub_addr_t) dev->command_list);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_CLBU, 0);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_FB,
+			(grub_uint32_t) (grub_addr_t) dev->rfis);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_FBU, 0);
+  grub_ahci_port_write (dev, GRUB_AHCI_PORT_IE, 0);
+
+  if (grub_ahci_port_start (dev))
+    goto fail;
+
+  dev->num = grub_ahci_numdevs;
+  if (grub_ahci_identify (dev))
+    {
+      grub_ahci_port_stop (dev);
+      goto fail;
+    }
+  grub_ahci_numdevs++;
+
+  /* Register the device.  */
+  for (devp = &grub_ahci_devices; *devp; devp = &(*devp)->next);
+  *devp = dev;
+
+  return;
+
+ fail:
+  grub_ahci_free_device (dev);
+}
+
+static int
+grub_ahci_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *closure __attribute__ ((unused)))
+{
+  grub_pci_address_t addr;
+  grub_uint32_t class;
+  grub_uint32_t bar;
+  grub_uint32_t pi;
+  volatile grub_uint32_t *hba;
+  int i;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Mass storage, SATA, AHCI programming interface.  */
+  if ((class >> 8) != 0x010601)
+    return 0;
+
+  /* The HBA registers are in memory space at ABAR.  */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG5);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+
+  /* Enable memory space and bus mastering.  */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr) | 0x6);
+
+  hba = grub_pci_device_map_range (dev, bar & GRUB_PCI_ADDR_MEM_MASK, 0x1100);
+
+  /* Switch to AHCI mode, in case the firmware left it in legacy
+     mode.  */
+  hba[GRUB_AHCI_HBA_GHC / 4] |= grub_cpu_to_le32 (GRUB_AHCI_HBA_GHC_AE);
+
+  pi = grub_le_to_cpu32 (hba[GRUB_AHCI_HBA_PI / 4]);
+
+  grub_dprintf ("ahci", "PCI dev (%d,%d,%d) abar=0x%x cap=0x%x pi=0x%x\n",
+		grub_pci_get_bus (dev), grub_pci_get_device (dev),
+		grub_pci_get_function (dev), bar & GRUB_PCI_ADDR_MEM_MASK,
+		grub_le_to_cpu32 (hba[GRUB_AHCI_HBA_CAP / 4]), pi);
+
+  for (i = 0; i < 32; i++)
+    if (pi & (1U << i))
+      {
+	grub_ahci_device_initialize (hba, i);
+
+	/* Errors only mean this port is unusable.  */
+	if (grub_errno)
+	  {
+	    grub_print_error ();
+	    grub_errno = GRUB_ERR_NONE;
+	  }
+      }
+
+  return 0;
+}
+
+static grub_err_t
+grub_ahci_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_size_t size, char *buf, int rw)
+{
+  struct grub_ahci_device *dev = (struct grub_ahci_device *) disk->data;
+  grub_size_t maxbatch;
+  char *bounce = 0;
+  int cmd;
+
+  if (dev->lba48)
+    {
+      maxbatch = 65535;
+      cmd = rw ? GRUB_ATA_CMD_WRITE_DMA_EXT : GRUB_ATA_CMD_READ_DMA_EXT;
+    }
+  else
+    {
+      maxbatch = 255;
+      cmd = rw ? GRUB_ATA_CMD_WRITE_DMA : GRUB_ATA_CMD_READ_DMA;
+    }
+
+  /* Buffers the HBA can't reach go through a bounce buffer.  */
+  if (! grub_ahci_dma_usable (buf, size * GRUB_DISK_SECTOR_SIZE))
+    {
+      maxbatch = 128;
+      bounce = grub_memalign (2, maxbatch * GRUB_DISK_SECTOR_SIZE);
+      if (! bounce)
+	return grub_errno;
+    }
+
+  while (size)
+    {
+      grub_size_t batch = size;
+      grub_size_t len;
+      char *p = bounce ? bounce : buf;
+
+      if (batch > maxbatch)
+	batch = maxbatch;
+      len = batch * GRUB_DISK_SECTOR_SIZE;
+
+      if (bounce && rw)
+	grub_memcpy (bounce, buf, len);
+
+      if (grub_ahci_command (dev, cmd, sector, batch, p, len, rw))
+	{
+	  grub_free (bounce);
+	  return grub_errno;
+	}
+
+      if (bounce && ! rw)
+	grub_memcpy (buf, bounce, len);
+
+      buf += len;
+      sector += batch;
+      size -= batch;
+    }
+
+  grub_free (bounce);
+
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_ahci_iterate (int (*hook) (const char *name, void *closure),
+		   void *closure)
+{
+  struct grub_ahci_device *dev;
+
+  for (dev = grub_ahci_devices; dev; dev = dev->next)
+    {
+      char devname[10];
+
+      grub_snprintf (devname, sizeof (devname), "ahci%d", dev->num);
+
+      if (hook (devname, closure))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_ahci_open (const char *name, grub_disk_t disk)
+{
+  struct grub_ahci_device *dev;
+
+  for (dev = grub_ahci_devices; dev; dev = dev->next)
+    {
+      char devname[10];
+
+      grub_snprintf (devname, sizeof (devname), "ahci%d", dev->num);
+      if (grub_strcmp (name, devname) == 0)
+	break;
+    }
+
+  if (! dev)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "can't open device");
+
+  disk->total_sectors = dev->size;
+  disk->id = (unsigned long) dev;
+  disk->has_partitions = 1;
+  disk->data = dev;
+
+  return 0;
+}
+
+static void
+grub_ahci_close (grub_disk_t disk __attribute__ ((unused)))
+{
+
+}
+
+static grub_err_t
+grub_ahci_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  return grub_ahci_readwrite (disk, sector, size, buf, 0);
+}
+
+static grub_err_t
+grub_ahci_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  return grub_ahci_readwrite (disk, sector, size, (char *) buf, 1);
+}
+
+static struct grub_disk_dev grub_ahci_dev =
+  {
+    .name = "AHCI",
+    .id = GRUB_DISK_DEVICE_AHCI_ID,
+    .iterate = grub_ahci_iterate,
+    .open = grub_ahci_open,
+    .close = grub_ahci_close,
+    .read = grub_ahci_read,
+    .write = grub_ahci_write,
+    .next = 0
+  };
+
+
+
+GRUB_MOD_INIT(ahci)
+{
+  /* To prevent two drivers operating on the same disks.  */
+  grub_disk_firmware_is_tainted = 1;
+  if (grub_disk_firmware_fini)
+    {
+      grub_disk_firmware_fini ();
+      grub_disk_firmware_fini = NULL;
+    }
+
+  grub_pci_iterate (grub_ahci_pciinit, 0);
+
+  grub_disk_dev_register (&grub_ahci_dev);
+}
+
+GRUB_MOD_FINI(ahci)
+{
+  struct grub_ahci_device *dev;
+
+  grub_disk_dev_unregister (&grub_ahci_dev);
+
+  /* Hand the ports back stopped, the HBA must not write into memory
+     that is reused.  */
+  while (grub_ahci_devices)
+    {
+      dev = grub_ahci_devices;
+      grub_ahci_devices = dev->next;
+      grub_ahci_port_stop (dev);
+      grub_errno = GRUB_ERR_NONE;
+      grub_ahci_free_device (dev);
+    }
+  grub_ahci_numdevs = 0;
+}
@@ -35,6 +35,20 @@ static const grub_port_t grub_ata_ioaddress2[] = { 0x3f6, 0x376 };
 
 static struct grub_ata_device *grub_ata_devices;
 
+/* Bus master DMA hands buffer addresses to the controller unchanged,
+   which is only correct where memory is identity mapped.  */
+#if defined (__i386__) || defined (__x86_64__)
+#define GRUB_ATA_USE_DMA	1
+#else
+#define GRUB_ATA_USE_DMA	0
+#endif
+
+/* Number of entries in a PRD table.  A transfer of N bytes needs at
+   most N / 64KiB + 1 of them.  */
+#define GRUB_ATA_PRD_COUNT	256
+#define GRUB_ATA_DMA_MAX_SECTORS \
+  ((GRUB_ATA_PRD_COUNT - 1) * (0x10000 / GRUB_DISK_SECTOR_SIZE))
+
 /* Wait for !BSY.  */
 grub_err_t
 grub_ata_wait_not_busy (struct grub_ata_device *dev, int milliseconds)
@@ -243,6 +257,70 @@ grub_atapi_packet (struct grub_ata_device *dev, char *packet,
   return GRUB_ERR_NONE;
 }
 
+/* Switch the device to transfer COUNT sectors per DRQ block.  */
+static void
+grub_ata_set_multiple (struct grub_ata_device *dev, int count)
+{
+  dev->multiple = 0;
+
+  /* Blocks of one sector are what READ SECTORS does anyway.  */
+  if (count <= 1)
+    return;
+
+  grub_ata_regset (dev, GRUB_ATA_REG_DISK, 0xE0 | dev->device << 4);
+  if (grub_ata_check_ready (dev))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_ata_regset (dev, GRUB_ATA_REG_SECTORS, count);
+  grub_ata_regset (dev, GRUB_ATA_REG_CMD, GRUB_ATA_CMD_SET_MULTIPLE_MODE);
+
+  if (grub_ata_wait_not_busy (dev, GRUB_ATA_TOUT_STD))
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if (grub_ata_regget (dev, GRUB_ATA_REG_STATUS) & GRUB_ATA_STATUS_ERR)
+    return;
+
+  dev->multiple = count;
+}
+
+/* Allocate the PRD table and mark the device as DMA capable.  */
+static void
+grub_ata_dma_init (struct grub_ata_device *dev)
+{
+  grub_port_t status = dev->bmaddress + GRUB_ATA_BM_STATUS;
+
+  /* The table may not cross a 64KiB boundary, aligning it to its
+     size ensures that.  */
+  dev->prd = grub_memalign (GRUB_ATA_PRD_COUNT * sizeof (struct grub_ata_prd),
+			    GRUB_ATA_PRD_COUNT * sizeof (struct grub_ata_prd));
+  if (! dev->prd)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if ((grub_uint64_t) dev->prd >> 32)
+    {
+      grub_free (dev->prd);
+      dev->prd = 0;
+      return;
+    }
+#endif
+
+  grub_outb ((grub_inb (status) & ~(GRUB_ATA_BM_STATUS_ERROR
+				    | GRUB_ATA_BM_STATUS_INTR))
+	     | (GRUB_ATA_BM_STATUS_DMA0 << dev->device), status);
+
+  dev->dma = 1;
+}
+
 static grub_err_t
 grub_ata_identify (struct grub_ata_device *dev)
 {
@@ -328,6 +406,19 @@ grub_ata_identify (struct grub_ata_device *dev)
   dev->heads = info16[3];
   dev->sectors_per_track = info16[6];
 
+  /* Use the largest DRQ block the device supports for PIO.  */
+  grub_ata_set_multiple (dev, info16[47] & 0xFF);
+
+  /* Only use DMA if the firmware left a DMA mode selected, so that the
+     controller timings are known to match the device.  */
+  if (GRUB_ATA_USE_DMA && dev->bmaddress
+      && (info16[49] & (1 << 8))
+      && (((info16[53] & (1 << 2)) && (info16[88] & 0x7F00))
+	  || (info16[63] & 0x0700)))
+    grub_ata_dma_init (dev);
+
+  grub_dprintf ("ata", "Multiple: %d, DMA: %d\n", dev->multiple, dev->dma);
+
   grub_ata_dumpinfo (dev, info);
 
   grub_free(info);
@@ -336,7 +427,8 @@ grub_ata_identify (struct grub_ata_device *dev)
 }
 
 static grub_err_t
-grub_ata_device_initialize (int port, int device, int addr, int addr2)
+grub_ata_device_initialize (int port, int device, int addr, int addr2,
+			    int bmaddr)
 {
   struct grub_ata_device *dev;
   struct grub_ata_device **devp;
@@ -344,7 +436,7 @@ grub_ata_device_initialize (int port, int device, int addr, int addr2)
   grub_dprintf ("ata", "detecting device %d,%d (0x%x, 0x%x)\n",
 		port, device, addr, addr2);
 
-  dev = grub_malloc (sizeof(*dev));
+  dev = grub_zalloc (sizeof(*dev));
   if (! dev)
     return grub_errno;
 
@@ -353,6 +445,8 @@ grub_ata_device_initialize (int port, int device, int addr, int addr2)
   dev->device = device;
   dev->ioaddress = addr + GRUB_MACHINE_PCI_IO_BASE;
   dev->ioaddress2 = addr2 + GRUB_MACHINE_PCI_IO_BASE;
+  if (bmaddr)
+    dev->bmaddress = bmaddr + GRUB_MACHINE_PCI_IO_BASE;
   dev->next = NULL;
 
   grub_ata_regset (dev, GRUB_ATA_REG_DISK, dev->device << 4);
@@ -400,6 +494,7 @@ grub_ata_pciinit (grub_pci_device_t dev, grub_pci_id_t pciid,
   grub_uint32_t class;
   grub_uint32_t bar1;
   grub_uint32_t bar2;
+  grub_uint32_t bar4 = 0;
   int rega;
   int regb;
   int i;
@@ -422,10 +517,31 @@ grub_ata_pciinit (grub_pci_device_t dev, grub_pci_id_t pciid,
   if (!cs5536 && (class >> 16 != 0x0101))
     return 0;
 
+  /* Find the bus master registers if the controller can do DMA, and
+     allow it to access memory.  */
+  if (GRUB_ATA_USE_DMA && !cs5536 && (class & (0x80 << 8)))
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG4);
+      bar4 = grub_pci_read (addr);
+
+      if (bar4 & 1)
+	{
+	  grub_uint16_t command;
+
+	  bar4 &= GRUB_PCI_ADDR_IO_MASK;
+	  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+	  command = grub_pci_read_word (addr);
+	  grub_pci_write_word (addr, command | 0x4);
+	}
+      else
+	bar4 = 0;
+    }
+
   for (i = 0; i < nports; i++)
     {
       /* Set to 0 when the channel operated in compatibility mode.  */
       int compat;
+      int regbm;
 
       /* We don't support non-compatibility mode for CS5536.  */
       if (cs5536)
@@ -464,15 +580,19 @@ grub_ata_pciinit (grub_pci_device_t dev, grub_pci_id_t pciid,
 	    }
 	}
 
+      regbm = bar4 ? bar4 + 8 * i : 0;
+
       grub_dprintf ("ata",
-		    "PCI dev (%d,%d,%d) compat=%d rega=0x%x regb=0x%x\n",
+		    "PCI dev (%d,%d,%d) compat=%d rega=0x%x regb=0x%x "
+		    "regbm=0x%x\n",
 		    grub_pci_get_bus (dev), grub_pci_get_device (dev),
-		    grub_pci_get_function (dev), compat, rega, regb);
+		    grub_pci_get_function (dev), compat, rega, regb, regbm);
 
       if (rega && regb)
 	{
 	  grub_errno = GRUB_ERR_NONE;
-	  grub_ata_device_initialize (controller * 2 + i, 0, rega, regb);
+	  grub_ata_device_initialize (controller * 2 + i, 0, rega, regb,
+				      regbm);
 
 	  /* Most errors raised by grub_ata_device_initialize() are harmless.
 	     They just indicate this particular drive is not responding, most
@@ -484,7 +604,8 @@ grub_ata_pciinit (grub_pci_device_t dev, grub_pci_id_t pciid,
 	      grub_errno = GRUB_ERR_NONE;
 	    }
 
-	  grub_ata_device_initialize (controller * 2 + i, 1, rega, regb);
+	  grub_ata_device_initialize (controller * 2 + i, 1, rega, regb,
+				      regbm);
 
 	  /* Likewise.  */
 	  if (grub_errno)
@@ -585,6 +706,115 @@ grub_ata_setaddress (struct grub_ata_device *dev,
   return GRUB_ERR_NONE;
 }
 
+/* Check that the controller can transfer SIZE bytes at BUF.  */
+static int
+grub_ata_dma_usable (char *buf, grub_size_t size)
+{
+  grub_addr_t addr = (grub_addr_t) buf;
+
+  /* PRD entries must start on an even address.  */
+  if (addr & 1)
+    return 0;
+
+#if GRUB_CPU_SIZEOF_VOID_P == 8
+  if ((grub_uint64_t) (addr + size) >> 32)
+    return 0;
+#else
+  (void) size;
+#endif
+
+  return 1;
+}
+
+/* Describe the SIZE bytes at BUF in the PRD table and prepare the bus
+   master for the transfer.  */
+static void
+grub_ata_dma_setup (struct grub_ata_device *dev, char *buf,
+		    grub_size_t size, int rw)
+{
+  struct grub_ata_prd *prd = dev->prd;
+  grub_uint32_t addr = (grub_uint32_t) (grub_addr_t) buf;
+  grub_port_t status = dev->bmaddress + GRUB_ATA_BM_STATUS;
+
+  while (size)
+    {
+      grub_uint32_t len;
+
+      /* An entry may not cross a 64KiB boundary.  */
+      len = 0x10000 - (addr & 0xFFFF);
+      if (len > size)
+	len = size;
+
+      prd->addr = grub_cpu_to_le32 (addr);
+      prd->size = grub_cpu_to_le16 (len & 0xFFFF);
+      size -= len;
+      addr += len;
+      prd->flags = grub_cpu_to_le16 (size ? 0 : GRUB_ATA_PRD_EOT);
+      prd++;
+    }
+
+  grub_outl ((grub_uint32_t) (grub_addr_t) dev->prd,
+	     dev->bmaddress + GRUB_ATA_BM_PRD);
+  grub_outb (rw ? 0 : GRUB_ATA_BM_CMD_TO_MEM,
+	     dev->bmaddress + GRUB_ATA_BM_CMD);
+  grub_outb (grub_inb (status) | GRUB_ATA_BM_STATUS_ERROR
+	     | GRUB_ATA_BM_STATUS_INTR, status);
+}
+
+/* Start the bus master after the command was issued and wait until the
+   transfer is done.  */
+static grub_err_t
+grub_ata_dma_wait (struct grub_ata_device *dev, int rw)
+{
+  grub_port_t cmd = dev->bmaddress + GRUB_ATA_BM_CMD;
+  grub_port_t status = dev->bmaddress + GRUB_ATA_BM_STATUS;
+  grub_uint8_t dir = rw ? 0 : GRUB_ATA_BM_CMD_TO_MEM;
+  grub_uint64_t limit;
+  grub_uint8_t bmsts;
+  grub_uint8_t sts;
+
+  grub_outb (dir | GRUB_ATA_BM_CMD_START, cmd);
+
+  /* Interrupts are not used, but the controller still latches the
+     interrupt bit when the device is done.  */
+  limit = grub_get_time_ms () + GRUB_ATA_TOUT_DATA;
+  while (1)
+    {
+      bmsts = grub_inb (status);
+      if (! (bmsts & GRUB_ATA_BM_STATUS_ACTIVE)
+	  || (bmsts & GRUB_ATA_BM_STATUS_INTR))
+	break;
+
+      if (grub_get_time_ms () > limit)
+	{
+	  grub_outb (dir, cmd);
+	  grub_dprintf ("ata", "DMA timeout, bus master status=0x%x\n", bmsts);
+	  return grub_error (GRUB_ERR_TIMEOUT, "ATA DMA timeout");
+	}
+    }
+
+  grub_outb (dir, cmd);
+  grub_outb (bmsts | GRUB_ATA_BM_STATUS_ERROR | GRUB_ATA_BM_STATUS_INTR,
+	     status);
+
+  if (grub_ata_wait_not_busy (dev, GRUB_ATA_TOUT_DATA))
+    return grub_errno;
+
+  sts = grub_ata_regget (dev, GRUB_ATA_REG_STATUS);
+  if ((bmsts & GRUB_ATA_BM_STATUS_ERROR)
+      || (sts & (GRUB_ATA_STATUS_DRQ | GRUB_ATA_STATUS_ERR)))
+    {
+      grub_dprintf ("ata", "DMA error: status=0x%x, bus master status=0x%x\n",
+		    sts, bmsts);
+      if (! rw)
+	return grub_error (GRUB_ERR_READ_ERROR, "ATA read error");
+      else
+	return grub_error (GRUB_ERR_WRITE_ERROR, "ATA write error");
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf, int rw)
@@ -594,69 +824,129 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   grub_dprintf("ata", "grub_ata_readwrite (size=%llu, rw=%d)\n", (unsigned long long) size, rw);
 
   grub_ata_addressing_t addressing = dev->addr;
-  grub_size_t batch;
-  int cmd, cmd_write;
+  grub_size_t maxbatch;
+  int ext;
+  grub_uint64_t start = grub_get_time_ms ();
 
   if (addressing == GRUB_ATA_LBA48 && ((sector + size) >> 28) != 0)
     {
-      batch = 65536;
-      cmd = GRUB_ATA_CMD_READ_SECTORS_EXT;
-      cmd_write = GRUB_ATA_CMD_WRITE_SECTORS_EXT;
+      maxbatch = 65536;
+      ext = 1;
     }
   else
     {
       if (addressing == GRUB_ATA_LBA48)
 	addressing = GRUB_ATA_LBA;
-      batch = 256;
-      cmd = GRUB_ATA_CMD_READ_SECTORS;
-      cmd_write = GRUB_ATA_CMD_WRITE_SECTORS;
+      maxbatch = 256;
+      ext = 0;
     }
 
   grub_size_t nsectors = 0;
   while (nsectors < size)
     {
+      grub_size_t batch = maxbatch;
+      int dma;
+      int cmd;
+
       if (size - nsectors < batch)
 	batch = size - nsectors;
 
-      grub_dprintf("ata", "rw=%d, sector=%llu, batch=%llu\n", rw, (unsigned long long) sector, (unsigned long long) batch);
+      dma = (dev->dma
+	     && grub_ata_dma_usable (buf, batch * GRUB_DISK_SECTOR_SIZE));
+      if (dma && batch > GRUB_ATA_DMA_MAX_SECTORS)
+	batch = GRUB_ATA_DMA_MAX_SECTORS;
+
+      if (dma)
+	cmd = (! rw ? (ext ? GRUB_ATA_CMD_READ_DMA_EXT
+		       : GRUB_ATA_CMD_READ_DMA)
+	       : (ext ? GRUB_ATA_CMD_WRITE_DMA_EXT
+		  : GRUB_ATA_CMD_WRITE_DMA));
+      else if (dev->multiple)
+	cmd = (! rw ? (ext ? GRUB_ATA_CMD_READ_MULTIPLE_EXT
+		       : GRUB_ATA_CMD_READ_MULTIPLE)
+	       : (ext ? GRUB_ATA_CMD_WRITE_MULTIPLE_EXT
+		  : GRUB_ATA_CMD_WRITE_MULTIPLE));
+      else
+	cmd = (! rw ? (ext ? GRUB_ATA_CMD_READ_SECTORS_EXT
+		       : GRUB_ATA_CMD_READ_SECTORS)
+	       : (ext ? GRUB_ATA_CMD_WRITE_SECTORS_EXT
+		  : GRUB_ATA_CMD_WRITE_SECTORS));
+
+      grub_dprintf("ata", "rw=%d, sector=%llu, batch=%llu, dma=%d\n", rw, (unsigned long long) sector, (unsigned long long) batch, dma);
 
       /* Send read/write command.  */
       if (grub_ata_setaddress (dev, addressing, sector, batch))
 	return grub_errno;
 
-      grub_ata_regset (dev, GRUB_ATA_REG_CMD, (! rw ? cmd : cmd_write));
+      if (dma)
+	grub_ata_dma_setup (dev, buf, batch * GRUB_DISK_SECTOR_SIZE, rw);
 
-      unsigned sect;
-      for (sect = 0; sect < batch; sect++)
-	{
-	  /* Wait for !BSY, DRQ.  */
-	  if (grub_ata_wait_drq (dev, rw, GRUB_ATA_TOUT_DATA))
-	    return grub_errno;
+      grub_ata_regset (dev, GRUB_ATA_REG_CMD, cmd);
 
-	  /* Transfer data.  */
-	  if (! rw)
-	    grub_ata_pio_read (dev, buf, GRUB_DISK_SECTOR_SIZE);
-	  else
-	    grub_ata_pio_write (dev, buf, GRUB_DISK_SECTOR_SIZE);
+      if (dma)
+	{
+	  if (grub_ata_dma_wait (dev, rw))
+	    {
+	      /* Fall back to PIO for this and all later transfers.  */
+	      grub_print_error ();
+	      grub_errno = GRUB_ERR_NONE;
+	      dev->dma = 0;
+	      continue;
+	    }
 
-	  buf += GRUB_DISK_SECTOR_SIZE;
+	  buf += batch * GRUB_DISK_SECTOR_SIZE;
 	}
+      else
+	{
+	  grub_size_t sect = 0;
 
-      if (rw)
-        {
-	  /* Check for write error.  */
-	  if (grub_ata_wait_not_busy (dev, GRUB_ATA_TOUT_DATA))
-	    return grub_errno;
+	  while (sect < batch)
+	    {
+	      grub_size_t count = 1;
+
+	      /* READ and WRITE MULTIPLE transfer a whole block for each
+		 DRQ, only the last one may be shorter.  */
+	      if (dev->multiple)
+		{
+		  count = batch - sect;
+		  if (count > (grub_size_t) dev->multiple)
+		    count = dev->multiple;
+		}
+
+	      /* Wait for !BSY, DRQ.  */
+	      if (grub_ata_wait_drq (dev, rw, GRUB_ATA_TOUT_DATA))
+		return grub_errno;
+
+	      /* Transfer data.  */
+	      if (! rw)
+		grub_ata_pio_read (dev, buf, count * GRUB_DISK_SECTOR_SIZE);
+	      else
+		grub_ata_pio_write (dev, buf, count * GRUB_DISK_SECTOR_SIZE);
+
+	      buf += count * GRUB_DISK_SECTOR_SIZE;
+	      sect += count;
+	    }
+
+	  if (rw)
+	    {
+	      /* Check for write error.  */
+	      if (grub_ata_wait_not_busy (dev, GRUB_ATA_TOUT_DATA))
+		return grub_errno;
 
-	  if (grub_ata_regget (dev, GRUB_ATA_REG_STATUS)
-	      & (GRUB_ATA_STATUS_DRQ | GRUB_ATA_STATUS_ERR))
-	    return grub_error (GRUB_ERR_WRITE_ERROR, "ATA write error");
+	      if (grub_ata_regget (dev, GRUB_ATA_REG_STATUS)
+		  & (GRUB_ATA_STATUS_DRQ | GRUB_ATA_STATUS_ERR))
+		return grub_error (GRUB_ERR_WRITE_ERROR, "ATA write error");
+	    }
 	}
 
       sector += batch;
       nsectors += batch;
     }
 
+  grub_dprintf ("ata", "%s %llu sectors in %llu ms\n",
+		rw ? "wrote" : "read", (unsigned long long) size,
+		(unsigned long long) (grub_get_time_ms () - start));
+
   return GRUB_ERR_NONE;
 }
 
@@ -34,11 +34,89 @@ static int cd_drive = -1;
 
 #define GRUB_BIOSDISK_MAX_SECTORS	0x7f
 
+/* The disk address packet lives right after the data in the scratch
+   area.  */
+#define GRUB_BIOSDISK_DAP_ADDR	(GRUB_MEMORY_MACHINE_SCRATCH_ADDR \
+				 + (GRUB_BIOSDISK_MAX_SECTORS \
+				    << GRUB_DISK_SECTOR_BITS))
+
+/* Buffers below this address can be passed as SEGMENT:ADDRESS.  */
+#define GRUB_BIOSDISK_REAL_LIMIT	0x100000
+
+/* Where a BIOS ignoring the flat address puts the data, taking the
+   buffer 0xFFFF:0xFFFF literally.  */
+#define GRUB_BIOSDISK_FLAT_ALIAS	(0xffff0 + 0xffff)
+
 #define DISK_NUM_INC	4
 
 struct grub_biosdisk_data *grub_biosdisk_geom;
 int grub_biosdisk_num;
 
+static int
+grub_biosdisk_real_addressable (grub_addr_t addr, grub_size_t size)
+{
+  return (addr < GRUB_BIOSDISK_REAL_LIMIT
+	  && size <= GRUB_BIOSDISK_REAL_LIMIT - addr);
+}
+
+/* Some BIOSes advertise the EDD 3.0 64-bit extensions without honouring
+   the flat buffer address, so check that reading the first block through
+   it gives the same data as reading it into the scratch area.  Such a
+   BIOS writes the block over GRUB_BIOSDISK_FLAT_ALIAS, so that memory is
+   saved and restored around the probe.  */
+static int
+grub_biosdisk_check_flat (int drive, grub_size_t block_size)
+{
+  struct grub_biosdisk_dap *dap;
+  grub_uint8_t *scratch = (grub_uint8_t *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
+  grub_uint8_t *alias = (grub_uint8_t *) GRUB_BIOSDISK_FLAT_ALIAS;
+  grub_uint8_t *buf, *saved;
+  grub_size_t i;
+  int ret = 0;
+
+  buf = grub_malloc (2 * block_size);
+  if (! buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+  saved = buf + block_size;
+
+  /* Neither buffer may be clobbered by the read it is meant to catch.  */
+  if ((grub_addr_t) buf < GRUB_BIOSDISK_FLAT_ALIAS + block_size
+      && (grub_addr_t) buf + 2 * block_size > GRUB_BIOSDISK_FLAT_ALIAS)
+    goto out;
+
+  dap = (struct grub_biosdisk_dap *) GRUB_BIOSDISK_DAP_ADDR;
+  dap->length = GRUB_BIOSDISK_DAP_SIZE;
+  dap->reserved = 0;
+  dap->blocks = 1;
+  dap->buffer = GRUB_MEMORY_MACHINE_SCRATCH_SEG << 16;
+  dap->block = 0;
+  if (grub_biosdisk_rw_int13_extensions (0x42, drive, dap))
+    goto out;
+
+  /* Make sure the comparison can't succeed unless the BIOS wrote BUF.  */
+  for (i = 0; i < block_size; i++)
+    buf[i] = ~scratch[i];
+
+  dap->length = GRUB_BIOSDISK_DAP_FLAT_SIZE;
+  dap->blocks = 1;
+  dap->buffer = 0xffffffff;
+  dap->block = 0;
+  dap->flat_buffer = (grub_addr_t) buf;
+  grub_memcpy (saved, alias, block_size);
+  if (! grub_biosdisk_rw_int13_extensions (0x42, drive, dap))
+    ret = ! grub_memcmp (buf, scratch, block_size);
+  grub_memcpy (alias, saved, block_size);
+
+ out:
+  grub_dprintf ("biosdisk", "drive 0x%x: flat addressing %s\n", drive,
+		ret ? "enabled" : "disabled");
+  grub_free (buf);
+  return ret;
+}
+
 static struct grub_biosdisk_data *
 get_drive_geom (int drive)
 {
@@ -79,9 +157,18 @@ get_drive_geom (int drive)
 
   if (drive == cd_drive)
     {
+      int version;
+
       data->flags = GRUB_BIOSDISK_FLAG_LBA | GRUB_BIOSDISK_FLAG_CDROM;
       data->max_sectors = data->sectors = 32;
+      data->chunk_sectors = data->max_sectors;
       data->total_sectors = GRUB_ULONG_MAX;  /* TODO: get the correct size.  */
+
+      version = grub_biosdisk_check_int13_extensions (drive);
+      if ((version & 0xff) >= 0x30
+	  && (version & (GRUB_BIOSDISK_EXT_64BIT << 8))
+	  && grub_biosdisk_check_flat (drive, 4 << GRUB_DISK_SECTOR_BITS))
+	data->flags |= GRUB_BIOSDISK_FLAG_FLAT;
       return data;
     }
 
@@ -104,6 +191,11 @@ get_drive_geom (int drive)
 	    {
 	      data->flags = GRUB_BIOSDISK_FLAG_LBA;
 
+	      /* EDD 3.0 can transfer to any address, checked below.  */
+	      if ((version & 0xff) >= 0x30
+		  && (version & (GRUB_BIOSDISK_EXT_64BIT << 8)))
+		data->flags |= GRUB_BIOSDISK_FLAG_FLAT;
+
 	      if (drp->cylinders == 65535)
 		total_sectors = GRUB_ULONG_MAX;
 	      else if (drp->total_sectors)
@@ -190,6 +282,13 @@ get_drive_geom (int drive)
     total_sectors = cylinders;
 
   data->total_sectors = total_sectors;
+  data->chunk_sectors = data->max_sectors;
+
+  if ((data->flags & GRUB_BIOSDISK_FLAG_FLAT)
+      && ! ((data->flags & GRUB_BIOSDISK_FLAG_LBA)
+	    && grub_biosdisk_check_flat (drive, GRUB_DISK_SECTOR_SIZE)))
+    data->flags &= ~GRUB_BIOSDISK_FLAG_FLAT;
+
   return data;
 }
 
@@ -300,25 +399,44 @@ grub_biosdisk_open (const char *name, grub_disk_t disk)
 
 #define GRUB_BIOSDISK_CDROM_RETRY_COUNT 3
 
+/* Number of attempts at one transfer size before it is halved.  */
+#define GRUB_BIOSDISK_RETRY_COUNT	2
+
+/* Number of good transfers after which a shrunk transfer size is
+   doubled again.  */
+#define GRUB_BIOSDISK_GROW_AFTER	16
+
 static grub_err_t
 grub_biosdisk_rw (int cmd, grub_disk_t disk,
 		  grub_disk_addr_t sector, grub_size_t size,
-		  unsigned segment)
+		  grub_addr_t addr)
 {
   struct grub_biosdisk_data *data = disk->data;
 
   if (data->flags & GRUB_BIOSDISK_FLAG_LBA)
     {
       struct grub_biosdisk_dap *dap;
+      grub_size_t bytes = size << GRUB_DISK_SECTOR_BITS;
 
-      dap = (struct grub_biosdisk_dap *) (GRUB_MEMORY_MACHINE_SCRATCH_ADDR
-					  + (GRUB_BIOSDISK_MAX_SECTORS
-					     << GRUB_DISK_SECTOR_BITS));
-      dap->length = sizeof (*dap);
+      if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
+	bytes = ALIGN_UP (size, 4) << GRUB_DISK_SECTOR_BITS;
+
+      dap = (struct grub_biosdisk_dap *) GRUB_BIOSDISK_DAP_ADDR;
       dap->reserved = 0;
       dap->blocks = size;
-      dap->buffer = segment << 16;	/* The format SEGMENT:ADDRESS.  */
       dap->block = sector;
+      if (grub_biosdisk_real_addressable (addr, bytes))
+	{
+	  dap->length = GRUB_BIOSDISK_DAP_SIZE;
+	  /* The format SEGMENT:ADDRESS.  */
+	  dap->buffer = ((addr >> 4) << 16) | (addr & 0xf);
+	}
+      else
+	{
+	  dap->length = GRUB_BIOSDISK_DAP_FLAT_SIZE;
+	  dap->buffer = 0xffffffff;
+	  dap->flat_buffer = addr;
+	}
 
       if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
         {
@@ -350,58 +468,99 @@ grub_biosdisk_rw (int cmd, grub_disk_t disk,
 	  63 /* spt */)
 	return grub_error (GRUB_ERR_OUT_OF_RANGE, "%s out of disk", disk->name);
 
+      /* The buffer is passed as a bare segment.  */
+      if ((addr & 0xf) != 0
+	  || ! grub_biosdisk_real_addressable (addr,
+					       size << GRUB_DISK_SECTOR_BITS))
+	return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			   "buffer not addressable by %s", disk->name);
+
       soff = ((grub_uint32_t) sector) % data->sectors + 1;
       head = ((grub_uint32_t) sector) / data->sectors;
       hoff = head % data->heads;
       coff = head / data->heads;
 
       return grub_biosdisk_rw_standard (cmd + 0x02, data->drive,
-					coff, hoff, soff, size, segment);
+					coff, hoff, soff, size, addr >> 4);
     }
 
   return GRUB_ERR_NONE;
 }
 
+/* Transfer up to SIZE sectors at SECTOR from or to ADDR and return the
+   number of sectors done, or zero on error.  A failing transfer is retried
+   and then halved; the size grows back once the BIOS behaves again.  If
+   DIRECT is set, ADDR is the caller's buffer, which the caller reads again
+   through the scratch buffer on failure, so the transfer is tried once and
+   the size left alone.  */
 static grub_size_t
 grub_biosdisk_safe_rw (int cmd, grub_disk_t disk,
 		       grub_disk_addr_t sector, grub_size_t size,
-		       unsigned segment)
+		       grub_addr_t addr, int direct)
 {
   struct grub_biosdisk_data *data = disk->data;
-  grub_size_t len = size;
-  grub_size_t max = data->max_sectors;
+  grub_size_t len;
+  grub_size_t min;
   grub_uint32_t chs_max;
+  int tries = 0;
+
+  /* CDROM transfers are done in whole 2048-byte sectors.  */
+  min = (data->flags & GRUB_BIOSDISK_FLAG_CDROM) ? 4 : 1;
 
   grub_divmod64 (sector, data->sectors, &chs_max);
   chs_max = data->sectors - chs_max;
   while (1)
     {
+      len = size;
       if (((data->flags & GRUB_BIOSDISK_FLAG_LBA) == 0) && (len > chs_max))
 	len = chs_max;
 
-      if (len > max)
-	len = max;
+      if (len > data->chunk_sectors)
+	len = data->chunk_sectors;
 
-      if (! grub_biosdisk_rw (cmd, disk, sector, len, segment))
+      if (! grub_biosdisk_rw (cmd, disk, sector, len, addr))
 	{
-	  data->max_sectors = max;
+	  if (data->chunk_sectors < data->max_sectors
+	      && ++data->good_transfers >= GRUB_BIOSDISK_GROW_AFTER)
+	    {
+	      data->chunk_sectors <<= 1;
+	      if (data->chunk_sectors > data->max_sectors)
+		data->chunk_sectors = data->max_sectors;
+	      data->good_transfers = 0;
+	    }
 	  return len;
 	}
 
       if (grub_errno)
 	break;
 
-      if (len > 63)
-	max = 63;
-      else if (len > 7)
-	max = 7;
-      else if (len > 1)
-	max = 1;
-      else if (data->flags & GRUB_BIOSDISK_FLAG_LBA)
+      grub_biosdisk_reset (data->drive);
+      data->good_transfers = 0;
+
+      if (direct)
+	break;
+
+      if (++tries < GRUB_BIOSDISK_RETRY_COUNT)
+	continue;
+      tries = 0;
+
+      if (len > min)
+	{
+	  data->chunk_sectors = (len >> 1) & ~(min - 1);
+	  if (data->chunk_sectors < min)
+	    data->chunk_sectors = min;
+	  grub_dprintf ("biosdisk", "%s: transfer size reduced to %lu\n",
+			disk->name, (unsigned long) data->chunk_sectors);
+	}
+      else if ((data->flags & GRUB_BIOSDISK_FLAG_LBA)
+	       && ! (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
+	       && ! (addr & 0xf)
+	       && grub_biosdisk_real_addressable (addr,
+						  len << GRUB_DISK_SECTOR_BITS))
 	{
 	  /* Fall back to the CHS mode.  */
 	  data->flags &= ~GRUB_BIOSDISK_FLAG_LBA;
-	  max = data->max_sectors;
+	  data->chunk_sectors = data->max_sectors;
 	}
       else
 	{
@@ -411,12 +570,45 @@ grub_biosdisk_safe_rw (int cmd, grub_disk_t disk,
 	    grub_error (GRUB_ERR_WRITE_ERROR, "%s write error", disk->name);
 	  break;
 	}
-      grub_biosdisk_reset (data->drive);
     }
 
   return 0;
 }
 
+/* Return how many of the SIZE sectors at SECTOR can be read straight into
+   BUF, or zero if they have to go through the scratch buffer.  */
+static grub_size_t
+grub_biosdisk_direct_len (struct grub_biosdisk_data *data,
+			  grub_disk_addr_t sector, grub_size_t size,
+			  char *buf)
+{
+  grub_addr_t addr = (grub_addr_t) buf;
+
+  if (size > data->max_sectors)
+    size = data->max_sectors;
+
+  if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
+    {
+      if (sector & 3)
+	return 0;
+      size &= ~3;
+    }
+
+  if (! size)
+    return 0;
+
+  if (grub_biosdisk_real_addressable (addr, size << GRUB_DISK_SECTOR_BITS))
+    {
+      if ((data->flags & GRUB_BIOSDISK_FLAG_LBA) || ! (addr & 0xf))
+	return size;
+    }
+  else if ((data->flags & GRUB_BIOSDISK_FLAG_LBA)
+	   && (data->flags & GRUB_BIOSDISK_FLAG_FLAT))
+    return size;
+
+  return 0;
+}
+
 static grub_err_t
 grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
@@ -427,6 +619,25 @@ grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
     {
       grub_size_t len;
       grub_size_t cdoff = 0;
+      int direct_failed = 0;
+
+      len = grub_biosdisk_direct_len (data, sector, size, buf);
+      if (len)
+	{
+	  len = grub_biosdisk_safe_rw (GRUB_BIOSDISK_READ, disk, sector, len,
+				       (grub_addr_t) buf, 1);
+	  if (len)
+	    {
+	      buf += len << GRUB_DISK_SECTOR_BITS;
+	      sector += len;
+	      size -= len;
+	      continue;
+	    }
+
+	  /* Try again through the scratch buffer before giving up.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  direct_failed = 1;
+	}
 
       len = size;
       if (data->flags & GRUB_BIOSDISK_FLAG_CDROM)
@@ -437,10 +648,23 @@ grub_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 	}
 
       len = grub_biosdisk_safe_rw (GRUB_BIOSDISK_READ, disk, sector, len,
-				   GRUB_MEMORY_MACHINE_SCRATCH_SEG);
+				   GRUB_MEMORY_MACHINE_SCRATCH_ADDR, 0);
       if (! len)
 	break;
 
+      /* The scratch buffer works where the flat address didn't, so the
+	 BIOS doesn't really implement it.  */
+      if (direct_failed && (data->flags & GRUB_BIOSDISK_FLAG_FLAT)
+	  && ! grub_biosdisk_real_addressable ((grub_addr_t) buf,
+					       len << GRUB_DISK_SECTOR_BITS))
+	{
+	  grub_dprintf ("biosdisk", "%s: flat addressing disabled\n",
+			disk->name);
+	  data->flags &= ~GRUB_BIOSDISK_FLAG_FLAT;
+	}
+
+      len -= cdoff >> GRUB_DISK_SECTOR_BITS;
+      sector += cdoff >> GRUB_DISK_SECTOR_BITS;
       if (len > size)
 	len = size;
 
@@ -466,7 +690,7 @@ grub_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
   while (size)
     {
       grub_size_t len;
-      unsigned seg;
+      grub_addr_t addr;
 
       len = (size > GRUB_BIOSDISK_MAX_SECTORS) ?
 	GRUB_BIOSDISK_MAX_SECTORS : size;
@@ -476,18 +700,18 @@ grub_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
       buf += len << GRUB_DISK_SECTOR_BITS;
       size -= len;
 
-      seg = GRUB_MEMORY_MACHINE_SCRATCH_SEG;
+      addr = GRUB_MEMORY_MACHINE_SCRATCH_ADDR;
       while (len)
 	{
 	  grub_size_t ret;
 
 	  ret = grub_biosdisk_safe_rw (GRUB_BIOSDISK_WRITE, disk, sector, len,
-				       seg);
+				       addr, 0);
 	  if (! ret)
 	    return grub_errno;
 	  len -= ret;
 	  sector += ret;
-	  seg += ret << (GRUB_DISK_SECTOR_BITS - 4);
+	  addr += ret << GRUB_DISK_SECTOR_BITS;
 	}
     }
 
@@ -418,8 +418,10 @@ grub_affs_open (struct grub_file *file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_affs_iterate_dir, 0,
-			 grub_affs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				grub_affs_iterate_dir, 0,
+				grub_affs_read_symlink, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -505,8 +507,10 @@ grub_affs_dir (grub_device_t device, const char *path,
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_affs_iterate_dir, 0,
-			 grub_affs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				grub_affs_iterate_dir, 0,
+				grub_affs_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
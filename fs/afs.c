@@ -565,8 +565,10 @@ grub_afs_open (struct grub_file *file, const char *name)
   if (! data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_afs_iterate_dir, 0,
-			 grub_afs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				grub_afs_iterate_dir, 0, grub_afs_read_symlink,
+				GRUB_FSHELP_REG, data->disk,
+				sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -649,8 +651,10 @@ grub_afs_dir (grub_device_t device, const char *path,
   if (! data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_afs_iterate_dir, 0,
-			 grub_afs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				grub_afs_iterate_dir, 0, grub_afs_read_symlink,
+				GRUB_FSHELP_DIR, data->disk,
+				sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
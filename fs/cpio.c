@@ -23,6 +23,10 @@
 #include <grub/disk.h>
 #include <grub/dl.h>
 
+#define ATTR_TYPE	0170000
+#define ATTR_DIR	0040000
+#define ATTR_REG	0100000
+
 #ifndef MODE_USTAR
 /* cpio support */
 #define	MAGIC_BCPIO	070707
@@ -42,6 +46,52 @@ struct head
   grub_uint16_t filesize_1;
   grub_uint16_t filesize_2;
 } __attribute__ ((packed));
+
+/* The portable ASCII format, with octal numbers.  */
+#define MAGIC_ODC	"070707"
+struct head_odc
+{
+  char magic[6];
+  char dev[6];
+  char ino[6];
+  char mode[6];
+  char uid[6];
+  char gid[6];
+  char nlink[6];
+  char rdev[6];
+  char mtime[11];
+  char namesize[6];
+  char filesize[11];
+} __attribute__ ((packed));
+
+/* The new ASCII format, with hexadecimal numbers, as used by
+   initramfs.  */
+#define MAGIC_NEWC	"070701"
+#define MAGIC_NEWC_CRC	"070702"
+struct head_newc
+{
+  char magic[6];
+  char ino[8];
+  char mode[8];
+  char uid[8];
+  char gid[8];
+  char nlink[8];
+  char mtime[8];
+  char filesize[8];
+  char devmajor[8];
+  char devminor[8];
+  char rdevmajor[8];
+  char rdevminor[8];
+  char namesize[8];
+  char check[8];
+} __attribute__ ((packed));
+
+enum grub_cpio_format
+  {
+    GRUB_CPIO_BIN,
+    GRUB_CPIO_ODC,
+    GRUB_CPIO_NEWC
+  };
 #else
 /* tar support */
 #define MAGIC_USTAR	"ustar"
@@ -66,16 +116,173 @@ struct head
 } __attribute__ ((packed));
 #endif
 
+/* A member of the archive.  NAME has no leading, trailing or duplicate
+   slashes.  */
+struct grub_cpio_entry
+{
+  char *name;
+  grub_off_t dofs;
+  grub_off_t size;
+  grub_uint32_t mode;
+  /* The target of a hard link, whose data isn't stored again.  */
+  char *link;
+};
+
+/* The members of an archive, sorted by name.  It is read once per mount
+   and shared by all the files opened on it.  */
 struct grub_cpio_data
 {
+  struct grub_cpio_entry *entries;
+  int count;
+};
+
+/* An opened member.  */
+struct grub_cpio_file
+{
+  struct grub_cpio_data *data;
   grub_disk_t disk;
-  grub_uint32_t hofs;
-  grub_uint32_t dofs;
-  grub_uint32_t size;
+  grub_off_t dofs;
 };
 
 static grub_dl_t my_mod;
 
+static struct grub_fs grub_cpio_fs;
+
+/* Return a copy of NAME without leading, trailing or duplicate slashes
+   and without "." components.  There is room left to append a slash.  */
+static char *
+grub_cpio_canonicalize (const char *name, grub_size_t len)
+{
+  const char *end = name + len;
+  char *ret, *q;
+
+  ret = q = grub_malloc (len + 2);
+  if (! ret)
+    return 0;
+
+  while (name < end && *name)
+    {
+      if (*name == '/')
+	{
+	  name++;
+	  continue;
+	}
+
+      if (name[0] == '.' && (name + 1 == end || name[1] == '/' || ! name[1]))
+	{
+	  name++;
+	  continue;
+	}
+
+      if (q != ret)
+	*q++ = '/';
+      while (name < end && *name && *name != '/')
+	*q++ = *name++;
+    }
+  *q = '\0';
+
+  return ret;
+}
+
+/* Compare the names A and B so that the members of a directory follow
+   it, before any other name which starts with the same characters.  */
+static int
+grub_cpio_cmp (const char *a, const char *b)
+{
+  unsigned char ca, cb;
+
+  while (*a && *a == *b)
+    {
+      a++;
+      b++;
+    }
+
+  ca = (*a == '/') ? 1 : (unsigned char) *a;
+  cb = (*b == '/') ? 1 : (unsigned char) *b;
+  return (int) ca - (int) cb;
+}
+
+/* Return the index of the first member whose name is not lower than
+   NAME.  */
+static int
+grub_cpio_lookup (struct grub_cpio_data *data, const char *name)
+{
+  int low = 0, high = data->count;
+
+  while (low < high)
+    {
+      int mid = (low + high) / 2;
+
+      if (grub_cpio_cmp (data->entries[mid].name, name) < 0)
+	low = mid + 1;
+      else
+	high = mid;
+    }
+
+  return low;
+}
+
+/* Sort the COUNT members in ENTRIES by name, keeping the order of the
+   archive for duplicate names.  */
+static grub_err_t
+grub_cpio_sort (struct grub_cpio_entry *entries, int count)
+{
+  struct grub_cpio_entry *tmp, *src, *dst;
+  int width;
+
+  tmp = grub_malloc (count * sizeof (*tmp));
+  if (! tmp)
+    return grub_errno;
+
+  src = entries;
+  dst = tmp;
+  for (width = 1; width < count; width *= 2)
+    {
+      struct grub_cpio_entry *t;
+      int i;
+
+      for (i = 0; i < count; i += 2 * width)
+	{
+	  int l = i, r = i + width, k = i;
+	  int lend = (i + width < count) ? i + width : count;
+	  int rend = (i + 2 * width < count) ? i + 2 * width : count;
+
+	  while (l < lend && r < rend)
+	    {
+	      if (grub_cpio_cmp (src[r].name, src[l].name) < 0)
+		dst[k++] = src[r++];
+	      else
+		dst[k++] = src[l++];
+	    }
+	  while (l < lend)
+	    dst[k++] = src[l++];
+	  while (r < rend)
+	    dst[k++] = src[r++];
+	}
+
+      t = src;
+      src = dst;
+      dst = t;
+    }
+
+  if (src != entries)
+    grub_memcpy (entries, src, count * sizeof (*entries));
+  grub_free (tmp);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Return the LEN characters long number in STR, in BASE.  */
+static grub_off_t
+grub_cpio_number (const char *str, int len, int base)
+{
+  char buf[len + 1];
+
+  grub_memcpy (buf, str, len);
+  buf[len] = '\0';
+  return grub_strtoull (buf, 0, base);
+}
+
 #ifndef MODE_USTAR
 
 static void
@@ -84,108 +291,385 @@ grub_cpio_convert_header (struct head *head)
   if (head->magic != MAGIC_BCPIO)
     {
       head->magic = grub_swap_bytes16 (head->magic);
+      head->mode = grub_swap_bytes16 (head->mode);
       head->namesize = grub_swap_bytes16 (head->namesize);
       head->filesize_1 = grub_swap_bytes16 (head->filesize_1);
       head->filesize_2 = grub_swap_bytes16 (head->filesize_2);
     }
 }
 
-#endif
-
+/* Read the header at *OFS of DISK into ENTRY and set *OFS to the next
+   one.  ENTRY->name is NULL at the end of the archive.  */
 static grub_err_t
-grub_cpio_find_file (struct grub_cpio_data *data, char **name,
-		     grub_uint32_t * ofs)
+grub_cpio_read_header (grub_disk_t disk, enum grub_cpio_format format,
+		       grub_off_t *ofs, struct grub_cpio_entry *entry)
 {
-#ifndef MODE_USTAR
+  grub_size_t namesize, hdsize, align;
+  char *name;
+
+  entry->name = 0;
+  entry->link = 0;
+  if (format == GRUB_CPIO_BIN)
+    {
       struct head hd;
 
-      if (grub_disk_read
-	  (data->disk, 0, data->hofs, sizeof (hd), &hd))
+      if (grub_disk_read (disk, 0, *ofs, sizeof (hd), &hd))
 	return grub_errno;
       grub_cpio_convert_header (&hd);
 
       if (hd.magic != MAGIC_BCPIO)
 	return grub_error (GRUB_ERR_BAD_FS, "invalid cpio archive");
 
-      data->size = (((grub_uint32_t) hd.filesize_1) << 16) + hd.filesize_2;
+      entry->mode = hd.mode;
+      entry->size = (((grub_uint32_t) hd.filesize_1) << 16) + hd.filesize_2;
+      namesize = hd.namesize;
+      hdsize = sizeof (hd);
+      align = 2;
+    }
+  else if (format == GRUB_CPIO_ODC)
+    {
+      struct head_odc hd;
 
-      if (hd.namesize & 1)
-	hd.namesize++;
+      if (grub_disk_read (disk, 0, *ofs, sizeof (hd), &hd))
+	return grub_errno;
 
-      if ((*name = grub_malloc (hd.namesize)) == NULL)
+      if (grub_memcmp (hd.magic, MAGIC_ODC, sizeof (hd.magic)))
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cpio archive");
+
+      entry->mode = grub_cpio_number (hd.mode, sizeof (hd.mode), 8);
+      entry->size = grub_cpio_number (hd.filesize, sizeof (hd.filesize), 8);
+      namesize = grub_cpio_number (hd.namesize, sizeof (hd.namesize), 8);
+      hdsize = sizeof (hd);
+      align = 1;
+    }
+  else
+    {
+      struct head_newc hd;
+
+      if (grub_disk_read (disk, 0, *ofs, sizeof (hd), &hd))
 	return grub_errno;
 
-      if (grub_disk_read (data->disk, 0, data->hofs + sizeof (hd),
-			  hd.namesize, *name))
+      if (grub_memcmp (hd.magic, MAGIC_NEWC, sizeof (hd.magic))
+	  && grub_memcmp (hd.magic, MAGIC_NEWC_CRC, sizeof (hd.magic)))
+	return grub_error (GRUB_ERR_BAD_FS, "invalid cpio archive");
+
+      entry->mode = grub_cpio_number (hd.mode, sizeof (hd.mode), 16);
+      entry->size = grub_cpio_number (hd.filesize, sizeof (hd.filesize), 16);
+      namesize = grub_cpio_number (hd.namesize, sizeof (hd.namesize), 16);
+      hdsize = sizeof (hd);
+      align = 4;
+    }
+
+  if (grub_errno)
+    return grub_errno;
+
+  name = grub_malloc (namesize + 1);
+  if (! name)
+    return grub_errno;
+
+  if (grub_disk_read (disk, 0, *ofs + hdsize, namesize, name))
+    {
+      grub_free (name);
+      return grub_errno;
+    }
+  name[namesize] = '\0';
+
+  if (! grub_strcmp (name, "TRAILER!!!"))
+    {
+      grub_free (name);
+      return GRUB_ERR_NONE;
+    }
+
+  entry->name = name;
+  entry->dofs = ALIGN_UP (*ofs + hdsize + namesize, align);
+  *ofs = ALIGN_UP (entry->dofs + entry->size, align);
+
+  return GRUB_ERR_NONE;
+}
+
+#else
+
+/* Read the header at *OFS of DISK into ENTRY and set *OFS to the next
+   one.  ENTRY->name is NULL at the end of the archive.  */
+static grub_err_t
+grub_cpio_read_header (grub_disk_t disk, grub_off_t *ofs,
+		       struct grub_cpio_entry *entry)
+{
+  struct head hd;
+  char *longname = 0;
+
+  entry->name = 0;
+  entry->link = 0;
+  while (1)
+    {
+      grub_size_t len;
+      char *name;
+
+      if (grub_disk_read (disk, 0, *ofs, sizeof (hd), &hd))
+	break;
+
+      if (!hd.name[0])
+	break;
+
+      if (grub_memcmp (hd.magic, MAGIC_USTAR, sizeof (MAGIC_USTAR) - 1))
 	{
-	  grub_free (*name);
-	  return grub_errno;
+	  grub_error (GRUB_ERR_BAD_FS, "invalid tar archive");
+	  break;
 	}
 
-      if (data->size == 0 && hd.mode == 0 && hd.namesize == 11 + 1
-	  && ! grub_memcmp(*name, "TRAILER!!!", 11))
+      entry->size = grub_cpio_number (hd.size, sizeof (hd.size), 8);
+      entry->dofs = *ofs + GRUB_DISK_SECTOR_SIZE;
+      *ofs = entry->dofs + ALIGN_UP (entry->size, GRUB_DISK_SECTOR_SIZE);
+
+      /* The name of the next member, too long for its header.  */
+      if (hd.typeflag == 'L')
 	{
-	  *ofs = 0;
-	  return GRUB_ERR_NONE;
+	  grub_free (longname);
+	  longname = grub_malloc (entry->size + 1);
+	  if (! longname)
+	    break;
+	  if (grub_disk_read (disk, 0, entry->dofs, entry->size, longname))
+	    break;
+	  longname[entry->size] = '\0';
+	  continue;
 	}
 
-      data->dofs = data->hofs + sizeof (hd) + hd.namesize;
-      *ofs = data->dofs + data->size;
-      if (data->size & 1)
-	(*ofs)++;
-#else
-      struct head hd;
+      /* Extended headers, only the name of the next member is used.  */
+      if (hd.typeflag == 'x' || hd.typeflag == 'g')
+	{
+	  char *rec, *p, *end;
 
-      if (grub_disk_read
-	  (data->disk, 0, data->hofs, sizeof (hd), &hd))
-	return grub_errno;
+	  if (hd.typeflag == 'g')
+	    continue;
 
-      if (!hd.name[0])
+	  rec = grub_malloc (entry->size + 1);
+	  if (! rec)
+	    break;
+	  if (grub_disk_read (disk, 0, entry->dofs, entry->size, rec))
+	    {
+	      grub_free (rec);
+	      break;
+	    }
+	  rec[entry->size] = '\0';
+
+	  /* Each record is "LENGTH KEYWORD=VALUE\n".  */
+	  for (p = rec; p < rec + entry->size; p = end)
+	    {
+	      char *kw;
+
+	      end = p + grub_strtoul (p, &kw, 10);
+	      if (grub_errno || end <= p || end > rec + entry->size
+		  || *kw != ' ')
+		{
+		  grub_errno = GRUB_ERR_NONE;
+		  break;
+		}
+	      kw++;
+	      if (! grub_memcmp (kw, "path=", sizeof ("path=") - 1))
+		{
+		  grub_free (longname);
+		  kw += sizeof ("path=") - 1;
+		  longname = grub_strndup (kw, end - 1 - kw);
+		  break;
+		}
+	    }
+	  grub_free (rec);
+	  continue;
+	}
+
+      if (longname)
+	name = longname;
+      else
 	{
-	  *ofs = 0;
-	  return GRUB_ERR_NONE;
+	  for (len = 0; len < sizeof (hd.prefix) && hd.prefix[len]; len++);
+	  name = grub_malloc (len + 1 + sizeof (hd.name) + 1);
+	  if (! name)
+	    break;
+	  grub_memcpy (name, hd.prefix, len);
+	  if (len)
+	    name[len++] = '/';
+	  grub_memcpy (name + len, hd.name, sizeof (hd.name));
+	  name[len + sizeof (hd.name)] = '\0';
 	}
+      longname = 0;
 
-      if (grub_memcmp (hd.magic, MAGIC_USTAR, sizeof (MAGIC_USTAR) - 1))
-	return grub_error (GRUB_ERR_BAD_FS, "invalid tar archive");
+      entry->name = name;
+      entry->mode = ((hd.typeflag == '5') ? ATTR_DIR : ATTR_REG);
+      if (hd.typeflag == '1')
+	{
+	  grub_size_t n;
 
-      if ((*name = grub_strdup (hd.name)) == NULL)
-	return grub_errno;
+	  for (n = 0; n < sizeof (hd.linkname) && hd.linkname[n]; n++);
+	  entry->link = grub_cpio_canonicalize (hd.linkname, n);
+	  if (! entry->link)
+	    {
+	      grub_free (name);
+	      entry->name = 0;
+	      break;
+	    }
+	}
+      return GRUB_ERR_NONE;
+    }
+
+  grub_free (longname);
+  return grub_errno;
+}
 
-      data->size = grub_strtoul (hd.size, NULL, 8);
-      data->dofs = data->hofs + GRUB_DISK_SECTOR_SIZE;
-      *ofs = data->dofs + ((data->size + GRUB_DISK_SECTOR_SIZE - 1) &
-			   ~(GRUB_DISK_SECTOR_SIZE - 1));
 #endif
-  return GRUB_ERR_NONE;
+
+static void
+grub_cpio_unmount (void *p)
+{
+  struct grub_cpio_data *data = p;
+  int i;
+
+  for (i = 0; i < data->count; i++)
+    {
+      grub_free (data->entries[i].name);
+      grub_free (data->entries[i].link);
+    }
+  grub_free (data->entries);
+  grub_free (data);
 }
 
-static struct grub_cpio_data *
-grub_cpio_mount (grub_disk_t disk)
+/* Read the index of the archive on DISK.  */
+static void *
+grub_cpio_mount (grub_disk_t disk, grub_size_t *size)
 {
-  struct head hd;
   struct grub_cpio_data *data;
+  struct grub_cpio_entry entry;
+  grub_off_t ofs = 0;
+  int i, max = 0;
+#ifndef MODE_USTAR
+  enum grub_cpio_format format;
+  union
+  {
+    struct head bin;
+    struct head_odc odc;
+    struct head_newc newc;
+  } hd;
 
   if (grub_disk_read (disk, 0, 0, sizeof (hd), &hd))
     goto fail;
 
-#ifndef MODE_USTAR
-  grub_cpio_convert_header (&hd);
-  if (hd.magic != MAGIC_BCPIO)
+  if (! grub_memcmp (hd.newc.magic, MAGIC_NEWC, sizeof (hd.newc.magic))
+      || ! grub_memcmp (hd.newc.magic, MAGIC_NEWC_CRC, sizeof (hd.newc.magic)))
+    format = GRUB_CPIO_NEWC;
+  else if (! grub_memcmp (hd.odc.magic, MAGIC_ODC, sizeof (hd.odc.magic)))
+    format = GRUB_CPIO_ODC;
+  else
+    {
+      grub_cpio_convert_header (&hd.bin);
+      if (hd.bin.magic != MAGIC_BCPIO)
+	goto fail;
+      format = GRUB_CPIO_BIN;
+    }
 #else
+  struct head hd;
+
+  if (grub_disk_read (disk, 0, 0, sizeof (hd), &hd))
+    goto fail;
+
   if (grub_memcmp (hd.magic, MAGIC_USTAR,
 		   sizeof (MAGIC_USTAR) - 1))
-#endif
     goto fail;
+#endif
 
-  data = (struct grub_cpio_data *) grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
-    goto fail;
+    return 0;
+
+  while (1)
+    {
+      char *name;
 
-  data->disk = disk;
+#ifndef MODE_USTAR
+      if (grub_cpio_read_header (disk, format, &ofs, &entry))
+#else
+      if (grub_cpio_read_header (disk, &ofs, &entry))
+#endif
+	goto fail_index;
+
+      if (! entry.name)
+	break;
 
+      name = grub_cpio_canonicalize (entry.name, grub_strlen (entry.name));
+      grub_free (entry.name);
+      entry.name = name;
+
+      /* Skip the entry of the root directory.  */
+      if (! name || ! *name)
+	{
+	  grub_free (name);
+	  grub_free (entry.link);
+	  if (! name)
+	    goto fail_index;
+	  continue;
+	}
+
+      if (data->count == max)
+	{
+	  struct grub_cpio_entry *p;
+
+	  max = (max) ? max * 2 : 64;
+	  p = grub_realloc (data->entries, max * sizeof (*p));
+	  if (! p)
+	    {
+	      grub_free (name);
+	      grub_free (entry.link);
+	      goto fail_index;
+	    }
+	  data->entries = p;
+	}
+
+      data->entries[data->count++] = entry;
+    }
+
+  if (data->count && grub_cpio_sort (data->entries, data->count))
+    goto fail_index;
+
+  /* Hard links share the data of their target, which comes earlier in
+     the archive.  */
+  for (i = 0; i < data->count; i++)
+    if (data->entries[i].link)
+      {
+	struct grub_cpio_entry *target = 0;
+	int j;
+
+	for (j = grub_cpio_lookup (data, data->entries[i].link);
+	     j < data->count
+	       && ! grub_strcmp (data->entries[j].name, data->entries[i].link);
+	     j++)
+	  if (! data->entries[j].link)
+	    target = &data->entries[j];
+
+	if (target)
+	  {
+	    data->entries[i].dofs = target->dofs;
+	    data->entries[i].size = target->size;
+	    data->entries[i].mode = target->mode;
+	  }
+      }
+
+  /* The last member with a given name wins, as when extracting.  */
+  for (i = 0; i + 1 < data->count; i++)
+    if (! grub_strcmp (data->entries[i].name, data->entries[i + 1].name))
+      {
+	grub_free (data->entries[i].name);
+	grub_free (data->entries[i].link);
+	grub_memmove (data->entries + i, data->entries + i + 1,
+		      (data->count - i - 1) * sizeof (data->entries[0]));
+	data->count--;
+	i--;
+      }
+
+  *size = sizeof (*data);
   return data;
 
+ fail_index:
+  grub_cpio_unmount (data);
+  return 0;
+
 fail:
   grub_error (GRUB_ERR_BAD_FS, "not a "
 #ifdef MODE_USTAR
@@ -205,67 +689,75 @@ grub_cpio_dir (grub_device_t device, const char *path,
 	       void *closure)
 {
   struct grub_cpio_data *data;
-  grub_uint32_t ofs;
-  char *prev, *name;
-  const char *np;
-  int len;
+  char *dir;
+  grub_size_t len;
+  int i;
 
   grub_dl_ref (my_mod);
 
-  prev = 0;
-
-  data = grub_cpio_mount (device->disk);
+  data = grub_fs_mount (&grub_cpio_fs, device->disk);
   if (!data)
     goto fail;
 
-  np = path + 1;
-  len = grub_strlen (path) - 1;
+  dir = grub_cpio_canonicalize (path, grub_strlen (path));
+  if (! dir)
+    goto fail;
 
-  data->hofs = 0;
-  while (1)
+  /* The members of DIR are the names which start with "DIR/", they follow
+     each other.  */
+  len = grub_strlen (dir);
+  if (len)
     {
-      if (grub_cpio_find_file (data, &name, &ofs))
-	goto fail;
-
-      if (!ofs)
-	break;
+      dir[len++] = '/';
+      dir[len] = '\0';
+    }
 
-      if (grub_memcmp (np, name, len) == 0)
+  i = grub_cpio_lookup (data, dir);
+  while (i < data->count && ! grub_strncmp (data->entries[i].name, dir, len))
+    {
+      struct grub_dirhook_info info;
+      const char *name, *p;
+      char *filename;
+      grub_size_t n;
+
+      name = data->entries[i].name + len;
+      p = grub_strchr (name, '/');
+      n = (p) ? (grub_size_t) (p - name) : grub_strlen (name);
+
+      grub_memset (&info, 0, sizeof (info));
+      info.dir = ((p != NULL)
+		  || ((data->entries[i].mode & ATTR_TYPE) == ATTR_DIR));
+
+      /* Directories don't always have an entry of their own, only list
+	 them once.  */
+      for (i++; i < data->count; i++)
 	{
-	  char *p, *n;
+	  const char *next = data->entries[i].name;
 
-	  n = name + len;
-	  if (*n == '/')
-	    n++;
+	  if (grub_strncmp (next, dir, len) || grub_strncmp (next + len, name, n)
+	      || (next[len + n] != '/' && next[len + n] != '\0'))
+	    break;
+	  info.dir = 1;
+	}
 
-	  p = grub_strchr (name + len, '/');
-	  if (p)
-	    *p = 0;
+      filename = grub_strndup (name, n);
+      if (! filename)
+	break;
 
-	  if ((!prev) || (grub_strcmp (prev, name) != 0))
-	    {
-	      struct grub_dirhook_info info;
-	      grub_memset (&info, 0, sizeof (info));
-	      info.dir = (p != NULL);
-
-	      hook (name + len, &info, closure);
-	      if (prev)
-		grub_free (prev);
-	      prev = name;
-	    }
-	  else
-	    grub_free (name);
+      if (hook (filename, &info, closure))
+	{
+	  grub_free (filename);
+	  break;
 	}
-      data->hofs = ofs;
+      grub_free (filename);
     }
 
-fail:
+  grub_free (dir);
 
-  if (prev)
-    grub_free (prev);
+fail:
 
   if (data)
-    grub_free (data);
+    grub_fs_unmount (&grub_cpio_fs, data);
 
   grub_dl_unref (my_mod);
 
@@ -276,68 +768,54 @@ static grub_err_t
 grub_cpio_open (grub_file_t file, const char *name)
 {
   struct grub_cpio_data *data;
-  grub_uint32_t ofs;
+  struct grub_cpio_file *cfile;
+  struct grub_cpio_entry *entry;
   char *fn;
-  int i, j;
+  int i;
 
   grub_dl_ref (my_mod);
 
-  data = grub_cpio_mount (file->device->disk);
+  data = grub_fs_mount (&grub_cpio_fs, file->device->disk);
   if (!data)
     goto fail;
 
-  data->hofs = 0;
-  while (1)
-    {
-      if (grub_cpio_find_file (data, &fn, &ofs))
-	goto fail;
-
-      if (!ofs)
-	{
-	  grub_error (GRUB_ERR_FILE_NOT_FOUND, "file not found");
-	  break;
-	}
-
-      /* Compare NAME and FN by hand in order to cope with duplicate
-	 slashes.  */
-      i = 0;
-      j = 0;
-      while (name[i] == '/')
-	i++;
-      while (1)
-	{
-	  if (name[i] != fn[j])
-	    goto no_match;
-
-	  if (name[i] == '\0')
-	    break;
-
-	  while (name[i] == '/' && name[i+1] == '/')
-	    i++;
+  fn = grub_cpio_canonicalize (name, grub_strlen (name));
+  if (! fn)
+    goto fail;
 
-	  i++;
-	  j++;
-	}
+  i = grub_cpio_lookup (data, fn);
+  if (i == data->count || grub_strcmp (data->entries[i].name, fn))
+    {
+      grub_free (fn);
+      grub_error (GRUB_ERR_FILE_NOT_FOUND, "file not found");
+      goto fail;
+    }
+  grub_free (fn);
 
-      if (name[i] != fn[j])
-	goto no_match;
+  entry = &data->entries[i];
+  if ((entry->mode & ATTR_TYPE) == ATTR_DIR)
+    {
+      grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a regular file");
+      goto fail;
+    }
 
-      file->data = data;
-      file->size = data->size;
-      grub_free (fn);
+  cfile = grub_malloc (sizeof (*cfile));
+  if (! cfile)
+    goto fail;
 
-      return GRUB_ERR_NONE;
+  cfile->data = data;
+  cfile->disk = file->device->disk;
+  cfile->dofs = entry->dofs;
 
-    no_match:
+  file->data = cfile;
+  file->size = entry->size;
 
-      grub_free (fn);
-      data->hofs = ofs;
-    }
+  return GRUB_ERR_NONE;
 
 fail:
 
   if (data)
-    grub_free (data);
+    grub_fs_unmount (&grub_cpio_fs, data);
 
   grub_dl_unref (my_mod);
 
@@ -347,17 +825,21 @@ fail:
 static grub_ssize_t
 grub_cpio_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  struct grub_cpio_data *data;
+  struct grub_cpio_file *cfile;
 
-  data = file->data;
-  return (grub_disk_read (data->disk, 0, data->dofs + file->offset,
+  cfile = file->data;
+  return (grub_disk_read (cfile->disk, 0, cfile->dofs + file->offset,
 			  len, buf)) ? -1 : (grub_ssize_t) len;
 }
 
 static grub_err_t
 grub_cpio_close (grub_file_t file)
 {
-  grub_free (file->data);
+  struct grub_cpio_file *cfile;
+
+  cfile = file->data;
+  grub_fs_unmount (&grub_cpio_fs, cfile->data);
+  grub_free (cfile);
 
   grub_dl_unref (my_mod);
 
@@ -374,6 +856,8 @@ static struct grub_fs grub_cpio_fs = {
   .open = grub_cpio_open,
   .read = grub_cpio_read,
   .close = grub_cpio_close,
+  .mount = grub_cpio_mount,
+  .unmount = grub_cpio_unmount,
 };
 
 #ifdef MODE_USTAR
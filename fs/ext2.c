@@ -133,6 +133,21 @@
 
 #define EXT4_EXTENTS_FLAG		0x80000
 
+/* The directory is indexed by an htree.  */
+#define EXT2_INDEX_FLAG			0x1000
+
+/* Superblock flags.  */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002
+
+/* The hashes used by htree indexed directories, the unsigned variants are
+   used if EXT2_FLAGS_UNSIGNED_HASH is set.  */
+#define EXT2_HASH_LEGACY		0
+#define EXT2_HASH_HALF_MD4		1
+#define EXT2_HASH_TEA			2
+#define EXT2_HASH_LEGACY_UNSIGNED	3
+#define EXT2_HASH_HALF_MD4_UNSIGNED	4
+#define EXT2_HASH_TEA_UNSIGNED		5
+
 /* The ext2 superblock.  */
 struct grub_ext2_sblock
 {
@@ -186,6 +201,12 @@ struct grub_ext2_sblock
   grub_uint32_t first_meta_bg;
   grub_uint32_t mkfs_time;
   grub_uint32_t jnl_blocks[17];
+  grub_uint32_t total_blocks_hi;
+  grub_uint32_t reserved_blocks_hi;
+  grub_uint32_t free_blocks_hi;
+  grub_uint16_t min_extra_isize;
+  grub_uint16_t want_extra_isize;
+  grub_uint32_t flags;
 };
 
 /* The ext2 blockgroup.  */
@@ -243,6 +264,31 @@ struct ext2_dirent
   grub_uint8_t filetype;
 };
 
+/* The htree information in the first block of an indexed directory,
+   after the entries for `.' and `..'.  */
+struct ext2_dx_root_info
+{
+  grub_uint32_t reserved_zero;
+  grub_uint8_t hash_version;
+  grub_uint8_t info_length;
+  grub_uint8_t indirect_levels;
+  grub_uint8_t unused_flags;
+};
+
+/* An htree index entry.  The hash of the first entry of every index block
+   is replaced by the limit and count of entries.  */
+struct ext2_dx_entry
+{
+  grub_uint32_t hash;
+  grub_uint32_t block;
+};
+
+struct ext2_dx_countlimit
+{
+  grub_uint16_t limit;
+  grub_uint16_t count;
+};
+
 struct grub_ext3_journal_header
 {
   grub_uint32_t magic;
@@ -543,8 +589,10 @@ grub_ext2_read_inode (struct grub_ext2_data *data,
   return 0;
 }
 
-static struct grub_ext2_data *
-grub_ext2_mount (grub_disk_t disk)
+static struct grub_fs grub_ext2_fs;
+
+static void *
+grub_ext2_mount_fs (grub_disk_t disk, grub_size_t *size)
 {
   struct grub_ext2_data *data;
 
@@ -586,6 +634,9 @@ grub_ext2_mount (grub_disk_t disk)
   if (grub_errno)
     goto fail;
 
+  /* The disk is set again for every open, see grub_ext2_mount.  */
+  data->disk = 0;
+  *size = sizeof (struct grub_ext2_data);
   return data;
 
  fail:
@@ -596,6 +647,22 @@ grub_ext2_mount (grub_disk_t disk)
   return 0;
 }
 
+static struct grub_ext2_data *
+grub_ext2_mount (grub_disk_t disk)
+{
+  struct grub_ext2_data *data;
+
+  data = grub_fs_mount_copy (&grub_ext2_fs, disk);
+  if (! data)
+    return 0;
+
+  data->disk = disk;
+  data->diropen.data = data;
+  data->inode = &data->diropen.inode;
+
+  return data;
+}
+
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
 {
@@ -636,6 +703,63 @@ grub_ext2_read_symlink (grub_fshelp_node_t node)
   return symlink;
 }
 
+/* Return a new node for the directory entry DIRENT of DIRO, and set TYPE
+   to the type of the file.  */
+static struct grub_fshelp_node *
+grub_ext2_dirent_node (struct grub_fshelp_node *diro,
+		       struct ext2_dirent *dirent,
+		       enum grub_fshelp_filetype *type)
+{
+  struct grub_fshelp_node *fdiro;
+
+  *type = GRUB_FSHELP_UNKNOWN;
+
+  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+  if (! fdiro)
+    return 0;
+
+  fdiro->data = diro->data;
+  fdiro->ino = grub_le_to_cpu32 (dirent->inode);
+
+  if (dirent->filetype != FILETYPE_UNKNOWN)
+    {
+      fdiro->inode_read = 0;
+
+      if (dirent->filetype == FILETYPE_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if (dirent->filetype == FILETYPE_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if (dirent->filetype == FILETYPE_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+  else
+    {
+      /* The filetype can not be read from the dirent, read
+	 the inode to get more information.  */
+      grub_ext2_read_inode (diro->data, grub_le_to_cpu32 (dirent->inode),
+			    &fdiro->inode);
+      if (grub_errno)
+	{
+	  grub_free (fdiro);
+	  return 0;
+	}
+
+      fdiro->inode_read = 1;
+
+      if ((grub_le_to_cpu16 (fdiro->inode.mode)
+	   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
+	*type = GRUB_FSHELP_DIR;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
+	*type = GRUB_FSHELP_SYMLINK;
+      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
+		& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
+	*type = GRUB_FSHELP_REG;
+    }
+
+  return fdiro;
+}
+
 static int
 grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 		       int (*hook) (const char *filename,
@@ -671,7 +795,7 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	{
 	  char filename[dirent.namelen + 1];
 	  struct grub_fshelp_node *fdiro;
-	  enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
+	  enum grub_fshelp_filetype type;
 
 	  grub_ext2_read_file (diro, 0, 0, 0,
 			       fpos + sizeof (struct ext2_dirent),
@@ -679,60 +803,364 @@ grub_ext2_iterate_dir (grub_fshelp_node_t dir,
 	  if (grub_errno)
 	    return 0;
 
-	  fdiro = grub_malloc (sizeof (struct grub_fshelp_node));
+	  filename[dirent.namelen] = '\0';
+
+	  fdiro = grub_ext2_dirent_node (diro, &dirent, &type);
 	  if (! fdiro)
 	    return 0;
 
-	  fdiro->data = diro->data;
-	  fdiro->ino = grub_le_to_cpu32 (dirent.inode);
+	  if (hook (filename, type, fdiro, closure))
+	    return 1;
+	}
 
-	  filename[dirent.namelen] = '\0';
+      fpos += grub_le_to_cpu16 (dirent.direntlen);
+    }
 
-	  if (dirent.filetype != FILETYPE_UNKNOWN)
-	    {
-	      fdiro->inode_read = 0;
-
-	      if (dirent.filetype == FILETYPE_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if (dirent.filetype == FILETYPE_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if (dirent.filetype == FILETYPE_REG)
-		type = GRUB_FSHELP_REG;
-	    }
+  return 0;
+}
+
+/* The legacy htree hash.  */
+static grub_uint32_t
+grub_ext2_dx_hack_hash (const char *name, int len, int unsigned_char)
+{
+  grub_uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+
+  while (len--)
+    {
+      int c;
+
+      c = (unsigned_char) ? (int) (unsigned char) *name
+	: (int) (signed char) *name;
+      name++;
+
+      hash = hash1 + (hash0 ^ (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+
+  return hash0 << 1;
+}
+
+/* Fill NUM words of BUF from the LEN bytes of NAME, for the half MD4 and
+   TEA hashes.  */
+static void
+grub_ext2_str2hashbuf (const char *name, int len, grub_uint32_t *buf,
+		       int num, int unsigned_char)
+{
+  grub_uint32_t pad, val;
+  int i;
+
+  pad = (grub_uint32_t) len | ((grub_uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+
+  for (i = 0; i < len; i++)
+    {
+      int c;
+
+      c = (unsigned_char) ? (int) (unsigned char) name[i]
+	: (int) (signed char) name[i];
+      val = c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+#define ROL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+#define HALF_MD4_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define HALF_MD4_G(x, y, z)	(((x) & (y)) + (((x) ^ (y)) & (z)))
+#define HALF_MD4_H(x, y, z)	((x) ^ (y) ^ (z))
+
+#define HALF_MD4_ROUND(f, a, b, c, d, x, s)	\
+  (a += f (b, c, d) + x, a = ROL32 (a, s))
+
+#define HALF_MD4_K1	0
+#define HALF_MD4_K2	013240474631UL
+#define HALF_MD4_K3	015666365641UL
+
+static void
+grub_ext2_half_md4_transform (grub_uint32_t buf[4], const grub_uint32_t in[8])
+{
+  grub_uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  HALF_MD4_ROUND (HALF_MD4_F, a, b, c, d, in[0] + HALF_MD4_K1, 3);
+  HALF_MD4_ROUND (HALF_MD4_F, d, a, b, c, in[1] + HALF_MD4_K1, 7);
+  HALF_MD4_ROUND (HALF_MD4_F, c, d, a, b, in[2] + HALF_MD4_K1, 11);
+  HALF_MD4_ROUND (HALF_MD4_F, b, c, d, a, in[3] + HALF_MD4_K1, 19);
+  HALF_MD4_ROUND (HALF_MD4_F, a, b, c, d, in[4] + HALF_MD4_K1, 3);
+  HALF_MD4_ROUND (HALF_MD4_F, d, a, b, c, in[5] + HALF_MD4_K1, 7);
+  HALF_MD4_ROUND (HALF_MD4_F, c, d, a, b, in[6] + HALF_MD4_K1, 11);
+  HALF_MD4_ROUND (HALF_MD4_F, b, c, d, a, in[7] + HALF_MD4_K1, 19);
+
+  HALF_MD4_ROUND (HALF_MD4_G, a, b, c, d, in[1] + HALF_MD4_K2, 3);
+  HALF_MD4_ROUND (HALF_MD4_G, d, a, b, c, in[3] + HALF_MD4_K2, 5);
+  HALF_MD4_ROUND (HALF_MD4_G, c, d, a, b, in[5] + HALF_MD4_K2, 9);
+  HALF_MD4_ROUND (HALF_MD4_G, b, c, d, a, in[7] + HALF_MD4_K2, 13);
+  HALF_MD4_ROUND (HALF_MD4_G, a, b, c, d, in[0] + HALF_MD4_K2, 3);
+  HALF_MD4_ROUND (HALF_MD4_G, d, a, b, c, in[2] + HALF_MD4_K2, 5);
+  HALF_MD4_ROUND (HALF_MD4_G, c, d, a, b, in[4] + HALF_MD4_K2, 9);
+  HALF_MD4_ROUND (HALF_MD4_G, b, c, d, a, in[6] + HALF_MD4_K2, 13);
+
+  HALF_MD4_ROUND (HALF_MD4_H, a, b, c, d, in[3] + HALF_MD4_K3, 3);
+  HALF_MD4_ROUND (HALF_MD4_H, d, a, b, c, in[7] + HALF_MD4_K3, 9);
+  HALF_MD4_ROUND (HALF_MD4_H, c, d, a, b, in[2] + HALF_MD4_K3, 11);
+  HALF_MD4_ROUND (HALF_MD4_H, b, c, d, a, in[6] + HALF_MD4_K3, 15);
+  HALF_MD4_ROUND (HALF_MD4_H, a, b, c, d, in[1] + HALF_MD4_K3, 3);
+  HALF_MD4_ROUND (HALF_MD4_H, d, a, b, c, in[5] + HALF_MD4_K3, 9);
+  HALF_MD4_ROUND (HALF_MD4_H, c, d, a, b, in[0] + HALF_MD4_K3, 11);
+  HALF_MD4_ROUND (HALF_MD4_H, b, c, d, a, in[4] + HALF_MD4_K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+static void
+grub_ext2_tea_transform (grub_uint32_t buf[4], const grub_uint32_t in[4])
+{
+  grub_uint32_t sum = 0;
+  grub_uint32_t b0 = buf[0], b1 = buf[1];
+  int n = 16;
+
+  do
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + in[0]) ^ (b1 + sum) ^ ((b1 >> 5) + in[1]);
+      b1 += ((b0 << 4) + in[2]) ^ (b0 + sum) ^ ((b0 >> 5) + in[3]);
+    }
+  while (--n);
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Return the htree hash of the LEN bytes of NAME, with the hash VERSION
+   of the filesystem DATA.  */
+static grub_uint32_t
+grub_ext2_dx_hash (struct grub_ext2_data *data, int version,
+		   const char *name, int len)
+{
+  grub_uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+  grub_uint32_t in[8], hash;
+  int i, unsigned_char = 0;
+
+  /* The seed is used only if it is set.  */
+  for (i = 0; i < 4; i++)
+    if (data->sblock.hash_seed[i])
+      break;
+  if (i < 4)
+    for (i = 0; i < 4; i++)
+      buf[i] = grub_le_to_cpu32 (data->sblock.hash_seed[i]);
+
+  if (version >= EXT2_HASH_LEGACY_UNSIGNED)
+    {
+      version -= EXT2_HASH_LEGACY_UNSIGNED;
+      unsigned_char = 1;
+    }
+
+  switch (version)
+    {
+    case EXT2_HASH_HALF_MD4:
+      for (; len > 0; len -= 32, name += 32)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 8, unsigned_char);
+	  grub_ext2_half_md4_transform (buf, in);
+	}
+      hash = buf[1];
+      break;
+
+    case EXT2_HASH_TEA:
+      for (; len > 0; len -= 16, name += 16)
+	{
+	  grub_ext2_str2hashbuf (name, len, in, 4, unsigned_char);
+	  grub_ext2_tea_transform (buf, in);
+	}
+      hash = buf[0];
+      break;
+
+    default:
+      hash = grub_ext2_dx_hack_hash (name, len, unsigned_char);
+    }
+
+  /* The hash of the end of the directory is not used.  */
+  hash &= ~1;
+  if (hash == 0xfffffffe)
+    hash = 0xfffffffc;
+
+  return hash;
+}
+
+/* Look NAME up in the htree index of the directory DIR, reading only the
+   index blocks on the way to the leaf block holding it.  */
+static int
+grub_ext2_find_entry (grub_fshelp_node_t dir, const char *name,
+		      grub_fshelp_node_t *foundnode,
+		      enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *diro = (struct grub_fshelp_node *) dir;
+  struct grub_ext2_data *data = diro->data;
+  struct ext2_dx_root_info *info;
+  struct ext2_dx_entry *entries;
+  struct ext2_dx_countlimit *countlimit;
+  grub_uint32_t hash, next_hash = 0, block = 0;
+  int blocksize = EXT2_BLOCK_SIZE (data);
+  int namelen = grub_strlen (name);
+  int level, levels, version, count = 0, index = 0;
+  char *buf, *leaf = 0;
+  int ret = -1;
+
+  if (! (grub_le_to_cpu32 (data->sblock.feature_compatibility)
+	 & EXT2_FEATURE_COMPAT_DIR_INDEX))
+    return -1;
+
+  /* `.' and `..' are in the index root, not in a leaf block.  */
+  if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+    return -1;
+
+  if (! diro->inode_read)
+    {
+      grub_ext2_read_inode (data, diro->ino, &diro->inode);
+      if (grub_errno)
+	return 0;
+      diro->inode_read = 1;
+    }
+
+  if (! (grub_le_to_cpu32 (diro->inode.flags) & EXT2_INDEX_FLAG))
+    return -1;
+
+  buf = grub_malloc (blocksize * 2);
+  if (! buf)
+    return 0;
+  leaf = buf + blocksize;
+
+  if (grub_ext2_read_file (diro, 0, 0, 0, 0, blocksize, buf) != blocksize)
+    goto fail;
+
+  /* The root info follows the 12 bytes of `.' and the header of `..'.  */
+  info = (struct ext2_dx_root_info *) (buf + 24);
+  levels = info->indirect_levels;
+  version = info->hash_version;
+  if (info->reserved_zero || info->info_length != sizeof (*info)
+      || levels > 2 || version > EXT2_HASH_TEA)
+    goto fail;
+
+  if (grub_le_to_cpu32 (data->sblock.flags) & EXT2_FLAGS_UNSIGNED_HASH)
+    version += EXT2_HASH_LEGACY_UNSIGNED;
+
+  hash = grub_ext2_dx_hash (data, version, name, namelen);
+  entries = (struct ext2_dx_entry *) (buf + 24 + info->info_length);
+
+  for (level = 0; ; level++)
+    {
+      int low, high;
+
+      countlimit = (struct ext2_dx_countlimit *) entries;
+      count = grub_le_to_cpu16 (countlimit->count);
+      if (count == 0 || count > grub_le_to_cpu16 (countlimit->limit)
+	  || ((char *) (entries + count) > buf + blocksize))
+	goto fail;
+
+      /* Find the last entry whose hash is not above HASH, the first entry
+	 stands for the hashes below the second one.  */
+      low = 1;
+      high = count - 1;
+      while (low <= high)
+	{
+	  int mid = (low + high) / 2;
+
+	  if (grub_le_to_cpu32 (entries[mid].hash) > hash)
+	    high = mid - 1;
 	  else
+	    low = mid + 1;
+	}
+      index = low - 1;
+      block = grub_le_to_cpu32 (entries[index].block) & 0x0fffffff;
+
+      if (level == levels)
+	break;
+
+      /* An index block starts with an empty directory entry.  */
+      if (grub_ext2_read_file (diro, 0, 0, 0,
+			       (grub_off_t) block * blocksize, blocksize, buf)
+	  != blocksize)
+	goto fail;
+
+      entries = (struct ext2_dx_entry *) (buf + 8);
+    }
+
+  /* Names with the same hash may continue in the next leaf blocks, which
+     have the low bit of their hash set.  */
+  for (;;)
+    {
+      int pos = 0;
+
+      if (grub_ext2_read_file (diro, 0, 0, 0,
+			       (grub_off_t) block * blocksize, blocksize, leaf)
+	  != blocksize)
+	goto fail;
+
+      while (pos <= blocksize - (int) sizeof (struct ext2_dirent))
+	{
+	  struct ext2_dirent *dirent = (struct ext2_dirent *) (leaf + pos);
+	  int len = grub_le_to_cpu16 (dirent->direntlen);
+
+	  if (len < (int) sizeof (struct ext2_dirent) || pos + len > blocksize)
+	    goto fail;
+
+	  if (dirent->inode && dirent->namelen == namelen
+	      && (int) sizeof (struct ext2_dirent) + namelen <= len
+	      && ! grub_memcmp (leaf + pos + sizeof (struct ext2_dirent),
+				name, namelen))
 	    {
-	      /* The filetype can not be read from the dirent, read
-		 the inode to get more information.  */
-	      grub_ext2_read_inode (diro->data,
-                                    grub_le_to_cpu32 (dirent.inode),
-				    &fdiro->inode);
-	      if (grub_errno)
-		{
-		  grub_free (fdiro);
-		  return 0;
-		}
-
-	      fdiro->inode_read = 1;
-
-	      if ((grub_le_to_cpu16 (fdiro->inode.mode)
-		   & FILETYPE_INO_MASK) == FILETYPE_INO_DIRECTORY)
-		type = GRUB_FSHELP_DIR;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_SYMLINK)
-		type = GRUB_FSHELP_SYMLINK;
-	      else if ((grub_le_to_cpu16 (fdiro->inode.mode)
-			& FILETYPE_INO_MASK) == FILETYPE_INO_REG)
-		type = GRUB_FSHELP_REG;
+	      *foundnode = grub_ext2_dirent_node (diro, dirent, foundtype);
+	      ret = (*foundnode) ? 1 : 0;
+	      goto fail;
 	    }
 
-	  if (hook (filename, type, fdiro, closure))
-	    return 1;
+	  pos += len;
 	}
 
-      fpos += grub_le_to_cpu16 (dirent.direntlen);
+      if (++index >= count)
+	{
+	  /* The next leaf would be in the next index block.  */
+	  ret = (levels) ? -1 : 0;
+	  break;
+	}
+
+      next_hash = grub_le_to_cpu32 (entries[index].hash);
+      if (! (next_hash & 1) || (next_hash & ~1) != hash)
+	{
+	  ret = 0;
+	  break;
+	}
+
+      block = grub_le_to_cpu32 (entries[index].block) & 0x0fffffff;
     }
 
-  return 0;
+ fail:
+  grub_free (buf);
+
+  /* Fall back to iterating over the directory if the index is broken.  */
+  if (ret < 0)
+    grub_errno = GRUB_ERR_NONE;
+
+  return ret;
 }
 
 /* Open a file named NAME and initialize FILE.  */
@@ -748,8 +1176,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
   if (! data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_ext2_iterate_dir, 0,
-			 grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				grub_ext2_iterate_dir, grub_ext2_find_entry,
+				grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -852,8 +1282,10 @@ grub_ext2_dir (grub_device_t device, const char *path,
   if (! data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_ext2_iterate_dir,
-			 0, grub_ext2_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				grub_ext2_iterate_dir, grub_ext2_find_entry,
+				grub_ext2_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -959,6 +1391,7 @@ static struct grub_fs grub_ext2_fs =
     .label = grub_ext2_label,
     .uuid = grub_ext2_uuid,
     .mtime = grub_ext2_mtime,
+    .mount = grub_ext2_mount_fs,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
 #endif
@@ -169,8 +169,10 @@ fat_log2 (unsigned x)
   return i;
 }
 
-static struct grub_fat_data *
-grub_fat_mount (grub_disk_t disk)
+static struct grub_fs grub_fat_fs;
+
+static void *
+grub_fat_mount_fs (grub_disk_t disk, grub_size_t *size)
 {
   struct grub_fat_bpb bpb;
   struct grub_fat_data *data = 0;
@@ -333,6 +335,7 @@ grub_fat_mount (grub_disk_t disk)
   data->file_cluster = data->root_cluster;
   data->cur_cluster_num = ~0U;
   data->attr = GRUB_FAT_ATTR_DIRECTORY;
+  *size = sizeof (struct grub_fat_data);
   return data;
 
  fail:
@@ -342,6 +345,18 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+static struct grub_fat_data *
+grub_fat_mount (grub_disk_t disk)
+{
+  if (! disk)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "not a FAT filesystem");
+      return 0;
+    }
+
+  return grub_fs_mount_copy (&grub_fat_fs, disk);
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, struct grub_fat_data *data,
 		    void (*read_hook) (grub_disk_addr_t sector,
@@ -888,6 +903,7 @@ static struct grub_fs grub_fat_fs =
     .close = grub_fat_close,
     .label = grub_fat_label,
     .uuid = grub_fat_uuid,
+    .mount = grub_fat_mount_fs,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
 #endif
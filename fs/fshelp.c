@@ -21,9 +21,13 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
+#include <grub/fs.h>
+#include <grub/dl.h>
 #include <grub/fshelp.h>
 
 GRUB_EXPORT(grub_fshelp_find_file);
+GRUB_EXPORT(grub_fshelp_find_file_cached);
 GRUB_EXPORT(grub_fshelp_log2blksize);
 GRUB_EXPORT(grub_fshelp_read_file);
 
@@ -36,11 +40,18 @@ struct grub_fshelp_find_file_closure
 		       enum grub_fshelp_filetype filetype,
 		       grub_fshelp_node_t node, void *closure),
 		      void *closure);
+  int (*find_entry) (grub_fshelp_node_t dir, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype);
   void *closure;
   char *(*read_symlink) (grub_fshelp_node_t node);
   int symlinknest;
   enum grub_fshelp_filetype foundtype;
   grub_fshelp_node_t currroot;
+  /* The mount the lookups are cached for, if DISK isn't NULL.  */
+  grub_disk_t disk;
+  grub_disk_addr_t start;
+  grub_size_t node_size;
 };
 
 static void
@@ -50,6 +61,133 @@ free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_closure *c)
     grub_free (node);
 }
 
+
+
+#define GRUB_FSHELP_CACHE_NUM	256
+
+/* A path looked up on a mounted filesystem, which doesn't exist if NODE
+   is NULL.  The filesystem is told apart by its iterate_dir function.  */
+struct grub_fshelp_cache
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  void *iterate_dir;
+  char *path;
+  enum grub_fshelp_filetype type;
+  grub_fshelp_node_t node;
+  grub_size_t size;
+};
+
+static struct grub_fshelp_cache grub_fshelp_cache_table[GRUB_FSHELP_CACHE_NUM];
+
+/* The mount generation the cache was built in.  */
+static unsigned long grub_fshelp_cache_generation;
+
+static void
+grub_fshelp_cache_invalidate_all (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_CACHE_NUM; i++)
+    {
+      struct grub_fshelp_cache *cache = grub_fshelp_cache_table + i;
+
+      grub_free (cache->path);
+      grub_free (cache->node);
+      cache->path = 0;
+      cache->node = 0;
+    }
+}
+
+static struct grub_fshelp_cache *
+grub_fshelp_cache_get (struct grub_fshelp_find_file_closure *c,
+		       const char *path)
+{
+  unsigned long index;
+
+  index = (grub_strhash (path) + c->disk->dev->id * 524287UL
+	   + c->disk->id * 2606459UL + (unsigned long) c->start);
+  return grub_fshelp_cache_table + index % GRUB_FSHELP_CACHE_NUM;
+}
+
+/* Look PATH up in the cache.  Return 0 if it isn't there, otherwise set
+   TYPE and NODE, to a copy of the cached node or to NULL if PATH doesn't
+   exist, and return 1.  */
+static int
+grub_fshelp_cache_fetch (struct grub_fshelp_find_file_closure *c,
+			 const char *path, enum grub_fshelp_filetype *type,
+			 grub_fshelp_node_t *node)
+{
+  struct grub_fshelp_cache *cache;
+
+  cache = grub_fshelp_cache_get (c, path);
+  if (! cache->path || cache->dev_id != c->disk->dev->id
+      || cache->disk_id != c->disk->id || cache->start != c->start
+      || cache->iterate_dir != (void *) c->iterate_dir
+      || grub_strcmp (cache->path, path))
+    return 0;
+
+  *node = 0;
+  if (cache->node)
+    {
+      *node = grub_malloc (cache->size);
+      if (! *node)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+
+      grub_memcpy (*node, cache->node, cache->size);
+
+      /* Point the copy to the data of the current mount.  */
+      *(void **) *node = *(void **) c->rootnode;
+    }
+
+  *type = cache->type;
+  return 1;
+}
+
+/* Remember NODE, of type TYPE, as the node found for PATH.  */
+static void
+grub_fshelp_cache_store (struct grub_fshelp_find_file_closure *c,
+			 const char *path, enum grub_fshelp_filetype type,
+			 grub_fshelp_node_t node)
+{
+  struct grub_fshelp_cache *cache;
+
+  cache = grub_fshelp_cache_get (c, path);
+  grub_free (cache->path);
+  grub_free (cache->node);
+  cache->node = 0;
+
+  cache->path = grub_strdup (path);
+  if (! cache->path)
+    goto fail;
+
+  if (node)
+    {
+      cache->node = grub_malloc (c->node_size);
+      if (! cache->node)
+	goto fail;
+
+      grub_memcpy (cache->node, node, c->node_size);
+    }
+
+  cache->dev_id = c->disk->dev->id;
+  cache->disk_id = c->disk->id;
+  cache->start = c->start;
+  cache->iterate_dir = (void *) c->iterate_dir;
+  cache->type = type;
+  cache->size = c->node_size;
+  return;
+
+ fail:
+  grub_free (cache->path);
+  cache->path = 0;
+  grub_errno = GRUB_ERR_NONE;
+}
+
 struct find_file_closure
 {
   char *name;
@@ -83,12 +221,16 @@ iterate (const char *filename,
   return 1;
 }
 
+/* Lookup CURRPATH from CURRROOT, which is the path BASE from the root,
+   used to key the cache.  */
 static grub_err_t
-find_file (const char *currpath, grub_fshelp_node_t currroot,
+find_file (const char *currpath, const char *base, grub_fshelp_node_t currroot,
 	   grub_fshelp_node_t *currfound,
 	   struct grub_fshelp_find_file_closure *c)
 {
   char fpath[grub_strlen (currpath) + 1];
+  char key[grub_strlen (base) + grub_strlen (currpath) + 2];
+  grub_size_t keylen;
   char *name = fpath;
   char *next;
   enum grub_fshelp_filetype type = GRUB_FSHELP_DIR;
@@ -98,6 +240,8 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
   c->currroot = currroot;
 
   grub_strncpy (fpath, currpath, grub_strlen (currpath) + 1);
+  grub_strcpy (key, base);
+  keylen = grub_strlen (key);
 
   /* Remove all leading slashes.  */
   while (*name == '/')
@@ -111,7 +255,8 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 
   for (;;)
     {
-      int found;
+      int found = 0;
+      grub_size_t parentlen = keylen;
       struct find_file_closure cc;
 
       /* Extract the actual part from the pathname.  */
@@ -131,24 +276,68 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 	  return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a directory");
 	}
 
-      cc.name = name;
-      cc.type = &type;
-      cc.oldnode = &oldnode;
-      cc.currnode = &currnode;
-      /* Iterate over the directory.  */
-      found = c->iterate_dir (currnode, iterate, &cc);
+      key[keylen++] = '/';
+      grub_strcpy (key + keylen, name);
+      keylen += grub_strlen (name);
+
+      if (c->disk)
+	{
+	  grub_fshelp_node_t node;
+
+	  if (grub_fshelp_cache_fetch (c, key, &type, &node))
+	    {
+	      if (! node)
+		break;
+
+	      oldnode = currnode;
+	      currnode = node;
+	      found = 1;
+	    }
+	}
+
       if (! found)
 	{
-	  if (grub_errno)
-	    return grub_errno;
+	  grub_fshelp_node_t node;
+
+	  /* Use the index of the directory, if it has one.  */
+	  found = -1;
+	  if (c->find_entry)
+	    found = c->find_entry (currnode, name, &node, &type);
+
+	  if (found > 0)
+	    {
+	      oldnode = currnode;
+	      currnode = node;
+	    }
+	  else if (found < 0)
+	    {
+	      cc.name = name;
+	      cc.type = &type;
+	      cc.oldnode = &oldnode;
+	      cc.currnode = &currnode;
+	      /* Iterate over the directory.  */
+	      found = c->iterate_dir (currnode, iterate, &cc);
+	    }
 
-	  break;
+	  if (! found)
+	    {
+	      if (grub_errno)
+		return grub_errno;
+
+	      if (c->disk)
+		grub_fshelp_cache_store (c, key, type, 0);
+	      break;
+	    }
+
+	  if (c->disk)
+	    grub_fshelp_cache_store (c, key, type, currnode);
 	}
 
       /* Read in the symlink and follow it.  */
       if (type == GRUB_FSHELP_SYMLINK)
 	{
 	  char *symlink;
+	  char saved;
 
 	  /* Test if the symlink does not loop.  */
 	  if (++(c->symlinknest) == 8)
@@ -173,10 +362,14 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
 	    {
 	      free_node (oldnode, c);
 	      oldnode = c->rootnode;
+	      parentlen = 0;
 	    }
 
 	  /* Lookup the node the symlink points to.  */
-	  find_file (symlink, oldnode, &currnode, c);
+	  saved = key[parentlen];
+	  key[parentlen] = '\0';
+	  find_file (symlink, key, oldnode, &currnode, c);
+	  key[parentlen] = saved;
 	  type = c->foundtype;
 	  grub_free (symlink);
 
@@ -203,6 +396,32 @@ find_file (const char *currpath, grub_fshelp_node_t currroot,
   return grub_error (GRUB_ERR_FILE_NOT_FOUND, "file not found");
 }
 
+static grub_err_t
+find_path (const char *path, grub_fshelp_node_t *foundnode,
+	   enum grub_fshelp_filetype expecttype,
+	   struct grub_fshelp_find_file_closure *c)
+{
+  grub_err_t err;
+
+  if (!path || path[0] != '/')
+    {
+      grub_error (GRUB_ERR_BAD_FILENAME, "bad filename");
+      return grub_errno;
+    }
+
+  err = find_file (path, "", c->rootnode, foundnode, c);
+  if (err)
+    return err;
+
+  /* Check if the node that was found was of the expected type.  */
+  if (expecttype == GRUB_FSHELP_REG && c->foundtype != expecttype)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a regular file");
+  else if (expecttype == GRUB_FSHELP_DIR && c->foundtype != expecttype)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a directory");
+
+  return 0;
+}
+
 /* Lookup the node PATH.  The node ROOTNODE describes the root of the
    directory tree.  The node found is returned in FOUNDNODE, which is
    either a ROOTNODE or a new malloc'ed node.  ITERATE_DIR is used to
@@ -226,40 +445,95 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 		       char *(*read_symlink) (grub_fshelp_node_t node),
 		       enum grub_fshelp_filetype expecttype)
 {
-  grub_err_t err;
   struct grub_fshelp_find_file_closure c;
 
   c.rootnode = rootnode;
   c.iterate_dir = iterate_dir;
+  c.find_entry = 0;
   c.closure = closure;
   c.read_symlink = read_symlink;
   c.symlinknest = 0;
   c.foundtype = GRUB_FSHELP_DIR;
+  c.disk = 0;
 
-  if (!path || path[0] != '/')
+  return find_path (path, foundnode, expecttype, &c);
+}
+
+/* Like grub_fshelp_find_file, but the nodes found on DISK are cached, so
+   that the directories of a path are not read again by later lookups.
+   The nodes are NODE_SIZE bytes and must start with a pointer to the
+   data of the mount, which is set from ROOTNODE in the copies returned
+   from the cache.  ROOTNODE must be the root of the filesystem.
+   FIND_ENTRY, if not NULL, looks NAME up in the index of the directory
+   DIR, and returns 1 if it is found, 0 if not, or -1 if DIR has no index
+   so ITERATE_DIR has to be used instead.  */
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      int (*iterate_dir) (grub_fshelp_node_t dir,
+						  int (*hook)
+						  (const char *filename,
+						   enum grub_fshelp_filetype filetype,
+						   grub_fshelp_node_t node,
+						   void *closure),
+						  void *closure),
+			      int (*find_entry) (grub_fshelp_node_t dir,
+						 const char *name,
+						 grub_fshelp_node_t *foundnode,
+						 enum grub_fshelp_filetype
+						 *foundtype),
+			      char *(*read_symlink) (grub_fshelp_node_t node),
+			      enum grub_fshelp_filetype expecttype,
+			      grub_disk_t disk, grub_size_t node_size)
+{
+  struct grub_fshelp_find_file_closure c;
+
+  /* The mounts the cache was built for may be gone.  */
+  if (grub_fshelp_cache_generation != grub_fs_mount_generation)
     {
-      grub_error (GRUB_ERR_BAD_FILENAME, "bad filename");
-      return grub_errno;
+      grub_fshelp_cache_invalidate_all ();
+      grub_fshelp_cache_generation = grub_fs_mount_generation;
     }
 
-  err = find_file (path, rootnode, foundnode, &c);
-  if (err)
-    return err;
+  c.rootnode = rootnode;
+  c.iterate_dir = iterate_dir;
+  c.find_entry = find_entry;
+  c.closure = 0;
+  c.read_symlink = read_symlink;
+  c.symlinknest = 0;
+  c.foundtype = GRUB_FSHELP_DIR;
+  c.disk = disk;
+  c.start = grub_partition_get_start (disk->partition);
+  c.node_size = node_size;
 
-  /* Check if the node that was found was of the expected type.  */
-  if (expecttype == GRUB_FSHELP_REG && c.foundtype != expecttype)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a regular file");
-  else if (expecttype == GRUB_FSHELP_DIR && c.foundtype != expecttype)
-    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a directory");
+  return find_path (path, foundnode, expecttype, &c);
+}
 
-  return 0;
+/* Read the SIZE bytes at OFFSET of the disk block BLKNR into BUF.  */
+static grub_err_t
+read_run (grub_disk_t disk, grub_disk_addr_t blknr, int offset,
+	  grub_size_t size, char *buf,
+	  void (*read_hook) (grub_disk_addr_t sector,
+			     unsigned offset,
+			     unsigned length,
+			     void *closure),
+	  void *closure, int flags)
+{
+  disk->read_hook = read_hook;
+  disk->closure = closure;
+
+  grub_disk_read_ex (disk, blknr, offset, size, buf, flags);
+  disk->read_hook = 0;
+
+  return grub_errno;
 }
 
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
    blocks to disk blocks.  The file is FILESIZE bytes big and the
-   blocks have a size of LOG2BLOCKSIZE (in log2).  */
+   blocks have a size of LOG2BLOCKSIZE (in log2).  Blocks which follow
+   each other on disk are read in one request.  */
 grub_ssize_t
 grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 		       void (*read_hook) (grub_disk_addr_t sector,
@@ -274,6 +548,11 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 {
   grub_disk_addr_t i, blockcnt;
   int blocksize = 1 << (log2blocksize + GRUB_DISK_SECTOR_BITS);
+  /* The blocks read so far and not yet requested from the disk.  */
+  grub_disk_addr_t runstart = 0, runnext = 0;
+  int runoff = 0;
+  grub_size_t runsize = 0;
+  char *runbuf = buf;
 
   /* Adjust LEN so it we can't read past the end of the file.  */
   if (pos + len > filesize)
@@ -315,23 +594,35 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 
       /* If the block number is 0 this block is not stored on disk but
 	 is zero filled instead.  */
-      if (blknr)
+      if (blknr && runsize && blknr == runnext)
+	runsize += blockend;
+      else
 	{
-	  disk->read_hook = read_hook;
-	  disk->closure = closure;
-
-	  grub_disk_read_ex (disk, blknr, skipfirst, blockend, buf, flags);
-	  disk->read_hook = 0;
-	  if (grub_errno)
+	  if (runsize && read_run (disk, runstart, runoff, runsize, runbuf,
+				   read_hook, closure, flags))
 	    return -1;
+
+	  runsize = 0;
+	  if (blknr)
+	    {
+	      runstart = blknr;
+	      runoff = skipfirst;
+	      runsize = blockend;
+	      runbuf = buf;
+	    }
+	  else if (buf)
+	    grub_memset (buf, 0, blockend);
 	}
-      else if (buf)
-	grub_memset (buf, 0, blockend);
+      runnext = blknr + (1 << log2blocksize);
 
       if (buf)
 	buf += blocksize - skipfirst;
     }
 
+  if (runsize && read_run (disk, runstart, runoff, runsize, runbuf,
+			   read_hook, closure, flags))
+    return -1;
+
   return len;
 }
 
@@ -355,3 +646,8 @@ grub_fshelp_log2blksize (unsigned int blksize, unsigned int *pow)
 
   return GRUB_ERR_NONE;
 }
+
+GRUB_MOD_FINI(fshelp)
+{
+  grub_fshelp_cache_invalidate_all ();
+}
@@ -164,6 +164,9 @@ struct grub_hfsplus_catfile
 #define GRUB_HFSPLUS_FILEID_OVERFLOW	3
 #define GRUB_HFSPLUS_FILEID_CATALOG	4
 
+/* The maximum length of a filename, in UTF-16 characters.  */
+#define GRUB_HFSPLUS_MAX_NAMELEN	255
+
 enum grub_hfsplus_filetype
   {
     GRUB_HFSPLUS_FILETYPE_DIR = 1,
@@ -207,6 +210,22 @@ struct grub_fshelp_node
   grub_uint64_t size;
   grub_uint32_t fileid;
   grub_int32_t mtime;
+
+  /* The extents of the last extent overflow record used, which start at
+     block OVERFLOW_START of the file, or 0 if there is none.  */
+  grub_uint32_t overflow_start;
+  struct grub_hfsplus_extent overflow[8];
+};
+
+/* The number of nodes cached for every B+ tree.  */
+#define GRUB_HFSPLUS_BTNODE_CACHE	8
+
+struct grub_hfsplus_btnode_cache
+{
+  /* The number of the node, 0 if the entry is unused.  */
+  grub_uint32_t number;
+  unsigned long last_use;
+  char *node;
 };
 
 struct grub_hfsplus_btree
@@ -216,6 +235,11 @@ struct grub_hfsplus_btree
 
   /* Catalog file node.  */
   struct grub_fshelp_node file;
+
+  /* The nodes read last.  Index nodes, which every search goes through,
+     are only replaced when there is no leaf to replace.  */
+  struct grub_hfsplus_btnode_cache cache[GRUB_HFSPLUS_BTNODE_CACHE];
+  unsigned long cache_clock;
 };
 
 /* Information about a "mounted" HFS+ filesystem.  */
@@ -267,6 +291,91 @@ grub_hfsplus_btree_recptr (struct grub_hfsplus_btree *btree,
 }
 
 
+static grub_ssize_t
+grub_hfsplus_read_file (grub_fshelp_node_t node,
+			void (*read_hook) (grub_disk_addr_t sector,
+					   unsigned offset, unsigned length,
+					   void *closure),
+			void *closure, int flags,
+			int pos, grub_size_t len, char *buf);
+
+/* Return the node NUMBER of the B+ tree BTREE.  The node is cached, it
+   stays valid until other nodes of BTREE replace it.  */
+static struct grub_hfsplus_btnode *
+grub_hfsplus_btree_read_node (struct grub_hfsplus_btree *btree,
+			      grub_uint32_t number)
+{
+  struct grub_hfsplus_btnode_cache *cache, *victim = 0;
+  int i, leaf, victim_leaf = 0;
+
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE; i++)
+    {
+      cache = &btree->cache[i];
+      if (cache->number == number && cache->node)
+	{
+	  cache->last_use = ++btree->cache_clock;
+	  return (struct grub_hfsplus_btnode *) cache->node;
+	}
+
+      /* Replace an unused entry, or else the least recently used leaf,
+	 so that the upper levels of the tree stay cached.  */
+      if (victim && ! victim->number)
+	continue;
+
+      if (! cache->number)
+	{
+	  victim = cache;
+	  continue;
+	}
+
+      leaf = (((struct grub_hfsplus_btnode *) cache->node)->type
+	      != GRUB_HFSPLUS_BTNODE_TYPE_INDEX);
+      if (! victim || (leaf && ! victim_leaf)
+	  || (leaf == victim_leaf && cache->last_use < victim->last_use))
+	{
+	  victim = cache;
+	  victim_leaf = leaf;
+	}
+    }
+
+  if (! victim->node)
+    {
+      victim->node = grub_malloc (btree->nodesize);
+      if (! victim->node)
+	return 0;
+    }
+
+  victim->number = 0;
+  if (grub_hfsplus_read_file (&btree->file, 0, 0, 0,
+			      (long) number * (long) btree->nodesize,
+			      btree->nodesize, victim->node) <= 0)
+    return 0;
+
+  victim->number = number;
+  victim->last_use = ++btree->cache_clock;
+  return (struct grub_hfsplus_btnode *) victim->node;
+}
+
+static void
+grub_hfsplus_btree_free (struct grub_hfsplus_btree *btree)
+{
+  int i;
+
+  for (i = 0; i < GRUB_HFSPLUS_BTNODE_CACHE; i++)
+    grub_free (btree->cache[i].node);
+}
+
+static void
+grub_hfsplus_unmount (struct grub_hfsplus_data *data)
+{
+  if (! data)
+    return;
+
+  grub_hfsplus_btree_free (&data->catalog_tree);
+  grub_hfsplus_btree_free (&data->extoverflow_tree);
+  grub_free (data);
+}
+
 /* Find the extent that points to FILEBLOCK.  If it is not in one of
    the 8 extents described by EXTENT, return -1.  In that case set
    FILEBLOCK to the next block.  */
@@ -308,6 +417,14 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   int blksleft = fileblock;
   struct grub_hfsplus_extent *extents = &node->extents[0];
 
+  /* Start from the last extent overflow record used, if the block is not
+     before it.  */
+  if (node->overflow_start && fileblock >= node->overflow_start)
+    {
+      blksleft = fileblock - node->overflow_start;
+      extents = &node->overflow[0];
+    }
+
   while (1)
     {
       struct grub_hfsplus_extkey *key;
@@ -318,11 +435,6 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
       /* Try to find this block in the current set of extents.  */
       blk = grub_hfsplus_find_block (extents, &blksleft);
 
-      /* The previous iteration of this loop allocated memory.  The
-	 code above used this memory, it can be freed now.  */
-      grub_free (nnode);
-      nnode = 0;
-
       if (blk != -1)
 	return (blk
 		+ (node->data->embedded_offset >> (node->data->log2blksize
@@ -352,17 +464,18 @@ grub_hfsplus_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 	  break;
 	}
 
-      /* The extent overflow file has 8 extents right after the key.  */
+      /* The extent overflow file has 8 extents right after the key.  They
+	 are kept in NODE, as the B+ tree node may be replaced.  */
       key = (struct grub_hfsplus_extkey *)
 	grub_hfsplus_btree_recptr (&node->data->extoverflow_tree, nnode, ptr);
-      extents = (struct grub_hfsplus_extent *) (key + 1);
+      grub_memcpy (node->overflow, key + 1, sizeof (node->overflow));
+      node->overflow_start = extoverflow.start;
+      extents = &node->overflow[0];
 
       /* The block wasn't found.  Perhaps the next iteration will find
 	 it.  The last block we found is stored in BLKSLEFT now.  */
     }
 
-  grub_free (nnode);
-
   /* Too bad, you lose.  */
   return -1;
 }
@@ -396,7 +509,7 @@ grub_hfsplus_mount (grub_disk_t disk)
     struct grub_hfsplus_volheader hfsplus;
   } volheader;
 
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (!data)
     return 0;
 
@@ -506,7 +619,7 @@ grub_hfsplus_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a HFS+ filesystem");
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
   return 0;
 }
 
@@ -518,35 +631,27 @@ grub_hfsplus_cmp_catkey (struct grub_hfsplus_key *keya,
 {
   struct grub_hfsplus_catkey *catkey_a = &keya->catkey;
   struct grub_hfsplus_catkey_internal *catkey_b = &keyb->catkey;
-  char *filename;
-  int i;
+  grub_uint16_t name[GRUB_HFSPLUS_MAX_NAMELEN];
+  char filename[GRUB_HFSPLUS_MAX_NAMELEN * 3 + 1];
+  int i, namelen;
   int diff;
 
   diff = grub_be_to_cpu32 (catkey_a->parent) - catkey_b->parent;
   if (diff)
     return diff;
 
-  /* Change the filename in keya so the endianness is correct.  */
-  for (i = 0; i < grub_be_to_cpu16 (catkey_a->namelen); i++)
-    catkey_a->name[i] = grub_be_to_cpu16 (catkey_a->name[i]);
-
-  filename = grub_malloc (grub_be_to_cpu16 (catkey_a->namelen) + 1);
-
-  if (! grub_utf16_to_utf8 ((grub_uint8_t *) filename, catkey_a->name,
-			    grub_be_to_cpu16 (catkey_a->namelen)))
-    return -1; /* XXX: This error never occurs, but in case it happens
-		  just skip this entry.  */
+  namelen = grub_be_to_cpu16 (catkey_a->namelen);
+  if (namelen > GRUB_HFSPLUS_MAX_NAMELEN)
+    return -1;
 
-  diff = grub_strncmp (filename, catkey_b->name,
-		       grub_be_to_cpu16 (catkey_a->namelen));
+  /* Convert a copy of the filename so the endianness is correct, keya
+     is part of a cached node.  */
+  for (i = 0; i < namelen; i++)
+    name[i] = grub_be_to_cpu16 (catkey_a->name[i]);
 
-  grub_free (filename);
+  *grub_utf16_to_utf8 ((grub_uint8_t *) filename, name, namelen) = '\0';
 
-  /* The endianness was changed to host format, change it back to
-     whatever it was.  */
-  for (i = 0; i < grub_be_to_cpu16 (catkey_a->namelen); i++)
-    catkey_a->name[i] = grub_cpu_to_be16 (catkey_a->name[i]);
-  return diff;
+  return grub_strncmp (filename, catkey_b->name, namelen);
 }
 
 /* Compare the on disk extent overflow key KEYA with the extent
@@ -600,8 +705,6 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 
   for (;;)
     {
-      char *cnode = (char *) first_node;
-
       /* Iterate over all records in this node.  */
       for (rec = first_rec; rec < grub_be_to_cpu16 (first_node->count); rec++)
 	{
@@ -612,10 +715,10 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
       if (! first_node->next)
 	break;
 
-      if (grub_hfsplus_read_file (&btree->file, 0, 0, 0,
-				  (grub_be_to_cpu32 (first_node->next)
-				   * btree->nodesize),
-				  btree->nodesize, cnode) <= 0)
+      first_node = grub_hfsplus_btree_read_node (btree,
+						 grub_be_to_cpu32
+						 (first_node->next));
+      if (! first_node)
 	return 1;
 
       /* Don't skip any record in the next iteration.  */
@@ -628,7 +731,7 @@ grub_hfsplus_btree_iterate_node (struct grub_hfsplus_btree *btree,
 /* Lookup the node described by KEY in the B+ Tree BTREE.  Compare
    keys using the function COMPARE_KEYS.  When a match is found,
    return the node in MATCHNODE and a pointer to the data in this node
-   in KEYOFFSET.  MATCHNODE should be freed by the caller.  */
+   in KEYOFFSET.  MATCHNODE is cached by BTREE and must not be freed.  */
 static grub_err_t
 grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 			   struct grub_hfsplus_key_internal *key,
@@ -636,80 +739,85 @@ grub_hfsplus_btree_search (struct grub_hfsplus_btree *btree,
 						struct grub_hfsplus_key_internal *keyb),
 			   struct grub_hfsplus_btnode **matchnode, int *keyoffset)
 {
-  grub_uint64_t currnode;
-  char *node;
+  grub_uint32_t currnode;
   struct grub_hfsplus_btnode *nodedesc;
-  int rec;
-
-  node = grub_malloc (btree->nodesize);
-  if (! node)
-    return grub_errno;
 
   currnode = btree->root;
   while (1)
     {
-      int match = 0;
+      int low, high, rec;
+      struct grub_hfsplus_key *currkey;
 
       /* Read a node.  */
-      if (grub_hfsplus_read_file (&btree->file, 0, 0, 0,
-				  (long)currnode * (long)btree->nodesize,
-				  btree->nodesize, (char *) node) <= 0)
+      nodedesc = grub_hfsplus_btree_read_node (btree, currnode);
+      if (! nodedesc)
+	return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
+
+      /* The records are sorted, find the last one whose key is lower or
+	 equal to the key that we are looking for.  */
+      low = 0;
+      high = grub_be_to_cpu16 (nodedesc->count) - 1;
+      rec = -1;
+      while (low <= high)
 	{
-	  grub_free (node);
-	  return grub_error (GRUB_ERR_BAD_FS, "couldn't read i-node");
-	}
-
-      nodedesc = (struct grub_hfsplus_btnode *) node;
+	  int mid = (low + high) / 2;
 
-      /* Find the record in this tree.  */
-      for (rec = 0; rec < grub_be_to_cpu16 (nodedesc->count); rec++)
-	{
-	  struct grub_hfsplus_key *currkey;
-	  currkey = grub_hfsplus_btree_recptr (btree, nodedesc, rec);
-
-	  /* The action that has to be taken depend on the type of
-	     record.  */
-	  if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_LEAF
-	      && compare_keys (currkey, key) == 0)
-	    {
-	      /* An exact match was found!  */
-
-	      *matchnode = nodedesc;
-	      *keyoffset = rec;
-
-	      return 0;
-	    }
-	  else if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_INDEX)
+	  currkey = grub_hfsplus_btree_recptr (btree, nodedesc, mid);
+	  if (compare_keys (currkey, key) > 0)
+	    high = mid - 1;
+	  else
 	    {
-	      grub_uint32_t *pointer;
-
-	      /* The place where the key could have been found didn't
-		 contain the key.  This means that the previous match
-		 is the one that should be followed.  */
-	      if (compare_keys (currkey, key) > 0)
-		break;
-
-	      /* Mark the last key which is lower or equal to the key
-		 that we are looking for.  The last match that is
-		 found will be used to locate the child which can
-		 contain the record.  */
-	      pointer = (grub_uint32_t *) ((char *) currkey
-					   + grub_be_to_cpu16 (currkey->keylen)
-					   + 2);
-	      currnode = grub_be_to_cpu32 (*pointer);
-	      match = 1;
+	      rec = mid;
+	      low = mid + 1;
 	    }
 	}
 
       /* No match is found, no record with this key exists in the
 	 tree.  */
-      if (! match)
+      if (rec < 0)
+	break;
+
+      currkey = grub_hfsplus_btree_recptr (btree, nodedesc, rec);
+
+      /* The action that has to be taken depend on the type of
+	 record.  */
+      if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_LEAF)
 	{
-	  *matchnode = 0;
-	  grub_free (node);
-	  return 1;
+	  /* The comparison does not fold case like the on disk order
+	     does, so scan the whole leaf before giving up.  */
+	  if (compare_keys (currkey, key) != 0)
+	    for (rec = 0; rec < grub_be_to_cpu16 (nodedesc->count); rec++)
+	      {
+		currkey = grub_hfsplus_btree_recptr (btree, nodedesc, rec);
+		if (compare_keys (currkey, key) == 0)
+		  break;
+	      }
+
+	  if (rec == grub_be_to_cpu16 (nodedesc->count))
+	    break;
+
+	  /* An exact match was found!  */
+	  *matchnode = nodedesc;
+	  *keyoffset = rec;
+
+	  return 0;
+	}
+      else if (nodedesc->type == GRUB_HFSPLUS_BTNODE_TYPE_INDEX)
+	{
+	  grub_uint32_t *pointer;
+
+	  /* The child which can contain the record follows the key.  */
+	  pointer = (grub_uint32_t *) ((char *) currkey
+				       + grub_be_to_cpu16 (currkey->keylen)
+				       + 2);
+	  currnode = grub_be_to_cpu32 (*pointer);
 	}
+      else
+	break;
     }
+
+  *matchnode = 0;
+  return 1;
 }
 
 struct grub_hfsplus_iterate_dir_closure
@@ -728,8 +836,9 @@ list_nodes (void *record, void *closure)
 {
   struct grub_hfsplus_iterate_dir_closure *c = closure;
   struct grub_hfsplus_catkey *catkey;
-  char *filename;
-  int i;
+  grub_uint16_t name[GRUB_HFSPLUS_MAX_NAMELEN];
+  char *filename, *end;
+  int i, namelen;
   struct grub_fshelp_node *node;
   struct grub_hfsplus_catfile *fileinfo;
   enum grub_fshelp_filetype type = GRUB_FSHELP_UNKNOWN;
@@ -765,44 +874,41 @@ list_nodes (void *record, void *closure)
   if (type == GRUB_FSHELP_UNKNOWN)
     return 0;
 
-  /* Make sure the byte order of the UTF16 string is correct.  */
-  for (i = 0; i < grub_be_to_cpu16 (catkey->namelen); i++)
+  namelen = grub_be_to_cpu16 (catkey->namelen);
+  if (namelen > GRUB_HFSPLUS_MAX_NAMELEN)
+    return 0;
+
+  /* Make sure the byte order of the UTF16 string is correct.  The key
+     lives in the node cache, so convert a copy of it.  */
+  for (i = 0; i < namelen; i++)
     {
-      catkey->name[i] = grub_be_to_cpu16 (catkey->name[i]);
+      name[i] = grub_be_to_cpu16 (catkey->name[i]);
 
       /* If the name is obviously invalid, skip this node.  */
-      if (catkey->name[i] == 0)
+      if (name[i] == 0)
 	return 0;
     }
 
-  filename = grub_malloc (grub_be_to_cpu16 (catkey->namelen) + 1);
+  filename = grub_malloc (namelen * 3 + 1);
   if (! filename)
     return 0;
 
-  if (! grub_utf16_to_utf8 ((grub_uint8_t *) filename, catkey->name,
-			    grub_be_to_cpu16 (catkey->namelen)))
-    {
-      grub_free (filename);
-      return 0;
-    }
-
-  filename[grub_be_to_cpu16 (catkey->namelen)] = '\0';
-
-  /* Restore the byte order to what it was previously.  */
-  for (i = 0; i < grub_be_to_cpu16 (catkey->namelen); i++)
-    catkey->name[i] = grub_be_to_cpu16 (catkey->name[i]);
+  end = (char *) grub_utf16_to_utf8 ((grub_uint8_t *) filename, name,
+				     namelen);
+  *end = '\0';
 
   /* hfs+ is case insensitive.  */
   if (! c->dir->data->case_sensitive)
     type |= GRUB_FSHELP_CASE_INSENSITIVE;
 
   /* Only accept valid nodes.  */
-  if (grub_strlen (filename) == grub_be_to_cpu16 (catkey->namelen))
+  if (grub_strlen (filename) == (grub_size_t) (end - filename))
     {
       /* A valid node is found; setup the node and call the
 	 callback function.  */
       node = grub_malloc (sizeof (*node));
       node->data = c->dir->data;
+      node->overflow_start = 0;
 
       grub_memcpy (node->extents, fileinfo->data.extents,
 		   sizeof (node->extents));
@@ -848,8 +954,6 @@ grub_hfsplus_iterate_dir (grub_fshelp_node_t dir,
   grub_hfsplus_btree_iterate_node (&dir->data->catalog_tree, node, ptr,
 				   list_nodes, &c);
 
-  grub_free (node);
-
   return c.ret;
 }
 
@@ -866,9 +970,10 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir, 0,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->dirroot, &fdiro,
+				grub_hfsplus_iterate_dir, 0,
+				grub_hfsplus_read_symlink, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -884,7 +989,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -895,7 +1000,7 @@ grub_hfsplus_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_hfsplus_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_hfsplus_unmount (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -959,9 +1064,10 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
     goto fail;
 
   /* Find the directory that should be opened.  */
-  grub_fshelp_find_file (path, &data->dirroot, &fdiro,
-			 grub_hfsplus_iterate_dir, 0,
-			 grub_hfsplus_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->dirroot, &fdiro,
+				grub_hfsplus_iterate_dir, 0,
+				grub_hfsplus_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
 
@@ -973,7 +1079,7 @@ grub_hfsplus_dir (grub_device_t device, const char *path,
  fail:
   if (data && fdiro != &data->dirroot)
     grub_free (fdiro);
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   grub_dl_unref (my_mod);
 
@@ -1008,7 +1114,7 @@ grub_hfsplus_mtime (grub_device_t device, grub_int32_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 
@@ -1034,7 +1140,7 @@ grub_hfsplus_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_hfsplus_unmount (data);
 
   return grub_errno;
 }
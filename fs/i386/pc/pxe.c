@@ -265,6 +265,7 @@ grub_pxefs_read (grub_file_t file, char *buf, grub_size_t len)
   struct grub_pxe_data *data;
   struct grub_pxe_disk_data *disk_data = file->device->disk->data;
   grub_uint32_t pn, r;
+  grub_ssize_t res;
 
   data = file->data;
 
@@ -300,21 +301,36 @@ grub_pxefs_read (grub_file_t file, char *buf, grub_size_t len)
     }
 
   c.buffer = SEGOFS (GRUB_MEMORY_MACHINE_SCRATCH_ADDR);
-  while (pn >= data->packet_number)
+  res = len;
+  while (1)
     {
-      c.buffer_size = data->block_size;
-      grub_pxe_call (GRUB_PXENV_TFTP_READ, &c);
-      if (c.status)
-        {
-          grub_error (GRUB_ERR_BAD_FS, "read fails");
-          return -1;
-        }
-      data->packet_number++;
-    }
+      grub_size_t n;
 
-  grub_memcpy (buf, (char *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR, len);
+      while (pn >= data->packet_number)
+	{
+	  c.buffer_size = data->block_size;
+	  grub_pxe_call (GRUB_PXENV_TFTP_READ, &c);
+	  if (c.status)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "read fails");
+	      return -1;
+	    }
+	  data->packet_number++;
+	}
+
+      /* Reads may span several packets.  */
+      n = len;
+      if (n > data->block_size)
+	n = data->block_size;
+      grub_memcpy (buf, (char *) GRUB_MEMORY_MACHINE_SCRATCH_ADDR, n);
+      buf += n;
+      len -= n;
+      if (! len)
+	break;
+      pn++;
+    }
 
-  return len;
+  return res;
 }
 
 static grub_err_t
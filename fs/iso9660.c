@@ -36,6 +36,9 @@
 #define GRUB_ISO9660_LOG2_BLKSZ		2
 #define GRUB_ISO9660_BLKSZ		2048
 
+/* The largest part of a directory read at once.  */
+#define GRUB_ISO9660_DIR_CHUNK		(16 * GRUB_ISO9660_BLKSZ)
+
 #define GRUB_ISO9660_RR_DOT		2
 #define GRUB_ISO9660_RR_DOTDOT		4
 
@@ -139,6 +142,11 @@ struct grub_iso9660_data
   int rockridge;
   int susp_skip;
   int joliet;
+
+  /* The block holding the last SUSP continuation area read, 0 if
+     none.  */
+  grub_uint32_t ce_blk;
+  char ce_buf[GRUB_ISO9660_BLKSZ];
 };
 
 struct grub_fshelp_node
@@ -153,48 +161,48 @@ struct grub_fshelp_node
 static grub_dl_t my_mod;
 
 
+/* Return the SUSP continuation area of LEN bytes at offset OFF of the
+   block BLK.  It stays valid until the next one is loaded.  */
 static char *
-load_sua (struct grub_iso9660_data *data, int sua_block, int sua_pos,
-	  int sua_size)
+grub_iso9660_load_ce (struct grub_iso9660_data *data, grub_uint32_t blk,
+		      grub_uint32_t off, grub_uint32_t len)
 {
-  char *sua;
-
-  sua = grub_malloc (sua_size);
-  if (!sua)
-    return 0;
-
-  if (grub_disk_read (data->disk, sua_block, sua_pos, sua_size, sua))
+  /* A continuation area doesn't cross a block boundary.  */
+  if (off >= GRUB_ISO9660_BLKSZ || len > GRUB_ISO9660_BLKSZ - off)
     {
-      grub_free (sua);
+      grub_error (GRUB_ERR_BAD_FS, "invalid continuation area");
       return 0;
     }
 
-  return sua;
+  if (data->ce_blk != blk)
+    {
+      data->ce_blk = 0;
+      if (grub_disk_read (data->disk, blk << GRUB_ISO9660_LOG2_BLKSZ, 0,
+			  GRUB_ISO9660_BLKSZ, data->ce_buf))
+	return 0;
+      data->ce_blk = blk;
+    }
+
+  return data->ce_buf + off;
 }
 
-/* Iterate over the susp entries, starting with block SUA_BLOCK on the
-   offset SUA_POS with a size of SUA_SIZE bytes.  Hook is called for
-   every entry.  */
+/* Iterate over the susp entries in SUA, of SUA_SIZE bytes, and the
+   continuation areas it points to.  Hook is called for every entry.  */
 static grub_err_t
 grub_iso9660_susp_iterate (struct grub_iso9660_data *data,
-			   int sua_block, int sua_pos, int sua_size,
+			   char *sua, int sua_size,
 			   grub_err_t (*hook)
 			   (struct grub_iso9660_susp_entry *entry,
 			    void *closure),
 			   void *closure)
 {
-  char *sua;
   struct grub_iso9660_susp_entry *entry;
+  int ce_count = 0;
 
-  /* Load a part of the System Usage Area.  */
-  sua = load_sua (data, sua_block, sua_pos, sua_size);
-  if (!sua)
-    return grub_errno;
   entry = (struct grub_iso9660_susp_entry *) sua;
-
-  for (; (char *) entry < (char *) sua + sua_size - 1;
-       entry = (struct grub_iso9660_susp_entry *)
-	 ((char *) entry + entry->len))
+  while ((char *) entry + sizeof (*entry) <= sua + sua_size
+	 && entry->len >= sizeof (*entry)
+	 && (char *) entry + entry->len <= sua + sua_size)
     {
       /* The last entry.  */
       if (grub_strncmp ((char *) entry->sig, "ST", 2) == 0)
@@ -205,26 +213,25 @@ grub_iso9660_susp_iterate (struct grub_iso9660_data *data,
 	{
 	  struct grub_iso9660_susp_ce *ce;
 
+	  if (++ce_count > 16)
+	    return grub_error (GRUB_ERR_BAD_FS, "too many continuation areas");
+
 	  ce = (struct grub_iso9660_susp_ce *) entry;
 	  sua_size = grub_le_to_cpu32 (ce->len);
-	  sua_pos = grub_le_to_cpu32 (ce->off);
-	  sua_block = grub_le_to_cpu32 (ce->blk) << GRUB_ISO9660_LOG2_BLKSZ;
-
-	  grub_free (sua);
-	  sua = load_sua (data, sua_block, sua_pos, sua_size);
+	  sua = grub_iso9660_load_ce (data, grub_le_to_cpu32 (ce->blk),
+				      grub_le_to_cpu32 (ce->off), sua_size);
 	  if (!sua)
 	    return grub_errno;
 	  entry = (struct grub_iso9660_susp_entry *) sua;
+	  continue;
 	}
 
       if (hook (entry, closure))
-	{
-	  grub_free (sua);
-	  return 0;
-	}
+	return 0;
+
+      entry = (struct grub_iso9660_susp_entry *) ((char *) entry + entry->len);
     }
 
-  grub_free (sua);
   return 0;
 }
 
@@ -265,10 +272,10 @@ static struct grub_iso9660_data *
 grub_iso9660_mount (grub_disk_t disk)
 {
   struct grub_iso9660_data *data = 0;
-  struct grub_iso9660_dir rootdir;
+  struct grub_iso9660_dir *rootdir;
+  char record[255];
   int sua_pos;
   int sua_size;
-  char *sua;
   struct grub_iso9660_susp_entry *entry;
   struct grub_iso9660_primary_voldesc voldesc;
   int block;
@@ -318,50 +325,35 @@ grub_iso9660_mount (grub_disk_t disk)
       block++;
     } while (voldesc.voldesc.type != GRUB_ISO9660_VOLDESC_END);
 
-  /* Read the system use area and test it to see if SUSP is
-     supported.  */
+  /* Read the root directory entry with its system use area and test it
+     to see if SUSP is supported.  */
   if (grub_disk_read (disk,
 		      (grub_le_to_cpu32 (data->voldesc.rootdir.first_sector)
 		       << GRUB_ISO9660_LOG2_BLKSZ), 0,
-		      sizeof (rootdir), (char *) &rootdir))
+		      sizeof (record), record))
     {
       grub_error (GRUB_ERR_BAD_FS, "not a ISO9660 filesystem");
       goto fail;
     }
 
-  sua_pos = (sizeof (rootdir) + rootdir.namelen
-	     + (rootdir.namelen % 2) - 1);
-  sua_size = rootdir.len - sua_pos;
+  rootdir = (struct grub_iso9660_dir *) record;
+  sua_pos = (sizeof (*rootdir) + rootdir->namelen
+	     + (rootdir->namelen % 2) - 1);
+  sua_size = rootdir->len - sua_pos;
 
-  sua = grub_malloc (sua_size);
-  if (! sua)
-    goto fail;
-
-  if (grub_disk_read (disk,
-		      (grub_le_to_cpu32 (data->voldesc.rootdir.first_sector)
-		       << GRUB_ISO9660_LOG2_BLKSZ), sua_pos,
-		      sua_size, sua))
-    {
-      grub_error (GRUB_ERR_BAD_FS, "not a ISO9660 filesystem");
-      goto fail;
-    }
-
-  entry = (struct grub_iso9660_susp_entry *) sua;
+  entry = (struct grub_iso9660_susp_entry *) (record + sua_pos);
 
   /* Test if the SUSP protocol is used on this filesystem.  */
-  if (grub_strncmp ((char *) entry->sig, "SP", 2) == 0)
+  if (sua_size >= 7 && grub_strncmp ((char *) entry->sig, "SP", 2) == 0)
     {
       /* The 2nd data byte stored how many bytes are skipped every time
 	 to get to the SUA (System Usage Area).  */
       data->susp_skip = entry->data[2];
-      entry = (struct grub_iso9660_susp_entry *) ((char *) entry + entry->len);
 
       /* Iterate over the entries in the SUA area to detect
 	 extensions.  */
-      if (grub_iso9660_susp_iterate (data,
-				     (grub_le_to_cpu32 (data->voldesc.rootdir.first_sector)
-				      << GRUB_ISO9660_LOG2_BLKSZ),
-				     sua_pos, sua_size, susp_iterate, data))
+      if (grub_iso9660_susp_iterate (data, record + sua_pos, sua_size,
+				     susp_iterate, data))
 	goto fail;
     }
 
@@ -403,7 +395,9 @@ susp_iterate_sl (struct grub_iso9660_susp_entry *entry, void *closure)
       unsigned int pos = 1;
 
       /* The symlink is not stored as a POSIX symlink, translate it.  */
-      while (pos < grub_le_to_cpu32 (entry->len))
+      while (pos + 2 <= (unsigned int) entry->len - sizeof (*entry)
+	     && pos + 2 + entry->data[pos + 1]
+	     <= (unsigned int) entry->len - sizeof (*entry))
 	{
 	  if (c->addslash)
 	    {
@@ -421,7 +415,8 @@ susp_iterate_sl (struct grub_iso9660_susp_entry *entry, void *closure)
 		   Record'.  */
 		add_part ((char *) &entry->data[pos + 2],
 			  entry->data[pos + 1], c);
-		if ((entry->data[pos] & 1))
+		/* Unless the component continues in the next one.  */
+		if (! (entry->data[pos] & 1))
 		  c->addslash = 1;
 
 		break;
@@ -455,18 +450,28 @@ susp_iterate_sl (struct grub_iso9660_susp_entry *entry, void *closure)
 static char *
 grub_iso9660_read_symlink (grub_fshelp_node_t node)
 {
-  struct grub_iso9660_dir dirent;
+  struct grub_iso9660_dir *dirent;
+  char record[255];
+  grub_size_t len;
   int sua_off;
   int sua_size;
   struct grub_iso9660_read_symlink_closure c;
 
+  /* Read the whole directory entry, it doesn't cross the end of the
+     block.  */
+  len = GRUB_ISO9660_BLKSZ - (((node->dir_blk & ((1 << GRUB_ISO9660_LOG2_BLKSZ)
+						 - 1))
+			       << GRUB_DISK_SECTOR_BITS) + node->dir_off);
+  if (len > sizeof (record))
+    len = sizeof (record);
   if (grub_disk_read (node->data->disk, node->dir_blk, node->dir_off,
-		      sizeof (dirent), (char *) &dirent))
+		      len, record))
     return 0;
 
-  sua_off = (sizeof (dirent) + dirent.namelen + 1 - (dirent.namelen % 2)
+  dirent = (struct grub_iso9660_dir *) record;
+  sua_off = (sizeof (*dirent) + dirent->namelen + 1 - (dirent->namelen % 2)
 	     + node->data->susp_skip);
-  sua_size = dirent.len - sua_off;
+  sua_size = dirent->len - sua_off;
 
   c.symlink = grub_malloc (1);
   if (!c.symlink)
@@ -475,9 +480,8 @@ grub_iso9660_read_symlink (grub_fshelp_node_t node)
   *c.symlink = '\0';
 
   c.addslash = 0;
-  if (grub_iso9660_susp_iterate (node->data, node->dir_blk,
-				 node->dir_off + sua_off,
-				 sua_size, susp_iterate_sl, &c))
+  if (grub_iso9660_susp_iterate (node->data, record + sua_off, sua_size,
+				 susp_iterate_sl, &c))
     {
       grub_free (c.symlink);
       return 0;
@@ -510,22 +514,22 @@ susp_iterate_dir (struct grub_iso9660_susp_entry *entry, void *closure)
 	filename = "..";
       else
 	{
-	  int size = 1;
-	  if (filename)
-	    {
-	      size += grub_strlen (filename);
-	      grub_realloc (filename,
-			    grub_strlen (filename)
-			    + entry->len);
-	    }
+	  /* A long name is split over several entries.  */
+	  int size = 0, len = entry->len - 5;
+	  char *p;
+
+	  if (c->filename_alloc)
+	    size = grub_strlen (filename);
 	  else
-	    {
-	      size = entry->len - 5;
-	      filename = grub_zalloc (size + 1);
-	    }
+	    filename = 0;
+
+	  p = grub_realloc (filename, size + len + 1);
+	  if (! p)
+	    return grub_errno;
+	  filename = p;
 	  c->filename_alloc = 1;
-	  grub_strncpy (filename, (char *) &entry->data[1], size);
-	  filename[size] = '\0';
+	  grub_memcpy (filename + size, (char *) &entry->data[1], len);
+	  filename[size + len] = '\0';
 	}
     }
   /* The mode information (st_mode).  */
@@ -564,66 +568,98 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 				       void *closure),
 			  void *closure)
 {
-  struct grub_iso9660_dir dirent;
+  struct grub_iso9660_dir *dirent;
   unsigned int offset = 0;
+  unsigned int chunk_start = 0, chunk_size = 0, chunk_max;
+  char *chunk;
   char *filename;
+  int ret = 0;
+
+  chunk_max = ((dir->size + GRUB_ISO9660_BLKSZ - 1)
+	       & ~(GRUB_ISO9660_BLKSZ - 1));
+  if (chunk_max > GRUB_ISO9660_DIR_CHUNK)
+    chunk_max = GRUB_ISO9660_DIR_CHUNK;
+
+  chunk = grub_malloc (chunk_max);
+  if (! chunk)
+    return 0;
 
   while (offset < dir->size)
     {
-      if (grub_disk_read (dir->data->disk,
-			  (dir->blk << GRUB_ISO9660_LOG2_BLKSZ)
-			  + offset / GRUB_DISK_SECTOR_SIZE,
-			  offset % GRUB_DISK_SECTOR_SIZE,
-			  sizeof (dirent), (char *) &dirent))
-	return 0;
+      unsigned int pos;
+
+      /* Read the directory whole blocks at a time, no entry crosses a
+	 block boundary.  */
+      if (offset >= chunk_start + chunk_size)
+	{
+	  chunk_start = offset & ~(GRUB_ISO9660_BLKSZ - 1);
+	  chunk_size = ((dir->size - chunk_start + GRUB_ISO9660_BLKSZ - 1)
+			& ~(GRUB_ISO9660_BLKSZ - 1));
+	  if (chunk_size > chunk_max)
+	    chunk_size = chunk_max;
+
+	  if (grub_disk_read (dir->data->disk,
+			      (dir->blk << GRUB_ISO9660_LOG2_BLKSZ)
+			      + (chunk_start >> GRUB_DISK_SECTOR_BITS),
+			      0, chunk_size, chunk))
+	    goto done;
+	}
+
+      pos = offset - chunk_start;
+      dirent = (struct grub_iso9660_dir *) (chunk + pos);
 
       /* The end of the block, skip to the next one.  */
-      if (!dirent.len)
+      if (!dirent->len)
 	{
 	  offset = (offset / GRUB_ISO9660_BLKSZ + 1) * GRUB_ISO9660_BLKSZ;
 	  continue;
 	}
 
+      /* The fixed part has to fit in the block before NAMELEN is read.  */
+      if ((pos % GRUB_ISO9660_BLKSZ) + sizeof (*dirent) > GRUB_ISO9660_BLKSZ
+	  || dirent->len < sizeof (*dirent) + dirent->namelen
+	  || (pos % GRUB_ISO9660_BLKSZ) + dirent->len > GRUB_ISO9660_BLKSZ)
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "invalid directory entry");
+	  goto done;
+	}
+
       {
-	char name[dirent.namelen + 1];
-	int nameoffset = offset + sizeof (dirent);
+	char name[dirent->namelen + 1];
 	struct grub_fshelp_node *node;
-	int sua_off = (sizeof (dirent) + dirent.namelen + 1
-		       - (dirent.namelen % 2));
-	int sua_size = dirent.len - sua_off;
+	int sua_off = (sizeof (*dirent) + dirent->namelen + 1
+		       - (dirent->namelen % 2) + dir->data->susp_skip);
+	int sua_size = dirent->len - sua_off;
 	struct grub_iso9660_iterate_dir_closure c;
 
-	sua_off += offset + dir->data->susp_skip;
-
 	filename = 0;
 	c.filename = &filename;
 	c.filename_alloc = 0;
 	c.type = GRUB_FSHELP_UNKNOWN;
 	if (dir->data->rockridge
-	    && grub_iso9660_susp_iterate (dir->data,
-					  (dir->blk << GRUB_ISO9660_LOG2_BLKSZ)
-					  + (sua_off
-					     / GRUB_DISK_SECTOR_SIZE),
-					  sua_off % GRUB_DISK_SECTOR_SIZE,
+	    && grub_iso9660_susp_iterate (dir->data, (char *) dirent + sua_off,
 					  sua_size, susp_iterate_dir, &c))
-	  return 0;
+	  {
+	    if (c.filename_alloc)
+	      grub_free (filename);
+	    goto done;
+	  }
 
-	/* Read the name.  */
-	if (grub_disk_read (dir->data->disk,
-			    (dir->blk << GRUB_ISO9660_LOG2_BLKSZ)
-			    + nameoffset / GRUB_DISK_SECTOR_SIZE,
-			    nameoffset % GRUB_DISK_SECTOR_SIZE,
-			    dirent.namelen, (char *) name))
-	  return 0;
+	/* The name follows the entry.  */
+	grub_memcpy (name, dirent + 1, dirent->namelen);
 
 	node = grub_malloc (sizeof (struct grub_fshelp_node));
 	if (!node)
-	  return 0;
+	  {
+	    if (c.filename_alloc)
+	      grub_free (filename);
+	    goto done;
+	  }
 
 	/* Setup a new node.  */
 	node->data = dir->data;
-	node->size = grub_le_to_cpu32 (dirent.size);
-	node->blk = grub_le_to_cpu32 (dirent.first_sector);
+	node->size = grub_le_to_cpu32 (dirent->size);
+	node->blk = grub_le_to_cpu32 (dirent->first_sector);
 	node->dir_blk = ((dir->blk << GRUB_ISO9660_LOG2_BLKSZ)
 			 + offset / GRUB_DISK_SECTOR_SIZE);
 	node->dir_off = offset % GRUB_DISK_SECTOR_SIZE;
@@ -632,7 +668,7 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	   whatever is stored in the iso9660 filesystem.  */
 	if (c.type == GRUB_FSHELP_UNKNOWN)
 	  {
-	    if ((dirent.flags & 3) == 2)
+	    if ((dirent->flags & 3) == 2)
 	      c.type = GRUB_FSHELP_DIR;
 	    else
 	      c.type = GRUB_FSHELP_REG;
@@ -642,14 +678,14 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 	   from the iso9660 filesystem.  */
 	if (!filename)
 	  {
-	    name[dirent.namelen] = '\0';
+	    name[dirent->namelen] = '\0';
 	    filename = grub_strrchr (name, ';');
 	    if (filename)
 	      *filename = '\0';
 
-	    if (dirent.namelen == 1 && name[0] == 0)
+	    if (dirent->namelen == 1 && name[0] == 0)
 	      filename = ".";
-	    else if (dirent.namelen == 1 && name[0] == 1)
+	    else if (dirent->namelen == 1 && name[0] == 1)
 	      filename = "..";
 	    else
 	      filename = name;
@@ -661,7 +697,7 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
 
             oldname = filename;
             filename = grub_iso9660_convert_string
-                  ((grub_uint16_t *) oldname, dirent.namelen >> 1);
+                  ((grub_uint16_t *) oldname, dirent->namelen >> 1);
 
 	    semicolon = grub_strrchr (filename, ';');
 	    if (semicolon)
@@ -673,20 +709,19 @@ grub_iso9660_iterate_dir (grub_fshelp_node_t dir,
             c.filename_alloc = 1;
           }
 
-	if (hook (filename, c.type, node, closure))
-	  {
-	    if (c.filename_alloc)
-	      grub_free (filename);
-	    return 1;
-	  }
+	ret = hook (filename, c.type, node, closure);
 	if (c.filename_alloc)
 	  grub_free (filename);
+	if (ret)
+	  goto done;
       }
 
-      offset += dirent.len;
+      offset += dirent->len;
     }
 
-  return 0;
+ done:
+  grub_free (chunk);
+  return ret;
 }
 
 struct grub_iso9660_dir_closure
@@ -734,11 +769,11 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.size = grub_le_to_cpu32 (data->voldesc.rootdir.size);
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir, 0,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode, &foundnode,
+				    grub_iso9660_iterate_dir, 0,
+				    grub_iso9660_read_symlink, GRUB_FSHELP_DIR,
+				    data->disk,
+				    sizeof (struct grub_fshelp_node)))
     goto fail;
 
   c.hook = hook;
@@ -777,11 +812,11 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.size = grub_le_to_cpu32 (data->voldesc.rootdir.size);
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir, 0,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode, &foundnode,
+				    grub_iso9660_iterate_dir, 0,
+				    grub_iso9660_read_symlink, GRUB_FSHELP_REG,
+				    data->disk,
+				    sizeof (struct grub_fshelp_node)))
     goto fail;
 
   data->first_sector = foundnode->blk;
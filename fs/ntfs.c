@@ -34,6 +34,79 @@ static grub_dl_t my_mod;
 
 ntfscomp_func_t grub_ntfscomp_func;
 
+#define GRUB_NTFS_MFT_CACHE	16
+
+/* A fixed up MFT record, MFTNO of the filesystem on the partition
+   starting at START.  SECTOR is 0 if it isn't known.  */
+struct grub_ntfs_mft_cache
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  grub_uint32_t mftno;
+  grub_uint32_t sector;
+  grub_uint32_t size;
+  unsigned long last_use;
+  char *buf;
+};
+
+static struct grub_ntfs_mft_cache grub_ntfs_mft_cache[GRUB_NTFS_MFT_CACHE];
+static unsigned long grub_ntfs_mft_cache_clock;
+
+/* The mount generation the MFT cache was filled in.  */
+static unsigned long grub_ntfs_mft_cache_generation;
+
+static void
+grub_ntfs_mft_cache_invalidate_all (void)
+{
+  int i;
+
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE; i++)
+    {
+      grub_free (grub_ntfs_mft_cache[i].buf);
+      grub_ntfs_mft_cache[i].buf = 0;
+    }
+}
+
+/* Return the cache entry of the MFT record MFTNO of DATA, or if it isn't
+   cached, the entry to replace with it and set *FOUND to 0.  */
+static struct grub_ntfs_mft_cache *
+grub_ntfs_mft_cache_get (struct grub_ntfs_data *data, grub_uint32_t mftno,
+			 int *found)
+{
+  struct grub_ntfs_mft_cache *cache, *victim = 0;
+  grub_disk_addr_t start;
+  int i;
+
+  if (grub_ntfs_mft_cache_generation != grub_fs_mount_generation)
+    {
+      grub_ntfs_mft_cache_invalidate_all ();
+      grub_ntfs_mft_cache_generation = grub_fs_mount_generation;
+    }
+
+  start = grub_partition_get_start (data->disk->partition);
+  for (i = 0; i < GRUB_NTFS_MFT_CACHE; i++)
+    {
+      cache = &grub_ntfs_mft_cache[i];
+      if (cache->buf && cache->mftno == mftno
+	  && cache->dev_id == data->disk->dev->id
+	  && cache->disk_id == data->disk->id && cache->start == start
+	  && cache->size == (data->mft_size << BLK_SHR))
+	{
+	  cache->last_use = ++grub_ntfs_mft_cache_clock;
+	  *found = 1;
+	  return cache;
+	}
+
+      if (! victim || (victim->buf && (! cache->buf
+				       || cache->last_use < victim->last_use)))
+	victim = cache;
+    }
+
+  *found = 0;
+  return victim;
+}
+
 static grub_err_t
 fixup (struct grub_ntfs_data *data, char *buf, int len, char *magic)
 {
@@ -92,6 +165,8 @@ init_attr (struct grub_ntfs_attr *at, struct grub_ntfs_file *mft)
   at->flags = (mft == &mft->data->mmft) ? AF_MMFT : 0;
   at->attr_nxt = mft->buf + u16at (mft->buf, 0x14);
   at->attr_end = at->emft_buf = at->edat_buf = at->sbuf = NULL;
+  at->run_key = NULL;
+  at->runs = NULL;
 }
 
 static void
@@ -100,6 +175,7 @@ free_attr (struct grub_ntfs_attr *at)
   grub_free (at->emft_buf);
   grub_free (at->edat_buf);
   grub_free (at->sbuf);
+  grub_free (at->runs);
 }
 
 static char *
@@ -292,6 +368,19 @@ grub_ntfs_read_run_list (struct grub_ntfs_rlst * ctx)
   grub_disk_addr_t val;
   char *run;
 
+  if (ctx->run < ctx->run_last)
+    {
+      ctx->curr_vcn = ctx->run->vcn;
+      ctx->next_vcn = ctx->run[1].vcn;
+      ctx->curr_lcn = ctx->run->lcn;
+      if (ctx->run->sparse)
+	ctx->flags |= RF_BLNK;
+      else
+	ctx->flags &= ~RF_BLNK;
+      ctx->run++;
+      return 0;
+    }
+
   run = ctx->cur_run;
 retry:
   c1 = ((unsigned char) (*run) & 0xF);
@@ -335,21 +424,161 @@ retry:
   return 0;
 }
 
-static grub_disk_addr_t
-grub_ntfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t block)
+/* Decode the run list of the non-resident attribute PA into AT, as the
+   run list of KEY.  */
+static grub_err_t
+decode_run_list (struct grub_ntfs_attr *at, char *pa, char *key)
+{
+  struct grub_ntfs_run *runs = 0;
+  int num = 0, max = 0;
+  grub_disk_addr_t vcn, lcn, val;
+  char *run, *end;
+
+  vcn = u64at (pa, 0x10);
+  lcn = 0;
+  run = pa + u16at (pa, 0x20);
+  end = pa + u32at (pa, 4);
+  while (1)
+    {
+      int c1, c2;
+
+      if (num + 1 >= max)
+	{
+	  struct grub_ntfs_run *p;
+
+	  max = (max) ? max * 2 : 16;
+	  p = grub_realloc (runs, max * sizeof (runs[0]));
+	  if (! p)
+	    {
+	      grub_free (runs);
+	      return grub_errno;
+	    }
+	  runs = p;
+	}
+
+      if (run >= end)
+	{
+	  grub_free (runs);
+	  return grub_error (GRUB_ERR_BAD_FS, "run list overflown");
+	}
+
+      c1 = ((unsigned char) (*run) & 0xF);
+      c2 = ((unsigned char) (*run) >> 4);
+      if (! c1)
+	break;
+
+      runs[num].vcn = vcn;
+      run = read_run_data (run + 1, c1, &val, 0);
+      vcn += val;
+      run = read_run_data (run, c2, &val, 1);
+      lcn += val;
+      runs[num].lcn = lcn;
+      runs[num].sparse = (val == 0);
+      num++;
+    }
+  runs[num].vcn = vcn;
+
+  grub_free (at->runs);
+  at->runs = runs;
+  at->num_runs = num;
+  at->run_key = key;
+  at->run_end = run;
+
+  return 0;
+}
+
+/* Set CTX to the run of the attribute PA of AT which contains
+   CTX->target_vcn.  */
+static grub_err_t
+seek_run_list (struct grub_ntfs_attr *at, char *pa, struct grub_ntfs_rlst *ctx)
+{
+  char *key;
+  int low, high;
+
+  /* The attribute is in a buffer shared by all the extents of an
+     attribute list, tell them apart by their entry in the list.  */
+  key = (at->flags & AF_ALST) ? at->attr_cur : pa;
+  if ((at->run_key != key) && (decode_run_list (at, pa, key)))
+    return grub_errno;
+
+  /* Find the last run starting before the target.  */
+  low = 0;
+  high = at->num_runs - 1;
+  while (low < high)
+    {
+      int mid = (low + high + 1) / 2;
+
+      if (at->runs[mid].vcn <= ctx->target_vcn)
+	low = mid;
+      else
+	high = mid - 1;
+    }
+
+  ctx->run = at->runs + low;
+  ctx->run_last = at->runs + at->num_runs;
+  ctx->cur_run = at->run_end;
+  ctx->next_vcn = ctx->run->vcn;
+  ctx->curr_lcn = (low) ? ctx->run[-1].lcn : 0;
+  while (ctx->next_vcn <= ctx->target_vcn)
+    {
+      if (grub_ntfs_read_run_list (ctx))
+	return grub_errno;
+    }
+
+  return 0;
+}
+
+/* Read LEN bytes at OFS of the uncompressed attribute of CTX, whole runs
+   at a time.  */
+static grub_err_t
+read_runs (struct grub_ntfs_rlst *ctx, char *dest, grub_disk_addr_t ofs,
+	   grub_size_t len,
+	   void (*read_hook) (grub_disk_addr_t sector,
+			      unsigned offset,
+			      unsigned length,
+			      void *closure),
+	   void *closure, int flags)
 {
-  struct grub_ntfs_rlst *ctx;
+  grub_disk_t disk = ctx->comp.disk;
 
-  ctx = (struct grub_ntfs_rlst *) node;
-  if (block >= ctx->next_vcn)
+  while (1)
     {
+      grub_disk_addr_t end;
+      grub_size_t n;
+
+      end = (ctx->next_vcn * ctx->comp.spc) << BLK_SHR;
+      n = len;
+      if (ofs + n > end)
+	n = end - ofs;
+
+      if (ctx->flags & RF_BLNK)
+	{
+	  if (dest)
+	    grub_memset (dest, 0, n);
+	}
+      else
+	{
+	  disk->read_hook = read_hook;
+	  disk->closure = closure;
+	  grub_disk_read_ex (disk,
+			     (ctx->curr_lcn - ctx->curr_vcn) * ctx->comp.spc
+			     + (ofs >> BLK_SHR),
+			     ofs & (GRUB_DISK_SECTOR_SIZE - 1), n, dest, flags);
+	  disk->read_hook = 0;
+	  if (grub_errno)
+	    return grub_errno;
+	}
+
+      if (dest)
+	dest += n;
+      ofs += n;
+      len -= n;
+      if (! len)
+	return 0;
+
       if (grub_ntfs_read_run_list (ctx))
-	return -1;
-      return ctx->curr_lcn;
+	return grub_errno;
     }
-  else
-    return (ctx->flags & RF_BLNK) ? 0 : (block -
-					 ctx->curr_vcn + ctx->curr_lcn);
 }
 
 static grub_err_t
@@ -438,13 +667,8 @@ read_data (struct grub_ntfs_attr *at, char *pa, char *dest,
   else
     vcn = ctx->target_vcn = grub_divmod64 (ofs >> BLK_SHR, ctx->comp.spc, 0);
 
-  ctx->next_vcn = u32at (pa, 0x10);
-  ctx->curr_lcn = 0;
-  while (ctx->next_vcn <= ctx->target_vcn)
-    {
-      if (grub_ntfs_read_run_list (ctx))
-	return grub_errno;
-    }
+  if (seek_run_list (at, pa, ctx))
+    return grub_errno;
 
   if (at->flags & AF_GPOS)
     {
@@ -469,15 +693,7 @@ read_data (struct grub_ntfs_attr *at, char *pa, char *dest,
     }
 
   if (!(ctx->flags & RF_COMP))
-    {
-      unsigned int pow;
-
-      if (!grub_fshelp_log2blksize (ctx->comp.spc, &pow))
-	grub_fshelp_read_file (ctx->comp.disk, (grub_fshelp_node_t) ctx,
-			       read_hook, closure, flags, ofs, len, dest,
-			       grub_ntfs_read_block, ofs + len, pow);
-      return grub_errno;
-    }
+    return read_runs (ctx, dest, ofs, len, read_hook, closure, flags);
 
   return (grub_ntfscomp_func) ? grub_ntfscomp_func (at, dest, ofs, len, ctx,
 						    vcn) :
@@ -548,11 +764,47 @@ static grub_err_t
 read_mft (struct grub_ntfs_data *data, char *buf, grub_uint32_t mftno,
 	  grub_uint32_t *sector)
 {
+  struct grub_ntfs_mft_cache *cache;
+  grub_uint32_t *sec = sector;
+  int found;
+
+  cache = grub_ntfs_mft_cache_get (data, mftno, &found);
+  if (found && (! sector || cache->sector))
+    {
+      grub_memcpy (buf, cache->buf, cache->size);
+      if (sector)
+	*sector = cache->sector;
+      return 0;
+    }
+
   if (read_attr
       (&data->mmft.attr, buf, mftno * ((grub_disk_addr_t) data->mft_size << BLK_SHR),
-       data->mft_size << BLK_SHR, 0, read_mft_hook, &sector, 0))
+       data->mft_size << BLK_SHR, 0, read_mft_hook, &sec, 0))
     return grub_error (GRUB_ERR_BAD_FS, "Read MFT 0x%X fails", mftno);
-  return fixup (data, buf, data->mft_size, "FILE");
+  if (fixup (data, buf, data->mft_size, "FILE"))
+    return grub_errno;
+
+  /* Remember the fixed up record.  */
+  if (! cache->buf)
+    {
+      cache->buf = grub_malloc (MAX_MFT << BLK_SHR);
+      if (! cache->buf)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+    }
+
+  cache->dev_id = data->disk->dev->id;
+  cache->disk_id = data->disk->id;
+  cache->start = grub_partition_get_start (data->disk->partition);
+  cache->mftno = mftno;
+  cache->sector = (sector) ? *sector : 0;
+  cache->size = data->mft_size << BLK_SHR;
+  cache->last_use = ++grub_ntfs_mft_cache_clock;
+  grub_memcpy (cache->buf, buf, cache->size);
+
+  return 0;
 }
 
 static grub_err_t
@@ -943,8 +1195,9 @@ grub_ntfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (path, &data->cmft, &fdiro, grub_ntfs_iterate_dir, 0,
-			 0, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->cmft, &fdiro,
+				grub_ntfs_iterate_dir, 0, 0, GRUB_FSHELP_DIR,
+				data->disk, sizeof (struct grub_ntfs_file));
 
   if (grub_errno)
     goto fail;
@@ -983,8 +1236,9 @@ grub_ntfs_open (grub_file_t file, const char *name)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file (name, &data->cmft, &mft, grub_ntfs_iterate_dir, 0,
-			 0, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->cmft, &mft,
+				grub_ntfs_iterate_dir, 0, 0, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_ntfs_file));
 
   if (grub_errno)
     goto fail;
@@ -1068,8 +1322,9 @@ grub_ntfs_label (grub_device_t device, char **label)
   if (!data)
     goto fail;
 
-  grub_fshelp_find_file ("/$Volume", &data->cmft, &mft, grub_ntfs_iterate_dir,
-			 0, 0, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached ("/$Volume", &data->cmft, &mft,
+				grub_ntfs_iterate_dir, 0, 0, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_ntfs_file));
 
   if (grub_errno)
     goto fail;
@@ -1164,4 +1419,5 @@ GRUB_MOD_INIT (ntfs)
 GRUB_MOD_FINI (ntfs)
 {
   grub_fs_unregister (&grub_ntfs_fs);
+  grub_ntfs_mft_cache_invalidate_all ();
 }
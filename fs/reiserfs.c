@@ -226,11 +226,23 @@ struct grub_fshelp_node
   struct grub_reiserfs_item_header header;
 };
 
+/* The number of internal tree nodes kept per mount.  */
+#define GRUB_REISERFS_NODE_CACHE_SIZE 16
+
+struct grub_reiserfs_node_cache
+{
+  grub_uint32_t block_number;
+  unsigned long last_use;
+  struct grub_reiserfs_block_header *node;
+};
+
 /* Returned when opening a file.  */
 struct grub_reiserfs_data
 {
   struct grub_reiserfs_superblock superblock;
   grub_disk_t disk;
+  struct grub_reiserfs_node_cache node_cache[GRUB_REISERFS_NODE_CACHE_SIZE];
+  unsigned long node_use;
 };
 
 /* Internal-only functions. Not to be used outside of this file.  */
@@ -460,15 +472,82 @@ grub_reiserfs_compare_keys (const struct grub_reiserfs_key *key1,
   return 0;
 }
 
+/* Return the tree node at BLOCK_NUMBER.  Internal nodes are kept in the
+   cache of DATA, leaves are read into BUF.  */
+static struct grub_reiserfs_block_header *
+grub_reiserfs_read_node (struct grub_reiserfs_data *data,
+                         grub_uint32_t block_number,
+                         struct grub_reiserfs_block_header *buf)
+{
+  struct grub_reiserfs_node_cache *cache, *victim;
+  grub_uint16_t block_size;
+  int i;
+
+  block_size = grub_le_to_cpu16 (data->superblock.block_size);
+  victim = &data->node_cache[0];
+  for (i = 0; i < GRUB_REISERFS_NODE_CACHE_SIZE; i++)
+    {
+      cache = &data->node_cache[i];
+      if (cache->node && cache->block_number == block_number)
+        {
+          cache->last_use = ++data->node_use;
+          return cache->node;
+        }
+      if (victim->node && (! cache->node
+                           || cache->last_use < victim->last_use))
+        victim = cache;
+    }
+
+  grub_disk_read (data->disk,
+                  block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
+                  (((grub_off_t) block_number * block_size)
+                   & (GRUB_DISK_SECTOR_SIZE - 1)),
+                  block_size, buf);
+  if (grub_errno)
+    return 0;
+
+  if (grub_le_to_cpu16 (buf->level) <= 1)
+    return buf;
+
+  if (! victim->node)
+    {
+      victim->node = grub_malloc (block_size);
+      if (! victim->node)
+        {
+          grub_errno = GRUB_ERR_NONE;
+          return buf;
+        }
+    }
+
+  grub_memcpy (victim->node, buf, block_size);
+  victim->block_number = block_number;
+  victim->last_use = ++data->node_use;
+  return victim->node;
+}
+
+static void
+grub_reiserfs_free (struct grub_reiserfs_data *data)
+{
+  int i;
+
+  if (! data)
+    return;
+
+  for (i = 0; i < GRUB_REISERFS_NODE_CACHE_SIZE; i++)
+    grub_free (data->node_cache[i].node);
+  grub_free (data);
+}
+
 /* Find the item identified by KEY in mounted filesystem DATA, and fill ITEM
-   accordingly to what was found.  */
+   accordingly to what was found.  If EXACT is 0, the last item of the leaf
+   which isn't higher than KEY is taken instead.  */
 static grub_err_t
-grub_reiserfs_get_item (struct grub_reiserfs_data *data,
-                        const struct grub_reiserfs_key *key,
-                        struct grub_fshelp_node *item)
+grub_reiserfs_search (struct grub_reiserfs_data *data,
+                      const struct grub_reiserfs_key *key,
+                      struct grub_fshelp_node *item, int exact)
 {
   grub_uint32_t block_number;
-  struct grub_reiserfs_block_header *block_header = 0;
+  struct grub_reiserfs_block_header *block_header = 0, *node;
   struct grub_reiserfs_key *block_key = 0;
   grub_uint16_t block_size, item_count, current_level;
   grub_uint16_t i;
@@ -506,14 +585,12 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
   item->next_offset = 0;
   do
     {
-      grub_disk_read (data->disk,
-                      block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
-                      (((grub_off_t) block_number * block_size)
-                       & (GRUB_DISK_SECTOR_SIZE - 1)),
-                      block_size, block_header);
-      if (grub_errno)
+      int low, high;
+
+      node = grub_reiserfs_read_node (data, block_number, block_header);
+      if (! node)
         goto fail;
-      current_level = grub_le_to_cpu16 (block_header->level);
+      current_level = grub_le_to_cpu16 (node->level);
       grub_dprintf ("reiserfs_tree", " at level %d\n", current_level);
       if (current_level >= previous_level)
         {
@@ -522,29 +599,40 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
           goto fail;
         }
       previous_level = current_level;
-      item_count = grub_le_to_cpu16 (block_header->item_count);
+      item_count = grub_le_to_cpu16 (node->item_count);
       grub_dprintf ("reiserfs_tree", " number of contained items : %d\n",
                     item_count);
       if (current_level > 1)
         {
           /* Internal node. Navigate to the child that should contain
-             the searched key.  */
+             the searched key, the one after the last key which isn't
+             higher.  */
           struct grub_reiserfs_key *keys
-            = (struct grub_reiserfs_key *) (block_header + 1);
+            = (struct grub_reiserfs_key *) (node + 1);
           struct grub_reiserfs_disk_child *children
             = ((struct grub_reiserfs_disk_child *)
                (keys + item_count));
 
-          for (i = 0;
-               i < item_count
-                 && grub_reiserfs_compare_keys (key, &(keys[i])) >= 0;
-               i++)
+          if ((grub_size_t) item_count * (sizeof (*keys) + sizeof (*children))
+              + sizeof (*children) + sizeof (*node) > block_size)
             {
-#ifdef GRUB_REISERFS_DEBUG
-              grub_printf("i %03d/%03d ", i + 1, item_count + 1);
-              grub_reiserfs_print_key (&(keys[i]));
-#endif
+              grub_error (GRUB_ERR_BAD_FS, "invalid internal node");
+              goto fail;
+            }
+
+          low = 0;
+          high = item_count;
+          while (low < high)
+            {
+              int mid = (low + high) / 2;
+
+              if (grub_reiserfs_compare_keys (key, &(keys[mid])) >= 0)
+                low = mid + 1;
+              else
+                high = mid;
             }
+          i = low;
+
           block_number = grub_le_to_cpu32 (children[i].block_number);
 	  if ((i < item_count) && (key->directory_id == keys[i].directory_id)
 	       && (key->object_id == keys[i].object_id))
@@ -574,23 +662,33 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
         {
           /* Leaf node.  Check that the key is actually present.  */
           item_headers
-            = (struct grub_reiserfs_item_header *) (block_header + 1);
-          for (i = 0;
-               i < item_count
-                 && (grub_reiserfs_compare_keys (key, &(item_headers[i].key))
-                     != 0);
-               i++)
+            = (struct grub_reiserfs_item_header *) (node + 1);
+          if ((grub_size_t) item_count * sizeof (*item_headers)
+              + sizeof (*node) > block_size)
             {
-#ifdef GRUB_REISERFS_DEBUG
-              if (key->directory_id == item_headers[i].key.directory_id && \
-                  key->object_id == item_headers[i].key.object_id)
-                grub_printf("C");
+              grub_error (GRUB_ERR_BAD_FS, "invalid leaf node");
+              goto fail;
+            }
+
+          low = 0;
+          high = item_count;
+          while (low < high)
+            {
+              int mid = (low + high) / 2;
+
+              if (grub_reiserfs_compare_keys (&(item_headers[mid].key),
+                                              key) < 0)
+                low = mid + 1;
               else
-                grub_printf(" ");
-              grub_printf(" %03d/%03d ", i + 1, item_count);
-              grub_reiserfs_print_key (&(item_headers[i].key));
-#endif
+                high = mid;
             }
+          i = low;
+
+          if (! exact && (i == item_count
+                          || grub_reiserfs_compare_keys (key,
+                                                         &(item_headers[i].key))))
+            i = (i > 0) ? i - 1 : item_count;
+
           if (i < item_count)
             block_key = &(item_headers[i].key);
         }
@@ -599,7 +697,8 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
 
   item->data = data;
 
-  if (i == item_count || grub_reiserfs_compare_keys (key, block_key))
+  if (i == item_count
+      || (exact && grub_reiserfs_compare_keys (key, block_key)))
     {
       item->block_number = 0;
       item->block_position = 0;
@@ -632,6 +731,16 @@ grub_reiserfs_get_item (struct grub_reiserfs_data *data,
   return grub_errno;
 }
 
+/* Find the item identified by KEY in mounted filesystem DATA, and fill ITEM
+   accordingly to what was found.  */
+static grub_err_t
+grub_reiserfs_get_item (struct grub_reiserfs_data *data,
+                        const struct grub_reiserfs_key *key,
+                        struct grub_fshelp_node *item)
+{
+  return grub_reiserfs_search (data, key, item, 1);
+}
+
 /* Return the path of the file which is pointed at by symlink NODE.  */
 static char *
 grub_reiserfs_read_symlink (grub_fshelp_node_t node)
@@ -681,7 +790,7 @@ static struct grub_reiserfs_data *
 grub_reiserfs_mount (grub_disk_t disk)
 {
   struct grub_reiserfs_data *data = 0;
-  data = grub_malloc (sizeof (*data));
+  data = grub_zalloc (sizeof (*data));
   if (! data)
     goto fail;
   grub_disk_read (disk, REISERFS_SUPER_BLOCK_OFFSET / GRUB_DISK_SECTOR_SIZE,
@@ -702,7 +811,7 @@ grub_reiserfs_mount (grub_disk_t disk)
   if (grub_errno == GRUB_ERR_OUT_OF_RANGE)
     grub_error (GRUB_ERR_BAD_FS, "not a ReiserFS filesystem");
 
-  grub_free (data);
+  grub_reiserfs_free (data);
   return 0;
 }
 
@@ -1002,9 +1111,10 @@ grub_reiserfs_open (struct grub_file *file, const char *name)
       grub_error (GRUB_ERR_BAD_FS, "unable to find root item");
       goto fail; /* Should never happen since checked at mount.  */
     }
-  grub_fshelp_find_file (name, &root, &found,
-                         grub_reiserfs_iterate_dir, 0,
-                         grub_reiserfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &root, &found,
+				grub_reiserfs_iterate_dir, 0,
+				grub_reiserfs_read_symlink, GRUB_FSHELP_REG,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
   key.directory_id = found->header.key.directory_id;
@@ -1057,15 +1167,32 @@ grub_reiserfs_open (struct grub_file *file, const char *name)
  fail:
   assert (grub_errno != GRUB_ERR_NONE);
   grub_free (found);
-  grub_free (data);
+  grub_reiserfs_free (data);
   grub_dl_unref (my_mod);
   return grub_errno;
 }
 
+/* Read the LENGTH bytes at OFFSET of the disk block BLOCK_NUMBER of DATA
+   into BUF, calling the read hook of FILE.  */
+static grub_err_t
+grub_reiserfs_read_data (grub_file_t file, struct grub_reiserfs_data *data,
+                         grub_uint32_t block_number, grub_off_t offset,
+                         grub_size_t length, char *buf)
+{
+  grub_uint16_t block_size = grub_le_to_cpu16 (data->superblock.block_size);
+
+  data->disk->read_hook = file->read_hook;
+  data->disk->closure = file->closure;
+  grub_disk_read (data->disk,
+                  block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
+                  offset, length, buf);
+  data->disk->read_hook = 0;
+  return grub_errno;
+}
+
 static grub_ssize_t
 grub_reiserfs_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  unsigned int indirect_block, indirect_block_count;
   struct grub_reiserfs_key key;
   struct grub_fshelp_node *node = file->data;
   struct grub_reiserfs_data *data = node->data;
@@ -1073,17 +1200,15 @@ grub_reiserfs_read (grub_file_t file, char *buf, grub_size_t len)
   grub_uint16_t block_size = grub_le_to_cpu16 (data->superblock.block_size);
   grub_uint16_t item_size;
   grub_uint32_t *indirect_block_ptr = 0;
-  grub_uint64_t current_key_offset = 1;
-  grub_off_t initial_position, current_position, final_position, length;
-  grub_disk_addr_t block;
-  grub_off_t offset;
+  grub_off_t initial_position, current_position, final_position;
+  grub_off_t item_position, item_end;
 
   key.directory_id = node->header.key.directory_id;
   key.object_id = node->header.key.object_id;
   key.u.v2.offset_type = 0;
   grub_reiserfs_set_key_type (&key, GRUB_REISERFS_ANY, 2);
   initial_position = file->offset;
-  current_position = 0;
+  current_position = initial_position;
   final_position = MIN (len + initial_position, file->size);
   grub_dprintf ("reiserfs",
 		"Reading from %lld to %lld (%lld instead of requested %ld)\n",
@@ -1091,99 +1216,127 @@ grub_reiserfs_read (grub_file_t file, char *buf, grub_size_t len)
 		(unsigned long long) final_position,
 		(unsigned long long) (final_position - initial_position),
 		(unsigned long) len);
+
+  /* Start with the item holding the first byte, whose offset (counted
+     from 1) is the last one which isn't higher.  */
+  grub_reiserfs_set_key_offset (&key, current_position + 1);
+  if (grub_reiserfs_search (data, &key, &found, 0) != GRUB_ERR_NONE)
+    goto fail;
+
   while (current_position < final_position)
     {
-      grub_reiserfs_set_key_offset (&key, current_key_offset);
-
-      if (grub_reiserfs_get_item (data, &key, &found) != GRUB_ERR_NONE)
-        goto fail;
-      if (found.block_number == 0)
+      if (found.block_number == 0
+          || found.header.key.directory_id != key.directory_id
+          || found.header.key.object_id != key.object_id
+          || (found.type != GRUB_REISERFS_DIRECT
+              && found.type != GRUB_REISERFS_INDIRECT))
         goto fail;
+
       item_size = grub_le_to_cpu16 (found.header.item_size);
+      item_position = grub_reiserfs_get_key_offset (&(found.header.key)) - 1;
+      if (item_position > current_position)
+        goto fail;
+
       switch (found.type)
         {
         case GRUB_REISERFS_DIRECT:
-          block = found.block_number * (block_size  >> GRUB_DISK_SECTOR_BITS);
-          grub_dprintf ("reiserfs_blocktype", "D: %u\n", (unsigned) block);
-          if (initial_position < current_position + item_size)
+          item_end = MIN (item_position + item_size, final_position);
+          grub_dprintf ("reiserfs", "Reading direct item at %u from %u to %u\n",
+                        (unsigned) found.block_number,
+                        (unsigned) (current_position - item_position),
+                        (unsigned) (item_end - item_position));
+          if (current_position < item_end)
             {
-              offset = MAX ((signed) (initial_position - current_position), 0);
-              length = (MIN (item_size, final_position - current_position)
-                        - offset);
-              grub_dprintf ("reiserfs",
-                            "Reading direct block %u from %u to %u...\n",
-                            (unsigned) block, (unsigned) offset,
-                            (unsigned) (offset + length));
-              found.data->disk->read_hook = file->read_hook;
-	      found.data->disk->closure = file->closure;
-              grub_disk_read (found.data->disk,
-                              block,
-                              offset
-                              + grub_le_to_cpu16 (found.header.item_location),
-                              length, buf);
-              found.data->disk->read_hook = 0;
-              if (grub_errno)
+              if (grub_reiserfs_read_data (file, data, found.block_number,
+                                           grub_le_to_cpu16 (found.header.item_location)
+                                           + current_position - item_position,
+                                           item_end - current_position, buf))
                 goto fail;
-              buf += length;
-              current_position += offset + length;
+              if (buf)
+                buf += item_end - current_position;
+              current_position = item_end;
             }
-          else
-            current_position += item_size;
           break;
+
         case GRUB_REISERFS_INDIRECT:
-          indirect_block_count = item_size / sizeof (*indirect_block_ptr);
-          indirect_block_ptr = grub_malloc (item_size);
-          if (! indirect_block_ptr)
-            goto fail;
-          grub_disk_read (found.data->disk,
-                          found.block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
-                          grub_le_to_cpu16 (found.header.item_location),
-                          item_size, indirect_block_ptr);
-          if (grub_errno)
-            goto fail;
-          found.data->disk->read_hook = file->read_hook;
-          for (indirect_block = 0;
-               indirect_block < indirect_block_count
-                 && current_position < final_position;
-               indirect_block++)
-            {
-              block = grub_le_to_cpu32 (indirect_block_ptr[indirect_block]) *
-                      (block_size >> GRUB_DISK_SECTOR_BITS);
-              grub_dprintf ("reiserfs_blocktype", "I: %u\n", (unsigned) block);
-              if (current_position + block_size >= initial_position)
-                {
-                  offset = MAX ((signed) (initial_position - current_position),
-                                0);
-                  length = (MIN (block_size, final_position - current_position)
-                            - offset);
-                  grub_dprintf ("reiserfs",
-                                "Reading indirect block %u from %u to %u...\n",
-                                (unsigned) block, (unsigned) offset,
-                                (unsigned) (offset + length));
-#if 0
-                  grub_dprintf ("reiserfs",
-                                "\nib=%04d/%04d, ip=%d, cp=%d, fp=%d, off=%d, l=%d, tl=%d\n",
-                                indirect_block + 1, indirect_block_count,
-                                initial_position, current_position,
-                                final_position, offset, length, len);
-#endif
-                  grub_disk_read (found.data->disk, block, offset, length, buf);
-                  if (grub_errno)
-                    goto fail;
-                  buf += length;
-                  current_position += offset + length;
-                }
-              else
-                current_position += block_size;
-            }
-          found.data->disk->read_hook = 0;
-          grub_free (indirect_block_ptr);
-          indirect_block_ptr = 0;
-          break;
+          {
+            unsigned int indirect_block, indirect_block_count;
+
+            indirect_block_count = item_size / sizeof (*indirect_block_ptr);
+            indirect_block_ptr = grub_malloc (item_size);
+            if (! indirect_block_ptr)
+              goto fail;
+            grub_disk_read (data->disk,
+                            found.block_number * (block_size >> GRUB_DISK_SECTOR_BITS),
+                            grub_le_to_cpu16 (found.header.item_location),
+                            item_size, indirect_block_ptr);
+            if (grub_errno)
+              goto fail;
+
+            item_end = MIN (item_position
+                            + (grub_off_t) indirect_block_count * block_size,
+                            final_position);
+
+            /* Read the blocks which follow each other on disk at once.  */
+            indirect_block = (current_position - item_position) / block_size;
+            while (current_position < item_end)
+              {
+                grub_uint32_t first;
+                unsigned int count;
+                grub_off_t end;
+
+                first = grub_le_to_cpu32 (indirect_block_ptr[indirect_block]);
+                for (count = 1;
+                     indirect_block + count < indirect_block_count
+                       && (item_position
+                           + (grub_off_t) (indirect_block + count) * block_size
+                           < item_end)
+                       && (grub_le_to_cpu32 (indirect_block_ptr[indirect_block
+                                                                + count])
+                           == (first ? first + count : 0));
+                     count++);
+
+                end = MIN (item_position
+                           + (grub_off_t) (indirect_block + count) * block_size,
+                           item_end);
+                grub_dprintf ("reiserfs", "Reading %u indirect blocks at %u\n",
+                              count, (unsigned) first);
+
+                /* Holes have no block.  */
+                if (! first)
+                  {
+                    if (buf)
+                      grub_memset (buf, 0, end - current_position);
+                  }
+                else if (grub_reiserfs_read_data (file, data, first,
+                                                  (current_position
+                                                   - item_position)
+                                                  % block_size,
+                                                  end - current_position, buf))
+                  goto fail;
+
+                if (buf)
+                  buf += end - current_position;
+                current_position = end;
+                indirect_block += count;
+              }
+
+            grub_free (indirect_block_ptr);
+            indirect_block_ptr = 0;
+            break;
+          }
+
         default:
           goto fail;
         }
-      current_key_offset = current_position + 1;
+
+      if (current_position >= final_position)
+        break;
+
+      /* The next item starts where this one ends.  */
+      grub_reiserfs_set_key_offset (&key, current_position + 1);
+      if (grub_reiserfs_get_item (data, &key, &found) != GRUB_ERR_NONE)
+        goto fail;
     }
 
   grub_dprintf ("reiserfs",
@@ -1192,52 +1345,6 @@ grub_reiserfs_read (grub_file_t file, char *buf, grub_size_t len)
 		(unsigned long) len);
   return current_position - initial_position;
 
-#if 0
-  switch (found.type)
-    {
-      case GRUB_REISERFS_DIRECT:
-        read_length = MIN (len, item_size - file->offset);
-        grub_disk_read (found.data->disk,
-                        (found.block_number * block_size) / GRUB_DISK_SECTOR_SIZE,
-                        grub_le_to_cpu16 (found.header.item_location) + file->offset,
-                        read_length, buf);
-        if (grub_errno)
-          goto fail;
-        break;
-      case GRUB_REISERFS_INDIRECT:
-        indirect_block_count = item_size / sizeof (*indirect_block_ptr);
-        indirect_block_ptr = grub_malloc (item_size);
-        if (!indirect_block_ptr)
-          goto fail;
-        grub_disk_read (found.data->disk,
-                        (found.block_number * block_size) / GRUB_DISK_SECTOR_SIZE,
-                        grub_le_to_cpu16 (found.header.item_location),
-                        item_size, (char *) indirect_block_ptr);
-        if (grub_errno)
-          goto fail;
-        len = MIN (len, file->size - file->offset);
-        for (indirect_block = file->offset / block_size;
-             indirect_block < indirect_block_count && read_length < len;
-             indirect_block++)
-          {
-            read = MIN (block_size, len - read_length);
-            grub_disk_read (found.data->disk,
-                            (grub_le_to_cpu32 (indirect_block_ptr[indirect_block]) * block_size) / GRUB_DISK_SECTOR_SIZE,
-                            file->offset % block_size, read,
-                            ((void *) buf) + read_length);
-            if (grub_errno)
-              goto fail;
-            read_length += read;
-          }
-        grub_free (indirect_block_ptr);
-        break;
-      default:
-        goto fail;
-    }
-
-  return read_length;
-#endif
-
  fail:
   grub_free (indirect_block_ptr);
   return 0;
@@ -1250,7 +1357,7 @@ grub_reiserfs_close (grub_file_t file)
   struct grub_fshelp_node *node = file->data;
   struct grub_reiserfs_data *data = node->data;
 
-  grub_free (data);
+  grub_reiserfs_free (data);
   grub_free (node);
   grub_dl_unref (my_mod);
   return GRUB_ERR_NONE;
@@ -1307,19 +1414,21 @@ grub_reiserfs_dir (grub_device_t device, const char *path,
       grub_error(GRUB_ERR_BAD_FS, "root not found");
       goto fail;
     }
-  grub_fshelp_find_file (path, &root, &found, grub_reiserfs_iterate_dir, 0,
-                         grub_reiserfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &root, &found,
+				grub_reiserfs_iterate_dir, 0,
+				grub_reiserfs_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, sizeof (struct grub_fshelp_node));
   if (grub_errno)
     goto fail;
   c.hook = hook;
   c.closure = closure;
   grub_reiserfs_iterate_dir (found, iterate, &c);
-  grub_free (data);
+  grub_reiserfs_free (data);
   grub_dl_unref (my_mod);
   return GRUB_ERR_NONE;
 
  fail:
-  grub_free (data);
+  grub_reiserfs_free (data);
   grub_dl_unref (my_mod);
   return grub_errno;
 }
@@ -1367,7 +1476,7 @@ grub_reiserfs_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_reiserfs_free (data);
 
   return grub_errno;
 }
@@ -83,8 +83,15 @@
 #define GRUB_UDF_EXT_NORMAL		0x00000000
 #define GRUB_UDF_EXT_NREC_ALLOC		0x40000000
 #define GRUB_UDF_EXT_NREC_NALLOC	0x80000000
+#define GRUB_UDF_EXT_NEXT		0xC0000000
 #define GRUB_UDF_EXT_MASK		0xC0000000
 
+/* The number of allocation extent descriptors followed for a node.  */
+#define GRUB_UDF_MAX_AED		1024
+
+/* The number of nodes whose extents are kept per mount.  */
+#define GRUB_UDF_EXTENT_CACHE		8
+
 #define GRUB_UDF_FID_CHAR_HIDDEN	0x01
 #define GRUB_UDF_FID_CHAR_DIRECTORY	0x02
 #define GRUB_UDF_FID_CHAR_DELETED	0x04
@@ -274,6 +281,13 @@ struct grub_udf_extended_file_entry
   grub_uint8_t ext_attr[1832];
 } __attribute__ ((packed));
 
+struct grub_udf_aed
+{
+  struct grub_udf_tag tag;
+  grub_uint32_t prev_ae;
+  grub_uint32_t ae_len;
+} __attribute__ ((packed));
+
 struct grub_udf_vrs
 {
   grub_uint8_t type;
@@ -336,6 +350,22 @@ struct grub_udf_lvd
   grub_uint8_t part_maps[1608];
 } __attribute__ ((packed));
 
+/* A run of file blocks, which are not stored on disk if START is 0.  */
+struct grub_udf_extent
+{
+  grub_uint32_t fileblock;
+  grub_uint32_t start;
+  grub_uint32_t length;
+};
+
+/* The extents of the node whose ICB is at the block ICB.  */
+struct grub_udf_extent_list
+{
+  grub_uint32_t icb;
+  struct grub_udf_extent *extents;
+  int count;
+};
+
 struct grub_udf_data
 {
   grub_disk_t disk;
@@ -344,6 +374,8 @@ struct grub_udf_data
   struct grub_udf_partmap *pms[GRUB_UDF_MAX_PMS];
   struct grub_udf_long_ad root_icb;
   int npd, npm;
+  struct grub_udf_extent_list extent_cache[GRUB_UDF_EXTENT_CACHE];
+  int extent_next;
 };
 
 struct grub_fshelp_node
@@ -355,6 +387,9 @@ struct grub_fshelp_node
     struct grub_udf_extended_file_entry efe;
   };
   int part_ref;
+  /* The block of the ICB, which is only read when the node is used.  */
+  grub_uint32_t block;
+  int loaded;
 };
 
 static grub_dl_t my_mod;
@@ -375,6 +410,22 @@ grub_udf_get_block (struct grub_udf_data *data,
           + U32 (block));
 }
 
+static void
+grub_udf_free_data (struct grub_udf_data *data)
+{
+  int i;
+
+  if (! data)
+    return;
+
+  for (i = 0; i < GRUB_UDF_EXTENT_CACHE; i++)
+    grub_free (data->extent_cache[i].extents);
+  grub_free (data);
+}
+
+/* Set NODE to the file whose ICB is ICB.  The ICB is read when the node
+   is used, by grub_udf_load_node, as most nodes found while iterating
+   over a directory are not.  */
 static grub_err_t
 grub_udf_read_icb (struct grub_udf_data *data,
 		   struct grub_udf_long_ad *icb,
@@ -389,7 +440,20 @@ grub_udf_read_icb (struct grub_udf_data *data,
   if (grub_errno)
     return grub_errno;
 
-  if (grub_disk_read (data->disk, block << GRUB_UDF_LOG2_BLKSZ, 0,
+  node->block = block;
+  node->loaded = 0;
+  node->part_ref = icb->block.part_ref;
+  node->data = data;
+  return 0;
+}
+
+static grub_err_t
+grub_udf_load_node (struct grub_fshelp_node *node)
+{
+  if (node->loaded)
+    return 0;
+
+  if (grub_disk_read (node->data->disk, node->block << GRUB_UDF_LOG2_BLKSZ, 0,
 		      sizeof (struct grub_udf_file_entry),
 		      &node->fe))
     return grub_errno;
@@ -398,72 +462,219 @@ grub_udf_read_icb (struct grub_udf_data *data,
       (U16 (node->fe.tag.tag_ident) != GRUB_UDF_TAG_IDENT_EFE))
     return grub_error (GRUB_ERR_BAD_FS, "invalid fe/efe descriptor");
 
-  node->part_ref = icb->block.part_ref;
-  node->data = data;
+  node->loaded = 1;
   return 0;
 }
 
-static grub_disk_addr_t
-grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+/* Add the extents described by the LEN bytes of allocation descriptors
+   at PTR to LIST.  Set *NEXT to the next allocation extent, if any.  */
+static grub_err_t
+grub_udf_add_extents (grub_fshelp_node_t node,
+		      struct grub_udf_extent_list *list, int *max,
+		      grub_uint32_t *fileblock, char *ptr, int len,
+		      grub_uint32_t *next)
+{
+  int is_long;
+
+  is_long = ((U16 (node->fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
+	     == GRUB_UDF_ICBTAG_FLAG_AD_LONG);
+
+  *next = 0;
+  while (len >= (int) (is_long ? sizeof (struct grub_udf_long_ad)
+		       : sizeof (struct grub_udf_short_ad)))
+    {
+      grub_uint32_t length, block, start;
+      grub_uint16_t part_ref;
+
+      if (is_long)
+	{
+	  struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
+
+	  length = U32 (ad->length);
+	  block = ad->block.block_num;
+	  part_ref = ad->block.part_ref;
+	  ptr += sizeof (*ad);
+	  len -= sizeof (*ad);
+	}
+      else
+	{
+	  struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+
+	  length = U32 (ad->length);
+	  block = ad->position;
+	  part_ref = node->part_ref;
+	  ptr += sizeof (*ad);
+	  len -= sizeof (*ad);
+	}
+
+      if (! (length & ~GRUB_UDF_EXT_MASK))
+	break;
+
+      if ((length & GRUB_UDF_EXT_MASK) == GRUB_UDF_EXT_NEXT)
+	{
+	  *next = grub_udf_get_block (node->data, part_ref, block);
+	  if (! *next && ! grub_errno)
+	    grub_error (GRUB_ERR_BAD_FS, "invalid allocation extent");
+	  return grub_errno;
+	}
+
+      start = 0;
+      if ((length & GRUB_UDF_EXT_MASK) == GRUB_UDF_EXT_NORMAL)
+	{
+	  start = grub_udf_get_block (node->data, part_ref, block);
+	  if (grub_errno)
+	    return grub_errno;
+	}
+      length = (((length & ~GRUB_UDF_EXT_MASK) + GRUB_UDF_BLKSZ - 1)
+		/ GRUB_UDF_BLKSZ);
+
+      if (list->count == *max)
+	{
+	  struct grub_udf_extent *p;
+
+	  *max = (*max) ? *max * 2 : 16;
+	  p = grub_realloc (list->extents, *max * sizeof (*p));
+	  if (! p)
+	    return grub_errno;
+	  list->extents = p;
+	}
+
+      list->extents[list->count].fileblock = *fileblock;
+      list->extents[list->count].start = start;
+      list->extents[list->count].length = length;
+      list->count++;
+      *fileblock += length;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Return the extents of NODE, decoded from its allocation descriptors
+   and the allocation extents they chain to.  */
+static struct grub_udf_extent_list *
+grub_udf_get_extents (grub_fshelp_node_t node)
 {
-  char *ptr;
-  int len;
-  grub_disk_addr_t filebytes;
+  struct grub_udf_data *data = node->data;
+  struct grub_udf_extent_list *list;
+  grub_uint32_t fileblock = 0, next;
+  char *ptr, *buf = 0;
+  int i, len, max = 0;
+
+  for (i = 0; i < GRUB_UDF_EXTENT_CACHE; i++)
+    if (data->extent_cache[i].extents && data->extent_cache[i].icb == node->block)
+      return &data->extent_cache[i];
+
+  list = &data->extent_cache[data->extent_next];
+  data->extent_next = (data->extent_next + 1) % GRUB_UDF_EXTENT_CACHE;
+  grub_free (list->extents);
+  list->extents = 0;
+  list->count = 0;
 
   if (U16 (node->fe.tag.tag_ident) == GRUB_UDF_TAG_IDENT_FE)
     {
       ptr = (char *) &node->fe.ext_attr[0] + U32 (node->fe.ext_attr_length);
       len = U32 (node->fe.alloc_descs_length);
+      if (len > (int) sizeof (node->fe.ext_attr)
+	  || U32 (node->fe.ext_attr_length) > sizeof (node->fe.ext_attr) - len)
+	goto bad;
     }
   else
     {
       ptr = (char *) &node->efe.ext_attr[0] + U32 (node->efe.ext_attr_length);
       len = U32 (node->efe.alloc_descs_length);
+      if (len > (int) sizeof (node->efe.ext_attr)
+	  || U32 (node->efe.ext_attr_length) > sizeof (node->efe.ext_attr) - len)
+	goto bad;
     }
 
-  if ((U16 (node->fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
-      == GRUB_UDF_ICBTAG_FLAG_AD_SHORT)
+  for (i = 0; ; i++)
     {
-      struct grub_udf_short_ad *ad = (struct grub_udf_short_ad *) ptr;
+      struct grub_udf_aed *aed;
+
+      if (grub_udf_add_extents (node, list, &max, &fileblock, ptr, len,
+				&next))
+	goto fail;
 
-      len /= sizeof (struct grub_udf_short_ad);
-      filebytes = fileblock * GRUB_UDF_BLKSZ;
-      while (len > 0)
+      if (! next)
+	break;
+
+      if (i == GRUB_UDF_MAX_AED)
+	goto bad;
+
+      if (! buf)
 	{
-	  if (filebytes < U32 (ad->length))
-	    return ((U32 (ad->position) & GRUB_UDF_EXT_MASK) ? 0 :
-                    (grub_udf_get_block (node->data,
-                                         node->part_ref,
-                                         ad->position)
-                     + (filebytes / GRUB_UDF_BLKSZ)));
-
-	  filebytes -= U32 (ad->length);
-	  ad++;
-	  len--;
+	  buf = grub_malloc (GRUB_UDF_BLKSZ);
+	  if (! buf)
+	    goto fail;
 	}
+
+      if (grub_disk_read (data->disk, next << GRUB_UDF_LOG2_BLKSZ, 0,
+			  GRUB_UDF_BLKSZ, buf))
+	goto fail;
+
+      aed = (struct grub_udf_aed *) buf;
+      if (U16 (aed->tag.tag_ident) != GRUB_UDF_TAG_IDENT_AED
+	  || U32 (aed->ae_len) > GRUB_UDF_BLKSZ - sizeof (*aed))
+	goto bad;
+
+      ptr = buf + sizeof (*aed);
+      len = U32 (aed->ae_len);
     }
-  else
+
+  grub_free (buf);
+
+  /* Keep files without extents apart from free entries.  */
+  if (! list->extents)
     {
-      struct grub_udf_long_ad *ad = (struct grub_udf_long_ad *) ptr;
+      list->extents = grub_malloc (sizeof (*list->extents));
+      if (! list->extents)
+	return 0;
+    }
+  list->icb = node->block;
+  return list;
+
+ bad:
+  grub_error (GRUB_ERR_BAD_FS, "invalid allocation descriptors");
+ fail:
+  grub_free (buf);
+  grub_free (list->extents);
+  list->extents = 0;
+  list->count = 0;
+  return 0;
+}
 
-      len /= sizeof (struct grub_udf_long_ad);
-      filebytes = fileblock * GRUB_UDF_BLKSZ;
-      while (len > 0)
-	{
-	  if (filebytes < U32 (ad->length))
-	    return ((U32 (ad->block.block_num) & GRUB_UDF_EXT_MASK) ?  0 :
-                    (grub_udf_get_block (node->data,
-                                         ad->block.part_ref,
-                                         ad->block.block_num)
-		     + (filebytes / GRUB_UDF_BLKSZ)));
-
-	  filebytes -= U32 (ad->length);
-	  ad++;
-	  len--;
-	}
+static grub_disk_addr_t
+grub_udf_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_udf_extent_list *list;
+  struct grub_udf_extent *ext;
+  int low, high;
+
+  list = grub_udf_get_extents (node);
+  if (! list)
+    return 0;
+
+  /* Find the last extent which starts at or before FILEBLOCK.  */
+  low = 0;
+  high = list->count;
+  while (low < high)
+    {
+      int mid = (low + high) / 2;
+
+      if (list->extents[mid].fileblock <= fileblock)
+	low = mid + 1;
+      else
+	high = mid;
     }
 
-  return 0;
+  if (! low)
+    return 0;
+
+  ext = &list->extents[low - 1];
+  if (fileblock - ext->fileblock >= ext->length || ! ext->start)
+    return 0;
+
+  return ext->start + (fileblock - ext->fileblock);
 }
 
 static grub_ssize_t
@@ -474,6 +685,9 @@ grub_udf_read_file (grub_fshelp_node_t node,
 		    void *closure, int flags,
 		    int pos, grub_size_t len, char *buf)
 {
+  if (grub_udf_load_node (node))
+    return -1;
+
   switch (U16 (node->fe.icbtag.flags) & GRUB_UDF_ICBTAG_FLAG_AD_MASK)
     {
     case GRUB_UDF_ICBTAG_FLAG_AD_IN_ICB:
@@ -513,7 +727,7 @@ grub_udf_mount (grub_disk_t disk)
   grub_uint32_t block;
   int i;
 
-  data = grub_malloc (sizeof (struct grub_udf_data));
+  data = grub_zalloc (sizeof (struct grub_udf_data));
   if (!data)
     return 0;
 
@@ -692,7 +906,7 @@ grub_udf_mount (grub_disk_t disk)
   return data;
 
 fail:
-  grub_free (data);
+  grub_udf_free_data (data);
   return 0;
 }
 
@@ -708,6 +922,9 @@ grub_udf_iterate_dir (grub_fshelp_node_t dir,
   struct grub_udf_file_ident dirent;
   grub_uint32_t offset = 0;
 
+  if (grub_udf_load_node (dir))
+    return 0;
+
   child = grub_malloc (sizeof (struct grub_fshelp_node));
   if (!child)
     return 0;
@@ -835,9 +1052,10 @@ grub_udf_dir (grub_device_t device, const char *path,
   if (grub_udf_read_icb (data, &data->root_icb, &rootnode))
     goto fail;
 
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_udf_iterate_dir, 0, 0, GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode, &foundnode,
+				    grub_udf_iterate_dir, 0, 0,
+				    GRUB_FSHELP_DIR, data->disk,
+				    sizeof (struct grub_fshelp_node)))
     goto fail;
 
   c.hook = hook;
@@ -848,7 +1066,7 @@ grub_udf_dir (grub_device_t device, const char *path,
     grub_free (foundnode);
 
 fail:
-  grub_free (data);
+  grub_udf_free_data (data);
 
   grub_dl_unref (my_mod);
 
@@ -871,11 +1089,18 @@ grub_udf_open (struct grub_file *file, const char *name)
   if (grub_udf_read_icb (data, &data->root_icb, &rootnode))
     goto fail;
 
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_udf_iterate_dir, 0, 0, GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode, &foundnode,
+				    grub_udf_iterate_dir, 0, 0,
+				    GRUB_FSHELP_REG, data->disk,
+				    sizeof (struct grub_fshelp_node)))
     goto fail;
 
+  if (grub_udf_load_node (foundnode))
+    {
+      grub_free (foundnode);
+      goto fail;
+    }
+
   file->data = foundnode;
   file->offset = 0;
   file->size = U64 (foundnode->fe.file_size);
@@ -885,7 +1110,7 @@ grub_udf_open (struct grub_file *file, const char *name)
 fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_udf_free_data (data);
 
   return grub_errno;
 }
@@ -906,7 +1131,7 @@ grub_udf_close (grub_file_t file)
     {
       struct grub_fshelp_node *node = (struct grub_fshelp_node *) file->data;
 
-      grub_free (node->data);
+      grub_udf_free_data (node->data);
       grub_free (node);
     }
 
@@ -924,7 +1149,7 @@ grub_udf_label (grub_device_t device, char **label)
   if (data)
     {
       *label = grub_strdup ((char *) &data->lvd.ident[1]);
-      grub_free (data);
+      grub_udf_free_data (data);
     }
   else
     *label = 0;
@@ -109,7 +109,9 @@ struct grub_xfs_inode
   grub_uint64_t nblocks;
   grub_uint32_t extsize;
   grub_uint32_t nextents;
-  grub_uint8_t unused3[20];
+  grub_uint8_t unused3[2];
+  grub_uint8_t fork_offset;
+  grub_uint8_t unused4[17];
   union
   {
     char raw[156];
@@ -129,6 +131,21 @@ struct grub_xfs_dirblock_tail
   grub_uint32_t leaf_stale;
 } __attribute__ ((packed));
 
+/* The hash index at the end of a single block directory.  */
+struct grub_xfs_dir2_leaf_entry
+{
+  grub_uint32_t hashval;
+  grub_uint32_t address;
+} __attribute__ ((packed));
+
+/* A decoded extent, whose blocks read as zeros if START is 0.  */
+struct grub_xfs_bmap_extent
+{
+  grub_uint64_t offset;
+  grub_uint64_t start;
+  grub_uint64_t size;
+};
+
 struct grub_fshelp_node
 {
   struct grub_xfs_data *data;
@@ -144,9 +161,18 @@ struct grub_xfs_data
   int pos;
   int bsize;
   int agsize;
+  /* The extents of the inode EXTENTS_INO, see grub_xfs_get_extents.  */
+  grub_uint64_t extents_ino;
+  struct grub_xfs_bmap_extent *extents;
+  int nextents;
   struct grub_fshelp_node diropen;
 };
 
+/* The size of a node, whose inode is as big as in the filesystem.  */
+#define GRUB_XFS_NODE_SIZE(data)			\
+  (sizeof (struct grub_fshelp_node) - sizeof (struct grub_xfs_inode)	\
+   + (1 << (data)->sblock.log2_inode))
+
 static grub_dl_t my_mod;
 
 
@@ -181,6 +207,10 @@ static grub_dl_t my_mod;
 #define GRUB_XFS_EXTENT_SIZE(exts,ex)		\
   (grub_be_to_cpu32 (exts[ex][3]) & ((1 << 20) - 1))
 
+/* Extents which are allocated but not written yet read as zeros.  */
+#define GRUB_XFS_EXTENT_UNWRITTEN(exts,ex)	\
+  (grub_be_to_cpu32 (exts[ex][0]) & (1 << 31))
+
 #define GRUB_XFS_ROUND_TO_DIRENT(pos)	((((pos) + 8 - 1) / 8) * 8)
 #define GRUB_XFS_NEXT_DIRENT(pos,len)		\
   (pos) + GRUB_XFS_ROUND_TO_DIRENT (8 + 1 + len + 2)
@@ -228,95 +258,217 @@ grub_xfs_read_inode (struct grub_xfs_data *data, grub_uint64_t ino,
 }
 
 
-static grub_disk_addr_t
-grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+static void
+grub_xfs_free (struct grub_xfs_data *data)
 {
-  struct grub_xfs_btree_node *leaf = 0;
-  int ex, nrec;
-  grub_xfs_extent *exts;
-  grub_uint64_t ret = 0;
+  if (data)
+    grub_free (data->extents);
+  grub_free (data);
+}
+
+/* Append the NREC extent records at EXTS to the extents of DATA.  */
+static grub_err_t
+grub_xfs_add_extents (struct grub_xfs_data *data, grub_xfs_extent *exts,
+		      int nrec, int max)
+{
+  int ex;
+
+  for (ex = 0; ex < nrec; ex++)
+    {
+      struct grub_xfs_bmap_extent *e;
+
+      if (data->nextents == max)
+	return grub_error (GRUB_ERR_BAD_FS, "too many XFS extents");
+
+      e = &data->extents[data->nextents++];
+      e->offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
+      e->size = GRUB_XFS_EXTENT_SIZE (exts, ex);
+      e->start = 0;
+      if (! GRUB_XFS_EXTENT_UNWRITTEN (exts, ex))
+	e->start = GRUB_XFS_FSB_TO_BLOCK (data, GRUB_XFS_EXTENT_BLOCK (exts, ex));
+
+      if (data->nextents > 1 && e->offset < e[-1].offset + e[-1].size)
+	return grub_error (GRUB_ERR_BAD_FS, "unsorted XFS extents");
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Decode the extents of NODE into DATA, unless they already are.  Files
+   with a bmap btree have all their leaves read once, from left to
+   right.  */
+static grub_err_t
+grub_xfs_get_extents (grub_fshelp_node_t node)
+{
+  struct grub_xfs_data *data = node->data;
+  int max;
+
+  if (data->extents && data->extents_ino == node->ino)
+    return GRUB_ERR_NONE;
+
+  grub_free (data->extents);
+  data->extents = 0;
+  data->nextents = 0;
+
+  max = grub_be_to_cpu32 (node->inode.nextents);
+  data->extents = grub_malloc ((max + 1) * sizeof (data->extents[0]));
+  if (! data->extents)
+    return grub_errno;
 
   if (node->inode.format == XFS_INODE_FORMAT_BTREE)
     {
-      grub_uint64_t *keys;
+      struct grub_xfs_btree_node *leaf;
+      grub_uint64_t *keys, ptr;
+      int nrec, recoffset, level;
 
-      leaf = grub_malloc (node->data->sblock.bsize);
+      leaf = grub_malloc (data->bsize);
       if (leaf == 0)
-        return 0;
+	goto fail;
+
+      /* The pointers follow the keys, as many as fit in the inode fork.  */
+      if (node->inode.fork_offset)
+	recoffset = (node->inode.fork_offset - 1) / 2;
+      else
+	recoffset = (((1 << data->sblock.log2_inode)
+		      - ((char *) &node->inode.data - (char *) &node->inode))
+		     / (2 * sizeof (grub_uint64_t)));
 
       nrec = grub_be_to_cpu16 (node->inode.data.btree.numrecs);
+      level = grub_be_to_cpu16 (node->inode.data.btree.level);
       keys = &node->inode.data.btree.keys[0];
-      do
-        {
-          int i;
-
-          for (i = 0; i < nrec; i++)
-            {
-              if (fileblock < grub_be_to_cpu64 (keys[i]))
-                break;
-            }
-
-          /* Sparse block.  */
-          if (i == 0)
-            {
-              grub_free (leaf);
-              return 0;
-            }
-
-          if (grub_disk_read (node->data->disk,
-                              grub_be_to_cpu64 (keys[i - 1 + nrec])
-                              << (node->data->sblock.log2_bsize
-                                  - GRUB_DISK_SECTOR_BITS),
-                              0, node->data->sblock.bsize, leaf))
-            return 0;
-
-          if (grub_strncmp ((char *) leaf->magic, "BMAP", 4))
-            {
-              grub_free (leaf);
-              grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
-              return 0;
-            }
-
-          nrec = grub_be_to_cpu16 (leaf->numrecs);
-          keys = &leaf->keys[0];
-        } while (leaf->level);
-      exts = (grub_xfs_extent *) keys;
+      if (! nrec || nrec > recoffset)
+	{
+	  grub_free (leaf);
+	  grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP root");
+	  goto fail;
+	}
+      ptr = grub_be_to_cpu64 (keys[recoffset]);
+
+      /* Go down to the leftmost leaf.  */
+      while (1)
+	{
+	  if (grub_disk_read (data->disk,
+			      GRUB_XFS_FSB_TO_BLOCK (data, ptr)
+			      << (data->sblock.log2_bsize
+				  - GRUB_DISK_SECTOR_BITS),
+			      0, data->bsize, leaf))
+	    break;
+
+	  if (grub_strncmp ((char *) leaf->magic, "BMAP", 4)
+	      || grub_be_to_cpu16 (leaf->level) != --level)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+	      break;
+	    }
+
+	  nrec = grub_be_to_cpu16 (leaf->numrecs);
+	  if (! level)
+	    break;
+
+	  recoffset = ((data->bsize - sizeof (struct grub_xfs_btree_node)
+			+ sizeof (grub_uint64_t))
+		       / (2 * sizeof (grub_uint64_t)));
+	  if (! nrec || nrec > recoffset)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+	      break;
+	    }
+	  ptr = grub_be_to_cpu64 (leaf->keys[recoffset]);
+	}
+
+      /* Then follow the leaves to the right.  */
+      while (! grub_errno)
+	{
+	  if (grub_xfs_add_extents (data, (grub_xfs_extent *) &leaf->keys[0],
+				    nrec, max))
+	    break;
+
+	  ptr = grub_be_to_cpu64 (leaf->right);
+	  if (ptr == ~(grub_uint64_t) 0)
+	    break;
+
+	  if (grub_disk_read (data->disk,
+			      GRUB_XFS_FSB_TO_BLOCK (data, ptr)
+			      << (data->sblock.log2_bsize
+				  - GRUB_DISK_SECTOR_BITS),
+			      0, data->bsize, leaf))
+	    break;
+
+	  if (grub_strncmp ((char *) leaf->magic, "BMAP", 4) || leaf->level)
+	    {
+	      grub_error (GRUB_ERR_BAD_FS, "not a correct XFS BMAP node");
+	      break;
+	    }
+	  nrec = grub_be_to_cpu16 (leaf->numrecs);
+	}
+
+      grub_free (leaf);
+      if (grub_errno)
+	goto fail;
     }
   else if (node->inode.format == XFS_INODE_FORMAT_EXT)
     {
-      nrec = grub_be_to_cpu32 (node->inode.nextents);
-      exts = &node->inode.data.extents[0];
+      if ((grub_size_t) max * sizeof (grub_xfs_extent)
+	  > (1 << data->sblock.log2_inode) - sizeof (struct grub_xfs_inode)
+	  + sizeof (node->inode.data))
+	{
+	  grub_error (GRUB_ERR_BAD_FS, "too many XFS extents");
+	  goto fail;
+	}
+
+      if (grub_xfs_add_extents (data, &node->inode.data.extents[0], max, max))
+	goto fail;
     }
   else
     {
       grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
 		  "XFS does not support inode format %d yet",
 		  node->inode.format);
-      return 0;
+      goto fail;
     }
 
-  /* Iterate over each extent to figure out which extent has
-     the block we are looking for.  */
-  for (ex = 0; ex < nrec; ex++)
+  data->extents_ino = node->ino;
+  return GRUB_ERR_NONE;
+
+ fail:
+  grub_free (data->extents);
+  data->extents = 0;
+  data->nextents = 0;
+  return grub_errno;
+}
+
+static grub_disk_addr_t
+grub_xfs_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+{
+  struct grub_xfs_data *data = node->data;
+  struct grub_xfs_bmap_extent *e;
+  int low, high;
+
+  if (grub_xfs_get_extents (node))
+    return 0;
+
+  /* Find the last extent which starts at or before FILEBLOCK.  */
+  low = 0;
+  high = data->nextents;
+  while (low < high)
     {
-      grub_uint64_t start = GRUB_XFS_EXTENT_BLOCK (exts, ex);
-      grub_uint64_t offset = GRUB_XFS_EXTENT_OFFSET (exts, ex);
-      grub_uint64_t size = GRUB_XFS_EXTENT_SIZE (exts, ex);
-
-      /* Sparse block.  */
-      if (fileblock < offset)
-        break;
-      else if (fileblock < offset + size)
-        {
-          ret = (fileblock - offset + start);
-          break;
-        }
+      int mid = (low + high) / 2;
+
+      if (data->extents[mid].offset <= fileblock)
+	low = mid + 1;
+      else
+	high = mid;
     }
 
-  if (leaf)
-    grub_free (leaf);
+  /* Sparse block.  */
+  if (! low)
+    return 0;
+
+  e = &data->extents[low - 1];
+  if (fileblock >= e->offset + e->size || ! e->start)
+    return 0;
 
-  return GRUB_XFS_FSB_TO_BLOCK(node->data, ret);
+  return fileblock - e->offset + e->start;
 }
 
 
@@ -397,15 +549,12 @@ struct grub_xfs_iterate_dir_closure
   struct grub_fshelp_node *diro;
 };
 
-static int
-call_hook (grub_uint64_t ino, char *filename,
-	   struct grub_xfs_iterate_dir_closure *c)
+static struct grub_fshelp_node *
+grub_xfs_new_node (struct grub_fshelp_node *diro, grub_uint64_t ino)
 {
   struct grub_fshelp_node *fdiro;
 
-  fdiro = grub_malloc (sizeof (struct grub_fshelp_node)
-		       - sizeof (struct grub_xfs_inode)
-		       + (1 << c->diro->data->sblock.log2_inode));
+  fdiro = grub_malloc (GRUB_XFS_NODE_SIZE (diro->data));
   if (!fdiro)
     return 0;
 
@@ -413,9 +562,22 @@ call_hook (grub_uint64_t ino, char *filename,
      not be determined.  */
   fdiro->ino = ino;
   fdiro->inode_read = 1;
-  fdiro->data = c->diro->data;
+  fdiro->data = diro->data;
   grub_xfs_read_inode (fdiro->data, ino, &fdiro->inode);
 
+  return fdiro;
+}
+
+static int
+call_hook (grub_uint64_t ino, char *filename,
+	   struct grub_xfs_iterate_dir_closure *c)
+{
+  struct grub_fshelp_node *fdiro;
+
+  fdiro = grub_xfs_new_node (c->diro, ino);
+  if (!fdiro)
+    return 0;
+
   return c->hook (filename,
 		  grub_xfs_mode_to_filetype (fdiro->inode.mode),
 		  fdiro, c->closure);
@@ -519,25 +681,34 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 	    /* The header is skipped, the first direntry is stored
 	       from byte 16.  */
 	    int pos = 16;
-	    int entries;
+	    int end = dirblk_size;
 	    int tail_start = (dirblk_size
 			      - sizeof (struct grub_xfs_dirblock_tail));
 
 	    struct grub_xfs_dirblock_tail *tail;
 	    tail = (struct grub_xfs_dirblock_tail *) &dirblock[tail_start];
 
+	    /* The whole directory block is read at once.  */
 	    numread = grub_xfs_read_file (dir, 0, 0, 0,
 					  blk << dirblk_log2,
 					  dirblk_size, dirblock);
 	    if (numread != dirblk_size)
-	      return 0;
+	      {
+		grub_free (dirblock);
+		return 0;
+	      }
 
-	    entries = (grub_be_to_cpu32 (tail->leaf_count)
-		       - grub_be_to_cpu32 (tail->leaf_stale));
+	    /* Only single block directories end with a hash index, the
+	       blocks of bigger ones hold entries up to their end.  Blocks
+	       which were freed are holes.  */
+	    if (! grub_memcmp (dirblock, "XD2B", 4))
+	      end = (tail_start - grub_be_to_cpu32 (tail->leaf_count)
+		     * sizeof (struct grub_xfs_dir2_leaf_entry));
+	    else if (grub_memcmp (dirblock, "XD2D", 4))
+	      continue;
 
 	    /* Iterate over all entries within this block.  */
-	    while (pos < (dirblk_size
-			  - (int) sizeof (struct grub_xfs_dir2_entry)))
+	    while (pos < (end - (int) sizeof (struct grub_xfs_dir2_entry)))
 	      {
 		struct grub_xfs_dir2_entry *direntry;
 		grub_uint16_t *freetag;
@@ -551,6 +722,8 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 		    grub_uint16_t *skip = (grub_uint16_t *) (freetag + 1);
 
 		    /* This entry is not used, go to the next one.  */
+		    if (! grub_be_to_cpu16 (*skip))
+		      break;
 		    pos += grub_be_to_cpu16 (*skip);
 
 		    continue;
@@ -567,12 +740,6 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
 		    return 1;
 		  }
 
-		/* Check if last direntry in this block is
-		   reached.  */
-		entries--;
-		if (!entries)
-		  break;
-
 		/* Select the next directory entry.  */
 		pos = GRUB_XFS_NEXT_DIRENT (pos, direntry->len);
 		pos = GRUB_XFS_ROUND_TO_DIRENT (pos);
@@ -590,9 +757,198 @@ grub_xfs_iterate_dir (grub_fshelp_node_t dir,
   return 0;
 }
 
+/* The hash of the names in directory blocks.  */
+static grub_uint32_t
+grub_xfs_hashname (const grub_uint8_t *name, int namelen)
+{
+  grub_uint32_t hash;
 
-static struct grub_xfs_data *
-grub_xfs_mount (grub_disk_t disk)
+  for (hash = 0; namelen >= 4; namelen -= 4, name += 4)
+    hash = ((name[0] << 21) ^ (name[1] << 14) ^ (name[2] << 7)
+	    ^ (name[3] << 0) ^ ((hash << 28) | (hash >> 4)));
+
+  switch (namelen)
+    {
+    case 3:
+      return ((name[0] << 14) ^ (name[1] << 7) ^ (name[2] << 0)
+	      ^ ((hash << 21) | (hash >> 11)));
+    case 2:
+      return ((name[0] << 7) ^ (name[1] << 0)
+	      ^ ((hash << 14) | (hash >> 18)));
+    case 1:
+      return ((name[0] << 0) ^ ((hash << 7) | (hash >> 25)));
+    default:
+      return hash;
+    }
+}
+
+/* Look NAME up in the directory DIR without reading the inodes of the
+   other entries.  Short form directories are searched by name, single
+   block directories by the hash index at the end of the block.  */
+static int
+grub_xfs_find_entry (grub_fshelp_node_t dir, const char *name,
+		     grub_fshelp_node_t *foundnode,
+		     enum grub_fshelp_filetype *foundtype)
+{
+  struct grub_fshelp_node *diro = (struct grub_fshelp_node *) dir;
+  int namelen = grub_strlen (name);
+  grub_uint64_t ino;
+
+  switch (diro->inode.format)
+    {
+    case XFS_INODE_FORMAT_INO:
+      {
+	struct grub_xfs_dir_entry *de = &diro->inode.data.dir.direntry[0];
+	int smallino = !diro->inode.data.dir.dirhead.smallino;
+	int i;
+
+	if (smallino)
+	  {
+	    ino = grub_be_to_cpu32 (diro->inode.data.dir.dirhead.parent.i4);
+	    ino = grub_cpu_to_be64 (ino);
+	    de = (struct grub_xfs_dir_entry *) ((char *) de - 4);
+	  }
+	else
+	  ino = diro->inode.data.dir.dirhead.parent.i8;
+
+	if (! grub_strcmp (name, "."))
+	  ino = diro->ino;
+
+	if (grub_strcmp (name, ".") && grub_strcmp (name, ".."))
+	  {
+	    for (i = 0; i < diro->inode.data.dir.dirhead.count; i++)
+	      {
+		void *inopos = (((char *) de)
+				+ sizeof (struct grub_xfs_dir_entry)
+				+ de->len - 1);
+
+		if (de->len == namelen
+		    && ! grub_memcmp (de->name, name, namelen))
+		  break;
+
+		de = ((struct grub_xfs_dir_entry *)
+		      ((char *) inopos + ((smallino ? sizeof (grub_uint32_t)
+					   : sizeof (grub_uint64_t)))));
+	      }
+
+	    if (i == diro->inode.data.dir.dirhead.count)
+	      return 0;
+
+	    if (smallino)
+	      {
+		ino = grub_be_to_cpu32 (*(grub_uint32_t *)
+					((char *) de->name + de->len));
+		ino = grub_cpu_to_be64 (ino);
+	      }
+	    else
+	      ino = *(grub_uint64_t *) ((char *) de->name + de->len);
+	  }
+	break;
+      }
+
+    case XFS_INODE_FORMAT_EXT:
+      {
+	struct grub_xfs_dirblock_tail *tail;
+	struct grub_xfs_dir2_leaf_entry *leaf;
+	char *dirblock;
+	int dirblk_size, count, low, high;
+	grub_uint32_t hash;
+
+	dirblk_size = 1 << (diro->data->sblock.log2_bsize
+			    + diro->data->sblock.log2_dirblk);
+	if (grub_be_to_cpu64 (diro->inode.size) != (grub_uint64_t) dirblk_size)
+	  return -1;
+
+	dirblock = grub_malloc (dirblk_size);
+	if (! dirblock)
+	  return 0;
+
+	if (grub_xfs_read_file (dir, 0, 0, 0, 0, dirblk_size, dirblock)
+	    != dirblk_size)
+	  {
+	    grub_free (dirblock);
+	    return 0;
+	  }
+
+	tail = (struct grub_xfs_dirblock_tail *)
+	  (dirblock + dirblk_size - sizeof (*tail));
+	count = grub_be_to_cpu32 (tail->leaf_count);
+	leaf = (struct grub_xfs_dir2_leaf_entry *) tail - count;
+	if (grub_memcmp (dirblock, "XD2B", 4)
+	    || (char *) leaf < dirblock + 16)
+	  {
+	    grub_free (dirblock);
+	    return -1;
+	  }
+
+	/* Find the first leaf entry with the hash of NAME.  */
+	hash = grub_xfs_hashname ((const grub_uint8_t *) name, namelen);
+	low = 0;
+	high = count;
+	while (low < high)
+	  {
+	    int mid = (low + high) / 2;
+
+	    if (grub_be_to_cpu32 (leaf[mid].hashval) < hash)
+	      low = mid + 1;
+	    else
+	      high = mid;
+	  }
+
+	for (; low < count && grub_be_to_cpu32 (leaf[low].hashval) == hash;
+	     low++)
+	  {
+	    struct grub_xfs_dir2_entry *direntry;
+	    int pos;
+
+	    /* Stale entries have no address.  */
+	    pos = grub_be_to_cpu32 (leaf[low].address) << 3;
+	    if (pos < 16 || pos > ((char *) leaf - dirblock
+				   - (int) sizeof (*direntry) - namelen))
+	      continue;
+
+	    direntry = (struct grub_xfs_dir2_entry *) (dirblock + pos);
+	    if (direntry->len == namelen
+		&& ! grub_memcmp (dirblock + pos + sizeof (*direntry),
+				  name, namelen))
+	      break;
+	  }
+
+	if (low == count || grub_be_to_cpu32 (leaf[low].hashval) != hash)
+	  {
+	    grub_free (dirblock);
+	    return 0;
+	  }
+
+	ino = ((struct grub_xfs_dir2_entry *)
+	       (dirblock + (grub_be_to_cpu32 (leaf[low].address) << 3)))->inode;
+	grub_free (dirblock);
+	break;
+      }
+
+    default:
+      return -1;
+    }
+
+  *foundnode = grub_xfs_new_node (diro, ino);
+  if (! *foundnode)
+    return 0;
+
+  if (grub_errno)
+    {
+      grub_free (*foundnode);
+      return 0;
+    }
+
+  *foundtype = grub_xfs_mode_to_filetype ((*foundnode)->inode.mode);
+  return 1;
+}
+
+
+static struct grub_fs grub_xfs_fs;
+
+static void *
+grub_xfs_mount_fs (grub_disk_t disk, grub_size_t *size)
 {
   struct grub_xfs_data *data = 0;
 
@@ -629,7 +985,13 @@ grub_xfs_mount (grub_disk_t disk)
   data->pos = 0;
 
   grub_xfs_read_inode (data, data->diropen.ino, &data->diropen.inode);
+  if (grub_errno)
+    goto fail;
 
+  /* The disk is set again for every open, see grub_xfs_mount.  */
+  data->disk = 0;
+  *size = (sizeof (struct grub_xfs_data) - sizeof (struct grub_xfs_inode)
+	   + (1 << data->sblock.log2_inode));
   return data;
  fail:
 
@@ -641,6 +1003,24 @@ grub_xfs_mount (grub_disk_t disk)
   return 0;
 }
 
+static struct grub_xfs_data *
+grub_xfs_mount (grub_disk_t disk)
+{
+  struct grub_xfs_data *data;
+
+  data = grub_fs_mount_copy (&grub_xfs_fs, disk);
+  if (! data)
+    return 0;
+
+  data->disk = disk;
+  data->pos = 0;
+  data->extents = 0;
+  data->nextents = 0;
+  data->diropen.data = data;
+
+  return data;
+}
+
 struct grub_xfs_dir_closure
 {
   int (*hook) (const char *filename,
@@ -681,8 +1061,10 @@ grub_xfs_dir (grub_device_t device, const char *path,
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (path, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 0, grub_xfs_read_symlink, GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &data->diropen, &fdiro,
+				grub_xfs_iterate_dir, grub_xfs_find_entry,
+				grub_xfs_read_symlink, GRUB_FSHELP_DIR,
+				data->disk, GRUB_XFS_NODE_SIZE (data));
   if (grub_errno)
     goto fail;
 
@@ -693,7 +1075,7 @@ grub_xfs_dir (grub_device_t device, const char *path,
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_free (data);
 
  mount_fail:
 
@@ -716,8 +1098,10 @@ grub_xfs_open (struct grub_file *file, const char *name)
   if (!data)
     goto mount_fail;
 
-  grub_fshelp_find_file (name, &data->diropen, &fdiro, grub_xfs_iterate_dir,
-			 0, grub_xfs_read_symlink, GRUB_FSHELP_REG);
+  grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				grub_xfs_iterate_dir, grub_xfs_find_entry,
+				grub_xfs_read_symlink, GRUB_FSHELP_REG,
+				data->disk, GRUB_XFS_NODE_SIZE (data));
   if (grub_errno)
     goto fail;
 
@@ -743,7 +1127,7 @@ grub_xfs_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_xfs_free (data);
 
  mount_fail:
   grub_dl_unref (my_mod);
@@ -766,7 +1150,7 @@ grub_xfs_read (grub_file_t file, char *buf, grub_size_t len)
 static grub_err_t
 grub_xfs_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_xfs_free (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -790,7 +1174,7 @@ grub_xfs_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_free (data);
 
   return grub_errno;
 }
@@ -821,7 +1205,7 @@ grub_xfs_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_xfs_free (data);
 
   return grub_errno;
 }
@@ -837,6 +1221,7 @@ static struct grub_fs grub_xfs_fs =
     .close = grub_xfs_close,
     .label = grub_xfs_label,
     .uuid = grub_xfs_uuid,
+    .mount = grub_xfs_mount_fs,
     .next = 0
   };
 
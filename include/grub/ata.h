@@ -51,6 +51,19 @@ typedef enum
 
 #define GRUB_ATA_REG2_CONTROL	0
 
+/* PCI IDE bus master registers, relative to the channel's base.  */
+#define GRUB_ATA_BM_CMD		0
+#define GRUB_ATA_BM_STATUS	2
+#define GRUB_ATA_BM_PRD		4
+
+#define GRUB_ATA_BM_CMD_START	0x01
+#define GRUB_ATA_BM_CMD_TO_MEM	0x08
+
+#define GRUB_ATA_BM_STATUS_ACTIVE	0x01
+#define GRUB_ATA_BM_STATUS_ERROR	0x02
+#define GRUB_ATA_BM_STATUS_INTR		0x04
+#define GRUB_ATA_BM_STATUS_DMA0		0x20
+
 #define GRUB_ATA_STATUS_ERR	0x01
 #define GRUB_ATA_STATUS_INDEX	0x02
 #define GRUB_ATA_STATUS_ECC	0x04
@@ -76,13 +89,22 @@ enum grub_ata_commands
     GRUB_ATA_CMD_PACKET			= 0xa0,
     GRUB_ATA_CMD_READ_SECTORS		= 0x20,
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
+    GRUB_ATA_CMD_READ_DMA		= 0xc8,
+    GRUB_ATA_CMD_READ_DMA_EXT		= 0x25,
+    GRUB_ATA_CMD_READ_MULTIPLE		= 0xc4,
+    GRUB_ATA_CMD_READ_MULTIPLE_EXT	= 0x29,
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
+    GRUB_ATA_CMD_SET_MULTIPLE_MODE	= 0xc6,
     GRUB_ATA_CMD_SLEEP			= 0xe6,
     GRUB_ATA_CMD_SMART			= 0xb0,
     GRUB_ATA_CMD_STANDBY_IMMEDIATE	= 0xe0,
     GRUB_ATA_CMD_WRITE_SECTORS		= 0x30,
     GRUB_ATA_CMD_WRITE_SECTORS_EXT	= 0x34,
+    GRUB_ATA_CMD_WRITE_DMA		= 0xca,
+    GRUB_ATA_CMD_WRITE_DMA_EXT		= 0x35,
+    GRUB_ATA_CMD_WRITE_MULTIPLE		= 0xc5,
+    GRUB_ATA_CMD_WRITE_MULTIPLE_EXT	= 0x39,
   };
 
 enum grub_ata_timeout_milliseconds
@@ -91,6 +113,17 @@ enum grub_ata_timeout_milliseconds
     GRUB_ATA_TOUT_DATA = 10000   /* 10s DATA I/O timeout.  */
   };
 
+/* Physical Region Descriptor, one entry of a bus master DMA table.  */
+struct grub_ata_prd
+{
+  grub_uint32_t addr;
+  /* Byte count, 0 means 64KiB.  */
+  grub_uint16_t size;
+  grub_uint16_t flags;
+} __attribute__ ((packed));
+
+#define GRUB_ATA_PRD_EOT	0x8000
+
 struct grub_ata_device
 {
   /* IDE port to use.  */
@@ -122,6 +155,20 @@ struct grub_ata_device
   /* Set to 0 for ATA, set to 1 for ATAPI.  */
   int atapi;
 
+  /* Sectors per DRQ block set with SET MULTIPLE MODE, 0 if READ and
+     WRITE MULTIPLE are not used.  */
+  int multiple;
+
+  /* IO address of the bus master registers of this channel, 0 if the
+     controller can't do DMA.  */
+  grub_port_t bmaddress;
+
+  /* Set to 1 when transfers use bus master DMA.  */
+  int dma;
+
+  /* The PRD table used for DMA transfers.  */
+  struct grub_ata_prd *prd;
+
   struct grub_ata_device *next;
 };
 
@@ -69,6 +69,9 @@ struct grub_command
 
   /* Arbitrary data.  */
   void *data;
+
+  /* The next element in the same hash bucket.  */
+  struct grub_command *hash_next;
 };
 typedef struct grub_command *grub_command_t;
 
@@ -89,11 +92,7 @@ void grub_unregister_command (grub_command_t cmd);
   grub_reg_cmd (name, func, summary, description, 1); \
   GRUB_MODATTR ("command", "*" name);
 
-static inline grub_command_t
-grub_command_find (const char *name)
-{
-  return grub_named_list_find (GRUB_AS_NAMED_LIST (grub_command_list), name);
-}
+grub_command_t grub_command_find (const char *name);
 
 static inline grub_err_t
 grub_command_execute (const char *name, int argc, char **argv)
@@ -112,6 +111,10 @@ grub_command_iterate (int (*func) (grub_command_t, void *closure),
 			    (grub_list_hook_t) func, closure);
 }
 
+int grub_command_iterate_prefix (const char *prefix,
+				 int (*func) (grub_command_t, void *closure),
+				 void *closure);
+
 void grub_register_core_commands (void);
 
 #endif /* ! GRUB_COMMAND_HEADER */
@@ -45,6 +45,7 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_LUKS_ID,
     GRUB_DISK_DEVICE_USB_ID,
     GRUB_DISK_DEVICE_MAP_ID,
+    GRUB_DISK_DEVICE_AHCI_ID,
   };
 
 struct grub_disk;
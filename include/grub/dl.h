@@ -88,12 +88,19 @@ struct grub_dl
   Elf_Sym *symtab;
   void (*init) (struct grub_dl *mod);
   void (*fini) (void);
+  /* The image loaded from file, if any.  */
+  void *core;
+  /* The time in ms spent reading, relocating and initializing.  */
+  grub_uint64_t load_time;
 };
 typedef struct grub_dl *grub_dl_t;
 
 
 grub_dl_t grub_dl_load_file (const char *filename);
 grub_dl_t grub_dl_load (const char *name);
+void grub_dl_preload (int argc, char *names[]);
+typedef void (*grub_dl_trace_hook_t) (grub_dl_t mod);
+extern grub_dl_trace_hook_t grub_dl_trace_hook;
 grub_dl_t grub_dl_load_core (void *addr, grub_size_t size);
 int grub_dl_unload (grub_dl_t mod);
 void grub_dl_unload_unneeded (void);
@@ -21,14 +21,25 @@
 
 #include <grub/env.h>
 
-/* The size of the hash table.  */
-#define	HASHSZ	13
+/* The initial size of the hash table, must be a power of two.  */
+#define	GRUB_ENV_HASHSZ_MIN	16
 
 /* A hashtable for quick lookup of variables.  */
 struct grub_env_context
 {
-  /* A hash table for variables.  */
-  struct grub_env_var *vars[HASHSZ];
+  /* A hash table for variables, allocated on the first insertion.  */
+  struct grub_env_var **vars;
+
+  /* The number of buckets in VARS.  */
+  unsigned size;
+
+  /* The number of variables in VARS.  */
+  unsigned count;
+
+  /* The context whose exported variables are shared with this one until
+     they are written, or NULL.  A variable with a NULL value in VARS hides
+     the inherited variable of the same name.  */
+  struct grub_env_context *inherit;
 
   /* One level deeper on the stack.  */
   struct grub_env_context *prev;
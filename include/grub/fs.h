@@ -74,6 +74,14 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* Read and check the filesystem on DISK, and return data describing it,
+     of SIZE bytes, to be shared by the files opened on DISK.  This is
+     optional, see grub_fs_mount.  */
+  void *(*mount) (struct grub_disk *disk, grub_size_t *size);
+
+  /* Free the data returned by mount.  Defaults to grub_free.  */
+  void (*unmount) (void *data);
+
 #ifdef GRUB_UTIL
   /* Whether this filesystem reserves first sector for DOS-style boot.  */
   int reserved_first_sector;
@@ -99,10 +107,17 @@ grub_fs_register (grub_fs_t fs)
   GRUB_MODATTR ("fs", "");
 }
 
+void *grub_fs_mount (grub_fs_t fs, struct grub_disk *disk);
+void *grub_fs_mount_copy (grub_fs_t fs, struct grub_disk *disk);
+void grub_fs_unmount (grub_fs_t fs, void *data);
+void grub_fs_mount_flush (grub_fs_t fs);
+extern unsigned long grub_fs_mount_generation;
+
 static inline void
 grub_fs_unregister (grub_fs_t fs)
 {
   grub_list_remove (GRUB_AS_LIST_P (&grub_fs_list), GRUB_AS_LIST (fs));
+  grub_fs_mount_flush (fs);
 }
 
 static inline void
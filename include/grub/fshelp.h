@@ -62,6 +62,35 @@ grub_err_t grub_fshelp_find_file (const char *path,
 				  char *(*read_symlink) (grub_fshelp_node_t node),
 				  enum grub_fshelp_filetype expect);
 
+/* Like grub_fshelp_find_file, but the nodes found on DISK are cached, so
+   that the directories of a path are not read again by later lookups.
+   The nodes are NODE_SIZE bytes and must start with a pointer to the
+   data of the mount, which is set from ROOTNODE in the copies returned
+   from the cache.  ROOTNODE must be the root of the filesystem.
+   FIND_ENTRY, if not NULL, looks NAME up in the index of the directory
+   DIR, and returns 1 if it is found, 0 if not, or -1 if DIR has no index
+   so ITERATE_DIR has to be used instead.  */
+grub_err_t grub_fshelp_find_file_cached (const char *path,
+					 grub_fshelp_node_t rootnode,
+					 grub_fshelp_node_t *foundnode,
+					 int (*iterate_dir)
+					 (grub_fshelp_node_t dir,
+					  int (*hook)
+					  (const char *filename,
+					   enum grub_fshelp_filetype filetype,
+					   grub_fshelp_node_t node,
+					   void *closure),
+					  void *closure),
+					 int (*find_entry)
+					 (grub_fshelp_node_t dir,
+					  const char *name,
+					  grub_fshelp_node_t *foundnode,
+					  enum grub_fshelp_filetype *foundtype),
+					 char *(*read_symlink)
+					 (grub_fshelp_node_t node),
+					 enum grub_fshelp_filetype expect,
+					 grub_disk_t disk,
+					 grub_size_t node_size);
 
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
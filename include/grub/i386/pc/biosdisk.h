@@ -25,6 +25,13 @@
 #define GRUB_BIOSDISK_FLAG_LBA	1
 #define GRUB_BIOSDISK_FLAG_CDROM 2
 #define GRUB_BIOSDISK_FLAG_FB 4
+#define GRUB_BIOSDISK_FLAG_FLAT 8
+
+/* Subset support bitmap returned by the installation check.  */
+#define GRUB_BIOSDISK_EXT_ACCESS	1
+#define GRUB_BIOSDISK_EXT_LOCKING	2
+#define GRUB_BIOSDISK_EXT_EDD		4
+#define GRUB_BIOSDISK_EXT_64BIT		8
 
 #define GRUB_BIOSDISK_CDTYPE_NO_EMUL	0
 #define GRUB_BIOSDISK_CDTYPE_1_2_M	1
@@ -42,6 +49,11 @@ struct grub_biosdisk_data
   int flags;
   grub_size_t max_sectors;
   grub_uint64_t total_sectors;
+
+  /* Current transfer size, shrunk on errors and grown back after a run
+     of successful transfers.  */
+  grub_size_t chunk_sectors;
+  unsigned good_transfers;
 };
 
 /* Drive Parameters.  */
@@ -106,8 +118,14 @@ struct grub_biosdisk_dap
   grub_uint16_t blocks;
   grub_uint32_t buffer;
   grub_uint64_t block;
+
+  /* EDD 3.0: flat address used when BUFFER is 0xFFFF:FFFF.  */
+  grub_uint64_t flat_buffer;
 } __attribute__ ((packed));
 
+#define GRUB_BIOSDISK_DAP_SIZE		0x10
+#define GRUB_BIOSDISK_DAP_FLAT_SIZE	0x18
+
 int grub_biosdisk_rw_int13_extensions (int ah, int drive, void *dap);
 int grub_biosdisk_rw_standard (int ah, int drive, int coff, int hoff,
 			       int soff, int nsec, int segment);
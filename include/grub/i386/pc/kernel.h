@@ -41,13 +41,18 @@
 #define GRUB_KERNEL_MACHINE_DATA_END		0x5c
 
 /* The size of the first region which won't be compressed.  */
-#define GRUB_KERNEL_MACHINE_RAW_SIZE		(GRUB_KERNEL_MACHINE_DATA_END + 0x5F0)
+#define GRUB_KERNEL_MACHINE_RAW_SIZE		(GRUB_KERNEL_MACHINE_DATA_END + 0x630)
 
 #define GRUB_KERNEL_MACHINE_MENU_MAGIC		0x454d5542
 
 /* Enable LZMA compression */
 #define ENABLE_LZMA	1
 
+/* The compressed part is split in blocks of this size, each compressed on
+   its own. It starts with the block size, the number of blocks and the
+   compressed size of every block, all 32-bit, followed by the blocks.  */
+#define GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE	0x40000
+
 #ifndef ASM_FILE
 
 #include <grub/symbol.h>
@@ -183,6 +183,21 @@ grub_strncasecmp (const char *s1, const char *s2, grub_size_t n)
   return (int) grub_tolower (*s1) - (int) grub_tolower (*s2);
 }
 
+/* Return the 32-bit FNV-1a hash of the string S.  */
+static inline grub_uint32_t
+grub_strhash (const char *s)
+{
+  grub_uint32_t h = 2166136261U;
+
+  while (*s)
+    {
+      h ^= (grub_uint8_t) *s++;
+      h *= 16777619U;
+    }
+
+  return h;
+}
+
 unsigned long grub_strtoul (const char *str, char **end, int base);
 unsigned long long grub_strtoull (const char *str, char **end, int base);
 
@@ -32,6 +32,11 @@ void read_command_list (const char *prefix);
 /* Defined in `autofs.c'.  */
 void read_fs_list (const char *prefix);
 
+/* Defined in `preload.c'.  */
+void read_preload_list (const char *prefix);
+void grub_preload_init (void);
+void grub_preload_fini (void);
+
 void grub_context_init (void);
 void grub_context_fini (void);
 
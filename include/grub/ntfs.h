@@ -120,6 +120,14 @@ struct grub_ntfs_bpb
 
 #define grub_ntfs_file grub_fshelp_node
 
+/* A run of clusters from a decoded run list.  LCN is the last non sparse
+   LCN if SPARSE is set.  */
+struct grub_ntfs_run
+{
+  grub_disk_addr_t vcn, lcn;
+  int sparse;
+};
+
 struct grub_ntfs_attr
 {
   int flags;
@@ -128,6 +136,14 @@ struct grub_ntfs_attr
   grub_uint32_t save_pos;
   char *sbuf;
   struct grub_ntfs_file *mft;
+
+  /* The run list last used, decoded.  RUNS has NUM_RUNS entries followed
+     by one which gives the end of the last run.  RUN_END points to the
+     end of the run list in the attribute.  */
+  char *run_key;
+  struct grub_ntfs_run *runs;
+  int num_runs;
+  char *run_end;
 };
 
 struct grub_fshelp_node
@@ -170,6 +186,10 @@ struct grub_ntfs_rlst
   char *cur_run;
   struct grub_ntfs_attr *attr;
   struct grub_ntfs_comp comp;
+
+  /* The next decoded run and the end of the decoded runs.  CUR_RUN is
+     only used after the last one.  */
+  struct grub_ntfs_run *run, *run_last;
 };
 
 typedef grub_err_t (*ntfscomp_func_t) (struct grub_ntfs_attr * at, char *dest,
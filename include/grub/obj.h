@@ -22,7 +22,12 @@
 #include <grub/types.h>
 
 #define GRUB_OBJ_HEADER_MAGIC	0x4a424f47	/* GOBJ  */
-#define GRUB_OBJ_HEADER_VERSION	1
+
+/* A bundle has the layout of an object file, with several modules linked
+   together into a single segment which starts with a grub_module_info
+   table describing them.  */
+#define GRUB_OBJ_BUNDLE_MAGIC	0x4c444247	/* GBDL  */
+#define GRUB_OBJ_HEADER_VERSION	3
 
 #define GRUB_OBJ_SEG_END	0
 #define GRUB_OBJ_SEG_TEXT	1
@@ -45,9 +50,9 @@ struct grub_obj_header
 {
   grub_uint32_t magic;
   grub_uint16_t version;
-  grub_uint16_t symbol_table;
-  grub_uint16_t reloc_table;
-  grub_uint16_t string_table;
+  grub_uint32_t symbol_table;
+  grub_uint32_t reloc_table;
+  grub_uint32_t string_table;
   grub_uint16_t init_func;
   grub_uint16_t fini_func;
   grub_uint32_t mod_deps;
@@ -73,6 +78,10 @@ struct grub_obj_header
 #define GRUB_OBJ_REL_TYPE_MASK	0x7f
 #define GRUB_OBJ_REL_FLAG_REL	0x80
 
+/* Every name in the string table is preceded by its grub_strhash value,
+   stored in target byte order.  */
+#define GRUB_OBJ_STRTAB_HASH_SIZE	4
+
 struct grub_obj_symbol
 {
   grub_uint8_t segment;
@@ -69,6 +69,10 @@ void grub_usb_controller_dev_register (grub_usb_controller_dev_t usb);
 
 void grub_usb_controller_dev_unregister (grub_usb_controller_dev_t usb);
 
+void grub_usb_controller_dev_rescan (grub_usb_controller_dev_t usb);
+
+void grub_usb_forget_devs (grub_usb_controller_dev_t usb);
+
 int grub_usb_controller_iterate (int (*hook) (grub_usb_controller_t dev,
 					      void *closure),
 				 void *closure);
@@ -108,6 +112,10 @@ struct grub_usb_controller_dev
 
   grub_usb_speed_t (*detect_dev) (grub_usb_controller_t dev, int port);
 
+  /* The largest transaction the controller splits into packets by
+     itself, 0 if a transaction must fit in a single packet.  */
+  grub_size_t max_transaction;
+
   /* The next host controller.  */
   struct grub_usb_controller_dev *next;
 };
@@ -0,0 +1,67 @@
+/* hostio.h - read and write host files and devices */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef GRUB_UTIL_HOSTIO_HEADER
+#define GRUB_UTIL_HOSTIO_HEADER	1
+
+#include <grub/types.h>
+#include <grub/err.h>
+#include <sys/types.h>
+
+/* How host files and devices are accessed.  The mode is taken from the
+   GRUB_HOSTIO environment variable unless set explicitly.  */
+enum grub_util_hostio_mode
+  {
+    /* pread and pwrite on a descriptor kept open.  */
+    GRUB_UTIL_HOSTIO_PREAD,
+    /* Map regular files read-only, other files use pread.  */
+    GRUB_UTIL_HOSTIO_MMAP,
+    /* Bypass the page cache for block devices opened read-only.  */
+    GRUB_UTIL_HOSTIO_DIRECT
+  };
+
+struct grub_util_hostio
+{
+  int fd;
+
+  /* The mode actually used for FD.  */
+  enum grub_util_hostio_mode mode;
+
+  char *map;
+  grub_uint64_t map_size;
+
+  /* Alignment of O_DIRECT transfers and the buffer to bounce unaligned
+     ones through.  */
+  grub_size_t align;
+  char *bounce;
+};
+
+grub_err_t grub_util_hostio_set_mode (const char *name);
+enum grub_util_hostio_mode grub_util_hostio_get_mode (void);
+const char *grub_util_hostio_mode_name (enum grub_util_hostio_mode mode);
+int grub_util_hostio_mode_in_use (enum grub_util_hostio_mode mode);
+
+void grub_util_hostio_attach (struct grub_util_hostio *io, int fd, int flags);
+void grub_util_hostio_detach (struct grub_util_hostio *io);
+ssize_t grub_util_hostio_read (struct grub_util_hostio *io, char *buf,
+			       size_t len, grub_uint64_t offset);
+ssize_t grub_util_hostio_write (struct grub_util_hostio *io, const char *buf,
+				size_t len, grub_uint64_t offset);
+
+#endif /* ! GRUB_UTIL_HOSTIO_HEADER */
@@ -81,6 +81,9 @@ struct grub_util_obj
   grub_uint32_t mod_attr;
   char *attr;
   int attr_len;
+  char *deps;
+  int deps_len;
+  int bundle;
   struct grub_util_obj_segment *got_segment;
   struct grub_util_obj_csym *csyms;
   struct grub_util_obj_got *gots;
@@ -106,6 +109,11 @@ struct grub_util_obj_segment *
 grub_obj_add_modinfo (struct grub_util_obj *obj, const char *dir,
 		      struct grub_util_path_list *path_list, int as_info,
 		      char *memdisk_path, char *config_path);
+struct grub_util_obj_segment *
+grub_obj_add_bundle (struct grub_util_obj *obj,
+		     struct grub_util_path_list *path_list);
+void grub_obj_bundle_done (struct grub_util_obj *obj,
+			   struct grub_util_obj_segment *modinfo);
 int grub_obj_add_kernel_symbols (struct grub_util_obj *obj,
 				 struct grub_util_obj_segment *modinfo,
 				 grub_uint32_t offset);
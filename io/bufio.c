@@ -1,7 +1,7 @@
 /* bufio.c - buffered io access */
 /*
  *  GRUB  --  GRand Unified Bootloader
- *  Copyright (C) 2008  Free Software Foundation, Inc.
+ *  Copyright (C) 2008,2010  Free Software Foundation, Inc.
  *
  *  GRUB is free software: you can redistribute it and/or modify
  *  it under the terms of the GNU General Public License as published by
@@ -30,12 +30,34 @@ GRUB_EXPORT(grub_buffile_open);
 #define GRUB_BUFIO_DEF_SIZE	8192
 #define GRUB_BUFIO_MAX_SIZE	1048576
 
+/* A piece of the underlying file kept in memory.  */
+struct grub_bufio_buffer
+{
+  grub_off_t offset;
+  grub_size_t len;
+  grub_size_t alloc;
+  char *data;
+};
+
 struct grub_bufio
 {
   grub_file_t file;
+  /* Reads from the underlying file start at a multiple of this.  */
   grub_size_t block_size;
-  grub_size_t buffer_len;
-  char buffer[0];
+  /* How much to read on the next miss, and how far it can grow.  */
+  grub_size_t window;
+  grub_size_t max_window;
+  /* Where the last read from the underlying file ended.  */
+  grub_off_t next;
+  /* The last buffer filled, and the one before it, so that seeking back a
+     little doesn't read the file again.  */
+  struct grub_bufio_buffer cur;
+  struct grub_bufio_buffer prev;
+  /* Statistics, shown by the `bufio' debug condition on close.  */
+  unsigned long hits;
+  unsigned long back_hits;
+  unsigned long fills;
+  unsigned long direct;
 };
 typedef struct grub_bufio *grub_bufio_t;
 
@@ -60,7 +82,7 @@ grub_bufio_open (grub_file_t io, int size)
     size = ((io->size > GRUB_BUFIO_MAX_SIZE) ? GRUB_BUFIO_MAX_SIZE :
             io->size);
 
-  bufio = grub_malloc (sizeof (struct grub_bufio) + size);
+  bufio = grub_zalloc (sizeof (struct grub_bufio));
   if (! bufio)
     {
       grub_free (file);
@@ -69,7 +91,11 @@ grub_bufio_open (grub_file_t io, int size)
 
   bufio->file = io;
   bufio->block_size = size;
-  bufio->buffer_len = 0;
+  bufio->window = size;
+  bufio->max_window = size;
+  if (size)
+    bufio->max_window = (GRUB_BUFIO_MAX_SIZE / size) * size;
+  bufio->next = (grub_off_t) -1;
 
   file->device = io->device;
   file->offset = 0;
@@ -100,85 +126,136 @@ grub_buffile_open (const char *name, int size)
   return file;
 }
 
-static grub_ssize_t
-grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
+/* Read the window at START into the current buffer, after keeping the
+   current one as the previous.  */
+static grub_err_t
+grub_bufio_fill (grub_bufio_t bufio, grub_off_t start)
 {
-  grub_size_t res = len;
-  grub_bufio_t bufio = file->data;
-  grub_uint32_t pos;
-
-  if ((file->offset >= bufio->file->offset) &&
-      (file->offset < bufio->file->offset + bufio->buffer_len))
-    {
-      grub_size_t n;
+  struct grub_bufio_buffer b = bufio->prev;
+  grub_size_t len;
 
-      pos = file->offset - bufio->file->offset;
-      n = bufio->buffer_len - pos;
-      if (n > len)
-        n = len;
+  bufio->prev = bufio->cur;
 
-      grub_memcpy (buf, &bufio->buffer[pos], n);
-      len -= n;
-      if (! len)
-        return res;
-
-      buf += n;
-      bufio->file->offset += bufio->buffer_len;
-      pos = 0;
-    }
-  else
-    {
-      bufio->file->offset = grub_divmod64 (file->offset, bufio->block_size,
-                                           &pos);
-      bufio->file->offset *= bufio->block_size;
-    }
+  len = bufio->file->size - start;
+  if (len > bufio->window)
+    len = bufio->window;
 
-  if (pos + len >= bufio->block_size)
+  if (b.alloc < len)
     {
-      if (pos)
-        {
-          grub_size_t n;
-
-          bufio->file->fs->read (bufio->file, bufio->buffer,
-                                 bufio->block_size);
-          if (grub_errno)
-            return -1;
-
-          n = bufio->block_size - pos;
-          grub_memcpy (buf, &bufio->buffer[pos], n);
-          len -= n;
-          buf += n;
-          bufio->file->offset += bufio->block_size;
-          pos = 0;
-        }
-
-      while (len >= bufio->block_size)
-        {
-          bufio->file->fs->read (bufio->file, buf, bufio->block_size);
-          if (grub_errno)
-            return -1;
-
-          len -= bufio->block_size;
-          buf += bufio->block_size;
-          bufio->file->offset += bufio->block_size;
-        }
-
-      if (! len)
-        {
-          bufio->buffer_len = 0;
-          return res;
-        }
+      grub_free (b.data);
+      b.data = grub_malloc (len);
+      if (! b.data && len > bufio->block_size)
+	{
+	  /* Fall back to the smallest window.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  bufio->window = bufio->block_size;
+	  if (len > bufio->window)
+	    len = bufio->window;
+	  b.data = grub_malloc (len);
+	}
+      b.alloc = b.data ? len : 0;
     }
 
-  bufio->buffer_len = bufio->file->size - bufio->file->offset;
-  if (bufio->buffer_len > bufio->block_size)
-    bufio->buffer_len = bufio->block_size;
+  b.len = 0;
+  bufio->cur = b;
+  if (! b.data)
+    return grub_errno;
 
-  bufio->file->fs->read (bufio->file, bufio->buffer, bufio->buffer_len);
+  bufio->file->offset = start;
+  bufio->file->fs->read (bufio->file, b.data, len);
   if (grub_errno)
-    return -1;
+    return grub_errno;
+
+  bufio->cur.offset = start;
+  bufio->cur.len = len;
+  bufio->next = start + len;
+  bufio->fills++;
 
-  grub_memcpy (buf, &bufio->buffer[pos], len);
+  return GRUB_ERR_NONE;
+}
+
+static grub_ssize_t
+grub_bufio_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_size_t res = len;
+  grub_bufio_t bufio = file->data;
+  grub_off_t offset = file->offset;
+
+  while (len)
+    {
+      struct grub_bufio_buffer *b;
+      grub_off_t start;
+      grub_uint32_t pos;
+
+      if (offset - bufio->cur.offset < bufio->cur.len)
+	b = &bufio->cur;
+      else if (offset - bufio->prev.offset < bufio->prev.len)
+	b = &bufio->prev;
+      else
+	b = 0;
+
+      if (b)
+	{
+	  grub_size_t n;
+
+	  pos = offset - b->offset;
+	  n = b->len - pos;
+	  if (n > len)
+	    n = len;
+
+	  grub_memcpy (buf, b->data + pos, n);
+	  if (b == &bufio->cur)
+	    bufio->hits++;
+	  else
+	    bufio->back_hits++;
+
+	  buf += n;
+	  len -= n;
+	  offset += n;
+	  continue;
+	}
+
+      start = grub_divmod64 (offset, bufio->block_size, &pos);
+      start *= bufio->block_size;
+
+      /* Read ahead further each time the file is read sequentially, and
+	 start over from one block on a seek.  */
+      if (start == bufio->next)
+	{
+	  if (bufio->window < bufio->max_window)
+	    bufio->window *= 2;
+	  if (bufio->window > bufio->max_window)
+	    bufio->window = bufio->max_window;
+	}
+      else
+	bufio->window = bufio->block_size;
+
+      /* Whole blocks that don't fit in the window go straight to the
+	 caller, in a single read.  */
+      if (! pos && len >= bufio->window)
+	{
+	  grub_size_t n = len;
+
+	  if (offset + n < file->size)
+	    n -= n % bufio->block_size;
+
+	  bufio->file->offset = offset;
+	  bufio->file->fs->read (bufio->file, buf, n);
+	  if (grub_errno)
+	    return -1;
+
+	  bufio->next = offset + n;
+	  bufio->direct++;
+
+	  buf += n;
+	  len -= n;
+	  offset += n;
+	  continue;
+	}
+
+      if (grub_bufio_fill (bufio, start))
+	return -1;
+    }
 
   return res;
 }
@@ -188,7 +265,13 @@ grub_bufio_close (grub_file_t file)
 {
   grub_bufio_t bufio = file->data;
 
+  grub_dprintf ("bufio", "%lu hits, %lu back hits, %lu fills, %lu direct "
+		"reads, window %lu\n", bufio->hits, bufio->back_hits,
+		bufio->fills, bufio->direct, (unsigned long) bufio->window);
+
   grub_file_close (bufio->file);
+  grub_free (bufio->cur.data);
+  grub_free (bufio->prev.data);
   grub_free (bufio);
 
   file->device = 0;
@@ -41,6 +41,7 @@
 #include <grub/fs.h>
 #include <grub/file.h>
 #include <grub/gzio.h>
+#include <grub/lz4io.h>
 
 GRUB_EXPORT(grub_gzfile_open);
 GRUB_EXPORT(grub_gzio_open);
@@ -1145,13 +1146,19 @@ grub_gzio_open (grub_file_t io, int transparent)
       grub_free (file);
       grub_file_seek (io, 0);
 
-      if (grub_errno == GRUB_ERR_BAD_FILE_TYPE && transparent)
+      if (grub_errno == GRUB_ERR_BAD_FILE_TYPE)
 	{
+	  grub_file_t lz4;
+
+	  /* It may still be compressed by LZ4.  */
 	  grub_errno = GRUB_ERR_NONE;
-	  return io;
+	  lz4 = grub_lz4io_open (io, 1);
+	  if (lz4 != io || transparent)
+	    return lz4;
+
+	  grub_error (GRUB_ERR_BAD_FILE_TYPE, "no gzip magic found");
 	}
-      else
-	return 0;
+      return 0;
     }
 
   return file;
@@ -0,0 +1,614 @@
+/* lz4io.c - decompression support for LZ4 frames */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * LZ4 trades compression ratio for a decoder that is little more than
+ * a series of memory copies, which makes it much cheaper than inflate on
+ * slow firmware. Only the frame format is understood. The header, block
+ * and content checksums are skipped.
+ */
+
+#include <grub/err.h>
+#include <grub/types.h>
+#include <grub/mm.h>
+#include <grub/misc.h>
+#include <grub/fs.h>
+#include <grub/file.h>
+#include <grub/lz4io.h>
+
+GRUB_EXPORT(grub_lz4io_open);
+
+#define LZ4_MAGIC			0x184D2204
+
+#define LZ4_FLG_VERSION_MASK		0xc0
+#define LZ4_FLG_VERSION			0x40
+#define LZ4_FLG_BLOCK_INDEP		0x20
+#define LZ4_FLG_BLOCK_CHECKSUM		0x10
+#define LZ4_FLG_CONTENT_SIZE		0x08
+#define LZ4_FLG_CONTENT_CHECKSUM	0x04
+#define LZ4_FLG_RESERVED		0x02
+#define LZ4_FLG_DICT_ID			0x01
+
+#define LZ4_BD_BLOCK_MAX_SHIFT		4
+#define LZ4_BD_BLOCK_MAX_MASK		0x07
+
+/* Set in the size of a block stored without compression.  */
+#define LZ4_BLOCK_UNCOMPRESSED		0x80000000
+
+/* How far back a match can reach.  */
+#define LZ4_WINDOW_SIZE			0x10000
+
+/* The minimum length of a match.  */
+#define LZ4_MIN_MATCH			4
+
+/* Copies are done a word at a time and may run this far past their end,
+   so the buffers have that much room after them.  */
+#define LZ4_COPY_SLACK			sizeof (grub_addr_t)
+
+struct lz4_word
+{
+  grub_addr_t w;
+} __attribute__ ((packed));
+
+/* Where a block starts, to find it again after a seek.  */
+struct grub_lz4io_block
+{
+  grub_off_t in;
+  grub_off_t out;
+};
+
+/* The state stored in filesystem-specific data.  */
+struct grub_lz4io
+{
+  /* The underlying file object.  */
+  grub_file_t file;
+  /* The frame flags.  */
+  int flags;
+  /* The maximum size of a decompressed block.  */
+  grub_size_t block_max;
+  /* The offset of the first block in the underlying file.  */
+  grub_off_t data_offset;
+  /* The offset of the next block in the underlying file.  */
+  grub_off_t next_in;
+  /* The offset of the current block in the decompressed data.  */
+  grub_off_t block_out;
+  /* The length of the current block.  */
+  grub_size_t block_len;
+  /* The length of the data before the current block in the window.  */
+  grub_size_t history;
+  /* The compressed data of a block.  */
+  grub_uint8_t *inbuf;
+  /* LZ4_WINDOW_SIZE bytes for the end of the previous blocks, followed by
+     the current block.  */
+  grub_uint8_t *window;
+  /* The blocks seen so far, in order.  */
+  struct grub_lz4io_block *blocks;
+  unsigned num_blocks;
+  unsigned max_blocks;
+};
+typedef struct grub_lz4io *grub_lz4io_t;
+
+/* Declare the filesystem structure for grub_lz4io_open.  */
+static struct grub_fs grub_lz4io_fs;
+
+/* Copy N bytes from S to D, which is at least LZ4_COPY_SLACK bytes after
+   S if they overlap. Bytes up to LZ4_COPY_SLACK - 1 after D + N may be
+   overwritten.  */
+static inline void
+copy_words (grub_uint8_t *d, const grub_uint8_t *s, grub_size_t n)
+{
+  grub_uint8_t *e = d + n;
+
+  while (d < e)
+    {
+      ((struct lz4_word *) d)->w = ((const struct lz4_word *) s)->w;
+      d += sizeof (grub_addr_t);
+      s += sizeof (grub_addr_t);
+    }
+}
+
+/* Read a length continued in the bytes following a nibble of 15.  */
+#define LZ4_READ_LENGTH(ip, iend, len)		\
+  do						\
+    {						\
+      unsigned b;				\
+						\
+      do					\
+	{					\
+	  if (ip >= iend)			\
+	    goto fail;				\
+	  b = *ip++;				\
+	  len += b;				\
+	}					\
+      while (b == 255);				\
+    }						\
+  while (0)
+
+/* Decompress the INSIZE bytes at IN to OUT, which has room for OUTSIZE
+   bytes and is preceded by HISTORY bytes of earlier output. Return the
+   decompressed length, or -1 if the data is invalid.  */
+static grub_ssize_t
+decode_block (const grub_uint8_t *ip, grub_size_t insize,
+	      grub_uint8_t *out, grub_size_t outsize, grub_size_t history)
+{
+  const grub_uint8_t *iend = ip + insize;
+  grub_uint8_t *op = out, *oend = out + outsize;
+
+  while (1)
+    {
+      grub_uint8_t *match;
+      grub_size_t len, offset;
+      unsigned token;
+
+      if (ip >= iend)
+	goto fail;
+      token = *ip++;
+
+      /* Copy the literals.  */
+      len = token >> 4;
+      if (len == 15)
+	LZ4_READ_LENGTH (ip, iend, len);
+      if (len > (grub_size_t) (iend - ip) || len > (grub_size_t) (oend - op))
+	goto fail;
+      copy_words (op, ip, len);
+      ip += len;
+      op += len;
+
+      /* The last sequence has no match.  */
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	goto fail;
+      offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (grub_size_t) (op - out) + history)
+	goto fail;
+
+      len = token & 15;
+      if (len == 15)
+	LZ4_READ_LENGTH (ip, iend, len);
+      len += LZ4_MIN_MATCH;
+      if (len > (grub_size_t) (oend - op))
+	goto fail;
+
+      /* A match closer than a word repeats itself within the word.  */
+      match = op - offset;
+      if (offset >= LZ4_COPY_SLACK)
+	{
+	  copy_words (op, match, len);
+	  op += len;
+	}
+      else
+	while (len--)
+	  *op++ = *match++;
+    }
+
+  return op - out;
+
+ fail:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid LZ4 data");
+  return -1;
+}
+
+/* Return the decompressed length of the INSIZE bytes at IN without
+   decompressing them, or -1 if the data is invalid.  */
+static grub_ssize_t
+block_length (const grub_uint8_t *ip, grub_size_t insize)
+{
+  const grub_uint8_t *iend = ip + insize;
+  grub_size_t total = 0;
+
+  while (1)
+    {
+      grub_size_t len;
+      unsigned token;
+
+      if (ip >= iend)
+	goto fail;
+      token = *ip++;
+
+      len = token >> 4;
+      if (len == 15)
+	LZ4_READ_LENGTH (ip, iend, len);
+      if (len > (grub_size_t) (iend - ip))
+	goto fail;
+      ip += len;
+      total += len;
+
+      if (ip == iend)
+	break;
+
+      if (iend - ip < 2)
+	goto fail;
+      ip += 2;
+
+      len = token & 15;
+      if (len == 15)
+	LZ4_READ_LENGTH (ip, iend, len);
+      total += len + LZ4_MIN_MATCH;
+    }
+
+  return total;
+
+ fail:
+  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid LZ4 data");
+  return -1;
+}
+
+static grub_err_t
+read_at (grub_lz4io_t lz4io, grub_off_t offset, void *buf, grub_size_t len)
+{
+  grub_file_seek (lz4io->file, offset);
+  if (grub_errno)
+    return grub_errno;
+
+  if (grub_file_read (lz4io->file, buf, len) != (grub_ssize_t) len
+      && ! grub_errno)
+    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "truncated LZ4 data");
+
+  return grub_errno;
+}
+
+/* Read the size of the block at IN. Return 0 at the end mark.  */
+static grub_err_t
+read_block_size (grub_lz4io_t lz4io, grub_off_t in, grub_uint32_t *size)
+{
+  if (read_at (lz4io, in, size, sizeof (*size)))
+    return grub_errno;
+
+  *size = grub_le_to_cpu32 (*size);
+  if ((*size & ~LZ4_BLOCK_UNCOMPRESSED) > lz4io->block_max)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "LZ4 block too large");
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_off_t
+next_block_in (grub_lz4io_t lz4io, grub_off_t in, grub_uint32_t size)
+{
+  in += sizeof (size) + (size & ~LZ4_BLOCK_UNCOMPRESSED);
+  if (lz4io->flags & LZ4_FLG_BLOCK_CHECKSUM)
+    in += sizeof (grub_uint32_t);
+  return in;
+}
+
+/* Remember that the block at IN in the underlying file starts at OUT.  */
+static void
+add_block (grub_lz4io_t lz4io, grub_off_t in, grub_off_t out)
+{
+  if (lz4io->num_blocks && lz4io->blocks[lz4io->num_blocks - 1].in >= in)
+    return;
+
+  if (lz4io->num_blocks == lz4io->max_blocks)
+    {
+      struct grub_lz4io_block *blocks;
+      unsigned max = lz4io->max_blocks ? lz4io->max_blocks * 2 : 64;
+
+      blocks = grub_realloc (lz4io->blocks, max * sizeof (blocks[0]));
+      if (! blocks)
+	{
+	  /* It only makes seeking faster.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  return;
+	}
+      lz4io->blocks = blocks;
+      lz4io->max_blocks = max;
+    }
+
+  lz4io->blocks[lz4io->num_blocks].in = in;
+  lz4io->blocks[lz4io->num_blocks].out = out;
+  lz4io->num_blocks++;
+}
+
+/* Decompress the block following the current one.  */
+static grub_err_t
+next_block (grub_lz4io_t lz4io)
+{
+  grub_uint8_t *out = lz4io->window + LZ4_WINDOW_SIZE;
+  grub_uint32_t size;
+  grub_ssize_t len;
+
+  if (read_block_size (lz4io, lz4io->next_in, &size))
+    return grub_errno;
+  if (size == 0)
+    return grub_error (GRUB_ERR_BAD_COMPRESSED_DATA,
+		       "unexpected end of LZ4 data");
+
+  /* Keep what the next block may refer to in front of it.  */
+  if (! (lz4io->flags & LZ4_FLG_BLOCK_INDEP))
+    {
+      grub_size_t keep = lz4io->history + lz4io->block_len;
+
+      if (keep > LZ4_WINDOW_SIZE)
+	keep = LZ4_WINDOW_SIZE;
+      if (lz4io->block_len >= LZ4_COPY_SLACK)
+	copy_words (out - keep, out + lz4io->block_len - keep, keep);
+      else
+	grub_memmove (out - keep, out + lz4io->block_len - keep, keep);
+      lz4io->history = keep;
+    }
+
+  lz4io->block_out += lz4io->block_len;
+  lz4io->block_len = 0;
+
+  if (size & LZ4_BLOCK_UNCOMPRESSED)
+    {
+      len = size & ~LZ4_BLOCK_UNCOMPRESSED;
+      if (read_at (lz4io, lz4io->next_in + sizeof (size), out, len))
+	return grub_errno;
+    }
+  else
+    {
+      if (read_at (lz4io, lz4io->next_in + sizeof (size), lz4io->inbuf, size))
+	return grub_errno;
+      len = decode_block (lz4io->inbuf, size, out, lz4io->block_max,
+			  lz4io->history);
+      if (len < 0)
+	return grub_errno;
+    }
+
+  add_block (lz4io, lz4io->next_in, lz4io->block_out);
+  lz4io->block_len = len;
+  lz4io->next_in = next_block_in (lz4io, lz4io->next_in, size);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Make the block containing OFFSET the current one.  */
+static grub_err_t
+find_block (grub_lz4io_t lz4io, grub_off_t offset)
+{
+  if (offset < lz4io->block_out)
+    {
+      lz4io->next_in = lz4io->data_offset;
+      lz4io->block_out = 0;
+      lz4io->block_len = 0;
+      lz4io->history = 0;
+    }
+
+  /* Independent blocks can be decompressed without the ones before.  */
+  if ((lz4io->flags & LZ4_FLG_BLOCK_INDEP)
+      && offset >= lz4io->block_out + lz4io->block_len)
+    {
+      unsigned lo = 0, hi = lz4io->num_blocks;
+
+      while (hi - lo > 1)
+	{
+	  unsigned mid = (lo + hi) / 2;
+
+	  if (lz4io->blocks[mid].out <= offset)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+
+      if (lo < lz4io->num_blocks && lz4io->blocks[lo].out > lz4io->block_out)
+	{
+	  lz4io->next_in = lz4io->blocks[lo].in;
+	  lz4io->block_out = lz4io->blocks[lo].out;
+	  lz4io->block_len = 0;
+	}
+    }
+
+  while (offset >= lz4io->block_out + lz4io->block_len)
+    if (next_block (lz4io))
+      return grub_errno;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Get the decompressed size of a frame without a content size, by
+   walking its blocks.  */
+static grub_err_t
+get_size (grub_lz4io_t lz4io, grub_off_t *total)
+{
+  grub_off_t in = lz4io->data_offset, out = 0;
+
+  while (1)
+    {
+      grub_uint32_t size;
+      grub_ssize_t len;
+
+      if (read_block_size (lz4io, in, &size))
+	return grub_errno;
+      if (size == 0)
+	break;
+
+      if (size & LZ4_BLOCK_UNCOMPRESSED)
+	len = size & ~LZ4_BLOCK_UNCOMPRESSED;
+      else
+	{
+	  if (read_at (lz4io, in + sizeof (size), lz4io->inbuf, size))
+	    return grub_errno;
+	  len = block_length (lz4io->inbuf, size);
+	  if (len < 0)
+	    return grub_errno;
+	}
+
+      add_block (lz4io, in, out);
+      out += len;
+      in = next_block_in (lz4io, in, size);
+    }
+
+  *total = out;
+  return GRUB_ERR_NONE;
+}
+
+static void
+free_lz4io (grub_lz4io_t lz4io)
+{
+  grub_free (lz4io->inbuf);
+  grub_free (lz4io->window);
+  grub_free (lz4io->blocks);
+  grub_free (lz4io);
+}
+
+/* Open a new decompressing object on the top of IO. If TRANSPARENT is true,
+   even if IO does not contain an LZ4 frame, return a valid file object.
+   Note that this function won't close IO, even if an error occurs.  */
+grub_file_t
+grub_lz4io_open (grub_file_t io, int transparent)
+{
+  grub_file_t file;
+  grub_lz4io_t lz4io;
+  struct
+  {
+    grub_uint32_t magic;
+    grub_uint8_t flags;
+    grub_uint8_t bd;
+  } __attribute__ ((packed)) hdr;
+  grub_uint64_t size;
+  unsigned block_max;
+
+  grub_file_seek (io, 0);
+  if (grub_file_read (io, &hdr, sizeof (hdr)) != sizeof (hdr)
+      || grub_le_to_cpu32 (hdr.magic) != LZ4_MAGIC)
+    {
+      grub_file_seek (io, 0);
+      if (transparent && (! grub_errno
+			  || grub_errno == GRUB_ERR_BAD_FILE_TYPE))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return io;
+	}
+
+      if (! grub_errno)
+	grub_error (GRUB_ERR_BAD_FILE_TYPE, "no LZ4 magic found");
+      return 0;
+    }
+
+  block_max = (hdr.bd >> LZ4_BD_BLOCK_MAX_SHIFT) & LZ4_BD_BLOCK_MAX_MASK;
+  if ((hdr.flags & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION
+      || (hdr.flags & (LZ4_FLG_RESERVED | LZ4_FLG_DICT_ID))
+      || block_max < 4)
+    {
+      grub_file_seek (io, 0);
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "unsupported LZ4 frame");
+      return 0;
+    }
+
+  file = grub_zalloc (sizeof (*file));
+  if (! file)
+    return 0;
+
+  lz4io = grub_zalloc (sizeof (*lz4io));
+  if (! lz4io)
+    {
+      grub_free (file);
+      return 0;
+    }
+
+  lz4io->file = io;
+  lz4io->flags = hdr.flags;
+  lz4io->block_max = 1 << (2 * block_max + 8);
+  /* Skip the header checksum.  */
+  lz4io->data_offset = sizeof (hdr) + 1;
+  if (hdr.flags & LZ4_FLG_CONTENT_SIZE)
+    lz4io->data_offset += sizeof (size);
+  lz4io->next_in = lz4io->data_offset;
+
+  file->device = io->device;
+  file->offset = 0;
+  file->data = lz4io;
+  file->read_hook = 0;
+  file->fs = &grub_lz4io_fs;
+
+  lz4io->inbuf = grub_malloc (lz4io->block_max + LZ4_COPY_SLACK);
+  lz4io->window = grub_malloc (LZ4_WINDOW_SIZE + lz4io->block_max
+			       + LZ4_COPY_SLACK);
+  if (! lz4io->inbuf || ! lz4io->window)
+    goto fail;
+
+  if (hdr.flags & LZ4_FLG_CONTENT_SIZE)
+    {
+      if (grub_file_read (io, &size, sizeof (size)) != sizeof (size))
+	{
+	  if (! grub_errno)
+	    grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "truncated LZ4 data");
+	  goto fail;
+	}
+      file->size = grub_le_to_cpu64 (size);
+    }
+  else if (get_size (lz4io, &file->size))
+    goto fail;
+
+  return file;
+
+ fail:
+  grub_file_seek (io, 0);
+  free_lz4io (lz4io);
+  grub_free (file);
+  return 0;
+}
+
+static grub_ssize_t
+grub_lz4io_read (grub_file_t file, char *buf, grub_size_t len)
+{
+  grub_lz4io_t lz4io = file->data;
+  grub_off_t offset = file->offset;
+  grub_ssize_t ret = 0;
+
+  while (len > 0)
+    {
+      grub_size_t pos, size;
+
+      if (find_block (lz4io, offset))
+	return -1;
+
+      pos = offset - lz4io->block_out;
+      size = lz4io->block_len - pos;
+      if (size > len)
+	size = len;
+
+      grub_memcpy (buf, lz4io->window + LZ4_WINDOW_SIZE + pos, size);
+      buf += size;
+      len -= size;
+      ret += size;
+      offset += size;
+    }
+
+  return ret;
+}
+
+/* Release everything, including the underlying file object.  */
+static grub_err_t
+grub_lz4io_close (grub_file_t file)
+{
+  grub_lz4io_t lz4io = file->data;
+
+  grub_file_close (lz4io->file);
+  free_lz4io (lz4io);
+
+  /* No need to close the same device twice.  */
+  file->device = 0;
+
+  return grub_errno;
+}
+
+static struct grub_fs grub_lz4io_fs =
+  {
+    .name = "lz4io",
+    .dir = 0,
+    .open = 0,
+    .read = grub_lz4io_read,
+    .close = grub_lz4io_close,
+    .label = 0,
+    .next = 0
+  };
@@ -23,9 +23,65 @@
 GRUB_EXPORT(grub_command_list);
 GRUB_EXPORT(grub_reg_cmd);
 GRUB_EXPORT(grub_unregister_command);
+GRUB_EXPORT(grub_command_find);
+GRUB_EXPORT(grub_command_iterate_prefix);
+
+/* The size of the command hash table, must be a power of two.  */
+#define GRUB_COMMAND_HASHSZ	128
 
 grub_command_t grub_command_list;
 
+/* An index over grub_command_list.  Every registered command is chained
+   in the bucket of its name, whether it is active or not.  */
+static grub_command_t grub_command_hash[GRUB_COMMAND_HASHSZ];
+
+static inline grub_command_t *
+grub_command_bucket (const char *name)
+{
+  return &grub_command_hash[grub_strhash (name) & (GRUB_COMMAND_HASHSZ - 1)];
+}
+
+grub_command_t
+grub_command_find (const char *name)
+{
+  grub_command_t cmd;
+
+  /* Only the active command of a name is visible, that is the one with
+     the highest priority, just as the first match in the sorted list.  */
+  for (cmd = *grub_command_bucket (name); cmd; cmd = cmd->hash_next)
+    if ((cmd->prio & GRUB_PRIO_LIST_FLAG_ACTIVE) &&
+	(! grub_strcmp (cmd->name, name)))
+      return cmd;
+
+  return 0;
+}
+
+int
+grub_command_iterate_prefix (const char *prefix,
+			     int (*func) (grub_command_t, void *closure),
+			     void *closure)
+{
+  grub_command_t cmd;
+  grub_size_t len;
+
+  len = grub_strlen (prefix);
+  for (cmd = grub_command_list; cmd; cmd = cmd->next)
+    {
+      int r;
+
+      /* The list is sorted by name, so stop once we are past PREFIX.  */
+      r = grub_strncmp (cmd->name, prefix, len);
+      if (r > 0)
+	break;
+
+      if ((r == 0) && (cmd->prio & GRUB_PRIO_LIST_FLAG_ACTIVE) &&
+	  (func (cmd, closure)))
+	return 1;
+    }
+
+  return 0;
+}
+
 grub_command_t
 grub_reg_cmd (const char *name,
 	      grub_command_func_t func,
@@ -33,7 +89,7 @@ grub_reg_cmd (const char *name,
 	      const char *description,
 	      int prio)
 {
-  grub_command_t cmd;
+  grub_command_t cmd, *bucket;
 
   cmd = (grub_command_t) grub_zalloc (sizeof (*cmd));
   if (! cmd)
@@ -50,12 +106,25 @@ grub_reg_cmd (const char *name,
   grub_prio_list_insert (GRUB_AS_PRIO_LIST_P (&grub_command_list),
 			 GRUB_AS_PRIO_LIST (cmd));
 
+  bucket = grub_command_bucket (name);
+  cmd->hash_next = *bucket;
+  *bucket = cmd;
+
   return cmd;
 }
 
 void
 grub_unregister_command (grub_command_t cmd)
 {
+  grub_command_t *p;
+
+  for (p = grub_command_bucket (cmd->name); *p; p = &((*p)->hash_next))
+    if (*p == cmd)
+      {
+	*p = cmd->hash_next;
+	break;
+      }
+
   grub_prio_list_remove (GRUB_AS_PRIO_LIST_P (&grub_command_list),
 			 GRUB_AS_PRIO_LIST (cmd));
   grub_free (cmd);
@@ -24,6 +24,7 @@
 #include <grub/misc.h>
 #include <grub/time.h>
 #include <grub/file.h>
+#include <grub/fs.h>
 
 GRUB_EXPORT(grub_disk_dev_register);
 GRUB_EXPORT(grub_disk_dev_unregister);
@@ -113,6 +114,8 @@ grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
+  grub_fs_mount_flush (0);
+
   for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
@@ -689,6 +692,10 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
  finish:
 
+  /* Filesystems mounted from this disk may now read differently.  */
+  if (grub_errno == GRUB_ERR_NONE)
+    grub_fs_mount_flush (0);
+
   return grub_errno;
 }
 
@@ -31,9 +31,13 @@
 #include <grub/file.h>
 #include <grub/env.h>
 #include <grub/cache.h>
+#include <grub/time.h>
+#include <grub/kernel.h>
 
 GRUB_EXPORT(grub_dl_load_file);
 GRUB_EXPORT(grub_dl_load);
+GRUB_EXPORT(grub_dl_preload);
+GRUB_EXPORT(grub_dl_trace_hook);
 GRUB_EXPORT(grub_dl_unload);
 #ifndef GRUB_UTIL
 GRUB_EXPORT(grub_dl_ref);
@@ -121,76 +125,114 @@ struct grub_symbol
 {
   struct grub_symbol *next;
   const char *name;
+  grub_uint32_t hash;
   void *addr;
   grub_dl_t mod;	/* The module to which this symbol belongs.  */
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The initial size of the symbol table, must be a power of two.  */
+#define GRUB_SYMTAB_SIZE_MIN	512
 
 /* The symbol table (using an open-hash).  */
-static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
+static grub_symbol_t *grub_symtab;
 
-/* Simple hash function.  */
-static unsigned
-grub_symbol_hash (const char *s)
-{
-  unsigned key = 0;
-
-  while (*s)
-    key = key * 65599 + *s++;
-
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
-}
+/* The number of buckets in, and the number of symbols in the table.  */
+static unsigned grub_symtab_size, grub_symtab_count;
 
-/* Resolve the symbol name NAME and return the address.
-   Return NULL, if not found.  */
+/* Resolve the symbol name NAME with the hash value HASH and return the
+   address.  Return NULL, if not found.  */
 static void *
-grub_dl_resolve_symbol (const char *name)
+grub_dl_resolve_symbol (const char *name, grub_uint32_t hash)
 {
   grub_symbol_t sym;
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
+  if (! grub_symtab)
+    return 0;
+
+  for (sym = grub_symtab[hash & (grub_symtab_size - 1)]; sym; sym = sym->next)
+    if ((sym->hash == hash) && (grub_strcmp (sym->name, name) == 0))
       return sym->addr;
 
   return 0;
 }
 
-/* Register a symbol with the name NAME and the address ADDR.  */
-grub_err_t
-grub_dl_register_symbol (const char *name, void *addr, grub_dl_t mod)
+/* Double the size of the symbol table.  */
+static grub_err_t
+grub_dl_grow_symtab (void)
 {
-  grub_symbol_t sym;
-  unsigned k;
+  grub_symbol_t *old = grub_symtab;
+  unsigned i, old_size = grub_symtab_size;
 
-  sym = (grub_symbol_t) grub_malloc (sizeof (*sym));
-  if (! sym)
-    return grub_errno;
+  grub_symtab_size = (old) ? old_size * 2 : GRUB_SYMTAB_SIZE_MIN;
+  grub_symtab = grub_zalloc (grub_symtab_size * sizeof (grub_symtab[0]));
+  if (! grub_symtab)
+    {
+      grub_symtab = old;
+      grub_symtab_size = old_size;
+      return grub_errno;
+    }
 
-  if (mod)
+  for (i = 0; i < old_size; i++)
     {
-      sym->name = grub_strdup (name);
-      if (! sym->name)
+      grub_symbol_t sym, next;
+
+      for (sym = old[i]; sym; sym = next)
 	{
-	  grub_free (sym);
-	  return grub_errno;
+	  unsigned k = sym->hash & (grub_symtab_size - 1);
+
+	  next = sym->next;
+	  sym->next = grub_symtab[k];
+	  grub_symtab[k] = sym;
 	}
     }
-  else
-    sym->name = name;
 
+  grub_free (old);
+  return GRUB_ERR_NONE;
+}
+
+/* Register a symbol with the name NAME, its hash value HASH and the
+   address ADDR.  NAME is not copied, it must live as long as MOD.  */
+static grub_err_t
+grub_dl_register_symbol_hash (const char *name, grub_uint32_t hash,
+			      void *addr, grub_dl_t mod)
+{
+  grub_symbol_t sym;
+  unsigned k;
+
+  if ((! grub_symtab) || (grub_symtab_count >= grub_symtab_size * 2))
+    {
+      if ((grub_dl_grow_symtab ()) && (! grub_symtab))
+	return grub_errno;
+
+      /* A full table is slower, but still works.  */
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  sym = (grub_symbol_t) grub_malloc (sizeof (*sym));
+  if (! sym)
+    return grub_errno;
+
+  sym->name = name;
+  sym->hash = hash;
   sym->addr = addr;
   sym->mod = mod;
 
-  k = grub_symbol_hash (name);
+  k = hash & (grub_symtab_size - 1);
   sym->next = grub_symtab[k];
   grub_symtab[k] = sym;
+  grub_symtab_count++;
 
   return GRUB_ERR_NONE;
 }
 
+/* Register a symbol with the name NAME and the address ADDR.  */
+grub_err_t
+grub_dl_register_symbol (const char *name, void *addr, grub_dl_t mod)
+{
+  return grub_dl_register_symbol_hash (name, grub_strhash (name), addr, mod);
+}
+
 /* Unregister all the symbols defined in the module MOD.  */
 static void
 grub_dl_unregister_symbols (grub_dl_t mod)
@@ -200,7 +242,7 @@ grub_dl_unregister_symbols (grub_dl_t mod)
   if (! mod)
     grub_fatal ("core symbols cannot be unregistered");
 
-  for (i = 0; i < GRUB_SYMTAB_SIZE; i++)
+  for (i = 0; i < grub_symtab_size; i++)
     {
       grub_symbol_t sym, *p, q;
 
@@ -210,8 +252,8 @@ grub_dl_unregister_symbols (grub_dl_t mod)
 	  if (sym->mod == mod)
 	    {
 	      *p = q;
-	      grub_free ((void *) sym->name);
 	      grub_free (sym);
+	      grub_symtab_count--;
 	    }
 	  else
 	    p = &sym->next;
@@ -219,6 +261,17 @@ grub_dl_unregister_symbols (grub_dl_t mod)
     }
 }
 
+/* Return the precomputed hash value of the name at NAME in the string
+   table of a module.  */
+static inline grub_uint32_t
+grub_dl_strtab_hash (const char *name)
+{
+  grub_uint32_t hash;
+
+  grub_memcpy (&hash, name - GRUB_OBJ_STRTAB_HASH_SIZE, sizeof (hash));
+  return hash;
+}
+
 /* Return the address of a section whose index is N.  */
 static void *
 grub_dl_get_section_addr (grub_dl_t mod, unsigned n)
@@ -295,7 +348,9 @@ grub_dl_resolve_symbols (grub_dl_t mod, struct grub_obj_header *e)
       addr = grub_dl_get_section_addr (mod, sym->segment);
       addr += sym->offset;
 
-      if (grub_dl_register_symbol (strtab + sym->name, addr, mod))
+      if (grub_dl_register_symbol_hash (strtab + sym->name,
+					grub_dl_strtab_hash (strtab + sym->name),
+					addr, mod))
 	return grub_errno;
     }
 
@@ -321,7 +376,8 @@ grub_dl_resolve_symbols (grub_dl_t mod, struct grub_obj_header *e)
 	  char *name;
 
 	  name = strtab + rel->symbol_name;
-	  symbol_addr = grub_dl_resolve_symbol (name);
+	  symbol_addr = grub_dl_resolve_symbol (name,
+						grub_dl_strtab_hash (name));
 	  if (! symbol_addr)
 	    return grub_error (GRUB_ERR_BAD_MODULE,
 			       "symbol not found: `%s'", name);
@@ -523,6 +579,175 @@ grub_dl_flush_cache (grub_dl_t mod)
   }
 }
 
+/* Check that none of the modules in the bundle E is loaded already, as
+   their symbols would clash.  */
+static grub_err_t
+grub_dl_check_bundle (struct grub_obj_header *e)
+{
+  struct grub_module_info *info;
+  struct grub_module_header *header;
+
+  info = (struct grub_module_info *) ((char *) e + e->segments[0].offset);
+  if (info->magic != GRUB_MODULE_MAGIC)
+    return grub_error (GRUB_ERR_BAD_MODULE, "invalid bundle");
+
+  for (header = (struct grub_module_header *) (info + 1);
+       header < (struct grub_module_header *) ((char *) info + info->size);
+       header = (struct grub_module_header *) ((char *) header + header->size))
+    {
+      struct grub_module_object *obj;
+
+      if (header->type != OBJ_TYPE_OBJECT)
+	continue;
+
+      obj = (struct grub_module_object *) (header + 1);
+      if (grub_dl_get (obj->name))
+	return grub_error (GRUB_ERR_BAD_MODULE,
+			   "module %s is already loaded", obj->name);
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+/* Register the module OBJ, whose code lives in BUNDLE at address BASE.  */
+static grub_err_t
+grub_dl_load_bundle_object (grub_dl_t bundle, char *base,
+			    struct grub_module_object *obj)
+{
+  grub_dl_t mod;
+  grub_dl_dep_t dep;
+  char *sym;
+  grub_uint32_t *sym_value;
+  grub_uint64_t start;
+
+  mod = (grub_dl_t) grub_zalloc (sizeof (*mod));
+  if (! mod)
+    return grub_errno;
+
+  dep = (grub_dl_dep_t) grub_malloc (sizeof (*dep));
+  mod->name = grub_strdup (obj->name);
+  if ((! dep) || (! mod->name))
+    {
+      grub_free (dep);
+      grub_free (mod->name);
+      grub_free (mod);
+      return grub_errno;
+    }
+
+  /* The bundle owns the code, keep it as long as the module.  */
+  grub_dl_ref (bundle);
+  dep->mod = bundle;
+  dep->next = 0;
+  mod->dep = dep;
+
+  start = grub_get_time_ms ();
+  if (grub_dl_resolve_dependencies (mod, obj->name))
+    goto fail;
+
+  sym = obj->name + obj->symbol_name;
+  sym_value = (grub_uint32_t *) (obj->name + obj->symbol_value);
+  while (*sym)
+    {
+      if (grub_dl_register_symbol (sym, base + *(sym_value++), mod))
+	goto fail;
+
+      sym += grub_strlen (sym) + 1;
+    }
+
+  if (obj->init_func)
+    mod->init = (void (*) (grub_dl_t)) (base + obj->init_func);
+
+  if (obj->fini_func)
+    mod->fini = (void (*) (void)) (base + obj->fini_func);
+
+  grub_dprintf ("modules", "bundled module name: %s\n", mod->name);
+  grub_dl_call_init (mod);
+  mod->load_time = grub_get_time_ms () - start;
+
+  if (grub_dl_add (mod))
+    {
+      grub_dl_unload (mod);
+      return grub_errno;
+    }
+
+  return GRUB_ERR_NONE;
+
+ fail:
+  mod->fini = 0;
+  grub_dl_unload (mod);
+  return grub_errno;
+}
+
+/* Return the COUNTth module object in the module table of BUNDLE.  */
+static struct grub_module_object *
+grub_dl_get_bundle_object (grub_dl_t bundle, unsigned count)
+{
+  struct grub_module_info *info;
+  struct grub_module_header *header;
+
+  info = (struct grub_module_info *) grub_dl_get_section_addr (bundle, 0);
+  for (header = (struct grub_module_header *) (info + 1);
+       header < (struct grub_module_header *) ((char *) info + info->size);
+       header = (struct grub_module_header *) ((char *) header + header->size))
+    if ((header->type == OBJ_TYPE_OBJECT) && (! count--))
+      return (struct grub_module_object *) (header + 1);
+
+  return 0;
+}
+
+/* Register the modules of BUNDLE in the order of its module table, which
+   lists dependencies first.  If one fails, unload those registered before
+   it, so that nothing refers to the bundle any more.  */
+static grub_err_t
+grub_dl_load_bundle (grub_dl_t bundle)
+{
+  char *base;
+  struct grub_module_info *info;
+  struct grub_module_header *header;
+  unsigned count = 0;
+
+  base = grub_dl_get_section_addr (bundle, 0);
+  info = (struct grub_module_info *) base;
+  for (header = (struct grub_module_header *) (info + 1);
+       header < (struct grub_module_header *) (base + info->size);
+       header = (struct grub_module_header *) ((char *) header + header->size))
+    {
+      if (header->type != OBJ_TYPE_OBJECT)
+	continue;
+
+      if (grub_dl_load_bundle_object (bundle, base,
+				      (struct grub_module_object *)
+				      (header + 1)))
+	break;
+
+      count++;
+    }
+
+  if (header >= (struct grub_module_header *) (base + info->size))
+    return GRUB_ERR_NONE;
+
+  grub_error_push ();
+  while (count--)
+    {
+      grub_dl_t mod;
+      grub_dl_dep_t dep;
+
+      mod = grub_dl_get (grub_dl_get_bundle_object (bundle, count)->name);
+      if ((! mod) || (mod == bundle))
+	continue;
+
+      for (dep = mod->dep; dep; dep = dep->next)
+	if (dep->mod == bundle)
+	  {
+	    grub_dl_unload (mod);
+	    break;
+	  }
+    }
+  grub_error_pop ();
+
+  return grub_errno;
+}
+
 /* Load a module from core memory.  */
 grub_dl_t
 grub_dl_load_core (void *addr, grub_size_t size)
@@ -530,18 +755,23 @@ grub_dl_load_core (void *addr, grub_size_t size)
   struct grub_obj_header *e;
   grub_dl_t mod;
   char *name;
+  grub_uint64_t start;
 
   grub_dprintf ("modules", "module at %p, size 0x%lx\n", addr,
 		(unsigned long) size);
 
   e = addr;
-  if ((e->magic != GRUB_OBJ_HEADER_MAGIC) ||
+  if (((e->magic != GRUB_OBJ_HEADER_MAGIC) &&
+       (e->magic != GRUB_OBJ_BUNDLE_MAGIC)) ||
       (e->version != GRUB_OBJ_HEADER_VERSION))
     {
       grub_error (GRUB_ERR_BAD_OS, "invalid object file");
       return 0;
     }
 
+  if ((e->magic == GRUB_OBJ_BUNDLE_MAGIC) && (grub_dl_check_bundle (e)))
+    return 0;
+
   mod = (grub_dl_t) grub_malloc (sizeof (*mod));
   if (! mod)
     return 0;
@@ -554,22 +784,43 @@ grub_dl_load_core (void *addr, grub_size_t size)
   mod->segment = 0;
   mod->init = 0;
   mod->fini = 0;
+  mod->core = 0;
+  mod->load_time = 0;
 
   grub_dprintf ("modules", "relocating to %p\n", mod);
-  if (grub_dl_resolve_dependencies (mod, name)
-      || grub_dl_load_segments (mod, e)
+  if (grub_dl_resolve_dependencies (mod, name))
+    goto fail;
+
+  /* Dependencies account for their own load time.  */
+  start = grub_get_time_ms ();
+  if (grub_dl_load_segments (mod, e)
       || grub_dl_resolve_symbols (mod, e))
-    {
-      mod->fini = 0;
-      grub_dl_unload (mod);
-      return 0;
-    }
+    goto fail;
 
   grub_dl_flush_cache (mod);
 
+  if (e->magic == GRUB_OBJ_BUNDLE_MAGIC)
+    {
+      mod->load_time = grub_get_time_ms () - start;
+      if (grub_dl_add (mod))
+	goto fail;
+
+      /* A bundle that couldn't register all its modules has unloaded
+	 those it did, unload it too.  */
+      if (grub_dl_load_bundle (mod))
+	{
+	  mod->ref_count--;
+	  grub_dl_unload (mod);
+	  return 0;
+	}
+
+      return mod;
+    }
+
   grub_dprintf ("modules", "module name: %s\n", mod->name);
   grub_dprintf ("modules", "init function: %p\n", mod->init);
   grub_dl_call_init (mod);
+  mod->load_time = grub_get_time_ms () - start;
 
   if (grub_dl_add (mod))
     {
@@ -578,30 +829,33 @@ grub_dl_load_core (void *addr, grub_size_t size)
     }
 
   return mod;
+
+ fail:
+  mod->fini = 0;
+  grub_dl_unload (mod);
+  return 0;
 }
 
-/* Load a module from the file FILENAME.  */
-grub_dl_t
-grub_dl_load_file (const char *filename)
+/* Read the whole file FILENAME, and set SIZE to its size.  */
+static void *
+grub_dl_read_file (const char *filename, grub_size_t *size)
 {
-  grub_file_t file = NULL;
-  grub_ssize_t size;
-  void *core = 0;
-  grub_dl_t mod = 0;
+  grub_file_t file;
+  void *core;
 
   file = grub_file_open (filename);
   if (! file)
     return 0;
 
-  size = grub_file_size (file);
-  core = grub_malloc (size);
+  *size = grub_file_size (file);
+  core = grub_malloc (*size);
   if (! core)
     {
       grub_file_close (file);
       return 0;
     }
 
-  if (grub_file_read (file, core, size) != (int) size)
+  if (grub_file_read (file, core, *size) != (grub_ssize_t) *size)
     {
       grub_file_close (file);
       grub_free (core);
@@ -613,6 +867,16 @@ grub_dl_load_file (const char *filename)
      opens of the same device.  */
   grub_file_close (file);
 
+  return core;
+}
+
+/* Load a module from the image CORE read from a file, which took
+   READ_TIME ms.  The module takes over CORE.  */
+static grub_dl_t
+grub_dl_load_image (void *core, grub_size_t size, grub_uint64_t read_time)
+{
+  grub_dl_t mod;
+
   mod = grub_dl_load_core (core, size);
   if (! mod)
     {
@@ -620,10 +884,64 @@ grub_dl_load_file (const char *filename)
       return 0;
     }
 
-  mod->ref_count = 0;
+  /* The exported symbol names point into the image.  */
+  mod->core = core;
+  mod->load_time += read_time;
+  /* Drop the reference taken while loading.  A bundle stays referenced
+     by the modules it contains.  */
+  mod->ref_count--;
   return mod;
 }
 
+/* Load a module from the file FILENAME.  */
+grub_dl_t
+grub_dl_load_file (const char *filename)
+{
+  void *core;
+  grub_size_t size;
+  grub_uint64_t start;
+
+  start = grub_get_time_ms ();
+  core = grub_dl_read_file (filename, &size);
+  if (! core)
+    return 0;
+
+  return grub_dl_load_image (core, size, grub_get_time_ms () - start);
+}
+
+/* Called for every module grub_dl_load reads from disk.  */
+grub_dl_trace_hook_t grub_dl_trace_hook;
+
+#if !GRUB_NO_MODULES
+/* Module images read ahead by grub_dl_preload, waiting to be linked.  */
+struct grub_dl_image
+{
+  struct grub_dl_image *next;
+  char *name;
+  void *core;
+  grub_size_t size;
+  grub_uint64_t read_time;
+};
+
+static struct grub_dl_image *grub_dl_images;
+
+/* Remove the image of the module NAME from the read ahead images.  */
+static struct grub_dl_image *
+grub_dl_take_image (const char *name)
+{
+  struct grub_dl_image **p, *q;
+
+  for (p = &grub_dl_images, q = *p; q; p = &q->next, q = *p)
+    if (! grub_strcmp (q->name, name))
+      {
+	*p = q->next;
+	return q;
+      }
+
+  return 0;
+}
+#endif
+
 /* Load a module using a symbolic name.  */
 grub_dl_t
 grub_dl_load (const char *name)
@@ -632,25 +950,37 @@ grub_dl_load (const char *name)
   (void) name;
   return 0;
 #else
-  char *filename;
   grub_dl_t mod;
-  char *grub_dl_dir = grub_env_get ("prefix");
+  struct grub_dl_image *image;
 
   mod = grub_dl_get (name);
   if (mod)
     return mod;
 
-  if (! grub_dl_dir) {
-    grub_error (GRUB_ERR_FILE_NOT_FOUND, "\"prefix\" is not set");
-    return 0;
-  }
+  image = grub_dl_take_image (name);
+  if (image)
+    {
+      mod = grub_dl_load_image (image->core, image->size, image->read_time);
+      grub_free (image->name);
+      grub_free (image);
+    }
+  else
+    {
+      char *filename;
+      char *grub_dl_dir = grub_env_get ("prefix");
 
-  filename = grub_xasprintf ("%s/%s.mod", grub_dl_dir, name);
-  if (! filename)
-    return 0;
+      if (! grub_dl_dir) {
+	grub_error (GRUB_ERR_FILE_NOT_FOUND, "\"prefix\" is not set");
+	return 0;
+      }
+
+      filename = grub_xasprintf ("%s/%s.mod", grub_dl_dir, name);
+      if (! filename)
+	return 0;
 
-  mod = grub_dl_load_file (filename);
-  grub_free (filename);
+      mod = grub_dl_load_file (filename);
+      grub_free (filename);
+    }
 
   if (! mod)
     return 0;
@@ -658,10 +988,106 @@ grub_dl_load (const char *name)
   if (grub_strcmp (mod->name, name) != 0)
     grub_error (GRUB_ERR_BAD_MODULE, "mismatched names");
 
+  if (grub_dl_trace_hook)
+    grub_dl_trace_hook (mod);
+
   return mod;
 #endif
 }
 
+/* Load the modules in NAMES and keep them loaded.  All the files are read
+   before any module is linked, in name order, which is usually their
+   order on disk as well.  This makes the reads one sequential burst,
+   instead of interleaving them with dependency resolution.  Failures are
+   reported, but don't stop the other modules from loading.  */
+void
+grub_dl_preload (int argc, char *names[])
+{
+#if GRUB_NO_MODULES
+  (void) argc;
+  (void) names;
+#else
+  char **sorted;
+  char *prefix;
+  int i, j, count;
+
+  /* Without these, the modules are just loaded one by one.  */
+  prefix = grub_env_get ("prefix");
+  sorted = grub_malloc (argc * sizeof (sorted[0]));
+  count = ((prefix) && (sorted)) ? argc : 0;
+
+  for (i = 0; i < count; i++)
+    {
+      for (j = i; (j > 0) && (grub_strcmp (sorted[j - 1], names[i]) > 0); j--)
+	sorted[j] = sorted[j - 1];
+      sorted[j] = names[i];
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      struct grub_dl_image *image;
+      char *filename;
+      grub_uint64_t start;
+
+      if ((i > 0) && (! grub_strcmp (sorted[i - 1], sorted[i])))
+	continue;
+
+      if (grub_dl_get (sorted[i]))
+	continue;
+
+      image = grub_zalloc (sizeof (*image));
+      if (! image)
+	break;
+
+      image->name = grub_strdup (sorted[i]);
+      filename = grub_xasprintf ("%s/%s.mod", prefix, sorted[i]);
+      start = grub_get_time_ms ();
+      if ((image->name) && (filename))
+	image->core = grub_dl_read_file (filename, &image->size);
+      image->read_time = grub_get_time_ms () - start;
+      grub_free (filename);
+
+      /* Leave it to grub_dl_load below to report the error.  */
+      if (! image->core)
+	{
+	  grub_free (image->name);
+	  grub_free (image);
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      image->next = grub_dl_images;
+      grub_dl_images = image;
+    }
+
+  grub_free (sorted);
+
+  grub_errno = GRUB_ERR_NONE;
+  for (i = 0; i < argc; i++)
+    {
+      grub_dl_t mod;
+
+      mod = grub_dl_load (names[i]);
+      if (mod)
+	grub_dl_ref (mod);
+      else
+	grub_print_error ();
+    }
+
+  /* Images not picked up, because their module failed to load.  */
+  while (grub_dl_images)
+    {
+      struct grub_dl_image *image;
+
+      image = grub_dl_images;
+      grub_dl_images = image->next;
+      grub_free (image->core);
+      grub_free (image->name);
+      grub_free (image);
+    }
+#endif
+}
+
 /* Unload the module MOD.  */
 int
 grub_dl_unload (grub_dl_t mod)
@@ -696,6 +1122,7 @@ grub_dl_unload (grub_dl_t mod)
     }
 
   grub_free (mod->name);
+  grub_free (mod->core);
 #ifdef GRUB_MODULES_MACHINE_READONLY
   grub_free (mod->symtab);
 #endif
@@ -40,40 +40,64 @@ static struct grub_env_context initial_context;
 /* The current context.  */
 struct grub_env_context *grub_current_context = &initial_context;
 
-/* Return the hash representation of the string S.  */
-static unsigned int
-grub_env_hashval (const char *s)
+/* Return the bucket of the string S in the table of CONTEXT.  */
+static inline unsigned
+grub_env_hashval (struct grub_env_context *context, const char *s)
 {
-  unsigned int i = 0;
+  return grub_strhash (s) & (context->size - 1);
+}
 
-  /* XXX: This can be done much more efficiently.  */
-  while (*s)
-    i += 5 * *(s++);
+/* Return the entry of NAME in CONTEXT itself, including placeholders.  */
+static struct grub_env_var *
+grub_env_lookup (struct grub_env_context *context, const char *name)
+{
+  struct grub_env_var *var;
+
+  if (! context->vars)
+    return 0;
 
-  return i % HASHSZ;
+  for (var = context->vars[grub_env_hashval (context, name)]; var;
+       var = var->next)
+    if (grub_strcmp (var->name, name) == 0)
+      return var;
+
+  return 0;
+}
+
+/* Return the variable NAME that CONTEXT shares with its ancestors.  */
+static struct grub_env_var *
+grub_env_find_inherited (struct grub_env_context *context, const char *name)
+{
+  for (context = context->inherit; context; context = context->inherit)
+    {
+      struct grub_env_var *var;
+
+      var = grub_env_lookup (context, name);
+      if (var)
+	return (var->value && var->global) ? var : 0;
+    }
+
+  return 0;
 }
 
 struct grub_env_var *
 grub_env_find (const char *name)
 {
   struct grub_env_var *var;
-  int idx = grub_env_hashval (name);
 
   /* Look for the variable in the current context.  */
-  for (var = grub_current_context->vars[idx]; var; var = var->next)
-    if (grub_strcmp (var->name, name) == 0)
-      return var;
+  var = grub_env_lookup (grub_current_context, name);
+  if (var)
+    return (var->value) ? var : 0;
 
-  return 0;
+  return grub_env_find_inherited (grub_current_context, name);
 }
 
 static void
-grub_env_insert (struct grub_env_context *context,
-		 struct grub_env_var *var)
+grub_env_link (struct grub_env_context *context, struct grub_env_var *var)
 {
-  int idx = grub_env_hashval (var->name);
+  int idx = grub_env_hashval (context, var->name);
 
-  /* Insert the variable into the hashtable.  */
   var->prevp = &context->vars[idx];
   var->next = context->vars[idx];
   if (var->next)
@@ -81,13 +105,122 @@ grub_env_insert (struct grub_env_context *context,
   context->vars[idx] = var;
 }
 
+static grub_err_t
+grub_env_insert (struct grub_env_context *context,
+		 struct grub_env_var *var)
+{
+  /* Grow the table when the chains become longer than two on average.  */
+  if ((! context->vars) || (context->count >= context->size * 2))
+    {
+      struct grub_env_var **old = context->vars;
+      unsigned i, old_size = context->size;
+      unsigned size = (old) ? old_size * 2 : GRUB_ENV_HASHSZ_MIN;
+
+      context->vars = grub_zalloc (size * sizeof (context->vars[0]));
+      if (! context->vars)
+	{
+	  context->vars = old;
+	  if (! old)
+	    return grub_errno;
+
+	  /* Keep using the old table.  */
+	  grub_errno = GRUB_ERR_NONE;
+	}
+      else
+	{
+	  context->size = size;
+	  for (i = 0; i < old_size; i++)
+	    {
+	      struct grub_env_var *p, *q;
+
+	      for (p = old[i]; p; p = q)
+		{
+		  q = p->next;
+		  grub_env_link (context, p);
+		}
+	    }
+	  grub_free (old);
+	}
+    }
+
+  /* Insert the variable into the hashtable.  */
+  grub_env_link (context, var);
+  context->count++;
+
+  return GRUB_ERR_NONE;
+}
+
 static void
-grub_env_remove (struct grub_env_var *var)
+grub_env_remove (struct grub_env_context *context, struct grub_env_var *var)
 {
   /* Remove the entry from the variable table.  */
   *var->prevp = var->next;
   if (var->next)
     var->next->prevp = var->prevp;
+  context->count--;
+}
+
+static struct grub_env_var *
+grub_env_new (const char *name)
+{
+  struct grub_env_var *var;
+
+  var = grub_zalloc (sizeof (*var));
+  if (! var)
+    return 0;
+
+  var->name = grub_strdup (name);
+  if ((! var->name) ||
+      (grub_env_insert (grub_current_context, var) != GRUB_ERR_NONE))
+    {
+      grub_free (var->name);
+      grub_free (var);
+      return 0;
+    }
+
+  return var;
+}
+
+/* Store in RES the variable NAME of the current context, copying it from
+   the context it is shared with first if needed, or NULL if there is no
+   such variable.  */
+static grub_err_t
+grub_env_find_writable (const char *name, struct grub_env_var **res)
+{
+  struct grub_env_var *var, *orig;
+
+  *res = 0;
+  var = grub_env_lookup (grub_current_context, name);
+  if (var)
+    {
+      if (var->value)
+	*res = var;
+      return GRUB_ERR_NONE;
+    }
+
+  orig = grub_env_find_inherited (grub_current_context, name);
+  if (! orig)
+    return GRUB_ERR_NONE;
+
+  var = grub_env_new (name);
+  if (! var)
+    return grub_errno;
+
+  var->value = grub_strdup (orig->value);
+  if (! var->value)
+    {
+      grub_env_remove (grub_current_context, var);
+      grub_free (var->name);
+      grub_free (var);
+      return grub_errno;
+    }
+
+  var->read_hook = orig->read_hook;
+  var->write_hook = orig->write_hook;
+  var->global = 1;
+
+  *res = var;
+  return GRUB_ERR_NONE;
 }
 
 grub_err_t
@@ -96,7 +229,9 @@ grub_env_set (const char *name, const char *val)
   struct grub_env_var *var;
 
   /* If the variable does already exist, just update the variable.  */
-  var = grub_env_find (name);
+  if (grub_env_find_writable (name, &var) != GRUB_ERR_NONE)
+    return grub_errno;
+
   if (var)
     {
       char *old = var->value;
@@ -116,32 +251,32 @@ grub_env_set (const char *name, const char *val)
       return GRUB_ERR_NONE;
     }
 
-  /* The variable does not exist, so create a new one.  */
-  var = grub_zalloc (sizeof (*var));
+  /* The variable does not exist, so create a new one, or reuse the
+     placeholder left by grub_env_unset.  */
+  var = grub_env_lookup (grub_current_context, name);
   if (! var)
-    return grub_errno;
-
-  /* This is not necessary. But leave this for readability.  */
-  var->global = 0;
-
-  var->name = grub_strdup (name);
-  if (! var->name)
-    goto fail;
+    {
+      var = grub_env_new (name);
+      if (! var)
+	return grub_errno;
+    }
 
   var->value = grub_strdup (val);
   if (! var->value)
-    goto fail;
+    {
+      if (! grub_env_find_inherited (grub_current_context, name))
+	{
+	  grub_env_remove (grub_current_context, var);
+	  grub_free (var->name);
+	  grub_free (var);
+	}
+      return grub_errno;
+    }
 
-  grub_env_insert (grub_current_context, var);
+  /* This is not necessary. But leave this for readability.  */
+  var->global = 0;
 
   return GRUB_ERR_NONE;
-
- fail:
-  grub_free (var->name);
-  grub_free (var->value);
-  grub_free (var);
-
-  return grub_errno;
 }
 
 char *
@@ -174,44 +309,77 @@ grub_env_unset (const char *name)
       return;
     }
 
-  grub_env_remove (var);
+  if (grub_env_find_inherited (grub_current_context, name))
+    {
+      /* Hide the shared variable behind a placeholder.  */
+      if (var != grub_env_lookup (grub_current_context, name))
+	{
+	  var = grub_env_new (name);
+	  if (! var)
+	    return;
+	}
+
+      grub_free (var->value);
+      var->value = 0;
+      var->global = 0;
+      return;
+    }
+
+  grub_env_remove (grub_current_context, var);
 
   grub_free (var->name);
   grub_free (var->value);
   grub_free (var);
 }
 
+static int
+grub_env_add_sorted (struct grub_env_sorted_var **sorted_list,
+		     struct grub_env_var *var)
+{
+  struct grub_env_sorted_var *sorted_var, *p, **q;
+
+  sorted_var = grub_malloc (sizeof (*sorted_var));
+  if (! sorted_var)
+    return 1;
+
+  sorted_var->var = var;
+
+  for (q = sorted_list, p = *q; p; q = &((*q)->next), p = *q)
+    {
+      if (grub_strcmp (p->var->name, var->name) > 0)
+	break;
+    }
+
+  sorted_var->next = *q;
+  *q = sorted_var;
+
+  return 0;
+}
+
 void
 grub_env_iterate (int (*func) (struct grub_env_var *var, void *closure),
 		  void *closure)
 {
   struct grub_env_sorted_var *sorted_list = 0;
   struct grub_env_sorted_var *sorted_var;
-  int i;
+  struct grub_env_context *context;
 
-  /* Add variables associated with this context into a sorted list.  */
-  for (i = 0; i < HASHSZ; i++)
+  /* Add variables visible in this context into a sorted list.  */
+  for (context = grub_current_context; context; context = context->inherit)
     {
-      struct grub_env_var *var;
-
-      for (var = grub_current_context->vars[i]; var; var = var->next)
-	{
-	  struct grub_env_sorted_var *p, **q;
-
-	  sorted_var = grub_malloc (sizeof (*sorted_var));
-	  if (! sorted_var)
-	    goto fail;
+      unsigned i;
 
-	  sorted_var->var = var;
+      if (! context->vars)
+	continue;
 
-	  for (q = &sorted_list, p = *q; p; q = &((*q)->next), p = *q)
-	    {
-	      if (grub_strcmp (p->var->name, var->name) > 0)
-		break;
-	    }
+      for (i = 0; i < context->size; i++)
+	{
+	  struct grub_env_var *var;
 
-	  sorted_var->next = *q;
-	  *q = sorted_var;
+	  for (var = context->vars[i]; var; var = var->next)
+	    if ((grub_env_find (var->name) == var) &&
+		(grub_env_add_sorted (&sorted_list, var)))
+	      goto fail;
 	}
     }
 
@@ -237,7 +405,10 @@ grub_register_variable_hook (const char *name,
 			     grub_env_read_hook_t read_hook,
 			     grub_env_write_hook_t write_hook)
 {
-  struct grub_env_var *var = grub_env_find (name);
+  struct grub_env_var *var;
+
+  if (grub_env_find_writable (name, &var) != GRUB_ERR_NONE)
+    return grub_errno;
 
   if (! var)
     {
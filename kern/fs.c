@@ -33,6 +33,11 @@ GRUB_EXPORT(grub_fs_list);
 GRUB_EXPORT(grub_fs_probe);
 GRUB_EXPORT(grub_blocklist_convert);
 GRUB_EXPORT(grub_blocklist_write);
+GRUB_EXPORT(grub_fs_mount);
+GRUB_EXPORT(grub_fs_mount_copy);
+GRUB_EXPORT(grub_fs_unmount);
+GRUB_EXPORT(grub_fs_mount_flush);
+GRUB_EXPORT(grub_fs_mount_generation);
 
 grub_fs_t grub_fs_list;
 
@@ -110,6 +115,171 @@ grub_fs_probe (grub_device_t device)
 
 
 
+/* A filesystem mounted on a disk, shared by the files opened on it.  */
+struct grub_fs_mount
+{
+  struct grub_fs_mount *next;
+  grub_fs_t fs;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t start;
+  int ref_count;
+  void *data;
+  grub_size_t size;
+};
+
+static struct grub_fs_mount *grub_fs_mount_list;
+
+/* Bumped on every flush, for caches built on top of mounts.  */
+unsigned long grub_fs_mount_generation;
+
+/* Mounts flushed while still in use, freed by their last unmount.  */
+static struct grub_fs_mount *grub_fs_mount_stale;
+
+static void
+grub_fs_mount_free (struct grub_fs_mount *m)
+{
+  if (m->fs->unmount)
+    (m->fs->unmount) (m->data);
+  else
+    grub_free (m->data);
+
+  grub_free (m);
+}
+
+/* Return the data of FS mounted on DISK, calling the mount hook of FS if
+   it isn't cached yet.  The data is shared, it must not be modified and
+   is released with grub_fs_unmount.  */
+void *
+grub_fs_mount (grub_fs_t fs, grub_disk_t disk)
+{
+  struct grub_fs_mount *m;
+  grub_disk_addr_t start;
+  grub_size_t size;
+  void *data;
+
+  start = grub_partition_get_start (disk->partition);
+  for (m = grub_fs_mount_list; m; m = m->next)
+    if ((m->fs == fs) && (m->dev_id == disk->dev->id)
+	&& (m->disk_id == disk->id) && (m->start == start))
+      {
+	m->ref_count++;
+	return m->data;
+      }
+
+  data = (fs->mount) (disk, &size);
+  if (! data)
+    return 0;
+
+  /* Without an entry, the data is simply not cached.  */
+  m = grub_malloc (sizeof (*m));
+  if (! m)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return data;
+    }
+
+  m->fs = fs;
+  m->dev_id = disk->dev->id;
+  m->disk_id = disk->id;
+  m->start = start;
+  m->ref_count = 1;
+  m->data = data;
+  m->size = size;
+  m->next = grub_fs_mount_list;
+  grub_fs_mount_list = m;
+
+  return data;
+}
+
+/* Return a private copy of the data of FS mounted on DISK, to be freed
+   with grub_free.  Only for filesystems without an unmount hook.  */
+void *
+grub_fs_mount_copy (grub_fs_t fs, grub_disk_t disk)
+{
+  struct grub_fs_mount *m;
+  void *data, *copy;
+
+  data = grub_fs_mount (fs, disk);
+  if (! data)
+    return 0;
+
+  for (m = grub_fs_mount_list; m; m = m->next)
+    if (m->data == data)
+      break;
+
+  /* Not cached, it can be used directly.  */
+  if (! m)
+    return data;
+
+  copy = grub_malloc (m->size);
+  if (copy)
+    grub_memcpy (copy, data, m->size);
+
+  grub_fs_unmount (fs, data);
+  return copy;
+}
+
+/* Release the DATA of FS returned by grub_fs_mount.  */
+void
+grub_fs_unmount (grub_fs_t fs, void *data)
+{
+  struct grub_fs_mount *m, **p;
+
+  for (m = grub_fs_mount_list; m; m = m->next)
+    if (m->data == data)
+      {
+	m->ref_count--;
+	return;
+      }
+
+  for (p = &grub_fs_mount_stale, m = *p; m; p = &m->next, m = *p)
+    if (m->data == data)
+      {
+	if (--m->ref_count == 0)
+	  {
+	    *p = m->next;
+	    grub_fs_mount_free (m);
+	  }
+	return;
+      }
+
+  if (fs->unmount)
+    (fs->unmount) (data);
+  else
+    grub_free (data);
+}
+
+/* Drop the cached mounts of FS, or of all filesystems if FS is NULL.  This
+   is done whenever the disk cache is invalidated, as the media may have
+   changed since.  */
+void
+grub_fs_mount_flush (grub_fs_t fs)
+{
+  struct grub_fs_mount *m, **p;
+
+  grub_fs_mount_generation++;
+  for (p = &grub_fs_mount_list, m = *p; m; m = *p)
+    {
+      if ((fs) && (m->fs != fs))
+	{
+	  p = &m->next;
+	  continue;
+	}
+
+      *p = m->next;
+      if (m->ref_count)
+	{
+	  m->next = grub_fs_mount_stale;
+	  grub_fs_mount_stale = m;
+	}
+      else
+	grub_fs_mount_free (m);
+    }
+}
+
+
+
 /* Block list support routines.  */
 
 struct grub_fs_block
@@ -181,6 +181,26 @@ grub_set_root_dev (void)
 static void
 grub_load_normal_mode (void)
 {
+#if ! GRUB_NO_MODULES
+  const char *prefix;
+
+  /* Try the prelinked bundle first, it loads normal and its dependencies
+     with a single read.  Anything it doesn't provide is loaded below.  */
+  prefix = grub_env_get ("prefix");
+  if (prefix)
+    {
+      char *filename;
+
+      filename = grub_xasprintf ("%s/normal.bdl", prefix);
+      if (filename)
+	{
+	  grub_dl_load_file (filename);
+	  grub_free (filename);
+	}
+      grub_errno = GRUB_ERR_NONE;
+    }
+#endif
+
   /* Load the module.  */
   grub_dl_load ("normal");
 
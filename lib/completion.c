@@ -183,13 +183,10 @@ iterate_dev (const char *devname, void *closure __attribute__ ((unused)))
 static int
 iterate_command (grub_command_t cmd, void *closure __attribute__ ((unused)))
 {
-  if (cmd->prio & GRUB_PRIO_LIST_FLAG_ACTIVE)
+  if (cmd->flags & GRUB_COMMAND_FLAG_CMDLINE)
     {
-      if (cmd->flags & GRUB_COMMAND_FLAG_CMDLINE)
-	{
-	  if (add_completion (cmd->name, " ", GRUB_COMPLETION_TYPE_COMMAND))
-	    return 1;
-	}
+      if (add_completion (cmd->name, " ", GRUB_COMPLETION_TYPE_COMMAND))
+	return 1;
     }
 
   return 0;
@@ -425,7 +422,7 @@ grub_complete (char *buf, int *restore,
   if (argc == 1 || argc == 0)
     {
       /* Complete a command.  */
-      if (grub_command_iterate (iterate_command, 0))
+      if (grub_command_iterate_prefix (current_word, iterate_command, 0))
 	goto fail;
     }
   else if (*current_word == '-')
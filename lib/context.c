@@ -32,7 +32,6 @@ grub_err_t
 grub_env_context_open (int export)
 {
   struct grub_env_context *context;
-  int i;
   struct menu_pointer *menu;
 
   context = grub_zalloc (sizeof (*context));
@@ -40,7 +39,15 @@ grub_env_context_open (int export)
     return grub_errno;
   menu = grub_zalloc (sizeof (*menu));
   if (! menu)
-    return grub_errno;
+    {
+      grub_free (context);
+      return grub_errno;
+    }
+
+  /* Exported variables are shared with the previous context, and only
+     copied into this one when they are written.  */
+  if (export)
+    context->inherit = grub_current_context;
 
   context->prev = grub_current_context;
   grub_current_context = context;
@@ -48,26 +55,6 @@ grub_env_context_open (int export)
   menu->prev = grub_current_menu;
   grub_current_menu = menu;
 
-  /* Copy exported variables.  */
-  for (i = 0; i < HASHSZ; i++)
-    {
-      struct grub_env_var *var;
-
-      for (var = context->prev->vars[i]; var; var = var->next)
-	{
-	  if (export && var->global)
-	    {
-	      if (grub_env_set (var->name, var->value) != GRUB_ERR_NONE)
-		{
-		  grub_env_context_close ();
-		  return grub_errno;
-		}
-	      grub_env_export (var->name);
-	      grub_register_variable_hook (var->name, var->read_hook, var->write_hook);
-	    }
-	}
-    }
-
   return GRUB_ERR_NONE;
 }
 
@@ -75,7 +62,7 @@ grub_err_t
 grub_env_context_close (void)
 {
   struct grub_env_context *context;
-  int i;
+  unsigned i;
   struct menu_pointer *menu;
 
   if (! grub_current_context->prev)
@@ -83,14 +70,14 @@ grub_env_context_close (void)
 		       "cannot close the initial context");
 
   /* Free the variables associated with this context.  */
-  for (i = 0; i < HASHSZ; i++)
+  for (i = 0; i < grub_current_context->size; i++)
     {
       struct grub_env_var *p, *q;
 
       for (p = grub_current_context->vars[i]; p; p = q)
 	{
 	  q = p->next;
-          grub_free (p->name);
+	  grub_free (p->name);
 	  grub_free (p->value);
 	  grub_free (p);
 	}
@@ -98,6 +85,7 @@ grub_env_context_close (void)
 
   /* Restore the previous context.  */
   context = grub_current_context->prev;
+  grub_free (grub_current_context->vars);
   grub_free (grub_current_context);
   grub_current_context = context;
 
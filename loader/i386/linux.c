@@ -36,10 +36,15 @@
 #include <grub/i18n.h>
 #include <grub/env.h>
 #include <grub/lib.h>
+#include <grub/time.h>
 
 #define GRUB_LINUX_CL_OFFSET		0x1000
 #define GRUB_LINUX_CL_END_OFFSET	0x2000
 
+/* Maximum number of progress steps, each read is at least
+   GRUB_FILE_PB_MIN_SIZE bytes.  */
+#define GRUB_LINUX_PB_STEPS		64
+
 static grub_dl_t my_mod;
 
 static grub_size_t linux_mem_size;
@@ -50,6 +55,8 @@ static void *initrd_mem;
 static grub_uint32_t real_mode_pages;
 static grub_uint32_t prot_mode_pages;
 static grub_uint32_t initrd_pages;
+static grub_uint64_t load_bytes;
+static grub_uint64_t load_ms;
 
 static grub_uint8_t gdt[] __attribute__ ((aligned(16))) =
   {
@@ -262,6 +269,45 @@ page_align (grub_size_t size)
   return (size + (1 << 12) - 1) & (~((1 << 12) - 1));
 }
 
+/* Read LEN bytes of FILE straight to their final place at DEST, showing
+   the progress.  */
+static grub_err_t
+load_file (grub_file_t file, void *dest, grub_size_t len)
+{
+  grub_uint64_t start = grub_get_time_ms ();
+  int steps;
+
+  steps = len / GRUB_FILE_PB_MIN_SIZE;
+  if (steps > GRUB_LINUX_PB_STEPS)
+    steps = GRUB_LINUX_PB_STEPS;
+
+  if (grub_file_pb_read (file, dest, len, steps) != (grub_ssize_t) len)
+    return grub_error (GRUB_ERR_FILE_READ_ERROR, "couldn't read file");
+
+  load_bytes += len;
+  load_ms += grub_get_time_ms () - start;
+  return GRUB_ERR_NONE;
+}
+
+/* Publish the rate of the last load in MiB/s as `load_rate'.  */
+static void
+set_load_rate (const char *what)
+{
+  grub_uint64_t rate;
+  char buf[32];
+
+  /* In tenths of MiB/s.  */
+  rate = grub_divmod64 (load_bytes * 10000, load_ms ? load_ms : 1, 0) >> 20;
+  grub_snprintf (buf, sizeof (buf), "%llu.%llu",
+		 (unsigned long long) grub_divmod64 (rate, 10, 0),
+		 (unsigned long long) (rate - grub_divmod64 (rate, 10, 0) * 10));
+  grub_env_set ("load_rate", buf);
+
+  grub_dprintf ("linux", "%s: %llu bytes in %llu ms, %s MiB/s\n", what,
+		(unsigned long long) load_bytes,
+		(unsigned long long) load_ms, buf);
+}
+
 static int
 find_mmap_size_hook (grub_uint64_t addr __attribute__ ((unused)),
 		     grub_uint64_t size __attribute__ ((unused)),
@@ -908,9 +954,9 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
       dest = grub_stpcpy (dest, argv[i]);
     }
 
-  len = prot_size;
-  if (grub_file_read (file, (void *) GRUB_LINUX_BZIMAGE_ADDR, len) != len)
-    grub_error (GRUB_ERR_FILE_READ_ERROR, "couldn't read file");
+  load_bytes = load_ms = 0;
+  if (load_file (file, (void *) GRUB_LINUX_BZIMAGE_ADDR, prot_size) == 0)
+    set_load_rate ("kernel");
 
   if (grub_errno == GRUB_ERR_NONE)
     {
@@ -933,15 +979,19 @@ grub_cmd_linux (grub_command_t cmd __attribute__ ((unused)),
   return grub_errno;
 }
 
+/* Load the files given as one initrd.  They are concatenated in place,
+   each padded to 4 bytes as the kernel expects for cpio archives.  */
 static grub_err_t
 grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 		 int argc, char *argv[])
 {
-  grub_file_t file = 0;
-  grub_ssize_t size;
+  grub_file_t *files = 0;
+  grub_size_t size = 0;
   grub_addr_t addr_min, addr_max;
   grub_addr_t addr;
   struct linux_kernel_header *lh;
+  char *ptr;
+  int i;
 
   if (argc == 0)
     {
@@ -955,11 +1005,18 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
       goto fail;
     }
 
-  file = grub_file_open (argv[0]);
-  if (! file)
+  files = grub_zalloc (argc * sizeof (files[0]));
+  if (! files)
     goto fail;
 
-  size = grub_file_size (file);
+  for (i = 0; i < argc; i++)
+    {
+      files[i] = grub_file_open (argv[i]);
+      if (! files[i])
+	goto fail;
+      size += ALIGN_UP (grub_file_size (files[i]), 4);
+    }
+
   initrd_pages = (page_align (size) >> 12);
 
   lh = (struct linux_kernel_header *) real_mode_mem;
@@ -1005,12 +1062,22 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
 
   initrd_mem = (void *) addr;
 
-  if (grub_file_read (file, initrd_mem, size) != size)
+  load_bytes = load_ms = 0;
+  ptr = initrd_mem;
+  for (i = 0; i < argc; i++)
     {
-      grub_error (GRUB_ERR_FILE_READ_ERROR, "couldn't read file");
-      goto fail;
+      grub_size_t cursize = grub_file_size (files[i]);
+
+      if (load_file (files[i], ptr, cursize))
+	goto fail;
+      ptr += cursize;
+
+      grub_memset (ptr, 0, ALIGN_UP (cursize, 4) - cursize);
+      ptr += ALIGN_UP (cursize, 4) - cursize;
     }
 
+  set_load_rate ("initrd");
+
   grub_dprintf ("linux", "Initrd, addr=0x%x, size=0x%x\n",
 		(unsigned) addr, (unsigned) size);
 
@@ -1019,8 +1086,13 @@ grub_cmd_initrd (grub_command_t cmd __attribute__ ((unused)),
   lh->root_dev = 0x0100; /* XXX */
 
  fail:
-  if (file)
-    grub_file_close (file);
+  if (files)
+    {
+      for (i = 0; i < argc; i++)
+	if (files[i])
+	  grub_file_close (files[i]);
+      grub_free (files);
+    }
 
   return grub_errno;
 }
@@ -34,6 +34,8 @@
 #include <grub/extcmd.h>
 #include <grub/env.h>
 #include <grub/i18n.h>
+#include <grub/disk.h>
+#include <grub/partition.h>
 
 struct grub_xnu_devtree_key *grub_xnu_devtree_root = 0;
 static int driverspackagenum = 0;
@@ -619,9 +621,11 @@ get_name_ptr (char *name)
   return p2 + 1;
 }
 
-/* Load .kext. */
+/* Load .kext. If PLIST isn't 0 it holds the PLISTSIZE bytes of
+   INFOPLISTNAME, which then isn't read again.  */
 static grub_err_t
-grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile)
+grub_xnu_load_driver (char *infoplistname, char *plist, grub_size_t plistsize,
+		      grub_file_t binaryfile)
 {
   grub_macho_t macho;
   grub_err_t err;
@@ -666,18 +670,19 @@ grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile)
   else
     macho = 0;
 
-  if (infoplistname)
+  if (infoplistname && ! plist)
     infoplist = grub_gzfile_open (infoplistname, 1);
   else
     infoplist = 0;
   grub_errno = GRUB_ERR_NONE;
   if (infoplist)
-    {
-      infoplistsize = grub_file_size (infoplist);
-      neededspace += infoplistsize + 1;
-    }
+    infoplistsize = grub_file_size (infoplist);
+  else if (plist)
+    infoplistsize = plistsize;
   else
     infoplistsize = 0;
+  if (infoplist || plist)
+    neededspace += infoplistsize + 1;
 
   /* Allocate the space. */
   err = grub_xnu_align_heap (GRUB_XNU_PAGESIZE);
@@ -727,6 +732,15 @@ grub_xnu_load_driver (char *infoplistname, grub_file_t binaryfile)
       buf[infoplistsize] = 0;
       buf += infoplistsize + 1;
     }
+  else if (plist)
+    {
+      exthead->infoplistaddr = (buf - (grub_uint8_t *) grub_xnu_heap_start)
+	+ grub_xnu_heap_will_be_at;
+      exthead->infoplistsize = infoplistsize + 1;
+      grub_memcpy (buf, plist, infoplistsize);
+      buf[infoplistsize] = 0;
+      buf += infoplistsize + 1;
+    }
   grub_errno = GRUB_ERR_NONE;
 
   exthead->nameaddr = (buf - (grub_uint8_t *) grub_xnu_heap_start)
@@ -897,29 +911,29 @@ grub_cmd_xnu_ramdisk (grub_command_t cmd __attribute__ ((unused)),
   return grub_xnu_register_memory ("RAMDisk", 0, loadto, size);
 }
 
-/* Returns true if the kext should be loaded according to plist
-   and osbundlereq. Also fill BINNAME. */
-static int
-grub_xnu_check_os_bundle_required (char *plistname, char *osbundlereq,
-				   char **binname)
+/* Read the plist PLISTNAME. Fill OSBUNDLEREQ with the lowercased value of
+   OSBundleRequired and BINNAME with CFBundleExecutable, each left 0 if the
+   key is absent. If CONTENTS isn't 0 the plist itself is returned in it
+   and its size in CONTENTSSIZE.  */
+static grub_err_t
+grub_xnu_parse_plist (char *plistname, char **osbundlereq, char **binname,
+		      char **contents, grub_size_t *contentssize)
 {
   grub_file_t file;
   char *buf = 0, *tagstart = 0, *ptr1 = 0, *keyptr = 0;
   char *stringptr = 0, *ptr2 = 0;
   grub_size_t size;
   int depth = 0;
-  int ret;
   int osbundlekeyfound = 0, binnamekeyfound = 0;
-  if (binname)
-    *binname = 0;
+
+  *osbundlereq = 0;
+  *binname = 0;
 
   file = grub_gzfile_open (plistname, 1);
   if (! file)
     {
-      grub_file_close (file);
       grub_error_push ();
-      grub_error (GRUB_ERR_BAD_OS, "couldn't read file %s", plistname);
-      return 0;
+      return grub_error (GRUB_ERR_BAD_OS, "couldn't read file %s", plistname);
     }
 
   size = grub_file_size (file);
@@ -928,24 +942,18 @@ grub_xnu_check_os_bundle_required (char *plistname, char *osbundlereq,
     {
       grub_file_close (file);
       grub_error_push ();
-      grub_error (GRUB_ERR_OUT_OF_MEMORY, "couldn't read file %s", plistname);
-      return 0;
+      return grub_error (GRUB_ERR_OUT_OF_MEMORY, "couldn't read file %s",
+			 plistname);
     }
   if (grub_file_read (file, buf, size) != (grub_ssize_t) (size))
     {
       grub_file_close (file);
+      grub_free (buf);
       grub_error_push ();
-      grub_error (GRUB_ERR_BAD_OS, "couldn't read file %s", plistname);
-      return 0;
+      return grub_error (GRUB_ERR_BAD_OS, "couldn't read file %s", plistname);
     }
   grub_file_close (file);
 
-  /* Set the return value for the case when no OSBundleRequired tag is found. */
-  if (osbundlereq)
-    ret = grub_strword (osbundlereq, "all") || grub_strword (osbundlereq, "-");
-  else
-    ret = 1;
-
   /* Parse plist. It's quite dirty and inextensible but does its job. */
   for (ptr1 = buf; ptr1 < buf + size; ptr1++)
     switch (*ptr1)
@@ -959,17 +967,17 @@ grub_xnu_check_os_bundle_required (char *plistname, char *osbundlereq,
 	if (keyptr && depth == 4 &&
 	    grub_strcmp (keyptr, "CFBundleExecutable") == 0)
 	  binnamekeyfound = 1;
-	if (stringptr && osbundlekeyfound && osbundlereq && depth == 4)
+	if (stringptr && osbundlekeyfound && depth == 4)
 	  {
-	    for (ptr2 = stringptr; *ptr2; ptr2++)
-	      *ptr2 = grub_tolower (*ptr2);
-	    ret = grub_strword (osbundlereq, stringptr)
-	      || grub_strword (osbundlereq, "all");
+	    grub_free (*osbundlereq);
+	    *osbundlereq = grub_strdup (stringptr);
+	    if (*osbundlereq)
+	      for (ptr2 = *osbundlereq; *ptr2; ptr2++)
+		*ptr2 = grub_tolower (*ptr2);
 	  }
-	if (stringptr && binnamekeyfound && binname && depth == 4)
+	if (stringptr && binnamekeyfound && depth == 4)
 	  {
-	    if (*binname)
-	      grub_free (*binname);
+	    grub_free (*binname);
 	    *binname = grub_strdup (stringptr);
 	  }
 
@@ -981,8 +989,11 @@ grub_xnu_check_os_bundle_required (char *plistname, char *osbundlereq,
 	if (! tagstart)
 	  {
 	    grub_free (buf);
-	    grub_error (GRUB_ERR_BAD_OS, "can't parse %s", plistname);
-	    return 0;
+	    grub_free (*osbundlereq);
+	    grub_free (*binname);
+	    *osbundlereq = 0;
+	    *binname = 0;
+	    return grub_error (GRUB_ERR_BAD_OS, "can't parse %s", plistname);
 	  }
 	*ptr1 = 0;
 	if (tagstart[1] == '?' || ptr1[-1] == '/')
@@ -1008,15 +1019,108 @@ grub_xnu_check_os_bundle_required (char *plistname, char *osbundlereq,
 	  depth++;
 	break;
       }
-  grub_free (buf);
 
-  return ret;
+  if (contents)
+    {
+      *contents = buf;
+      *contentssize = size;
+    }
+  else
+    grub_free (buf);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Returns true if a kext whose OSBundleRequired is REQUIRED should be
+   loaded according to OSBUNDLEREQ.  */
+static int
+grub_xnu_check_os_bundle_required (const char *required, char *osbundlereq)
+{
+  if (! osbundlereq)
+    return 1;
+
+  /* No OSBundleRequired tag.  */
+  if (! required)
+    return grub_strword (osbundlereq, "all") || grub_strword (osbundlereq, "-");
+
+  return grub_strword (osbundlereq, required)
+    || grub_strword (osbundlereq, "all");
 }
 
+/* What is needed to load a kext without looking at its directory.  */
+struct grub_xnu_kext_info
+{
+  struct grub_xnu_kext_info *next;
+  char *plistname;
+  /* Full name of the executable, or 0.  */
+  char *binname;
+  /* Lowercased OSBundleRequired, or 0.  */
+  char *osbundlerequired;
+  /* Contents of the plist, kept only until the kext is loaded.  */
+  char *plist;
+  grub_size_t plistsize;
+};
+
+/* Kexts found under a directory scanned by xnu_kextdir. The entry stays
+   valid as long as the modification time of the directory doesn't change,
+   which is also what the kext cache of the OS itself relies on.  */
+struct grub_xnu_kext_cache
+{
+  struct grub_xnu_kext_cache *next;
+  /* The directory with the device it was scanned on.  */
+  char *key;
+  int mtimeset;
+  grub_int32_t mtime;
+  struct grub_xnu_kext_info *kexts;
+};
+
+static struct grub_xnu_kext_cache *grub_xnu_kext_cache;
+
+/* State of a scan. The device and its filesystem are only opened once.  */
+struct grub_xnu_kext_scan
+{
+  grub_device_t dev;
+  grub_fs_t fs;
+  /* Plists of the kexts selected by OSBUNDLEREQUIRED are kept.  */
+  char *osbundlerequired;
+  struct grub_xnu_kext_info **tail;
+};
+
+static void
+grub_xnu_free_kexts (struct grub_xnu_kext_info *kexts)
+{
+  struct grub_xnu_kext_info *next;
+
+  for (; kexts; kexts = next)
+    {
+      next = kexts->next;
+      grub_free (kexts->plistname);
+      grub_free (kexts->binname);
+      grub_free (kexts->osbundlerequired);
+      grub_free (kexts->plist);
+      grub_free (kexts);
+    }
+}
+
+static const char *
+grub_xnu_path (const char *name)
+{
+  const char *path;
+
+  path = grub_strchr (name, ')');
+  if (! path)
+    return name;
+  return path + 1;
+}
+
+static grub_err_t
+grub_xnu_scan_kext (struct grub_xnu_kext_scan *s, char *dirname,
+		    int maxrecursion);
+
 struct grub_xnu_scan_dir_for_kexts_closure
 {
+  struct grub_xnu_kext_scan *s;
   char *dirname;
-  char *osbundlerequired;
   int maxrecursion;
 };
 
@@ -1039,65 +1143,46 @@ grub_xnu_scan_dir_for_kexts_hook (const char *filename,
   newdirname
     = grub_malloc (grub_strlen (c->dirname) + grub_strlen (filename) + 2);
 
-  /* It's a .kext. Try to load it. */
+  /* It's a .kext. Look at it. */
   if (newdirname)
     {
       grub_strcpy (newdirname, c->dirname);
       newdirname[grub_strlen (newdirname) + 1] = 0;
       newdirname[grub_strlen (newdirname)] = '/';
       grub_strcpy (newdirname + grub_strlen (newdirname), filename);
-      grub_xnu_load_kext_from_dir (newdirname, c->osbundlerequired,
-				   c->maxrecursion);
+      grub_xnu_scan_kext (c->s, newdirname, c->maxrecursion);
       if (grub_errno == GRUB_ERR_BAD_OS)
 	grub_errno = GRUB_ERR_NONE;
       grub_free (newdirname);
     }
-  return 0;
+  return grub_errno != GRUB_ERR_NONE;
 }
 
-/* Load all loadable kexts placed under DIRNAME and matching OSBUNDLEREQUIRED */
-grub_err_t
-//grub_xnu_scan_dir_for_kexts (char *dirname, char *osbundlerequired, int maxrecursion)
-grub_xnu_scan_dir_for_kexts (char *dirname, char *osbundlerequired __attribute__((unused)), int maxrecursion __attribute__((unused)))
-
+/* Add all kexts placed under DIRNAME to the scan.  */
+static grub_err_t
+grub_xnu_scan_dir (struct grub_xnu_kext_scan *s, char *dirname,
+		   int maxrecursion)
 {
-  grub_device_t dev;
-  char *device_name;
-  grub_fs_t fs;
-  const char *path;
+  struct grub_xnu_scan_dir_for_kexts_closure c;
 
-  if (! grub_xnu_heap_size)
-    return grub_error (GRUB_ERR_BAD_OS, "no xnu kernel loaded");
-
-  device_name = grub_file_get_device_name (dirname);
-  dev = grub_device_open (device_name);
-  if (dev)
-    {
-//      struct grub_xnu_scan_dir_for_kexts_closure c;
-
-      fs = grub_fs_probe (dev);
-      path = grub_strchr (dirname, ')');
-      if (! path)
-	path = dirname;
-      else
-	path++;
-
-//      c.dirname = dirname;
-//      c.osbundlerequired = osbundlerequired;
-//      c.maxrecursion = maxrecursion;
-      if (fs)
-	(fs->dir) (dev, path, grub_xnu_scan_dir_for_kexts_hook, 0);
-      grub_device_close (dev);
-    }
-  grub_free (device_name);
+  if (maxrecursion <= 0)
+    return GRUB_ERR_NONE;
 
+  c.s = s;
+  c.dirname = dirname;
+  c.maxrecursion = maxrecursion;
+  (s->fs->dir) (s->dev, grub_xnu_path (dirname),
+		grub_xnu_scan_dir_for_kexts_hook, &c);
+  if (grub_errno == GRUB_ERR_OUT_OF_MEMORY)
+    return grub_errno;
+  grub_errno = GRUB_ERR_NONE;
   return GRUB_ERR_NONE;
 }
 
 struct grub_xnu_load_kext_from_dir_closure
 {
+  struct grub_xnu_kext_scan *s;
   char *dirname;
-  char *osbundlerequired;
   int maxrecursion;
   int usemacos;
   char *plistname;
@@ -1118,13 +1203,11 @@ grub_xnu_load_kext_from_dir_hook (const char *filename,
   /* If the kext contains directory "Contents" all real stuff is in
      this directory. */
   if (info->dir && grub_strcasecmp (filename, "Contents") == 0)
-    grub_xnu_load_kext_from_dir (c->newdirname, c->osbundlerequired,
-				 c->maxrecursion - 1);
+    grub_xnu_scan_kext (c->s, c->newdirname, c->maxrecursion - 1);
 
   /* Directory "Plugins" contains nested kexts. */
   if (info->dir && grub_strcasecmp (filename, "Plugins") == 0)
-    grub_xnu_scan_dir_for_kexts (c->newdirname, c->osbundlerequired,
-				 c->maxrecursion - 1);
+    grub_xnu_scan_dir (c->s, c->newdirname, c->maxrecursion - 1);
 
   /* Directory "MacOS" contains executable, otherwise executable is
      on the top. */
@@ -1135,22 +1218,22 @@ grub_xnu_load_kext_from_dir_hook (const char *filename,
   if (! info->dir && grub_strcasecmp (filename, "Info.plist") == 0
       && ! c->plistname)
     c->plistname = grub_strdup (c->newdirname);
-  return 0;
+  return grub_errno == GRUB_ERR_OUT_OF_MEMORY;
 }
 
-/* Load extension DIRNAME. (extensions are directories in xnu) */
-grub_err_t
-grub_xnu_load_kext_from_dir (char *dirname, char *osbundlerequired,
-			     int maxrecursion)
+/* Add extension DIRNAME (extensions are directories in xnu) and the ones
+   it contains to the scan.  */
+static grub_err_t
+grub_xnu_scan_kext (struct grub_xnu_kext_scan *s, char *dirname,
+		    int maxrecursion)
 {
-  grub_device_t dev;
-  char *newdirname;
-  char *newpath;
-  char *device_name;
-  grub_fs_t fs;
-  const char *path;
+  struct grub_xnu_load_kext_from_dir_closure c;
+  struct grub_xnu_kext_info *kext;
   char *binsuffix;
-  grub_file_t binfile;
+  char *newdirname;
+
+  if (maxrecursion <= 0)
+    return GRUB_ERR_NONE;
 
   newdirname = grub_malloc (grub_strlen (dirname) + 20);
   if (! newdirname)
@@ -1158,74 +1241,366 @@ grub_xnu_load_kext_from_dir (char *dirname, char *osbundlerequired,
   grub_strcpy (newdirname, dirname);
   newdirname[grub_strlen (dirname)] = '/';
   newdirname[grub_strlen (dirname) + 1] = 0;
-  device_name = grub_file_get_device_name (dirname);
-  dev = grub_device_open (device_name);
-  if (dev)
+
+  c.s = s;
+  c.dirname = dirname;
+  c.maxrecursion = maxrecursion;
+  c.usemacos = 0;
+  c.plistname = 0;
+  c.newdirname = newdirname;
+  /* Look at the directory. */
+  (s->fs->dir) (s->dev, grub_xnu_path (dirname),
+		grub_xnu_load_kext_from_dir_hook, &c);
+  grub_free (newdirname);
+  if (grub_errno == GRUB_ERR_OUT_OF_MEMORY)
     {
-      struct grub_xnu_load_kext_from_dir_closure c;
+      grub_free (c.plistname);
+      return grub_errno;
+    }
+  grub_errno = GRUB_ERR_NONE;
 
-      fs = grub_fs_probe (dev);
-      path = grub_strchr (dirname, ')');
-      if (! path)
-	path = dirname;
-      else
-	path++;
+  if (! c.plistname)
+    return GRUB_ERR_NONE;
 
-      newpath = grub_strchr (newdirname, ')');
-      if (! newpath)
-	newpath = newdirname;
+  kext = grub_zalloc (sizeof (*kext));
+  if (! kext)
+    {
+      grub_free (c.plistname);
+      return grub_errno;
+    }
+  kext->plistname = c.plistname;
+
+  if (grub_xnu_parse_plist (c.plistname, &kext->osbundlerequired, &binsuffix,
+			    &kext->plist, &kext->plistsize))
+    {
+      grub_xnu_free_kexts (kext);
+      return grub_errno;
+    }
+
+  if (! grub_xnu_check_os_bundle_required (kext->osbundlerequired,
+					   s->osbundlerequired))
+    {
+      grub_free (kext->plist);
+      kext->plist = 0;
+    }
+
+  if (binsuffix)
+    {
+      kext->binname = grub_malloc (grub_strlen (dirname)
+				   + grub_strlen (binsuffix)
+				   + sizeof ("/MacOS/"));
+      if (! kext->binname)
+	{
+	  grub_free (binsuffix);
+	  grub_xnu_free_kexts (kext);
+	  return grub_errno;
+	}
+      grub_strcpy (kext->binname, dirname);
+      if (c.usemacos)
+	grub_strcpy (kext->binname + grub_strlen (kext->binname), "/MacOS/");
       else
-	newpath++;
-
-      c.dirname = dirname;
-      c.osbundlerequired = osbundlerequired;
-      c.maxrecursion = maxrecursion;
-      c.usemacos = 0;
-      c.plistname = 0;
-      c.newdirname = newdirname;
-      /* Look at the directory. */
-      if (fs)
-	(fs->dir) (dev, path, grub_xnu_load_kext_from_dir_hook, &c);
-
-      if (c.plistname && grub_xnu_check_os_bundle_required
-	  (c.plistname, osbundlerequired, &binsuffix))
+	grub_strcpy (kext->binname + grub_strlen (kext->binname), "/");
+      grub_strcpy (kext->binname + grub_strlen (kext->binname), binsuffix);
+      grub_free (binsuffix);
+    }
+
+  *s->tail = kext;
+  s->tail = &kext->next;
+
+  return GRUB_ERR_NONE;
+}
+
+static const char *
+grub_xnu_kext_key (struct grub_xnu_kext_info *kext)
+{
+  return kext->binname ? : kext->plistname;
+}
+
+/* Load the kexts of KEXTS matching OSBUNDLEREQUIRED. Executables are read
+   in the order of their names, so the ones sharing a directory are read
+   one after another.  */
+static grub_err_t
+grub_xnu_load_kexts (struct grub_xnu_kext_info *kexts, char *osbundlerequired)
+{
+  struct grub_xnu_kext_info *kext, **sorted;
+  int count = 0, i, j;
+
+  for (kext = kexts; kext; kext = kext->next)
+    if (grub_xnu_check_os_bundle_required (kext->osbundlerequired,
+					   osbundlerequired))
+      count++;
+
+  if (! count)
+    return GRUB_ERR_NONE;
+
+  sorted = grub_malloc (count * sizeof (sorted[0]));
+  if (! sorted)
+    return grub_errno;
+
+  /* The scan already returns most kexts in order, so a plain insertion
+     sort is enough.  */
+  i = 0;
+  for (kext = kexts; kext; kext = kext->next)
+    if (grub_xnu_check_os_bundle_required (kext->osbundlerequired,
+					   osbundlerequired))
+      {
+	for (j = i; j > 0 && grub_strcmp (grub_xnu_kext_key (sorted[j - 1]),
+					  grub_xnu_kext_key (kext)) > 0; j--)
+	  sorted[j] = sorted[j - 1];
+	sorted[j] = kext;
+	i++;
+      }
+
+  for (i = 0; i < count; i++)
+    {
+      grub_file_t binfile = 0;
+
+      kext = sorted[i];
+      grub_dprintf ("xnu", "%s:%s\n", kext->plistname,
+		    kext->binname ? : "0");
+      if (kext->binname)
 	{
-	  if (binsuffix)
-	    {
-	      /* Open the binary. */
-	      char *binname = grub_malloc (grub_strlen (dirname)
-					   + grub_strlen (binsuffix)
-					   + sizeof ("/MacOS/"));
-	      grub_strcpy (binname, dirname);
-	      if (c.usemacos)
-		grub_strcpy (binname + grub_strlen (binname), "/MacOS/");
-	      else
-		grub_strcpy (binname + grub_strlen (binname), "/");
-	      grub_strcpy (binname + grub_strlen (binname), binsuffix);
-	      grub_dprintf ("xnu", "%s:%s\n", c.plistname, binname);
-	      binfile = grub_gzfile_open (binname, 1);
-	      if (! binfile)
-		grub_errno = GRUB_ERR_NONE;
-
-	      /* Load the extension. */
-	      grub_xnu_load_driver (c.plistname, binfile);
-	      grub_free (binname);
-	      grub_free (binsuffix);
-	    }
-	  else
-	    {
-	      grub_dprintf ("xnu", "%s:0\n", c.plistname);
-	      grub_xnu_load_driver (c.plistname, 0);
-	    }
+	  binfile = grub_gzfile_open (kext->binname, 1);
+	  if (! binfile)
+	    grub_errno = GRUB_ERR_NONE;
 	}
-      grub_free (c.plistname);
-      grub_device_close (dev);
+
+      /* Load the extension. */
+      grub_xnu_load_driver (kext->plistname, kext->plist, kext->plistsize,
+			    binfile);
+      grub_free (kext->plist);
+      kext->plist = 0;
+      if (grub_errno == GRUB_ERR_OUT_OF_MEMORY)
+	break;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_free (sorted);
+  return grub_errno;
+}
+
+struct grub_xnu_dir_mtime_closure
+{
+  const char *name;
+  int mtimeset;
+  grub_int32_t mtime;
+};
+
+static int
+grub_xnu_dir_mtime_hook (const char *filename,
+			 const struct grub_dirhook_info *info,
+			 void *closure)
+{
+  struct grub_xnu_dir_mtime_closure *c = closure;
+
+  if (! info->dir)
+    return 0;
+  if ((info->case_insensitive ? grub_strcasecmp (filename, c->name)
+       : grub_strcmp (filename, c->name)) != 0)
+    return 0;
+
+  c->mtimeset = info->mtimeset;
+  c->mtime = info->mtime;
+  return 1;
+}
+
+/* Get the modification time of DIRNAME from its parent. Returns 0 if the
+   filesystem doesn't know it.  */
+static int
+grub_xnu_dir_mtime (struct grub_xnu_kext_scan *s, char *dirname,
+		    grub_int32_t *mtime)
+{
+  struct grub_xnu_dir_mtime_closure c;
+  char *parent, *ptr;
+
+  parent = grub_strdup (grub_xnu_path (dirname));
+  if (! parent)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  for (ptr = parent + grub_strlen (parent); ptr > parent && ptr[-1] == '/';
+       ptr--)
+    ptr[-1] = 0;
+  ptr = grub_strrchr (parent, '/');
+  if (! ptr || ! ptr[1])
+    {
+      grub_free (parent);
+      return 0;
+    }
+
+  c.name = ptr + 1;
+  c.mtimeset = 0;
+  c.mtime = 0;
+  *ptr = 0;
+  (s->fs->dir) (s->dev, *parent ? parent : "/", grub_xnu_dir_mtime_hook, &c);
+  grub_errno = GRUB_ERR_NONE;
+  grub_free (parent);
+
+  *mtime = c.mtime;
+  return c.mtimeset;
+}
+
+/* Name DIRNAME with the device of S, which it may not give itself, so
+   that the same path on another root isn't taken from the cache.  */
+static char *
+grub_xnu_kext_cache_key (struct grub_xnu_kext_scan *s, char *dirname)
+{
+  grub_disk_t disk = s->dev->disk;
+  char *partname = 0, *key;
+
+  if (disk && disk->partition)
+    {
+      partname = grub_partition_get_name (disk->partition);
+      if (! partname)
+	return 0;
     }
+
+  key = grub_xasprintf ("(%s%s%s)%s", disk ? disk->name : "",
+			partname ? "," : "", partname ? partname : "",
+			grub_xnu_path (dirname));
+  grub_free (partname);
+  return key;
+}
+
+/* Load all loadable kexts placed under DIRNAME and matching OSBUNDLEREQUIRED */
+grub_err_t
+grub_xnu_scan_dir_for_kexts (char *dirname, char *osbundlerequired,
+			     int maxrecursion)
+{
+  struct grub_xnu_kext_cache *cache;
+  struct grub_xnu_kext_info *kexts = 0;
+  struct grub_xnu_kext_scan s;
+  char *device_name, *key;
+  grub_int32_t mtime = 0;
+  int mtimeset;
+
+  if (! grub_xnu_heap_size)
+    return grub_error (GRUB_ERR_BAD_OS, "no xnu kernel loaded");
+
+  device_name = grub_file_get_device_name (dirname);
+  s.dev = grub_device_open (device_name);
   grub_free (device_name);
+  if (! s.dev)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+
+  s.fs = grub_fs_probe (s.dev);
+  if (! s.fs)
+    {
+      grub_device_close (s.dev);
+      grub_errno = GRUB_ERR_NONE;
+      return GRUB_ERR_NONE;
+    }
+
+  key = grub_xnu_kext_cache_key (&s, dirname);
+  if (! key)
+    {
+      grub_device_close (s.dev);
+      return grub_errno;
+    }
+
+  mtimeset = grub_xnu_dir_mtime (&s, dirname, &mtime);
+
+  for (cache = grub_xnu_kext_cache; cache; cache = cache->next)
+    if (grub_strcmp (cache->key, key) == 0)
+      break;
+
+  /* Without a modification time the entry is trusted for the whole boot,
+     nothing here writes to the filesystem.  */
+  if (cache && cache->mtimeset == mtimeset
+      && (! mtimeset || cache->mtime == mtime))
+    {
+      grub_dprintf ("xnu", "using the cached kexts of %s\n", key);
+      grub_device_close (s.dev);
+      grub_free (key);
+      return grub_xnu_load_kexts (cache->kexts, osbundlerequired);
+    }
+
+  s.osbundlerequired = osbundlerequired;
+  s.tail = &kexts;
+  grub_xnu_scan_dir (&s, dirname, maxrecursion);
+  grub_device_close (s.dev);
+  if (grub_errno)
+    {
+      grub_free (key);
+      grub_xnu_free_kexts (kexts);
+      return grub_errno;
+    }
+
+  if (! cache)
+    {
+      cache = grub_zalloc (sizeof (*cache));
+      if (! cache)
+	{
+	  grub_free (key);
+	  grub_xnu_free_kexts (kexts);
+	  return grub_errno;
+	}
+      cache->key = key;
+      cache->next = grub_xnu_kext_cache;
+      grub_xnu_kext_cache = cache;
+    }
+  else
+    {
+      grub_free (key);
+      grub_xnu_free_kexts (cache->kexts);
+    }
+
+  cache->mtimeset = mtimeset;
+  cache->mtime = mtime;
+  cache->kexts = kexts;
+
+  return grub_xnu_load_kexts (kexts, osbundlerequired);
+}
+
+/* Load extension DIRNAME. (extensions are directories in xnu) */
+grub_err_t
+grub_xnu_load_kext_from_dir (char *dirname, char *osbundlerequired,
+			     int maxrecursion)
+{
+  struct grub_xnu_kext_info *kexts = 0;
+  struct grub_xnu_kext_scan s;
+  char *device_name;
+
+  device_name = grub_file_get_device_name (dirname);
+  s.dev = grub_device_open (device_name);
+  grub_free (device_name);
+  if (! s.dev)
+    return GRUB_ERR_NONE;
+
+  s.fs = grub_fs_probe (s.dev);
+  if (s.fs)
+    {
+      s.osbundlerequired = osbundlerequired;
+      s.tail = &kexts;
+      grub_xnu_scan_kext (&s, dirname, maxrecursion);
+    }
+  grub_device_close (s.dev);
+
+  if (! grub_errno)
+    grub_xnu_load_kexts (kexts, osbundlerequired);
+  grub_xnu_free_kexts (kexts);
 
   return GRUB_ERR_NONE;
 }
 
+static void
+grub_xnu_free_kext_cache (void)
+{
+  struct grub_xnu_kext_cache *next;
+
+  for (; grub_xnu_kext_cache; grub_xnu_kext_cache = next)
+    {
+      next = grub_xnu_kext_cache->next;
+      grub_xnu_free_kexts (grub_xnu_kext_cache->kexts);
+      grub_free (grub_xnu_kext_cache->key);
+      grub_free (grub_xnu_kext_cache);
+    }
+}
 
 static int locked=0;
 static grub_dl_t my_mod;
@@ -1249,7 +1624,7 @@ grub_cmd_xnu_kext (grub_command_t cmd __attribute__ ((unused)),
 	    }
 	}
       return grub_xnu_load_driver (grub_strcmp (args[0], "-") ? args[0] : 0,
-				   binfile);
+				   0, 0, binfile);
     }
 
   /* load kext normally. */
@@ -1500,5 +1875,6 @@ GRUB_MOD_FINI(xnu)
   grub_unregister_extcmd (cmd_splash);
   grub_unregister_command (cmd_kernel64);
 
+  grub_xnu_free_kext_cache ();
   grub_cpu_xnu_fini ();
 }
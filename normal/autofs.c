@@ -102,15 +102,23 @@ read_fs_list (const char *prefix)
 		  while (p < q && grub_isspace (*q))
 		    *q-- = '\0';
 
-		  /* If the line is empty, skip it.  */
-		  if (p >= q)
-		    continue;
+		  /* If the line is empty, or the module loaded already,
+		     skip it.  */
+		  if ((p >= q) || (grub_dl_get (p)))
+		    {
+		      grub_free (buf);
+		      continue;
+		    }
 
 		  fs_mod = grub_malloc (sizeof (*fs_mod));
 		  if (! fs_mod)
-		    continue;
+		    {
+		      grub_free (buf);
+		      continue;
+		    }
 
 		  fs_mod->name = grub_strdup (p);
+		  grub_free (buf);
 		  if (! fs_mod->name)
 		    {
 		      grub_free (fs_mod);
@@ -76,7 +76,7 @@ read_command_list (const char *prefix)
 	  if (file)
 	    {
 	      char *buf = NULL;
-	      grub_command_t ptr, last = 0, next;
+	      grub_command_t ptr, next;
 
 	      /* Override previous commands.lst.  */
 	      for (ptr = grub_command_list; ptr; ptr = next)
@@ -84,14 +84,12 @@ read_command_list (const char *prefix)
 		  next = ptr->next;
 		  if (ptr->func == grub_dyncmd_dispatcher)
 		    {
-		      if (last)
-			last->next = ptr->next;
-		      else
-			grub_command_list = ptr->next;
-		      grub_free (ptr);
+		      char *name = (char *) ptr->name;
+
+		      grub_free (ptr->data);
+		      grub_unregister_command (ptr);
+		      grub_free (name);
 		    }
-		  else
-		    last = ptr;
 		}
 
 	      for (;; grub_free (buf))
@@ -40,6 +40,7 @@ read_lists (const char *val)
 #ifdef GRUB_MACHINE_EMU
   (void) val;
 #else
+  read_preload_list (val);
   read_command_list (val);
   read_fs_list (val);
   read_crypto_list (val);
@@ -154,11 +155,14 @@ GRUB_MOD_INIT(normal)
 			 0, N_("Enter normal mode."));
   grub_register_command ("normal_exit", grub_cmd_normal_exit,
 			 0, N_("Exit from normal mode."));
+
+  grub_preload_init ();
 }
 
 GRUB_MOD_FINI(normal)
 {
   grub_unregister_command (export_cmd);
+  grub_preload_fini ();
 
   grub_history_init (0);
   grub_register_variable_hook ("pager", 0, 0);
@@ -0,0 +1,213 @@
+/* preload.c - load the modules a config needs in one batch */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/env.h>
+#include <grub/misc.h>
+#include <grub/file.h>
+#include <grub/command.h>
+#include <grub/normal.h>
+#include <grub/lib.h>
+#include <grub/i18n.h>
+
+/* The modules loaded on demand since tracing started, in load order.  */
+static grub_named_list_t trace_list;
+static grub_named_list_t *trace_tail = &trace_list;
+
+static void
+trace_module (grub_dl_t mod)
+{
+  grub_named_list_t p;
+
+  p = grub_malloc (sizeof (*p));
+  if (! p)
+    return;
+
+  p->name = grub_strdup (mod->name);
+  if (! p->name)
+    {
+      grub_free (p);
+      return;
+    }
+
+  p->next = 0;
+  *trace_tail = p;
+  trace_tail = &p->next;
+}
+
+static void
+free_trace_list (void)
+{
+  while (trace_list)
+    {
+      grub_named_list_t p;
+
+      p = trace_list;
+      trace_list = p->next;
+      grub_free (p->name);
+      grub_free (p);
+    }
+  trace_tail = &trace_list;
+}
+
+/* The prefix the modules were last preloaded from.  */
+static char *preload_prefix;
+
+/* Load the modules listed in preload.lst, before the lazy loading stubs
+   for commands and filesystems are set up, so that they are skipped.  If
+   preload.bdl, a bundle of the same modules, exists, it is used first.
+   Both are read once per prefix, the lists are read again each time
+   normal mode starts or the prefix is set.  */
+void
+read_preload_list (const char *prefix)
+{
+  if ((prefix) && (preload_prefix) && (! grub_strcmp (prefix, preload_prefix)))
+    return;
+
+  grub_free (preload_prefix);
+  preload_prefix = 0;
+
+  if (prefix)
+    {
+      char *filename;
+
+      preload_prefix = grub_strdup (prefix);
+
+      filename = grub_xasprintf ("%s/preload.bdl", prefix);
+      if (filename)
+	{
+	  grub_dl_load_file (filename);
+	  grub_free (filename);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+
+      filename = grub_xasprintf ("%s/preload.lst", prefix);
+      if (filename)
+	{
+	  grub_file_t file;
+
+	  file = grub_file_open (filename);
+	  if (file)
+	    {
+	      char *buf, **names = 0;
+	      int count = 0, max = 0;
+
+	      while ((buf = grub_getline (file)) != NULL)
+		{
+		  char *p, *q;
+
+		  p = buf;
+		  q = buf + grub_strlen (buf);
+
+		  /* Ignore space.  */
+		  while (grub_isspace (*p))
+		    p++;
+
+		  while (q > p && grub_isspace (q[-1]))
+		    *--q = '\0';
+
+		  if ((*p == '\0') || (*p == '#') || (grub_dl_get (p)))
+		    {
+		      grub_free (buf);
+		      continue;
+		    }
+
+		  if (count == max)
+		    {
+		      char **n;
+
+		      max = (max) ? max * 2 : 16;
+		      n = grub_realloc (names, max * sizeof (names[0]));
+		      if (! n)
+			{
+			  grub_free (buf);
+			  break;
+			}
+		      names = n;
+		    }
+
+		  names[count] = grub_strdup (p);
+		  if (names[count])
+		    count++;
+
+		  grub_free (buf);
+		}
+
+	      grub_file_close (file);
+
+	      grub_dl_preload (count, names);
+
+	      while (count)
+		grub_free (names[--count]);
+	      grub_free (names);
+	    }
+
+	  grub_free (filename);
+	}
+    }
+
+  /* Ignore errors.  */
+  grub_errno = GRUB_ERR_NONE;
+}
+
+/* preload [-t | -l | MODULE...] */
+static grub_err_t
+grub_cmd_preload (struct grub_command *cmd __attribute__ ((unused)),
+		  int argc, char *argv[])
+{
+  if ((argc > 0) && (! grub_strcmp (argv[0], "-t")))
+    {
+      free_trace_list ();
+      grub_dl_trace_hook = trace_module;
+    }
+  else if ((argc > 0) && (! grub_strcmp (argv[0], "-l")))
+    {
+      grub_named_list_t p;
+
+      for (p = trace_list; p; p = p->next)
+	grub_printf ("%s\n", p->name);
+    }
+  else
+    grub_dl_preload (argc, argv);
+
+  return 0;
+}
+
+static grub_command_t cmd;
+
+void
+grub_preload_init (void)
+{
+  cmd = grub_register_command ("preload", grub_cmd_preload,
+			       N_("[-t|-l|MODULE...]"),
+			       N_("Load modules in one batch. With -t, start "
+				  "recording the modules loaded on demand, "
+				  "with -l, list them in preload.lst format."));
+}
+
+void
+grub_preload_fini (void)
+{
+  grub_unregister_command (cmd);
+  grub_dl_trace_hook = 0;
+  free_trace_list ();
+  grub_free (preload_prefix);
+  preload_prefix = 0;
+}
@@ -31,6 +31,7 @@
 #include <grub/lib.h>
 #include <grub/command.h>
 #include <grub/i18n.h>
+#include <grub/util/hostio.h>
 
 #include <grub_fstest_init.h>
 
@@ -39,6 +40,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <getopt.h>
+#include <sys/time.h>
 
 #include "progname.h"
 
@@ -81,6 +83,7 @@ execute_command (char *name, int n, char **args)
 #define CMD_HEX         4
 #define CMD_CRC         6
 #define CMD_BLOCKLIST   7
+#define CMD_BENCH       8
 
 #define BUF_SIZE  32256
 
@@ -280,6 +283,46 @@ cmd_crc (char *pathname)
   printf ("%08x\n", crc);
 }
 
+static int
+bench_hook (grub_off_t ofs __attribute__ ((unused)),
+	    char *buf __attribute__ ((unused)), int len, void *closure)
+{
+  grub_uint64_t *total = closure;
+
+  *total += len;
+  return 0;
+}
+
+static void
+cmd_bench (char *pathname)
+{
+  struct timeval start, end;
+  grub_uint64_t total = 0;
+  double secs;
+  char used[32] = "";
+  int m;
+
+  /* The images stay open while the file is read.  A mode that doesn't
+     apply to them falls back to pread.  */
+  for (m = GRUB_UTIL_HOSTIO_PREAD; m <= GRUB_UTIL_HOSTIO_DIRECT; m++)
+    if (grub_util_hostio_mode_in_use (m))
+      {
+	if (used[0])
+	  strcat (used, "+");
+	strcat (used, grub_util_hostio_mode_name (m));
+      }
+
+  gettimeofday (&start, 0);
+  read_file (pathname, bench_hook, &total);
+  gettimeofday (&end, 0);
+
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  printf ("%s (asked %s): %llu bytes in %.3f s, %.1f MiB/s\n", used,
+	  grub_util_hostio_mode_name (grub_util_hostio_get_mode ()),
+	  (unsigned long long) total, secs,
+	  (secs > 0) ? total / secs / (1 << 20) : 0);
+}
+
 static void
 fstest (char **images, int num_disks, int cmd, int n, char **args)
 {
@@ -337,6 +380,9 @@ fstest (char **images, int num_disks, int cmd, int n, char **args)
     case CMD_BLOCKLIST:
       execute_command ("blocklist", n, args);
       grub_printf ("\n");
+      break;
+    case CMD_BENCH:
+      cmd_bench (args[0]);
     }
 
   argv[0] = "-d";
@@ -361,6 +407,7 @@ static struct option options[] = {
   {"length", required_argument, 0, 'n'},
   {"diskcount", required_argument, 0, 'c'},
   {"debug", required_argument, 0, 'd'},
+  {"io", required_argument, 0, 'i'},
   {"help", no_argument, 0, 'h'},
   {"version", no_argument, 0, 'V'},
   {"verbose", no_argument, 0, 'v'},
@@ -384,12 +431,15 @@ Debug tool for filesystem driver.\n\
   hex FILE                  Hex dump FILE\n\
   crc FILE                  Get crc32 checksum of FILE\n\
   blocklist FILE            display blocklist of FILE\n\
+  bench FILE                read FILE and report the throughput\n\
 \nOptions:\n\
   -r, --root=DEVICE_NAME    set root device\n\
   -s, --skip=N              skip N bytes from output file\n\
   -n, --length=N            handle N bytes in output file\n\
   -c, --diskcount=N         N input files\n\
   -d, --debug=S             Set debug environment variable\n\
+  -i, --io=MODE             access images with MODE (pread, mmap, direct),\n\
+                            default is $GRUB_HOSTIO or pread\n\
   -h, --help                display this message and exit\n\
   -V, --version             print version information and exit\n\
   -v, --verbose             print verbose messages\n\
@@ -418,7 +468,8 @@ main (int argc, char *argv[])
              (argv[num_opts][1] == 's') ||
              (argv[num_opts][1] == 'n') ||
              (argv[num_opts][1] == 'c') ||
-             (argv[num_opts][1] == 'd')))
+             (argv[num_opts][1] == 'd') ||
+             (argv[num_opts][1] == 'i')))
             num_opts++;
       }
     else
@@ -427,7 +478,7 @@ main (int argc, char *argv[])
   /* Check for options.  */
   while (1)
     {
-      int c = getopt_long (num_opts, argv, "r:s:n:c:d:hVv", options, 0);
+      int c = getopt_long (num_opts, argv, "r:s:n:c:d:i:hVv", options, 0);
       char *p;
 
       if (c == -1)
@@ -464,6 +515,14 @@ main (int argc, char *argv[])
             debug_str = optarg;
             break;
 
+          case 'i':
+            if (grub_util_hostio_set_mode (optarg))
+              {
+                fprintf (stderr, "%s.\n", grub_errmsg);
+                usage (1);
+              }
+            break;
+
 	  case 'h':
 	    usage (0);
 	    break;
@@ -531,6 +590,11 @@ main (int argc, char *argv[])
 	  cmd = CMD_BLOCKLIST;
           nparm = 1;
 	}
+      else if (!grub_strcmp (argv[optind], "bench"))
+	{
+	  cmd = CMD_BENCH;
+          nparm = 1;
+	}
       else
 	{
 	  fprintf (stderr, "Invalid command %s.\n", argv[optind]);
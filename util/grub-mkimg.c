@@ -1,4 +1,4 @@
-/* grub-mkrawmod.c - tool to generate raw image from object files.  */
+/* grub-mkimg.c - tool to generate raw image or bundle from object files.  */
 /*
  *  BURG - Brand-new Universal loadeR from GRUB
  *  Copyright 2009 Bean Lee - All Rights Reserved
@@ -21,6 +21,7 @@
 #include <grub/types.h>
 #include <grub/util/obj.h>
 #include <grub/util/misc.h>
+#include <grub/util/resolve.h>
 #include <grub/i18n.h>
 
 #include <stdio.h>
@@ -43,6 +44,9 @@ static struct option options[] = {
   {"verbose", no_argument, 0, 'v'},
   {"output", required_argument, 0, 'o'},
   {"base", required_argument, 0, 'b'},
+  {"bundle", required_argument, 0, 'B'},
+  {"directory", required_argument, 0, 'd'},
+  {"exclude", required_argument, 0, 'x'},
   {0, 0, 0, 0}
 };
 
@@ -54,16 +58,23 @@ usage (int status)
   else
     printf (_("\
 Usage: %s [OPTIONS] [OBJECT_FILES].\n\
+       %s [OPTIONS] --bundle=NAME [MODULES].\n\
 \n\
-Tool to generate img file from object files.\n\
+Tool to generate img file from object files, or a prelinked bundle\n\
+from modules and their dependencies.\n\
 \nOptions:\n\
   -h, --help              display this message and exit\n\
   -V, --version           print version information and exit\n\
   -v, --verbose           print verbose messages\n\
   -o, --output=FILE       output a generated image to FILE [default=stdout]\n\
   -b, --base=ADDR         set base address\n\
+  -B, --bundle=NAME       generate the bundle NAME instead of an image\n\
+  -d, --directory=DIR     use modules in DIR [default=%s]\n\
+  -x, --exclude=MODULES   leave comma separated MODULES and their\n\
+                          dependencies out of the bundle\n\
 \n\
-Report bugs to <%s>.\n"), program_name, PACKAGE_BUGREPORT);
+Report bugs to <%s>.\n"), program_name, program_name, GRUB_LIBDIR,
+	    PACKAGE_BUGREPORT);
 
   exit (status);
 }
@@ -113,12 +124,132 @@ mkrawimage (char *objs[], grub_uint32_t base, FILE *fp)
   grub_obj_free (obj);
 }
 
+static void
+free_path_list (struct grub_util_path_list *path_list)
+{
+  while (path_list)
+    {
+      struct grub_util_path_list *next;
+
+      next = path_list->next;
+      free ((void *) path_list->name);
+      free (path_list);
+      path_list = next;
+    }
+}
+
+/* Return the modules in the comma separated list EXCLUDE, with all their
+   dependencies.  */
+static struct grub_util_path_list *
+get_excluded (const char *dir, char *exclude)
+{
+  struct grub_util_path_list *path_list;
+  char **mods, *p;
+  int n;
+
+  if (! exclude)
+    return 0;
+
+  n = 2;
+  for (p = exclude; *p; p++)
+    if (*p == ',')
+      n++;
+
+  mods = xmalloc (n * sizeof (mods[0]));
+  n = 0;
+  p = exclude;
+  while (p)
+    {
+      char *next;
+
+      next = strchr (p, ',');
+      if (next)
+	*(next++) = 0;
+
+      if (*p)
+	mods[n++] = p;
+
+      p = next;
+    }
+  mods[n] = 0;
+
+  path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
+  free (mods);
+
+  return path_list;
+}
+
+static void
+mkbundle (const char *dir, char *mods[], char *exclude, char *name, FILE *fp)
+{
+  struct grub_util_path_list *path_list, *exclude_list, **p;
+  struct grub_util_obj_segment *modinfo;
+  struct grub_util_obj *obj;
+
+  path_list = grub_util_resolve_dependencies (dir, "moddep.lst", mods);
+  exclude_list = get_excluded (dir, exclude);
+
+  obj = xmalloc_zero (sizeof (*obj));
+
+  /* Excluded modules are expected to be loaded already, the ones used
+     by the bundle become its dependencies.  */
+  p = &path_list;
+  while (*p)
+    {
+      struct grub_util_path_list *q, *e;
+      char *mod_name;
+
+      q = *p;
+      for (e = exclude_list; e; e = e->next)
+	if (! strcmp (e->name, q->name))
+	  break;
+
+      mod_name = grub_util_get_module_name (q->name);
+      if (! strcmp (mod_name, name))
+	grub_util_error ("bundle %s has the name of one of its modules", name);
+
+      if ((! e) && (strcmp (mod_name, "kernel")))
+	{
+	  free (mod_name);
+	  p = &q->next;
+	  continue;
+	}
+
+      if (strcmp (mod_name, "kernel"))
+	{
+	  int len;
+
+	  len = strlen (mod_name) + 1;
+	  obj->deps = xrealloc (obj->deps, obj->deps_len + len);
+	  strcpy (obj->deps + obj->deps_len, mod_name);
+	  obj->deps_len += len;
+	}
+
+      *p = q->next;
+      q->next = 0;
+      free_path_list (q);
+      free (mod_name);
+    }
+
+  modinfo = grub_obj_add_bundle (obj, path_list);
+  grub_obj_merge_segments (obj, 0, GRUB_OBJ_MERGE_ALL);
+  grub_obj_bundle_done (obj, modinfo);
+  grub_obj_save (obj, name, fp);
+
+  grub_obj_free (obj);
+  free_path_list (path_list);
+  free_path_list (exclude_list);
+}
+
 int
 main (int argc, char *argv[])
 {
   FILE *fp = stdout;
   char *output = NULL;
   grub_uint32_t base = 0;
+  char *bundle = NULL;
+  char *dir = NULL;
+  char *exclude = NULL;
 
   set_program_name (argv[0]);
 
@@ -127,7 +258,7 @@ main (int argc, char *argv[])
   /* Check for options.  */
   while (1)
     {
-      int c = getopt_long (argc, argv, "hVvo:b:", options, 0);
+      int c = getopt_long (argc, argv, "hVvo:b:B:d:x:", options, 0);
 
       if (c == -1)
 	break;
@@ -157,6 +288,27 @@ main (int argc, char *argv[])
 	    base = strtoul (optarg, 0, 0);
 	    break;
 
+	  case 'B':
+	    if (bundle)
+	      free (bundle);
+
+	    bundle = xstrdup (optarg);
+	    break;
+
+	  case 'd':
+	    if (dir)
+	      free (dir);
+
+	    dir = xstrdup (optarg);
+	    break;
+
+	  case 'x':
+	    if (exclude)
+	      free (exclude);
+
+	    exclude = xstrdup (optarg);
+	    break;
+
 	  default:
 	    usage (1);
 	    break;
@@ -171,7 +323,16 @@ main (int argc, char *argv[])
       free (output);
     }
 
-  mkrawimage (argv + optind, base, fp);
+  if (bundle)
+    {
+      mkbundle ((dir) ? dir : GRUB_LIBDIR, argv + optind, exclude, bundle, fp);
+      free (bundle);
+    }
+  else
+    mkrawimage (argv + optind, base, fp);
+
+  free (dir);
+  free (exclude);
 
   fclose (fp);
 
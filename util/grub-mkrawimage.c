@@ -50,13 +50,32 @@ grub_strcmp (const char *s1, const char *s2)
 #ifdef ENABLE_LZMA
 #include <grub/lib/LzmaEnc.h>
 
+#ifdef HAVE_PTHREAD
+#include <pthread.h>
+#endif
+
 static void *SzAlloc(void *p, size_t size) { p = p; return xmalloc(size); }
 static void SzFree(void *p, void *address) { p = p; free(address); }
 static ISzAlloc g_Alloc = { SzAlloc, SzFree };
 
+struct lzma_block
+{
+  unsigned char *src;
+  size_t src_size;
+  unsigned char *dst;
+  size_t dst_size;
+};
+
+struct lzma_job
+{
+  struct lzma_block *blocks;
+  unsigned num_blocks;
+  unsigned first;
+  unsigned step;
+};
+
 static void
-compress_kernel (char *kernel_img, size_t kernel_size,
-		 char **core_img, size_t *core_size)
+compress_block (struct lzma_block *block)
 {
   CLzmaEncProps props;
   unsigned char out_props[5];
@@ -69,22 +88,118 @@ compress_kernel (char *kernel_img, size_t kernel_size,
   props.pb = 2;
   props.numThreads = 1;
 
+  /* Leave room for incompressible data.  */
+  block->dst_size = block->src_size + (block->src_size >> 4) + 64;
+  block->dst = xmalloc (block->dst_size);
+  if (LzmaEncode(block->dst, &block->dst_size,
+		 block->src, block->src_size,
+		 &props, out_props, &out_props_size,
+		 0, NULL, &g_Alloc, &g_Alloc) != SZ_OK)
+    grub_util_error (_("cannot compress the kernel image"));
+}
+
+static void *
+compress_blocks (void *arg)
+{
+  struct lzma_job *job = arg;
+  unsigned i;
+
+  for (i = job->first; i < job->num_blocks; i += job->step)
+    compress_block (&job->blocks[i]);
+
+  return NULL;
+}
+
+static void
+compress_kernel (char *kernel_img, size_t kernel_size,
+		 char **core_img, size_t *core_size)
+{
+  struct lzma_block *blocks;
+  struct lzma_job *jobs;
+  unsigned num_blocks, num_jobs, i;
+  size_t size, offset;
+  grub_uint32_t *index;
+  char *p;
+
   if (kernel_size < GRUB_KERNEL_MACHINE_RAW_SIZE)
     grub_util_error (_("the core image is too small"));
 
-  *core_img = xmalloc (kernel_size);
+  size = kernel_size - GRUB_KERNEL_MACHINE_RAW_SIZE;
+  num_blocks = ((size + GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE - 1)
+		/ GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE);
+  blocks = xmalloc (num_blocks * sizeof (*blocks));
+  for (i = 0, offset = GRUB_KERNEL_MACHINE_RAW_SIZE; i < num_blocks;
+       i++, offset += GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE)
+    {
+      blocks[i].src = (unsigned char *) kernel_img + offset;
+      blocks[i].src_size = kernel_size - offset;
+      if (blocks[i].src_size > GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE)
+	blocks[i].src_size = GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE;
+    }
+
+  /* The blocks don't depend on each other, so compress them at once.  */
+  num_jobs = 1;
+#if defined (HAVE_PTHREAD) && defined (_SC_NPROCESSORS_ONLN)
+  {
+    long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+    if (cpus > 1)
+      num_jobs = cpus;
+  }
+#endif
+  if (num_jobs > num_blocks)
+    num_jobs = num_blocks;
+
+  jobs = xmalloc (num_jobs * sizeof (*jobs));
+  for (i = 0; i < num_jobs; i++)
+    {
+      jobs[i].blocks = blocks;
+      jobs[i].num_blocks = num_blocks;
+      jobs[i].first = i;
+      jobs[i].step = num_jobs;
+    }
+
+#ifdef HAVE_PTHREAD
+  {
+    pthread_t *threads;
+
+    threads = xmalloc (num_jobs * sizeof (*threads));
+    for (i = 1; i < num_jobs; i++)
+      if (pthread_create (&threads[i], NULL, compress_blocks, &jobs[i]))
+	grub_util_error (_("cannot create a compression thread"));
+    compress_blocks (&jobs[0]);
+    for (i = 1; i < num_jobs; i++)
+      pthread_join (threads[i], NULL);
+    free (threads);
+  }
+#else
+  for (i = 0; i < num_jobs; i++)
+    compress_blocks (&jobs[i]);
+#endif
+
+  grub_util_info ("compressed %u blocks in %u threads", num_blocks, num_jobs);
+
+  *core_size = GRUB_KERNEL_MACHINE_RAW_SIZE + (2 + num_blocks) * 4;
+  for (i = 0; i < num_blocks; i++)
+    *core_size += blocks[i].dst_size;
+
+  *core_img = xmalloc (*core_size);
   memcpy (*core_img, kernel_img, GRUB_KERNEL_MACHINE_RAW_SIZE);
 
-  *core_size = kernel_size - GRUB_KERNEL_MACHINE_RAW_SIZE;
-  if (LzmaEncode((unsigned char *) *core_img + GRUB_KERNEL_MACHINE_RAW_SIZE,
-		 core_size,
-		 (unsigned char *) kernel_img + GRUB_KERNEL_MACHINE_RAW_SIZE,
-		 kernel_size - GRUB_KERNEL_MACHINE_RAW_SIZE,
-		 &props, out_props, &out_props_size,
-		 0, NULL, &g_Alloc, &g_Alloc) != SZ_OK)
-    grub_util_error (_("cannot compress the kernel image"));
+  index = (grub_uint32_t *) (*core_img + GRUB_KERNEL_MACHINE_RAW_SIZE);
+  index[0] = grub_host_to_target32 (GRUB_KERNEL_MACHINE_LZMA_BLOCK_SIZE);
+  index[1] = grub_host_to_target32 (num_blocks);
+  p = (char *) (index + 2 + num_blocks);
+  for (i = 0; i < num_blocks; i++)
+    {
+      index[2 + i] = grub_host_to_target32 (blocks[i].dst_size);
+      memcpy (p, blocks[i].dst, blocks[i].dst_size);
+      p += blocks[i].dst_size;
+      free (blocks[i].dst);
+    }
 
-  *core_size += GRUB_KERNEL_MACHINE_RAW_SIZE;
+  free (jobs);
+  free (blocks);
 }
 
 #else	/* No lzma compression */
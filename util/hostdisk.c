@@ -24,6 +24,7 @@
 #include <grub/err.h>
 #include <grub/util/misc.h>
 #include <grub/util/hostdisk.h>
+#include <grub/util/hostio.h>
 #include <grub/misc.h>
 #include <grub/i18n.h>
 #include <grub/list.h>
@@ -42,11 +43,6 @@
 
 #ifdef __linux__
 # include <sys/ioctl.h>         /* ioctl */
-# if !defined(__GLIBC__) || \
-        ((__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 1)))
-/* Maybe libc doesn't have large file support.  */
-#  include <linux/unistd.h>     /* _llseek */
-# endif /* (GLIBC < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR < 1)) */
 # ifndef BLKFLSBUF
 #  define BLKFLSBUF     _IO (0x12,97)   /* flush buffer cache */
 # endif /* ! BLKFLSBUF */
@@ -114,13 +110,15 @@ struct
 {
   char *drive;
   char *device;
+  /* Open descriptor, kept across grub_disk_open and grub_disk_close.  */
+  struct grub_util_biosdisk_data *data;
 } map[256];
 
 struct grub_util_biosdisk_data
 {
   char *dev;
   int access_mode;
-  int fd;
+  struct grub_util_hostio io;
 };
 
 #ifdef __linux__
@@ -220,10 +218,22 @@ grub_util_biosdisk_open (const char *name, grub_disk_t disk)
 
   disk->has_partitions = 1;
   disk->id = drive;
-  disk->data = data = xmalloc (sizeof (struct grub_util_biosdisk_data));
-  data->dev = NULL;
-  data->access_mode = 0;
-  data->fd = -1;
+  if (! map[drive].data)
+    {
+      data = xmalloc (sizeof (struct grub_util_biosdisk_data));
+      data->dev = NULL;
+      data->access_mode = 0;
+      data->io.fd = -1;
+      map[drive].data = data;
+    }
+#ifdef __linux__
+  else if (map[drive].data->io.fd != -1)
+    /* The descriptor is kept across opens, so flush the buffer cache
+       here as reopening the device used to.  Otherwise blocks written
+       through a mounted filesystem since the last open read stale.  */
+    ioctl (map[drive].data->io.fd, BLKFLSBUF, 0);
+#endif
+  disk->data = map[drive].data;
 
   /* Get the size.  */
 #if defined(__MINGW32__)
@@ -401,8 +411,11 @@ linux_find_partition (char *dev, unsigned long sector)
 }
 #endif /* __linux__ */
 
+/* Return a descriptor for reading or writing SECTOR of DISK, reusing the
+   one already open when possible.  SECTOR is adjusted if the descriptor
+   refers to a partition.  */
 static int
-open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
+open_device (const grub_disk_t disk, grub_disk_addr_t *sector, int flags)
 {
   int fd;
   struct grub_util_biosdisk_data *data = disk->data;
@@ -410,12 +423,16 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
 #ifdef O_LARGEFILE
   flags |= O_LARGEFILE;
 #endif
+  /* Only writes need to reach the disk before returning.  */
+  if ((flags & O_ACCMODE) != O_RDONLY)
+    {
 #ifdef O_SYNC
-  flags |= O_SYNC;
+      flags |= O_SYNC;
 #endif
 #ifdef O_FSYNC
-  flags |= O_FSYNC;
+      flags |= O_FSYNC;
 #endif
+    }
 #ifdef O_BINARY
   flags |= O_BINARY;
 #endif
@@ -431,7 +448,7 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
     part_start = grub_partition_get_start (disk->partition);
 
     strcpy (dev, map[disk->id].device);
-    if (disk->partition && sector >= part_start
+    if (disk->partition && *sector >= part_start
 	&& strncmp (map[disk->id].device, "/dev/", 5) == 0)
       is_partition = linux_find_partition (dev, part_start);
 
@@ -439,13 +456,18 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
 	data->access_mode == (flags & O_ACCMODE))
       {
 	grub_dprintf ("hostdisk", "reusing open device `%s'\n", dev);
-	fd = data->fd;
+	fd = data->io.fd;
       }
     else
       {
 	free (data->dev);
-	if (data->fd != -1)
-	  close (data->fd);
+	data->dev = NULL;
+	if (data->io.fd != -1)
+	  {
+	    grub_util_hostio_detach (&data->io);
+	    close (data->io.fd);
+	    data->io.fd = -1;
+	  }
 
 	/* Open the partition.  */
 	grub_dprintf ("hostdisk", "opening the device `%s' in open_device()\n", dev);
@@ -462,11 +484,11 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
 
 	data->dev = xstrdup (dev);
 	data->access_mode = (flags & O_ACCMODE);
-	data->fd = fd;
+	grub_util_hostio_attach (&data->io, fd, flags);
       }
 
     if (is_partition)
-      sector -= part_start;
+      *sector -= part_start;
   }
 #else /* ! __linux__ */
 #if defined (__FreeBSD__) || defined(__FreeBSD_kernel__)
@@ -491,20 +513,30 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
       data->access_mode == (flags & O_ACCMODE))
     {
       grub_dprintf ("hostdisk", "reusing open device `%s'\n", data->dev);
-      fd = data->fd;
+      fd = data->io.fd;
     }
   else
     {
       free (data->dev);
-      if (data->fd != -1)
-	close (data->fd);
+      data->dev = NULL;
+      if (data->io.fd != -1)
+	{
+	  grub_util_hostio_detach (&data->io);
+	  close (data->io.fd);
+	  data->io.fd = -1;
+	}
 
       fd = open (map[disk->id].device, flags);
+#if defined(__APPLE__)
+      /* If we can't have exclusive access, try shared access */
+      if (fd < 0)
+	fd = open(map[disk->id].device, flags | O_SHLOCK);
+#endif
       if (fd >= 0)
 	{
 	  data->dev = xstrdup (map[disk->id].device);
 	  data->access_mode = (flags & O_ACCMODE);
-	  data->fd = fd;
+	  grub_util_hostio_attach (&data->io, fd, flags);
 	}
     }
 
@@ -517,12 +549,6 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
     }
 #endif
 
-#if defined(__APPLE__)
-  /* If we can't have exclusive access, try shared access */
-  if (fd < 0)
-    fd = open(map[disk->id].device, flags | O_SHLOCK);
-#endif
-
   if (fd < 0)
     {
       grub_error (GRUB_ERR_BAD_DEVICE, "cannot open `%s' in open_device()", map[disk->id].device);
@@ -534,101 +560,36 @@ open_device (const grub_disk_t disk, grub_disk_addr_t sector, int flags)
   configure_device_driver (fd);
 #endif /* defined(__NetBSD__) */
 
-#if defined(__linux__) && (!defined(__GLIBC__) || \
-        ((__GLIBC__ < 2) || ((__GLIBC__ == 2) && (__GLIBC_MINOR__ < 1))))
-  /* Maybe libc doesn't have large file support.  */
-  {
-    loff_t offset, result;
-    static int _llseek (uint filedes, ulong hi, ulong lo,
-                        loff_t *res, uint wh);
-    _syscall5 (int, _llseek, uint, filedes, ulong, hi, ulong, lo,
-               loff_t *, res, uint, wh);
-
-    offset = (loff_t) sector << GRUB_DISK_SECTOR_BITS;
-    if (_llseek (fd, offset >> 32, offset & 0xffffffff, &result, SEEK_SET))
-      {
-	grub_error (GRUB_ERR_BAD_DEVICE, "cannot seek `%s'", map[disk->id].device);
-	close (fd);
-	return -1;
-      }
-  }
-#else
-  {
-    off_t offset = (off_t) sector << GRUB_DISK_SECTOR_BITS;
-
-    if (lseek (fd, offset, SEEK_SET) != offset)
-      {
-	grub_error (GRUB_ERR_BAD_DEVICE, "cannot seek `%s'", map[disk->id].device);
-	close (fd);
-	return -1;
-      }
-  }
-#endif
-
   return fd;
 }
 
-/* Read LEN bytes from FD in BUF. Return less than or equal to zero if an
-   error occurs, otherwise return LEN.  */
-static ssize_t
-nread (int fd, char *buf, size_t len)
-{
-  ssize_t size = len;
-
-  while (len)
-    {
-      ssize_t ret = read (fd, buf, len);
-
-      if (ret <= 0)
-        {
-          if (errno == EINTR)
-            continue;
-          else
-            return ret;
-        }
-
-      len -= ret;
-      buf += ret;
-    }
-
-  return size;
-}
-
-/* Write LEN bytes from BUF to FD. Return less than or equal to zero if an
-   error occurs, otherwise return LEN.  */
-static ssize_t
-nwrite (int fd, const char *buf, size_t len)
+/* Reads and writes crossing the start of the partition have to be split
+   if the partition is accessed through its own device.  */
+static int
+need_split (grub_disk_t disk, grub_disk_addr_t sector, grub_size_t size)
 {
-  ssize_t size = len;
-
-  while (len)
-    {
-      ssize_t ret = write (fd, buf, len);
-
-      if (ret <= 0)
-        {
-          if (errno == EINTR)
-            continue;
-          else
-            return ret;
-        }
-
-      len -= ret;
-      buf += ret;
-    }
-
-  return size;
+#ifdef __linux__
+  return (disk->partition && sector < disk->partition->start
+	  && sector + size > disk->partition->start
+	  && strncmp (map[disk->id].device, "/dev/", 5) == 0);
+#else
+  (void) disk;
+  (void) sector;
+  (void) size;
+  return 0;
+#endif
 }
 
 static grub_err_t
 grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 			 grub_size_t size, char *buf)
 {
+  struct grub_util_biosdisk_data *data = disk->data;
+  grub_disk_addr_t offset = sector;
   int fd;
 
   /* Split pre-partition and partition reads.  */
-  if (disk->partition && sector < disk->partition->start
-      && sector + size > disk->partition->start)
+  if (need_split (disk, sector, size))
     {
       grub_err_t err;
       err = grub_util_biosdisk_read (disk, sector,
@@ -643,30 +604,31 @@ grub_util_biosdisk_read (grub_disk_t disk, grub_disk_addr_t sector,
 					     << GRUB_DISK_SECTOR_BITS));
     }
 
-  fd = open_device (disk, sector, O_RDONLY);
+  fd = open_device (disk, &offset, O_RDONLY);
   if (fd < 0)
     return grub_errno;
 
 #ifdef __linux__
-  if (sector == 0 && size > 1)
+  if (sector == 0 && size > 1 && strncmp (map[disk->id].device, "/dev/", 5) == 0)
     {
       /* Work around a bug in Linux ez remapping.  Linux remaps all
 	 sectors that are read together with the MBR in one read.  It
 	 should only remap the MBR, so we split the read in two
 	 parts. -jochen  */
-      if (nread (fd, buf, GRUB_DISK_SECTOR_SIZE) != GRUB_DISK_SECTOR_SIZE)
-	{
-	  grub_error (GRUB_ERR_READ_ERROR, "cannot read `%s'", map[disk->id].device);
-	  close (fd);
-	  return grub_errno;
-	}
+      if (grub_util_hostio_read (&data->io, buf, GRUB_DISK_SECTOR_SIZE,
+				 offset << GRUB_DISK_SECTOR_BITS)
+	  != GRUB_DISK_SECTOR_SIZE)
+	return grub_error (GRUB_ERR_READ_ERROR, "cannot read `%s'",
+			   map[disk->id].device);
 
       buf += GRUB_DISK_SECTOR_SIZE;
+      offset++;
       size--;
     }
 #endif /* __linux__ */
 
-  if (nread (fd, buf, size << GRUB_DISK_SECTOR_BITS)
+  if (grub_util_hostio_read (&data->io, buf, size << GRUB_DISK_SECTOR_BITS,
+			     offset << GRUB_DISK_SECTOR_BITS)
       != (ssize_t) (size << GRUB_DISK_SECTOR_BITS))
     grub_error (GRUB_ERR_READ_ERROR, "cannot read from `%s'", map[disk->id].device);
 
@@ -677,11 +639,12 @@ static grub_err_t
 grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 			  grub_size_t size, const char *buf)
 {
+  struct grub_util_biosdisk_data *data = disk->data;
+  grub_disk_addr_t offset = sector;
   int fd;
 
   /* Split pre-partition and partition writes.  */
-  if (disk->partition && sector < disk->partition->start
-      && sector + size > disk->partition->start)
+  if (need_split (disk, sector, size))
     {
       grub_err_t err;
       err = grub_util_biosdisk_write (disk, sector,
@@ -696,11 +659,12 @@ grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 					      << GRUB_DISK_SECTOR_BITS));
     }
 
-  fd = open_device (disk, sector, O_WRONLY);
+  fd = open_device (disk, &offset, O_WRONLY);
   if (fd < 0)
     return grub_errno;
 
-  if (nwrite (fd, buf, size << GRUB_DISK_SECTOR_BITS)
+  if (grub_util_hostio_write (&data->io, buf, size << GRUB_DISK_SECTOR_BITS,
+			      offset << GRUB_DISK_SECTOR_BITS)
       != (ssize_t) (size << GRUB_DISK_SECTOR_BITS))
     grub_error (GRUB_ERR_WRITE_ERROR, "cannot write to `%s'", map[disk->id].device);
 
@@ -708,13 +672,14 @@ grub_util_biosdisk_write (grub_disk_t disk, grub_disk_addr_t sector,
 }
 
 static void
-grub_util_biosdisk_close (struct grub_disk *disk)
+close_device (struct grub_util_biosdisk_data *data)
 {
-  struct grub_util_biosdisk_data *data = disk->data;
-
   free (data->dev);
-  if (data->fd != -1)
-    close (data->fd);
+  if (data->io.fd != -1)
+    {
+      grub_util_hostio_detach (&data->io);
+      close (data->io.fd);
+    }
   free (data);
 }
 
@@ -724,7 +689,6 @@ static struct grub_disk_dev grub_util_biosdisk_dev =
     .id = GRUB_DISK_DEVICE_BIOSDISK_ID,
     .iterate = grub_util_biosdisk_iterate,
     .open = grub_util_biosdisk_open,
-    .close = grub_util_biosdisk_close,
     .read = grub_util_biosdisk_read,
     .write = grub_util_biosdisk_write,
     .next = 0
@@ -845,7 +809,10 @@ grub_util_biosdisk_fini (void)
 	free (map[i].drive);
       if (map[i].device)
 	free (map[i].device);
+      if (map[i].data)
+	close_device (map[i].data);
       map[i].drive = map[i].device = NULL;
+      map[i].data = NULL;
     }
 
   grub_disk_dev_unregister (&grub_util_biosdisk_dev);
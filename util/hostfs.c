@@ -23,10 +23,14 @@
 #include <grub/misc.h>
 #include <grub/dl.h>
 #include <grub/util/misc.h>
+#include <grub/util/hostio.h>
 
 #include <dirent.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #ifdef __MACH__
 #include <sys/disk.h>
@@ -98,13 +102,21 @@ grub_hostfs_dir (grub_device_t device, const char *path,
 static grub_err_t
 grub_hostfs_open (struct grub_file *file, const char *name)
 {
-  FILE *f;
+  struct grub_util_hostio *io;
+  int flags = O_RDONLY;
+  int fd;
 
-  f = fopen (name, "rb");
-  if (! f)
+#ifdef O_LARGEFILE
+  flags |= O_LARGEFILE;
+#endif
+#ifdef O_BINARY
+  flags |= O_BINARY;
+#endif
+
+  fd = open (name, flags);
+  if (fd < 0)
     return grub_error (GRUB_ERR_BAD_FILENAME,
 		       "can't open `%s'", name);
-  file->data = f;
 
 #ifdef __MINGW32__
   file->size = grub_util_get_disk_size (name);
@@ -114,56 +126,61 @@ grub_hostfs_open (struct grub_file *file, const char *name)
       unsigned long long int count;
       unsigned int size;
 
-      if ((ioctl (fileno (f), DKIOCGETBLOCKSIZE, &size) < 0) ||
-	  (ioctl (fileno (f), DKIOCGETBLOCKCOUNT, &count) < 0))
+      if ((ioctl (fd, DKIOCGETBLOCKSIZE, &size) < 0) ||
+	  (ioctl (fd, DKIOCGETBLOCKCOUNT, &count) < 0))
 	{
-	  file->data = 0;
-	  fclose (f);	  
+	  close (fd);
 	  return grub_error (GRUB_ERR_BAD_FILENAME, "ioctl fails");
 	}
       file->size = count * size;
     }
   else
-    {
-      fseeko (f, 0, SEEK_END);
-      file->size = ftello (f);
-      fseeko (f, 0, SEEK_SET);      
-    }
+    file->size = lseek (fd, 0, SEEK_END);
 #else
-  fseeko (f, 0, SEEK_END);
-  file->size = ftello (f);
-  fseeko (f, 0, SEEK_SET);
+  file->size = lseek (fd, 0, SEEK_END);
 #endif
 
+  io = xmalloc (sizeof (*io));
+  grub_util_hostio_attach (io, fd, flags);
+  file->data = io;
+
   return GRUB_ERR_NONE;
 }
 
 static grub_ssize_t
 grub_hostfs_read (grub_file_t file, char *buf, grub_size_t len)
 {
-  FILE *f;
+  struct grub_util_hostio *io = file->data;
+  ssize_t s;
 
-  f = (FILE *) file->data;
-  if (fseeko (f, file->offset, SEEK_SET) != 0)
+  /* grub_blocklist_convert reads without a buffer, but host files have
+     no block list.  */
+  if (! buf)
     {
-      grub_error (GRUB_ERR_OUT_OF_RANGE, "fseeko: %s", strerror (errno));
+      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET, "no block list for host files");
       return -1;
     }
 
-  unsigned int s = fread (buf, 1, len, f);
-  if (s != len)
-    grub_error (GRUB_ERR_FILE_READ_ERROR, "fread: %s", strerror (errno));
+  s = grub_util_hostio_read (io, buf, len, file->offset);
+  if (s < 0)
+    {
+      grub_error (GRUB_ERR_FILE_READ_ERROR, "read: %s", strerror (errno));
+      return -1;
+    }
+  if ((grub_size_t) s != len)
+    grub_error (GRUB_ERR_FILE_READ_ERROR, "short read from host file");
 
-  return (signed) s;
+  return s;
 }
 
 static grub_err_t
 grub_hostfs_close (grub_file_t file)
 {
-  FILE *f;
+  struct grub_util_hostio *io = file->data;
 
-  f = (FILE *) file->data;
-  fclose (f);
+  grub_util_hostio_detach (io);
+  close (io->fd);
+  free (io);
 
   return GRUB_ERR_NONE;
 }
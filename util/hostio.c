@@ -0,0 +1,344 @@
+/* hostio.c - read and write host files and devices */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2010  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE	1
+#include <config.h>
+#include <grub/util/hostio.h>
+#include <grub/util/misc.h>
+#include <grub/misc.h>
+#include <grub/mm.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifndef __MINGW32__
+# include <sys/mman.h>
+#endif
+
+#ifdef __linux__
+# include <sys/ioctl.h>
+# ifndef BLKSSZGET
+#  define BLKSSZGET	_IO (0x12,104)	/* get logical block size */
+# endif /* ! BLKSSZGET */
+#endif /* __linux__ */
+
+/* Size of the buffer unaligned O_DIRECT reads are bounced through.  */
+#define BOUNCE_SIZE	0x100000
+
+static int mode = -1;
+
+/* The number of descriptors attached in each mode.  */
+static unsigned attached[3];
+
+static const char *mode_names[] =
+  {
+    [GRUB_UTIL_HOSTIO_PREAD] = "pread",
+    [GRUB_UTIL_HOSTIO_MMAP] = "mmap",
+    [GRUB_UTIL_HOSTIO_DIRECT] = "direct"
+  };
+
+grub_err_t
+grub_util_hostio_set_mode (const char *name)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (mode_names); i++)
+    if (! strcmp (name, mode_names[i]))
+      {
+	mode = i;
+	return GRUB_ERR_NONE;
+      }
+
+  return grub_error (GRUB_ERR_BAD_ARGUMENT, "unknown host I/O mode `%s'",
+		     name);
+}
+
+enum grub_util_hostio_mode
+grub_util_hostio_get_mode (void)
+{
+  if (mode < 0)
+    {
+      const char *env = getenv ("GRUB_HOSTIO");
+
+      mode = GRUB_UTIL_HOSTIO_PREAD;
+      if (env && grub_util_hostio_set_mode (env))
+	{
+	  grub_util_warn ("%s", grub_errmsg);
+	  grub_errno = GRUB_ERR_NONE;
+	}
+    }
+
+  return mode;
+}
+
+const char *
+grub_util_hostio_mode_name (enum grub_util_hostio_mode m)
+{
+  return mode_names[m];
+}
+
+/* Return whether a descriptor is attached in mode M, which may not be the
+   mode asked for.  */
+int
+grub_util_hostio_mode_in_use (enum grub_util_hostio_mode m)
+{
+  return attached[m] != 0;
+}
+
+/* Read LEN bytes at OFFSET from FD in BUF. Return the number of bytes
+   read, which is less than LEN only at the end of file, or a negative
+   value if an error occurs.  */
+static ssize_t
+npread (int fd, char *buf, size_t len, grub_uint64_t offset)
+{
+  ssize_t size = 0;
+
+#ifdef __MINGW32__
+  if (lseek (fd, offset, SEEK_SET) != (off_t) offset)
+    return -1;
+#endif
+
+  while (len)
+    {
+#ifdef __MINGW32__
+      ssize_t ret = read (fd, buf, len);
+#else
+      ssize_t ret = pread (fd, buf, len, offset);
+#endif
+
+      if (ret < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          else
+            return ret;
+        }
+
+      if (ret == 0)
+	break;
+
+      len -= ret;
+      buf += ret;
+      offset += ret;
+      size += ret;
+    }
+
+  return size;
+}
+
+/* Write LEN bytes from BUF at OFFSET of FD. Return less than or equal to
+   zero if an error occurs, otherwise return LEN.  */
+static ssize_t
+npwrite (int fd, const char *buf, size_t len, grub_uint64_t offset)
+{
+  ssize_t size = len;
+
+#ifdef __MINGW32__
+  if (lseek (fd, offset, SEEK_SET) != (off_t) offset)
+    return -1;
+#endif
+
+  while (len)
+    {
+#ifdef __MINGW32__
+      ssize_t ret = write (fd, buf, len);
+#else
+      ssize_t ret = pwrite (fd, buf, len, offset);
+#endif
+
+      if (ret <= 0)
+        {
+          if (errno == EINTR)
+            continue;
+          else
+            return ret;
+        }
+
+      len -= ret;
+      buf += ret;
+      offset += ret;
+    }
+
+  return size;
+}
+
+void
+grub_util_hostio_attach (struct grub_util_hostio *io, int fd, int flags)
+{
+  enum grub_util_hostio_mode want = grub_util_hostio_get_mode ();
+  struct stat st;
+
+  io->fd = fd;
+  io->mode = GRUB_UTIL_HOSTIO_PREAD;
+  io->map = NULL;
+  io->map_size = 0;
+  io->align = 0;
+  io->bounce = NULL;
+
+  if (want == GRUB_UTIL_HOSTIO_PREAD || (flags & O_ACCMODE) != O_RDONLY
+      || fstat (fd, &st) < 0)
+    {
+      attached[io->mode]++;
+      return;
+    }
+
+#ifndef __MINGW32__
+  if (want == GRUB_UTIL_HOSTIO_MMAP && S_ISREG (st.st_mode)
+      && st.st_size > 0 && (grub_uint64_t) st.st_size == (size_t) st.st_size)
+    {
+      void *p;
+
+      p = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED)
+	{
+	  io->mode = GRUB_UTIL_HOSTIO_MMAP;
+	  io->map = p;
+	  io->map_size = st.st_size;
+	}
+    }
+#endif
+
+#ifdef O_DIRECT
+  if (want == GRUB_UTIL_HOSTIO_DIRECT && S_ISBLK (st.st_mode))
+    {
+      int fl = fcntl (fd, F_GETFL);
+      int ssize = 512;
+
+# ifdef __linux__
+      if (ioctl (fd, BLKSSZGET, &ssize) < 0 || ssize < 512)
+	ssize = 512;
+# endif
+
+      if (fl != -1 && fcntl (fd, F_SETFL, fl | O_DIRECT) == 0)
+	{
+	  io->mode = GRUB_UTIL_HOSTIO_DIRECT;
+	  io->align = ssize;
+	}
+    }
+#endif
+
+  attached[io->mode]++;
+  grub_dprintf ("hostio", "fd %d uses %s\n", fd, mode_names[io->mode]);
+}
+
+void
+grub_util_hostio_detach (struct grub_util_hostio *io)
+{
+  attached[io->mode]--;
+#ifndef __MINGW32__
+  if (io->map)
+    munmap (io->map, io->map_size);
+#endif
+  grub_free (io->bounce);
+  io->map = NULL;
+  io->bounce = NULL;
+  io->mode = GRUB_UTIL_HOSTIO_PREAD;
+}
+
+/* Read through the aligned bounce buffer whatever part of the request
+   O_DIRECT can't take directly.  */
+static ssize_t
+direct_read (struct grub_util_hostio *io, char *buf, size_t len,
+	     grub_uint64_t offset)
+{
+  grub_size_t mask = io->align - 1;
+  ssize_t size = 0;
+
+  if (! (offset & mask) && ! (len & mask) && ! ((grub_addr_t) buf & mask))
+    return npread (io->fd, buf, len, offset);
+
+  if (! io->bounce)
+    {
+      io->bounce = grub_memalign (io->align, BOUNCE_SIZE);
+      if (! io->bounce)
+	return -1;
+    }
+
+  while (len)
+    {
+      grub_uint64_t start = offset & ~(grub_uint64_t) mask;
+      grub_size_t skip = offset - start;
+      grub_size_t n;
+      ssize_t ret;
+
+      n = ALIGN_UP (skip + len, io->align);
+      if (n > BOUNCE_SIZE)
+	n = BOUNCE_SIZE;
+
+      ret = npread (io->fd, io->bounce, n, start);
+      if (ret < 0)
+	return ret;
+      if ((grub_size_t) ret <= skip)
+	break;
+
+      ret -= skip;
+      if ((grub_size_t) ret > len)
+	ret = len;
+
+      memcpy (buf, io->bounce + skip, ret);
+      buf += ret;
+      len -= ret;
+      offset += ret;
+      size += ret;
+
+      if (ret + skip < n)
+	break;
+    }
+
+  return size;
+}
+
+/* Read LEN bytes at OFFSET in BUF. Return the number of bytes read, which
+   is less than LEN only at the end of file, or a negative value if an
+   error occurs.  */
+ssize_t
+grub_util_hostio_read (struct grub_util_hostio *io, char *buf, size_t len,
+		       grub_uint64_t offset)
+{
+  switch (io->mode)
+    {
+    case GRUB_UTIL_HOSTIO_MMAP:
+      if (offset >= io->map_size)
+	return 0;
+      if (len > io->map_size - offset)
+	len = io->map_size - offset;
+      memcpy (buf, io->map + offset, len);
+      return len;
+
+    case GRUB_UTIL_HOSTIO_DIRECT:
+      return direct_read (io, buf, len, offset);
+
+    default:
+      return npread (io->fd, buf, len, offset);
+    }
+}
+
+/* Write LEN bytes from BUF at OFFSET. Return less than or equal to zero if
+   an error occurs, otherwise return LEN.  */
+ssize_t
+grub_util_hostio_write (struct grub_util_hostio *io, const char *buf,
+			size_t len, grub_uint64_t offset)
+{
+  /* Only read-only descriptors are mapped or opened with O_DIRECT.  */
+  return npwrite (io->fd, buf, len, offset);
+}
@@ -298,27 +298,19 @@ struct grub_strtab
 };
 typedef struct grub_strtab *grub_strtab_t;
 
+/* Each string is preceded by its hash, so it can't share a tail with a
+   longer string.  */
 static int
 grub_strtab_find (grub_strtab_t head, char *name)
 {
   int index = 1;
-  int len = strlen (name);
 
   while (head)
     {
-      if (head->len >= len)
-	{
-	  int ofs;
-
-	  ofs = head->len - len;
-	  if (! strcmp (head->name + ofs, name))
-	    {
-	      index += ofs;
-	      return index;
-	    }
-	}
+      if (! strcmp (head->name, name))
+	return index + GRUB_OBJ_STRTAB_HASH_SIZE;
 
-      index += head->len + 1;
+      index += GRUB_OBJ_STRTAB_HASH_SIZE + head->len + 1;
       head = head->next;
     }
 
@@ -348,7 +340,9 @@ grub_strtab_insert (grub_strtab_t *head, char *name)
 		    (grub_list_test_t) grub_strtab_insert_test, 0);
 }
 
-#define GRUB_OBJ_HEADER_MAX	0xffff
+#define GRUB_OBJ_HEADER_MAX	0x100000
+#define GRUB_OBJ_FUNC_MAX	0xffff
+#define GRUB_OBJ_STRTAB_MAX	0xffff
 #define ALIGN_BUF_SIZE		2048
 
 void
@@ -363,6 +357,7 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
   grub_uint32_t offset, raw_size;
   grub_strtab_t strtab;
   int strtab_size;
+  grub_uint32_t hash;
 
   if ((! obj->segments) || (obj->segments->segment.offset))
     grub_util_error ("invalid segment");
@@ -370,7 +365,8 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
   buf = xmalloc (GRUB_OBJ_HEADER_MAX);
   hdr = (struct grub_obj_header *) buf;
 
-  hdr->magic = grub_host_to_target32 (GRUB_OBJ_HEADER_MAGIC);
+  hdr->magic = grub_host_to_target32 ((obj->bundle) ? GRUB_OBJ_BUNDLE_MAGIC
+				     : GRUB_OBJ_HEADER_MAGIC);
   hdr->version = grub_host_to_target16 (GRUB_OBJ_HEADER_VERSION);
   hdr->init_func = grub_host_to_target16 (GRUB_OBJ_FUNC_NONE);
   hdr->fini_func = grub_host_to_target16 (GRUB_OBJ_FUNC_NONE);
@@ -436,14 +432,14 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
 	  ofs = sym->symbol.offset + sym->segment->segment.offset;
 	  if (! strcmp (sym->name, "grub_mod_init"))
 	    {
-	      if ((ofs >= GRUB_OBJ_HEADER_MAX) || (sym->segment->index))
+	      if ((ofs >= GRUB_OBJ_FUNC_MAX) || (sym->segment->index))
 		grub_util_error ("init function too far");
 
 	      hdr->init_func = grub_host_to_target16 (ofs);
 	    }
 	  else if (! strcmp (sym->name, "grub_mod_fini"))
 	    {
-	      if ((ofs >= GRUB_OBJ_HEADER_MAX) || (sym->segment->index))
+	      if ((ofs >= GRUB_OBJ_FUNC_MAX) || (sym->segment->index))
 		grub_util_error ("fini function too far");
 
 	      hdr->fini_func = grub_host_to_target16 (ofs);
@@ -468,10 +464,10 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
     }
 
   strtab_size = - grub_strtab_find (strtab, "?");
-  if (strtab_size >= GRUB_OBJ_HEADER_MAX)
+  if (strtab_size >= GRUB_OBJ_STRTAB_MAX)
     grub_util_error ("string table too large");
 
-  hdr->symbol_table = grub_host_to_target16 (p - buf);
+  hdr->symbol_table = grub_host_to_target32 (p - buf);
   sym = obj->symbols;
   while (sym)
     {
@@ -496,7 +492,7 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
   if (p - buf >= GRUB_OBJ_HEADER_MAX)
     grub_util_error ("symbol table too large");
 
-  hdr->reloc_table = grub_host_to_target16 (p - buf);
+  hdr->reloc_table = grub_host_to_target32 (p - buf);
   rel = obj->relocs;
   while (rel)
     {
@@ -536,8 +532,8 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
   if (p - buf >= GRUB_OBJ_HEADER_MAX)
     grub_util_error ("symbol table too large");
 
-  hdr->string_table = grub_host_to_target16 (p - buf);
-  offset = strtab_size + grub_target_to_host16 (hdr->string_table);
+  hdr->string_table = grub_host_to_target32 (p - buf);
+  offset = strtab_size + grub_target_to_host32 (hdr->string_table);
   idx = 0;
   while (1)
     {
@@ -551,7 +547,7 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
     grub_host_to_target32 (grub_target_to_host32 (hdr->segments[idx].offset)
 			   + obj->attr_len + 1);
 
-  grub_util_write_image (buf, grub_target_to_host16 (hdr->string_table), fp);
+  grub_util_write_image (buf, grub_target_to_host32 (hdr->string_table), fp);
   free (buf);
 
   buf = xmalloc (strtab_size);
@@ -565,6 +561,9 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
       cur = strtab;
       strtab = strtab->next;
 
+      hash = grub_host_to_target32 (grub_strhash (cur->name));
+      memcpy (p, &hash, GRUB_OBJ_STRTAB_HASH_SIZE);
+      p += GRUB_OBJ_STRTAB_HASH_SIZE;
       strcpy (p, cur->name);
       p += cur->len + 1;
       free (cur);
@@ -615,7 +614,10 @@ grub_obj_save (struct grub_util_obj *obj, char *mod_name, FILE *fp)
     grub_util_write_image (obj->attr, obj->attr_len, fp);
 
   strcpy (buf + 1, mod_name);
-  grub_util_write_image (buf, strlen (mod_name) + 3, fp);
+  grub_util_write_image (buf, strlen (mod_name) + 2, fp);
+  if (obj->deps_len)
+    grub_util_write_image (obj->deps, obj->deps_len, fp);
+  grub_util_write_image (buf, 1, fp);
   free (buf);
 }
 
@@ -633,13 +635,15 @@ grub_obj_load (char *image, int size, int load_data)
   hdr = (struct grub_obj_header *) image;
 
   if ((size <= (int) sizeof (*hdr)) ||
-      (grub_target_to_host32 (hdr->magic) != GRUB_OBJ_HEADER_MAGIC))
+      ((grub_target_to_host32 (hdr->magic) != GRUB_OBJ_HEADER_MAGIC) &&
+       (grub_target_to_host32 (hdr->magic) != GRUB_OBJ_BUNDLE_MAGIC)))
     grub_util_error ("invalid module file");
 
   if (grub_target_to_host16 (hdr->version) != GRUB_OBJ_HEADER_VERSION)
     grub_util_error ("version number not match");
 
   obj = xmalloc_zero (sizeof (*obj));
+  obj->bundle = (grub_target_to_host32 (hdr->magic) == GRUB_OBJ_BUNDLE_MAGIC);
   segments = xmalloc_zero (256 * sizeof (segments[0]));
 
   for (i = 0; hdr->segments[i].type != GRUB_OBJ_SEGMENT_END; i++)
@@ -667,9 +671,9 @@ grub_obj_load (char *image, int size, int load_data)
 
   obj->mod_attr = grub_target_to_host32 (hdr->segments[i].offset);
 
-  strtab = image + grub_target_to_host16 (hdr->string_table);
+  strtab = image + grub_target_to_host32 (hdr->string_table);
   for (sym = (struct grub_obj_symbol *)
-	 (image + grub_target_to_host16 (hdr->symbol_table));
+	 (image + grub_target_to_host32 (hdr->symbol_table));
        sym->segment != GRUB_OBJ_SEGMENT_END; sym++)
     {
       struct grub_util_obj_symbol *p;
@@ -683,7 +687,7 @@ grub_obj_load (char *image, int size, int load_data)
     }
 
   for (rel = (struct grub_obj_reloc_extern *)
-	 (image + grub_target_to_host16 (hdr->reloc_table));
+	 (image + grub_target_to_host32 (hdr->reloc_table));
        rel->segment != GRUB_OBJ_SEGMENT_END;)
     {
       struct grub_util_obj_reloc *p;
@@ -770,6 +774,7 @@ grub_obj_free (struct grub_util_obj *obj)
     }
 
   free (obj->attr);
+  free (obj->deps);
 }
 
 void
@@ -986,6 +991,8 @@ add_module (struct grub_util_obj *obj, const char *path,
   size = grub_util_get_image_size (path);
 
   mod = grub_obj_load (image, size, 1);
+  if (mod->bundle)
+    grub_util_error ("%s is a bundle", path);
 
   mod_header = (struct grub_obj_header *) image;
   mod_name = image + grub_target_to_host32 (mod_header->mod_deps);
@@ -1235,55 +1242,54 @@ grub_obj_add_modinfo (struct grub_util_obj *obj, const char *dir,
   return seg;
 }
 
-int
-grub_obj_add_kernel_symbols (struct grub_util_obj *obj,
-			     struct grub_util_obj_segment *modinfo,
-			     grub_uint32_t offset)
+struct grub_util_obj_segment *
+grub_obj_add_bundle (struct grub_util_obj *obj,
+		     struct grub_util_path_list *path_list)
 {
-  struct grub_util_obj_segment *seg, *first;
-  int data_size, bss_size;
-  struct grub_util_obj_symbol *sym;
-  struct grub_module_info *info;
-  char *p;
+  char *info;
+  int offset;
+  struct grub_util_obj_segment *seg;
 
-  seg = obj->segments;
-  data_size = 0;
-  bss_size = 0;
-  first = 0;
-  while (seg)
+  info = 0;
+  offset = sizeof (struct grub_module_info);
+  while (path_list)
     {
-      if (seg->segment.type == GRUB_OBJ_SEG_BSS)
-	{
-	  if (! first)
-	    {
-	      first = seg;
-	      sym = xmalloc_zero (sizeof (*sym));
-	      sym->name = xstrdup ("grub_bss_start");
-	      sym->segment = seg;
-	      sym->symbol.offset = 0;
-	      grub_list_push (GRUB_AS_LIST_P (&obj->symbols),
-			      GRUB_AS_LIST (sym));
-	    }
+      info = add_module (obj, path_list->name, info, &offset);
+      path_list = path_list->next;
+    }
 
-	  bss_size = seg->segment.offset + seg->segment.size;
-	}
-      else if (seg->segment.type != GRUB_OBJ_SEG_INFO)
-	data_size = seg->segment.offset + seg->segment.size;
+  if (! info)
+    grub_util_error ("no module to bundle");
 
-      seg = seg->next;
-    }
+  ((struct grub_module_info *) info)->magic =
+    grub_host_to_target32 (GRUB_MODULE_MAGIC);
+  ((struct grub_module_info *) info)->size = grub_host_to_target32 (offset);
 
-  if (first)
-    {
-      sym = xmalloc_zero (sizeof (*sym));
-      sym->name = xstrdup ("grub_bss_end");
-      sym->segment = first;
-      sym->symbol.offset = bss_size - first->segment.offset;
-      grub_list_push (GRUB_AS_LIST_P (&obj->symbols), GRUB_AS_LIST (sym));
-    }
+  /* Insert the module table in front of everything else, the loader
+     expects it at the start of the bundle.  */
+  seg = xmalloc_zero (sizeof (*seg));
+  seg->segment.type = GRUB_OBJ_SEG_TEXT;
+  seg->segment.align = GRUB_TARGET_MIN_ALIGN;
+  seg->segment.size = offset;
+  seg->raw_size = offset;
+  seg->data = info;
 
-  if (offset)
-    offset -= modinfo->segment.offset - data_size;
+  grub_obj_reverse (obj);
+  grub_obj_sort_segments (obj);
+  grub_list_push (GRUB_AS_LIST_P (&obj->segments), GRUB_AS_LIST (seg));
+  obj->bundle = 1;
+
+  return seg;
+}
+
+/* Fill in the init and fini functions and the symbol values of the
+   modules in MODINFO, once the segments of OBJ have been merged.  */
+static void
+fill_modinfo (struct grub_util_obj *obj,
+	      struct grub_util_obj_segment *modinfo)
+{
+  struct grub_module_info *info;
+  char *p;
 
   info = (struct grub_module_info *) modinfo->data;
   p = modinfo->data + sizeof (struct grub_module_info);
@@ -1350,6 +1356,81 @@ grub_obj_add_kernel_symbols (struct grub_util_obj *obj,
 
       p += grub_target_to_host32 (h->size);
     }
+}
+
+void
+grub_obj_bundle_done (struct grub_util_obj *obj,
+		      struct grub_util_obj_segment *modinfo)
+{
+  struct grub_util_obj_symbol *sym;
+
+  fill_modinfo (obj, modinfo);
+  grub_obj_reloc_symbols (obj, GRUB_OBJ_MERGE_ALL);
+
+  /* The module table exports the symbols on behalf of each module, the
+     bundle itself doesn't export any.  */
+  sym = obj->symbols;
+  while (sym)
+    {
+      struct grub_util_obj_symbol *p;
+
+      p = sym;
+      sym = sym->next;
+      free (p->name);
+      free (p);
+    }
+  obj->symbols = 0;
+}
+
+int
+grub_obj_add_kernel_symbols (struct grub_util_obj *obj,
+			     struct grub_util_obj_segment *modinfo,
+			     grub_uint32_t offset)
+{
+  struct grub_util_obj_segment *seg, *first;
+  int data_size, bss_size;
+  struct grub_util_obj_symbol *sym;
+
+  seg = obj->segments;
+  data_size = 0;
+  bss_size = 0;
+  first = 0;
+  while (seg)
+    {
+      if (seg->segment.type == GRUB_OBJ_SEG_BSS)
+	{
+	  if (! first)
+	    {
+	      first = seg;
+	      sym = xmalloc_zero (sizeof (*sym));
+	      sym->name = xstrdup ("grub_bss_start");
+	      sym->segment = seg;
+	      sym->symbol.offset = 0;
+	      grub_list_push (GRUB_AS_LIST_P (&obj->symbols),
+			      GRUB_AS_LIST (sym));
+	    }
+
+	  bss_size = seg->segment.offset + seg->segment.size;
+	}
+      else if (seg->segment.type != GRUB_OBJ_SEG_INFO)
+	data_size = seg->segment.offset + seg->segment.size;
+
+      seg = seg->next;
+    }
+
+  if (first)
+    {
+      sym = xmalloc_zero (sizeof (*sym));
+      sym->name = xstrdup ("grub_bss_end");
+      sym->segment = first;
+      sym->symbol.offset = bss_size - first->segment.offset;
+      grub_list_push (GRUB_AS_LIST_P (&obj->symbols), GRUB_AS_LIST (sym));
+    }
+
+  if (offset)
+    offset -= modinfo->segment.offset - data_size;
+
+  fill_modinfo (obj, modinfo);
 
   /* Insert the grub_modinfo symbol.  */
   sym = xmalloc_zero (sizeof (*sym));